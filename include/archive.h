@@ -0,0 +1,205 @@
+/**
+ * @file archive.h
+ * @brief Output archive (.tpa) writer, reader and extractor
+ *
+ * With --archive every module's .am, .ob, .ent and .ext outputs go into one
+ * container file instead of up to four files per module. The file starts with
+ * a fixed little-endian header, followed by the payloads in the order the
+ * modules were assembled, the module index sorted by name and the name pool.
+ * Payloads are appended as each module finishes; the index, which is only
+ * known at the end, follows them and the header is filled in last. A reader
+ * maps the file and finds a module with a binary search of the index.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include "assembler.h"
+#include "error.h"
+
+#define ARCHIVE_MAGIC "TPAR"          /* First four bytes of every .tpa file */
+#define ARCHIVE_VERSION 1             /* Current format version */
+#define ARCHIVE_INDEX_ALIGN 8         /* Alignment of the module index in bytes */
+
+/**
+ * @brief The outputs a module can have in the archive
+ */
+typedef enum {
+    ARCHIVE_MEMBER_SOURCE,        /* Expanded source (.am) */
+    ARCHIVE_MEMBER_OBJECT,        /* Object file (.ob) */
+    ARCHIVE_MEMBER_ENTRIES,       /* Entries file (.ent) */
+    ARCHIVE_MEMBER_EXTERNALS,     /* Externals file (.ext) */
+    ARCHIVE_MEMBER_COUNT
+} archive_member_t;
+
+/**
+ * @brief Fixed file header (40 bytes, little-endian)
+ *
+ * Offsets are relative to the start of the file.
+ */
+typedef struct {
+    char magic[4];                /* ARCHIVE_MAGIC */
+    uint16_t version;             /* ARCHIVE_VERSION */
+    uint16_t header_size;         /* sizeof(archive_header_t) */
+    uint32_t module_count;        /* Records in the module index */
+    uint32_t names_size;          /* Bytes in the name pool */
+    uint64_t index_offset;        /* Offset of the module index */
+    uint64_t names_offset;        /* Offset of the name pool */
+    uint64_t file_size;           /* Total file size in bytes */
+} archive_header_t;
+
+/**
+ * @brief Location of one payload
+ */
+typedef struct {
+    uint64_t offset;              /* Offset of the payload */
+    uint64_t size;                /* Bytes in the payload */
+} archive_extent_t;
+
+/**
+ * @brief Module index record; the index is sorted by name
+ */
+typedef struct {
+    uint32_t name_offset;         /* Offset of the NUL-terminated name in the name pool */
+    uint32_t members;             /* Bit (1 << member) set for every member present */
+    archive_extent_t extents[ARCHIVE_MEMBER_COUNT];
+} archive_module_t;
+
+/**
+ * @brief Archive being written
+ */
+typedef struct archive_writer {
+    FILE *file;
+    char path[MAX_FILENAME_LENGTH];
+    uint64_t offset;              /* Bytes written so far */
+    archive_module_t *modules;    /* Records in the order the modules were added */
+    int module_count;
+    int module_capacity;
+    char *names;                  /* Name pool */
+    size_t names_size;
+    size_t names_capacity;
+    int *slots;                   /* Hash of the module names: record index + 1, 0 = empty */
+    size_t slot_count;
+} archive_writer_t;
+
+/**
+ * @brief Read-only view of an archive, backed by mmap
+ */
+typedef struct {
+    const archive_header_t *header;
+    const archive_module_t *modules;
+    const char *names;
+    const unsigned char *base;    /* Start of the file */
+    void *mapping;                /* Mapped region */
+    size_t mapping_size;          /* Size of the mapped region */
+} archive_t;
+
+/**
+ * @brief Create an archive file and write its placeholder header
+ * @param archive The writer to initialize
+ * @param path The .tpa file path
+ * @param context Error context for reporting issues
+ * @return true if the file was created, false otherwise
+ */
+bool open_archive_writer(archive_writer_t *archive, const char *path, error_context_t *context);
+
+/**
+ * @brief Append one output of a module to the archive
+ * @param archive The writer
+ * @param module The module name (make_archive_module_name of its source)
+ * @param member The output the payload holds
+ * @param data The payload
+ * @param size The number of bytes in the payload
+ * @param context Error context for reporting issues
+ * @return true if the payload was written, false otherwise
+ *
+ * The members of a module are added one after the other, starting with its
+ * .am. A second module with the name of one already in the archive, such
+ * as ../t2/basic.as after t2/basic.as, is refused.
+ */
+bool add_archive_member(archive_writer_t *archive, const char *module, archive_member_t member,
+                        const char *data, size_t size, error_context_t *context);
+
+/**
+ * @brief Write the index and the header, then close the archive
+ * @param archive The writer (released even on failure)
+ * @param context Error context for reporting issues
+ * @return true if the archive is complete, false otherwise
+ */
+bool close_archive_writer(archive_writer_t *archive, error_context_t *context);
+
+/**
+ * @brief Map an archive file and validate its header and index
+ * @param path The .tpa file path
+ * @param archive Output parameter for the archive view
+ * @param context Error context for reporting issues
+ * @return true if the file is a valid archive, false otherwise
+ */
+bool open_archive(const char *path, archive_t *archive, error_context_t *context);
+
+/**
+ * @brief Release an archive view
+ * @param archive The archive view
+ */
+void close_archive(archive_t *archive);
+
+/**
+ * @brief Find a module by name
+ * @param archive The archive view
+ * @param name The module name
+ * @return The index record, or NULL if the archive has no such module
+ */
+const archive_module_t *find_archive_module(const archive_t *archive, const char *name);
+
+/**
+ * @brief Get the name of a module
+ * @param archive The archive view
+ * @param module The index record
+ * @return The NUL-terminated module name
+ */
+const char *archive_module_name(const archive_t *archive, const archive_module_t *module);
+
+/**
+ * @brief Get one output of a module
+ * @param archive The archive view
+ * @param module The index record
+ * @param member The output
+ * @param size Output parameter for the number of bytes
+ * @return The payload, or NULL if the module has no such output
+ */
+const char *archive_member_data(const archive_t *archive, const archive_module_t *module,
+                                archive_member_t member, size_t *size);
+
+/**
+ * @brief Get the file extension of an output
+ * @param member The output
+ * @return The extension, such as ".ob"
+ */
+const char *archive_member_extension(archive_member_t member);
+
+/**
+ * @brief Get the name a source file is stored under in an archive
+ * @param filename The source file, with or without its extension
+ * @param module Output buffer for the name (at least as long as filename)
+ *
+ * The name is the path without its extension, a leading '/' and any "." or
+ * ".." components, so extracting it never writes outside the target directory.
+ */
+void make_archive_module_name(const char *filename, char *module);
+
+/**
+ * @brief Write the outputs of a module back out as files
+ * @param archive The archive view
+ * @param module The index record
+ * @param directory Directory the module name is relative to (NULL for the current one)
+ * @param context Error context for reporting issues
+ * @return true if every file was written, false otherwise
+ *
+ * Missing parent directories of the module are created. A name that is
+ * absolute or has a ".." component is refused.
+ */
+bool extract_archive_module(const archive_t *archive, const archive_module_t *module,
+                            const char *directory, error_context_t *context);
+
+#endif /* ARCHIVE_H */
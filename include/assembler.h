@@ -25,12 +25,15 @@
 /* Memory model */
 #define MEMORY_START 100         /* Starting address for code section */
 #define WORD_SIZE 24             /* 24-bit machine words */
+#define MEMORY_END 0x1FFFFF      /* Code and data must end below this 21-bit address */
 
 /* Instruction types */
 typedef enum {
     INST_TYPE_INVALID,
     INST_TYPE_DATA,     /* .data directive */
     INST_TYPE_STRING,   /* .string directive */
+    INST_TYPE_INCBIN,   /* .incbin directive */
+    INST_TYPE_FILL,     /* .space and .fill directives */
     INST_TYPE_ENTRY,    /* .entry directive */
     INST_TYPE_EXTERN,   /* .extern directive */
     INST_TYPE_CODE      /* Machine instruction */
@@ -83,12 +86,45 @@ typedef enum {
     FUNCT_JSR = 3
 } funct_t;
 
+/* Instruction identifiers, one per mnemonic in specification order */
+typedef enum {
+    INSN_MOV, INSN_CMP, INSN_ADD, INSN_SUB, INSN_LEA,
+    INSN_CLR, INSN_NOT, INSN_INC, INSN_DEC,
+    INSN_JMP, INSN_BNE, INSN_JSR,
+    INSN_RED, INSN_PRN, INSN_RTS, INSN_STOP,
+    INSN_COUNT
+} instruction_id_t;
+
 /* File extensions */
 #define EXT_SOURCE ".as"      /* Source file extension */
 #define EXT_MACRO ".am"       /* After macro expansion extension */
 #define EXT_OBJECT ".ob"      /* Object file extension */
 #define EXT_ENTRY ".ent"      /* Entry points file extension */
 #define EXT_EXTERN ".ext"     /* External references file extension */
+#define EXT_BINARY ".tpo"     /* Binary object file extension */
+#define EXT_ARCHIVE ".tpa"    /* Output archive file extension */
+
+/* Object output formats selected with --format */
+typedef enum {
+    FORMAT_TEXT,             /* .ob, .ent and .ext text files */
+    FORMAT_BINARY,           /* .tpo binary object with 32-bit words */
+    FORMAT_BINARY_PACKED     /* .tpo binary object with 24-bit words */
+} output_format_t;
+
+/* Command-line options applied to every processed file */
+typedef struct {
+    output_format_t format;  /* Object output format */
+    bool optimize;           /* -O: peephole optimization between the passes */
+    int outline_min_saving;  /* --outline[=N]: outline repeated code saving at least N words (0 = off) */
+    bool gc_data;            /* --gc-data: drop data blocks no label reference reaches */
+    bool pool_data;          /* --pool-data: share identical data blocks and string suffixes */
+    const struct macro_library *macro_library; /* --macro-lib: macros used when not defined locally (NULL = none) */
+    struct archive_writer *archive; /* --archive: text outputs go into this archive instead of files (NULL = files) */
+    struct async_io *io;     /* --io: outputs written behind by this engine (NULL = blocking writes) */
+    bool check;              /* --check: report diagnostics only, building no images and writing no files */
+    FILE *stream;            /* -o -: text outputs go into this framed stream, progress is not printed (NULL = files) */
+    bool pipeline;           /* --pipeline: the first pass runs alongside the pre-assembler on its own thread */
+} assembler_options_t;
 
 /* Version information */
 #define ASSEMBLER_VERSION "1.0.0"
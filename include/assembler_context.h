@@ -0,0 +1,130 @@
+/**
+ * @file assembler_context.h
+ * @brief Per-file assembler state reused across the files of one run
+ *
+ * The context owns the tables and buffers the passes fill for a file: the
+ * macro table, the expanded source, the symbol table, the external
+ * references and the code and data images. Each file resets them instead of
+ * allocating new ones, so a run over many small modules allocates memory
+ * only while the buffers are still growing.
+ */
+
+#ifndef ASSEMBLER_CONTEXT_H
+#define ASSEMBLER_CONTEXT_H
+
+#include "assembler.h"
+#include "symbol_table.h"
+#include "pre_assembler.h"
+#include "expanded_source.h"
+#include "external_table.h"
+#include "async_io.h"
+#include "machine_word.h"
+#include "error.h"
+
+/**
+ * @brief State reused by every file assembled with the context
+ */
+typedef struct {
+    macro_table_t *macros;        /* Macros defined by the file */
+    expanded_source_t source;     /* Expanded source (.am) */
+    symbol_table_t *symbols;      /* Labels and their addresses */
+    external_table_t ext_refs;    /* Uses of external symbols */
+    machine_word_t *code_image;   /* Code words (NULL until the first second pass) */
+    machine_word_t *data_image;   /* Data words (NULL until the first second pass) */
+    error_context_t error;        /* Diagnostics position */
+} assembler_context_t;
+
+#define STDIN_SOURCE_NAME "<stdin>"    /* Name of the source read from standard input ("-") in diagnostics */
+#define DEFAULT_PREFETCH 8            /* Sources read ahead with --io unless --prefetch says otherwise */
+
+/**
+ * @brief Files waiting to be assembled while their sources are read ahead
+ *
+ * With an I/O engine in the options, the sources of the next window files
+ * are read in the background while the oldest one is assembled; without one
+ * every file is assembled as soon as it is queued.
+ */
+typedef struct {
+    assembler_context_t *ctx;
+    const assembler_options_t *options;
+    int window;                   /* Sources read ahead (0 = none) */
+    char (*names)[MAX_FILENAME_LENGTH]; /* Waiting files, a ring starting at first */
+    int *reads;                   /* Read request of each waiting file (-1 = read when assembled) */
+    int first;
+    int count;
+    bool success;                 /* Every file so far was assembled */
+} assembler_queue_t;
+
+/**
+ * @brief Initialize a context with empty tables
+ * @param ctx The context
+ * @return true if the tables were allocated, false otherwise
+ */
+bool init_assembler_context(assembler_context_t *ctx);
+
+/**
+ * @brief Release everything a context holds
+ * @param ctx The context
+ */
+void free_assembler_context(assembler_context_t *ctx);
+
+/**
+ * @brief Assemble one source file and write its output files
+ * @param ctx The context (its previous contents are discarded)
+ * @param filename The name of the source file
+ * @param options The command-line options
+ * @return true if processing was successful, false otherwise
+ */
+bool assemble_file(assembler_context_t *ctx, const char *filename, const assembler_options_t *options);
+
+/**
+ * @brief Assemble one source file from contents already in memory and write its output files
+ * @param ctx The context (its previous contents are discarded)
+ * @param filename The name of the source file (.include and .incbin paths are relative to it)
+ * @param text The contents of the source file
+ * @param length The length of the contents in bytes
+ * @param options The command-line options
+ * @return true if processing was successful, false otherwise
+ */
+bool assemble_loaded_file(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                          const assembler_options_t *options);
+
+/**
+ * @brief Start a queue of files to assemble
+ * @param queue The queue
+ * @param ctx The context every file is assembled with
+ * @param options The command-line options (options->io enables reading ahead)
+ * @param window The number of sources to read ahead (at most ASYNC_IO_MAX_REQUESTS / 2)
+ * @return true if the queue was allocated, false otherwise
+ */
+bool init_assembler_queue(assembler_queue_t *queue, assembler_context_t *ctx, const assembler_options_t *options,
+                          int window);
+
+/**
+ * @brief Add a file to the queue, assembling the oldest one when the window is full
+ * @param queue The queue
+ * @param filename The name of the source file
+ */
+void queue_file(assembler_queue_t *queue, const char *filename);
+
+/**
+ * @brief Assemble the files left in the queue and wait for every output to be written
+ * @param queue The queue (its buffers are released)
+ * @return true if every queued file was assembled and written, false otherwise
+ */
+bool finish_assembler_queue(assembler_queue_t *queue);
+
+/**
+ * @brief Run the first pass, the optimizations and the second pass over the context's expanded source
+ * @param ctx The context, holding the source produced by the pre-assembler
+ * @param filename The name of the source file, or NULL for a source assembled from memory
+ *                 (no file is touched and no progress is printed)
+ * @param options The command-line options
+ * @param ICF Output parameter for the final instruction counter
+ * @param DCF Output parameter for the final data counter
+ * @return true if every pass succeeded, false otherwise
+ */
+bool assemble_expanded_source(assembler_context_t *ctx, const char *filename, const assembler_options_t *options,
+                              int *ICF, int *DCF);
+
+#endif /* ASSEMBLER_CONTEXT_H */
@@ -0,0 +1,102 @@
+/**
+ * @file async_io.h
+ * @brief Asynchronous whole-file reads and writes for batch runs
+ *
+ * A batch run spends much of its time in blocking open, read, write and close
+ * calls, which on network-backed storage take longer than assembling a small
+ * module. This engine lets the assembler read the next sources and write the
+ * previous outputs while it works on the current file.
+ *
+ * Two backends do the same work. The io_uring backend (Linux, raw system
+ * calls) submits the open, read or write, and close of every file, each step
+ * queued as the previous one completes, and reaps completions in batches. The thread backend hands every
+ * file to a small pool of threads that make the blocking calls, and is used
+ * wherever io_uring is unavailable.
+ *
+ * The engine is driven by one thread: completions are only reaped inside the
+ * calls below.
+ */
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stddef.h>
+#include "assembler.h"
+#include "error.h"
+
+#define ASYNC_IO_MAX_REQUESTS 64      /* Reads and writes in flight at a time */
+#define ASYNC_IO_THREADS 4            /* Workers of the thread backend */
+
+/**
+ * @brief I/O backends selected with --io
+ */
+typedef enum {
+    ASYNC_IO_BACKEND_URING,       /* io_uring, falling back to threads when unavailable */
+    ASYNC_IO_BACKEND_THREADS      /* Pool of threads making blocking calls */
+} async_io_backend_t;
+
+/**
+ * @brief Opaque I/O engine
+ */
+typedef struct async_io async_io_t;
+
+/**
+ * @brief Create an I/O engine
+ * @param backend The preferred backend
+ * @return The engine, or NULL if it could not be created
+ */
+async_io_t *create_async_io(async_io_backend_t backend);
+
+/**
+ * @brief Get the backend an engine actually uses
+ * @param io The engine
+ * @return ASYNC_IO_BACKEND_URING or ASYNC_IO_BACKEND_THREADS
+ */
+async_io_backend_t async_io_backend(const async_io_t *io);
+
+/**
+ * @brief Start reading a whole file
+ * @param io The engine
+ * @param path The file to read
+ * @return A request handle for wait_async_read, or -1 if the read could not be started
+ */
+int async_read_file(async_io_t *io, const char *path);
+
+/**
+ * @brief Wait for a read started with async_read_file
+ * @param io The engine
+ * @param request The request handle (released by this call)
+ * @param data Output parameter for the contents (freed by the caller); NULL if the read failed
+ * @param size Output parameter for the number of bytes
+ * @return true if the file was read, false otherwise (the caller may retry with blocking calls)
+ */
+bool wait_async_read(async_io_t *io, int request, char **data, size_t *size);
+
+/**
+ * @brief Start writing a whole file, replacing it if it exists
+ * @param io The engine
+ * @param path The file to write
+ * @param data The contents (the engine frees it once written)
+ * @param size The number of bytes
+ * @param context Error context for reporting issues
+ * @return true if the write was started, false otherwise (data is freed)
+ *
+ * Failures of the write itself are reported when they are reaped and make
+ * drain_async_io return false.
+ */
+bool async_write_file(async_io_t *io, const char *path, char *data, size_t size, error_context_t *context);
+
+/**
+ * @brief Wait for every write started so far
+ * @param io The engine
+ * @return true if every write since the last drain succeeded, false otherwise
+ */
+bool drain_async_io(async_io_t *io);
+
+/**
+ * @brief Wait for outstanding requests and release an engine
+ * @param io The engine (NULL is ignored)
+ */
+void destroy_async_io(async_io_t *io);
+
+#endif /* ASYNC_IO_H */
@@ -0,0 +1,199 @@
+/**
+ * @file binary_object.h
+ * @brief Binary object format (.tpo) writer, reader and text converter
+ *
+ * The binary object is an alternative to the text .ob/.ent/.ext triple. It
+ * starts with a fixed little-endian header followed by the code words, the
+ * data words, the entry table, the external reference table and a string
+ * pool. Every section starts on a BINARY_SECTION_ALIGN boundary, so a
+ * consumer can mmap the file and index the sections directly.
+ */
+
+#ifndef BINARY_OBJECT_H
+#define BINARY_OBJECT_H
+
+#include <stdint.h>
+#include "assembler.h"
+#include "symbol_table.h"
+#include "second_pass.h"
+#include "error.h"
+
+#define BINARY_OBJECT_MAGIC "TPOB"    /* First four bytes of every .tpo file */
+#define BINARY_OBJECT_VERSION 1       /* Current format version */
+#define BINARY_SECTION_ALIGN 16       /* Alignment of every section in bytes */
+#define BINARY_WORD_PACKED 3          /* 24-bit packed words */
+#define BINARY_WORD_WIDE 4            /* 32-bit words */
+
+/**
+ * @brief Fixed file header (64 bytes, little-endian)
+ *
+ * Section offsets are relative to the start of the file. Words hold the
+ * 24-bit form of a machine word: (value << 3) | ARE.
+ */
+typedef struct {
+    char magic[4];                /* BINARY_OBJECT_MAGIC */
+    uint16_t version;             /* BINARY_OBJECT_VERSION */
+    uint16_t word_bytes;          /* BINARY_WORD_PACKED or BINARY_WORD_WIDE */
+    uint32_t header_size;         /* sizeof(binary_object_header_t) */
+    uint32_t code_start;          /* Address of the first code word */
+    uint32_t icf;                 /* Number of code words */
+    uint32_t dcf;                 /* Number of data words */
+    uint32_t entry_count;         /* Records in the entry table */
+    uint32_t extern_count;        /* Records in the external reference table */
+    uint32_t strings_size;        /* Bytes in the string pool */
+    uint32_t code_offset;         /* Offset of the code words */
+    uint32_t data_offset;         /* Offset of the data words */
+    uint32_t entries_offset;      /* Offset of the entry table */
+    uint32_t externs_offset;      /* Offset of the external reference table */
+    uint32_t strings_offset;      /* Offset of the string pool */
+    uint32_t file_size;           /* Total file size in bytes */
+    uint32_t reserved;            /* Must be zero */
+} binary_object_header_t;
+
+/**
+ * @brief Entry or external reference record
+ */
+typedef struct {
+    uint32_t name_offset;         /* Offset of the NUL-terminated name in the string pool */
+    uint32_t address;             /* Symbol address or referencing word address */
+} binary_symbol_t;
+
+/**
+ * @brief Named address used when building a binary object
+ */
+typedef struct {
+    const char *name;             /* Symbol name */
+    uint32_t address;             /* Symbol address or referencing word address */
+} binary_record_t;
+
+/**
+ * @brief In-memory object contents to be written as a binary object
+ */
+typedef struct {
+    uint32_t code_start;          /* Address of the first code word */
+    const uint32_t *code;         /* 24-bit code words */
+    uint32_t icf;                 /* Number of code words */
+    const uint32_t *data;         /* 24-bit data words */
+    uint32_t dcf;                 /* Number of data words */
+    const binary_record_t *entries;
+    uint32_t entry_count;
+    const binary_record_t *externs;
+    uint32_t extern_count;
+    int word_bytes;               /* BINARY_WORD_PACKED or BINARY_WORD_WIDE */
+} binary_image_t;
+
+/**
+ * @brief Read-only view of a binary object, usually backed by mmap
+ */
+typedef struct {
+    const binary_object_header_t *header;
+    const unsigned char *code;    /* icf words of header->word_bytes each */
+    const unsigned char *data;    /* dcf words of header->word_bytes each */
+    const binary_symbol_t *entries;
+    const binary_symbol_t *externs;
+    const char *strings;
+    void *mapping;                /* Mapped region (NULL when not owned) */
+    size_t mapping_size;          /* Size of the mapped region */
+} binary_object_t;
+
+/**
+ * @brief Write a binary object file (.tpo)
+ * @param filename The base filename
+ * @param symbols The symbol table (entries are taken from it)
+ * @param code_image The code image
+ * @param data_image The data image
+ * @param ext_refs The external references
+ * @param ICF The final instruction counter
+ * @param DCF The final data counter
+ * @param word_bytes BINARY_WORD_PACKED or BINARY_WORD_WIDE
+ * @param context Error context for reporting issues
+ * @return true if writing was successful, false otherwise
+ */
+bool write_binary_object_file(const char *filename, symbol_table_t *symbols,
+                              machine_word_t *code_image, machine_word_t *data_image,
+                              const external_table_t *ext_refs, int ICF, int DCF,
+                              int word_bytes, error_context_t *context);
+
+/**
+ * @brief Write an in-memory image as a binary object file
+ * @param path The .tpo file path
+ * @param image The object contents
+ * @param context Error context for reporting issues
+ * @return true if writing was successful, false otherwise
+ */
+bool write_binary_image(const char *path, const binary_image_t *image, error_context_t *context);
+
+/**
+ * @brief Map a binary object file and validate its header
+ * @param path The .tpo file path
+ * @param object Output parameter for the object view
+ * @param context Error context for reporting issues
+ * @return true if the file is a valid binary object, false otherwise
+ */
+bool open_binary_object(const char *path, binary_object_t *object, error_context_t *context);
+
+/**
+ * @brief Validate a binary object held in memory
+ * @param buffer The object bytes (must stay valid while the view is used)
+ * @param size The number of bytes in the buffer
+ * @param object Output parameter for the object view
+ * @param context Error context for reporting issues
+ * @return true if the buffer is a valid binary object, false otherwise
+ */
+bool load_binary_object(const void *buffer, size_t size, binary_object_t *object,
+                        error_context_t *context);
+
+/**
+ * @brief Release a binary object view opened with open_binary_object
+ * @param object The object view
+ */
+void close_binary_object(binary_object_t *object);
+
+/**
+ * @brief Get a code word of a binary object
+ * @param object The object view
+ * @param index Word index (0 to icf - 1)
+ * @return The 24-bit word
+ */
+uint32_t binary_object_code_word(const binary_object_t *object, int index);
+
+/**
+ * @brief Get a data word of a binary object
+ * @param object The object view
+ * @param index Word index (0 to dcf - 1)
+ * @return The 24-bit word
+ */
+uint32_t binary_object_data_word(const binary_object_t *object, int index);
+
+/**
+ * @brief Get the name of an entry or external reference record
+ * @param object The object view
+ * @param record The record
+ * @return The NUL-terminated symbol name
+ */
+const char *binary_object_name(const binary_object_t *object, const binary_symbol_t *record);
+
+/**
+ * @brief Convert a binary object into the text .ob/.ent/.ext files
+ * @param path The .tpo file path
+ * @param base The base filename of the text outputs
+ * @param context Error context for reporting issues
+ * @return true if conversion was successful, false otherwise
+ */
+bool convert_binary_to_text(const char *path, const char *base, error_context_t *context);
+
+/**
+ * @brief Convert the text .ob/.ent/.ext files into a binary object
+ * @param base The base filename of the text inputs
+ * @param path The .tpo file path to write
+ * @param word_bytes BINARY_WORD_PACKED or BINARY_WORD_WIDE
+ * @param context Error context for reporting issues
+ * @return true if conversion was successful, false otherwise
+ *
+ * The text .ob keeps only bits 6-17 of every word, so the words of the
+ * resulting binary object hold just those bits.
+ */
+bool convert_text_to_binary(const char *base, const char *path, int word_bytes,
+                            error_context_t *context);
+
+#endif /* BINARY_OBJECT_H */
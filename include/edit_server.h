@@ -0,0 +1,42 @@
+/**
+ * @file edit_server.h
+ * @brief JSON-lines edit protocol over an edit session
+ *
+ * Every request is one JSON object on its own line and gets one response
+ * line:
+ *
+ *   {"id":1,"op":"edit","start":3,"end":4,"text":"LOOP: inc r1\n"}
+ *   {"id":2,"op":"diagnostics"}
+ *   {"id":3,"op":"verify"}
+ *   {"id":4,"op":"exit"}
+ *
+ * edit replaces source lines start to end (1-based; end = start - 1 inserts
+ * before start), diagnostics reports the current text unchanged, verify also
+ * checks the text from scratch and adds "consistent", and exit ends the
+ * session. A response repeats the id and reports the line counts, what the
+ * update redid, the time it took and the diagnostics:
+ *
+ *   {"id":1,"ok":true,"source_lines":40,"lines":52,"relexed":1,"encoded":3,
+ *    "success":false,"time_us":85,"diagnostics":[{"line":7,"severity":"error",
+ *    "message":"Undefined symbol: LOOP"}]}
+ *
+ * A request that cannot be carried out gets {"id":1,"ok":false,"error":"..."}
+ * and leaves the session as it was.
+ */
+
+#ifndef EDIT_SERVER_H
+#define EDIT_SERVER_H
+
+#include <stdio.h>
+#include "assembler.h"
+
+/**
+ * @brief Serve edit requests for one source file until exit or end of input
+ * @param filename The source file loaded into the session
+ * @param input The stream requests are read from
+ * @param output The stream responses are written to (flushed after every response)
+ * @return true if the session ended with exit or end of input, false if the file could not be loaded
+ */
+bool serve_edit_session(const char *filename, FILE *input, FILE *output);
+
+#endif /* EDIT_SERVER_H */
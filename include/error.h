@@ -8,6 +8,32 @@
 
 #include "assembler.h"
 
+/**
+ * @brief Severity of a collected diagnostic
+ */
+typedef enum {
+    DIAGNOSTIC_ERROR,
+    DIAGNOSTIC_WARNING
+} diagnostic_severity_t;
+
+/**
+ * @brief A diagnostic collected instead of printed
+ */
+typedef struct {
+    diagnostic_severity_t severity;
+    int line_number;             /* Line of the expanded source (0 = not tied to a line) */
+    char *message;               /* Message without the file and line prefix */
+} diagnostic_t;
+
+/**
+ * @brief Diagnostics collected by an error context
+ */
+typedef struct diagnostic_list {
+    diagnostic_t *items;
+    int count;
+    int capacity;
+} diagnostic_list_t;
+
 /**
  * @brief Error context structure
  */
@@ -15,6 +41,7 @@ typedef struct {
     bool had_error;              /* Flag indicating if an error occurred */
     char filename[MAX_FILENAME_LENGTH]; /* Current filename being processed */
     int line_number;             /* Current line number being processed */
+    diagnostic_list_t *diagnostics; /* Collects the messages instead of stderr (NULL = print them) */
 } error_context_t;
 
 /**
@@ -32,6 +59,35 @@ void init_error_context(error_context_t *context, const char *filename);
  */
 void report_context_error(error_context_t *context, const char *format, ...);
 
+/**
+ * @brief Report a warning with the current context
+ * @param context The error context (NULL prints the warning anyway)
+ * @param format The warning message format
+ * @param ... Additional arguments for the format string
+ *
+ * Printed warnings are not tied to a line: "Warning: <message>".
+ */
+void report_context_warning(error_context_t *context, const char *format, ...);
+
+/**
+ * @brief Remove the diagnostics from a list, keeping its array
+ * @param list The list
+ */
+void clear_diagnostics(diagnostic_list_t *list);
+
+/**
+ * @brief Release the memory held by a diagnostics list (it is left empty)
+ * @param list The list
+ */
+void free_diagnostics(diagnostic_list_t *list);
+
+/**
+ * @brief Report collected diagnostics again, in order, through another context
+ * @param context The context reporting them (printing or collecting them as it is set up to)
+ * @param list The diagnostics
+ */
+void replay_diagnostics(error_context_t *context, const diagnostic_list_t *list);
+
 /**
  * @brief Set the current line number in the error context
  * @param context The error context
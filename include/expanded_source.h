@@ -0,0 +1,182 @@
+/**
+ * @file expanded_source.h
+ * @brief In-memory form of the expanded source (.am) shared by the passes
+ *
+ * The pre-assembler produces the expanded source as a list of spans over
+ * line templates. A line of the source file gets its own template, while
+ * every line of a macro body gets one template the first time the macro is
+ * expanded; later expansions only add a span referring to the same
+ * templates. A template is parsed the first time a pass reaches it and the
+ * parsed form is reused by every other reference and every later pass, with
+ * only the line number changed.
+ *
+ * Templates follow the line splitting of fgets with MAX_LINE_LENGTH, so the
+ * line numbers agree with a pass reading the written .am file.
+ */
+
+#ifndef EXPANDED_SOURCE_H
+#define EXPANDED_SOURCE_H
+
+#include <stddef.h>
+#include "assembler.h"
+#include "first_pass.h"
+#include "error.h"
+
+struct line_pipe;
+
+/**
+ * @brief One distinct line of the expanded source
+ */
+typedef struct {
+    char *text;                   /* Line text without the newline */
+    size_t text_capacity;         /* Bytes allocated for text */
+    bool joined;                  /* No newline follows in the .am file (the line was split) */
+    bool is_parsed;               /* parsed holds the parsed form of text */
+    parsed_line_t parsed;         /* Parsed form, line number aside */
+} source_template_t;
+
+/**
+ * @brief Consecutive templates making up consecutive lines
+ */
+typedef struct {
+    int first;                    /* First template */
+    int count;                    /* Number of lines */
+} source_span_t;
+
+/**
+ * @brief The expanded source
+ */
+typedef struct expanded_source {
+    source_template_t *templates;
+    int template_count;
+    int template_capacity;
+    source_span_t *spans;
+    int span_count;
+    int span_capacity;
+    int line_count;               /* Lines covered by all spans */
+    struct line_pipe *pipe;       /* Gets every line added, for a pipelined first pass (NULL = none) */
+    long *incbin_sizes;           /* Bytes of every .incbin line in order, as the last first pass found them */
+    int incbin_count;
+    char **headers;               /* Paths of the files named by .include, in the order first included */
+    int header_count;
+    int header_capacity;
+} expanded_source_t;
+
+/**
+ * @brief Position of a pass in the expanded source
+ */
+typedef struct {
+    int span;                     /* Current span */
+    int offset;                   /* Line within the span */
+    int line_number;              /* Line number of the line last returned (1-based) */
+} source_cursor_t;
+
+/**
+ * @brief Initialize an empty expanded source
+ * @param source The expanded source
+ */
+void init_expanded_source(expanded_source_t *source);
+
+/**
+ * @brief Empty an expanded source, keeping its arrays and line buffers for the next file
+ * @param source The expanded source
+ */
+void reset_expanded_source(expanded_source_t *source);
+
+/**
+ * @brief Release the templates and spans of an expanded source (it is left empty)
+ * @param source The expanded source
+ */
+void free_expanded_source(expanded_source_t *source);
+
+/**
+ * @brief Add one template as it is
+ * @param source The expanded source
+ * @param text The text of the line
+ * @param length The length of the text
+ * @param joined No newline follows the line in the .am file
+ * @return Index of the template, or -1 on allocation failure
+ */
+int add_source_line(expanded_source_t *source, const char *text, size_t length, bool joined);
+
+/**
+ * @brief Add the templates for a line of text, split the way fgets would read it back
+ * @param source The expanded source
+ * @param text The line without its newline
+ * @param length The length of the line
+ * @param count Output parameter for the number of templates added
+ * @return Index of the first template added, or -1 on allocation failure
+ */
+int add_source_templates(expanded_source_t *source, const char *text, size_t length, int *count);
+
+/**
+ * @brief Append consecutive templates as the next lines of the source
+ * @param source The expanded source
+ * @param first The first template
+ * @param count The number of templates
+ * @return true on success, false on allocation failure
+ *
+ * A span continuing the templates of the previous span is merged into it.
+ */
+bool add_source_span(expanded_source_t *source, int first, int count);
+
+/**
+ * @brief Append a line of text as the next line(s) of the source
+ * @param source The expanded source
+ * @param text The line without its newline
+ * @return true on success, false on allocation failure
+ */
+bool append_source_text(expanded_source_t *source, const char *text);
+
+/**
+ * @brief Record a file named by a .include directive (a path already recorded is ignored)
+ * @param source The expanded source
+ * @param path The resolved path of the header
+ * @return true on success, false on allocation failure
+ */
+bool add_source_header(expanded_source_t *source, const char *path);
+
+/**
+ * @brief Lay out the expanded source as the text of its .am file
+ * @param source The expanded source
+ * @param length Output parameter for the number of bytes
+ * @return The text (freed by the caller), or NULL on allocation failure
+ */
+char *format_expanded_source(const expanded_source_t *source, size_t *length);
+
+/**
+ * @brief Write the expanded source as a .am file
+ * @param source The expanded source
+ * @param path The file to write
+ * @param context Error context for reporting issues
+ * @return true if writing was successful, false otherwise
+ */
+bool write_expanded_source(const expanded_source_t *source, const char *path, error_context_t *context);
+
+/**
+ * @brief Start a walk over the lines of the expanded source
+ * @param cursor The cursor to initialize
+ */
+void init_source_cursor(source_cursor_t *cursor);
+
+/**
+ * @brief Move to the next line of the expanded source
+ * @param source The expanded source
+ * @param cursor The cursor (its line_number is updated)
+ * @return The template of the line, or NULL at the end of the source
+ */
+source_template_t *next_source_line(const expanded_source_t *source, source_cursor_t *cursor);
+
+/**
+ * @brief Parse a line of the expanded source, reusing an earlier parse of its template
+ * @param line The template of the line
+ * @param line_number The line number to report and store in the result
+ * @param parsed Output parameter for the parsed line
+ * @param context Error context for reporting issues
+ * @return true if parsing was successful, false otherwise
+ *
+ * Lines that fail to parse are not cached, so every reference reports its errors.
+ */
+bool parse_source_line(source_template_t *line, int line_number, parsed_line_t *parsed, error_context_t *context);
+
+#endif /* EXPANDED_SOURCE_H */
@@ -0,0 +1,98 @@
+/**
+ * @file external_table.h
+ * @brief Table of the references to external symbols made by a module
+ *
+ * Every use of an external symbol becomes one (symbol id, address) record
+ * in a growable array, so adding a reference costs O(1) and the records stay
+ * in the order they were added, which for the second pass is address order.
+ * Each distinct external symbol gets an id the first time it is referenced
+ * and keeps a chain through its records, so the references to one symbol can
+ * be walked without scanning or sorting the whole table.
+ */
+
+#ifndef EXTERNAL_TABLE_H
+#define EXTERNAL_TABLE_H
+
+#include <stddef.h>
+#include "assembler.h"
+#include "error.h"
+
+/**
+ * @brief One use of an external symbol
+ */
+typedef struct {
+    int symbol;                   /* Id of the external symbol (index into the table's symbols) */
+    int address;                  /* Address of the word holding the reference */
+    int next;                     /* Next reference to the same symbol (-1 = last) */
+} external_reference_t;
+
+/**
+ * @brief An external symbol with the chain of its references
+ */
+typedef struct {
+    char name[MAX_LABEL_LENGTH];  /* Symbol name */
+    int length;                   /* strlen(name) */
+    int first;                    /* First reference to the symbol */
+    int last;                     /* Last reference to the symbol */
+    int count;                    /* Number of references */
+} external_symbol_t;
+
+/**
+ * @brief The external references of a module
+ */
+typedef struct {
+    external_reference_t *refs;   /* References in the order they were added */
+    int count;
+    int capacity;
+    external_symbol_t *symbols;   /* Referenced symbols in order of first use */
+    int symbol_count;
+    int symbol_capacity;
+    int *slots;                   /* Hash slots holding symbol id + 1 (0 = empty) */
+    size_t slot_count;            /* Number of slots (power of two) */
+} external_table_t;
+
+/**
+ * @brief Initialize an empty table
+ * @param table The table
+ */
+void init_external_table(external_table_t *table);
+
+/**
+ * @brief Empty a table, keeping its arrays for the references added next
+ * @param table The table
+ */
+void reset_external_table(external_table_t *table);
+
+/**
+ * @brief Release the memory held by a table (it is left empty)
+ * @param table The table
+ */
+void free_external_table(external_table_t *table);
+
+/**
+ * @brief Add an external reference
+ * @param table The table
+ * @param name The name of the external symbol
+ * @param address The address where it's referenced
+ * @param context Error context for reporting issues
+ * @return true if the reference was added successfully, false otherwise
+ */
+bool add_external_reference(external_table_t *table, const char *name, int address, error_context_t *context);
+
+/**
+ * @brief Find the id of a referenced external symbol
+ * @param table The table
+ * @param name The name of the symbol
+ * @return The symbol id, or -1 if the table holds no reference to it
+ */
+int find_external_symbol(const external_table_t *table, const char *name);
+
+/**
+ * @brief Get the name of the symbol a reference points at
+ * @param table The table
+ * @param ref A reference of the table
+ * @return The symbol name
+ */
+const char *external_reference_name(const external_table_t *table, const external_reference_t *ref);
+
+#endif /* EXTERNAL_TABLE_H */
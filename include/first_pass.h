@@ -10,6 +10,8 @@
 #include "symbol_table.h"
 #include "error.h"
 
+struct expanded_source;
+
 /**
  * @brief Parsed line data
  */
@@ -22,6 +24,27 @@ typedef struct {
     int line_number;
 } parsed_line_t;
 
+/**
+ * @brief Byte range of a file included with .incbin (one data word per byte)
+ */
+typedef struct {
+    char path[MAX_FILENAME_LENGTH];   /* Relative paths are resolved against the source file's directory */
+    long offset;                      /* First byte included */
+    long length;                      /* Number of bytes included */
+} incbin_range_t;
+
+/**
+ * @brief Counters of a first pass in progress
+ */
+typedef struct {
+    int IC;                           /* Instruction Counter */
+    int DC;                           /* Data Counter */
+    bool success;                     /* Every line so far was processed */
+    long *incbin_sizes;               /* Bytes of every .incbin line so far, in order */
+    int incbin_count;
+    int incbin_capacity;
+} first_pass_state_t;
+
 /**
  * @brief Parse a line into its components
  * @param line The line to parse
@@ -52,6 +75,50 @@ bool process_data_directive(parsed_line_t *line, symbol_table_t *symbols, int *D
  */
 bool process_string_directive(parsed_line_t *line, symbol_table_t *symbols, int *DC, error_context_t *context);
 
+/**
+ * @brief Process a .incbin directive
+ * @param line The parsed line
+ * @param symbols The symbol table
+ * @param DC Pointer to the data counter
+ * @param source The source file the directive appears in (NULL for a source in memory)
+ * @param context Error context for reporting issues
+ * @return true if processing was successful, false otherwise
+ *
+ * Only the file size is looked at; the bytes are read when the data image is encoded.
+ */
+bool process_incbin_directive(parsed_line_t *line, symbol_table_t *symbols, int *DC, const char *source,
+                              error_context_t *context);
+
+/**
+ * @brief Resolve the file and byte range of a .incbin directive
+ * @param line The parsed line
+ * @param source The source file the directive appears in (NULL for a source in memory)
+ * @param range Output parameter for the file path and byte range
+ * @param context Error context for reporting issues
+ * @return true if the file exists and the range lies within it, false otherwise
+ */
+bool resolve_incbin(const parsed_line_t *line, const char *source, incbin_range_t *range, error_context_t *context);
+
+/**
+ * @brief Process a .space or .fill directive
+ * @param line The parsed line
+ * @param symbols The symbol table
+ * @param DC Pointer to the data counter
+ * @param context Error context for reporting issues
+ * @return true if processing was successful, false otherwise
+ */
+bool process_fill_directive(parsed_line_t *line, symbol_table_t *symbols, int *DC, error_context_t *context);
+
+/**
+ * @brief Get the word count and value of a .space or .fill directive
+ * @param line The parsed line (count in operands[0], the .fill value in operands[1])
+ * @param count Output parameter for the number of words
+ * @param value Output parameter for the value of every word (0 for .space)
+ * @param context Error context for reporting issues (may be NULL)
+ * @return true if both numbers are valid, false otherwise
+ */
+bool parse_fill_directive(const parsed_line_t *line, int *count, int *value, error_context_t *context);
+
 /**
  * @brief Process a .extern directive
  * @param line The parsed line
@@ -89,13 +156,43 @@ bool process_instruction(parsed_line_t *line, symbol_table_t *symbols, int *IC,
  */
 int calculate_instruction_length(const char *opcode, const char *operand1, const char *operand2, error_context_t *context);
 
+/**
+ * @brief Start a first pass over a file
+ * @param state The counters of the pass
+ * @param filename The name of the source file (NULL for a source assembled from memory)
+ * @param context Error context for reporting issues
+ */
+void begin_first_pass(first_pass_state_t *state, const char *filename, error_context_t *context);
+
+/**
+ * @brief Process one parsed line of the expanded source
+ * @param state The counters of the pass
+ * @param parsed_line The parsed line, with its line number
+ * @param filename The name of the source file (.incbin paths are relative to it)
+ * @param symbols The symbol table
+ * @param context Error context for reporting issues
+ */
+void first_pass_line(first_pass_state_t *state, parsed_line_t *parsed_line, const char *filename,
+                     symbol_table_t *symbols, error_context_t *context);
+
+/**
+ * @brief Finish a first pass once every line was processed, moving the data symbols after the code
+ * @param state The counters of the pass
+ * @param symbols The symbol table
+ * @param source The expanded source, which takes the sizes of its .incbin lines for the second pass
+ * @return true if every line was processed successfully, false otherwise
+ */
+bool end_first_pass(first_pass_state_t *state, symbol_table_t *symbols, struct expanded_source *source);
+
 /**
  * @brief Main function for the first pass
- * @param filename The name of the source file
+ * @param filename The name of the source file (NULL for a source assembled from memory)
+ * @param source The expanded source produced by the pre-assembler
  * @param symbols The symbol table
  * @param context Error context for reporting issues
  * @return true if the first pass was successful, false otherwise
  */
-bool first_pass(const char *filename, symbol_table_t *symbols, error_context_t *context);
+bool first_pass(const char *filename, struct expanded_source *source, symbol_table_t *symbols,
+                error_context_t *context);
 
 #endif /* FIRST_PASS_H */
\ No newline at end of file
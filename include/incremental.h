@@ -0,0 +1,94 @@
+/**
+ * @file incremental.h
+ * @brief Incremental re-assembly of one file for editor integration
+ *
+ * An edit session keeps everything a check of one file needs from one edit
+ * to the next: the source text, the macro table, a cache entry for every line
+ * of the expanded source (its parsed form, size, address, encoding and
+ * diagnostics), the symbols and, for every symbol, the lines defining it and
+ * the lines referring to it.
+ *
+ * After an edit the macros are expanded again, since changing one macro can
+ * change every expansion and expanding only copies text. The new expanded
+ * lines are matched against the cached ones from both ends and only the lines
+ * in between are parsed and checked again. Addresses are recomputed from the
+ * first changed line on, and an instruction is encoded again only when it is
+ * new, when a symbol it refers to was redefined or moved, or when it moved
+ * itself and uses relative addressing. The diagnostics are those a --check
+ * of the same text reports.
+ */
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stddef.h>
+#include "assembler.h"
+#include "error.h"
+
+/**
+ * @brief Opaque edit session
+ */
+typedef struct edit_session edit_session_t;
+
+/**
+ * @brief What the last update of a session did
+ */
+typedef struct {
+    int source_lines;             /* Lines of the source text */
+    int lines;                    /* Lines of the expanded source */
+    int relexed;                  /* Expanded lines parsed and checked again */
+    int encoded;                  /* Instructions and .entry lines encoded again */
+    bool success;                 /* The text assembles without errors */
+} edit_stats_t;
+
+/**
+ * @brief Load a source file into a new session and check it
+ * @param filename The source file (.include and .incbin paths are relative to it)
+ * @param context Error context for reporting issues
+ * @return The session, or NULL if the file could not be read
+ */
+edit_session_t *create_edit_session(const char *filename, error_context_t *context);
+
+/**
+ * @brief Replace a range of source lines and check the result
+ * @param session The session
+ * @param first The first line replaced (1-based)
+ * @param last The last line replaced (first - 1 inserts before first)
+ * @param text The new lines, each ending with a newline (one is added to a last line without it)
+ * @param length The length of the text in bytes
+ * @param context Error context for reporting issues
+ * @return true if the edit was applied, false if the range is invalid or memory ran out
+ */
+bool apply_source_edit(edit_session_t *session, int first, int last, const char *text, size_t length,
+                       error_context_t *context);
+
+/**
+ * @brief Get the diagnostics of the current text
+ * @param session The session
+ * @param count Output parameter for the number of diagnostics
+ * @return The diagnostics in the order --check reports them, valid until the next edit
+ */
+const diagnostic_t *get_session_diagnostics(const edit_session_t *session, int *count);
+
+/**
+ * @brief Get what the last update did
+ * @param session The session
+ * @param stats Output parameter for the counts
+ */
+void get_edit_stats(const edit_session_t *session, edit_stats_t *stats);
+
+/**
+ * @brief Check the current text from scratch and compare with the session
+ * @param session The session
+ * @param context Error context for reporting issues
+ * @return true if a full check reports exactly the session's diagnostics, false otherwise
+ */
+bool verify_edit_session(edit_session_t *session, error_context_t *context);
+
+/**
+ * @brief Release a session
+ * @param session The session (NULL is ignored)
+ */
+void destroy_edit_session(edit_session_t *session);
+
+#endif /* INCREMENTAL_H */
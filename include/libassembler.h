@@ -0,0 +1,84 @@
+/**
+ * @file libassembler.h
+ * @brief Embeddable API assembling sources held in memory (libassembler.a)
+ *
+ * asm_assemble runs the pre-assembler and both passes over a source buffer
+ * and returns the code and data images, the entries, the external references
+ * and the diagnostics in memory. Nothing is read from or written to the
+ * filesystem and nothing is printed, so .include and .incbin lines are
+ * reported as errors; macros can still come from a precompiled library
+ * mapped by the caller.
+ *
+ * A context keeps its tables and buffers between calls. Each context may be
+ * used by one thread at a time, and separate contexts may assemble
+ * concurrently (a shared macro library is only read).
+ */
+
+#ifndef LIBASSEMBLER_H
+#define LIBASSEMBLER_H
+
+#include <stddef.h>
+#include "assembler.h"
+#include "machine_word.h"
+#include "error.h"
+
+#define ASM_SOURCE_NAME "<memory>"  /* File name recorded in the context's diagnostics */
+
+/**
+ * @brief Opaque assembler context
+ */
+typedef struct asm_context asm_context_t;
+
+/**
+ * @brief A named address: an entry symbol, or one use of an external symbol
+ */
+typedef struct {
+    const char *name;             /* Symbol name */
+    int address;                  /* Symbol address, or address of the referencing word */
+} asm_symbol_t;
+
+/**
+ * @brief Outcome of asm_assemble
+ *
+ * Every pointer refers to memory owned by the context and stays valid until
+ * the next asm_assemble or asm_destroy_context call on that context.
+ */
+typedef struct {
+    bool success;                 /* The source assembled without errors */
+    const machine_word_t *code;   /* Code words (24-bit form), the first at code_start */
+    int code_size;
+    int code_start;               /* Address of the first code word (MEMORY_START) */
+    const machine_word_t *data;   /* Data words, placed after the code */
+    int data_size;
+    const asm_symbol_t *entries;  /* .entry symbols in .ent file order */
+    int entry_count;
+    const asm_symbol_t *externs;  /* External references in address order */
+    int extern_count;
+    const diagnostic_t *diagnostics; /* Errors and warnings in the order they were found */
+    int diagnostic_count;
+} asm_result_t;
+
+/**
+ * @brief Create an assembler context
+ * @param options Optimization passes and macro library to use (NULL for none); the output format is ignored
+ * @return The context, or NULL if memory could not be allocated
+ */
+asm_context_t *asm_create_context(const assembler_options_t *options);
+
+/**
+ * @brief Assemble a source held in memory
+ * @param ctx The context
+ * @param src The source text (need not be NUL-terminated)
+ * @param len The length of the source in bytes
+ * @param out Output parameter for the result (filled on failure too, with the diagnostics)
+ * @return true if the source assembled without errors, false otherwise
+ */
+bool asm_assemble(asm_context_t *ctx, const char *src, size_t len, asm_result_t *out);
+
+/**
+ * @brief Release a context and every result it returned
+ * @param ctx The context (NULL is ignored)
+ */
+void asm_destroy_context(asm_context_t *ctx);
+
+#endif /* LIBASSEMBLER_H */
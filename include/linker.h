@@ -0,0 +1,39 @@
+/**
+ * @file linker.h
+ * @brief Multi-module linker for binary objects
+ */
+
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "assembler.h"
+
+#define LINK_DEFAULT_OUTPUT "linked.tpo"  /* Output path when -o is not given */
+
+/**
+ * @brief Linker settings
+ */
+typedef struct {
+    const char *output;           /* Path of the linked binary object */
+    int base;                     /* Address of the first linked code word */
+    int threads;                  /* Worker threads (0 = one per online CPU) */
+    int word_bytes;               /* Word size of the linked binary object */
+} link_options_t;
+
+/**
+ * @brief Link binary objects into one image
+ * @param paths The .tpo files to link, in layout order
+ * @param count The number of files
+ * @param options The linker settings
+ * @return true if every module loaded and every reference resolved, false otherwise
+ *
+ * The code sections of all modules are laid out from options->base in the
+ * given order, followed by all data sections. Direct address words are
+ * relocated, every external reference is patched with the address of the
+ * matching .entry symbol, and the entries of all modules are exported from
+ * the linked object. Duplicate and undefined symbols are all reported
+ * before failing.
+ */
+bool link_objects(const char **paths, int count, const link_options_t *options);
+
+#endif /* LINKER_H */
@@ -6,15 +6,29 @@
 #ifndef MACHINE_WORD_H
 #define MACHINE_WORD_H
 
+#include <stdint.h>
 #include "assembler.h"
 
 /**
- * @brief Machine word structure with 24-bit layout
+ * @brief Machine word in its 24-bit form: the 21-bit value above the 3 ARE bits
+ *
+ * Code and data images are plain arrays of these words, so writers can copy
+ * them as they are.
  */
-typedef struct {
-    unsigned int value: 21;  /* 21-bit value */
-    unsigned int are: 3;     /* A=1 if absolute, R=1 if relocatable, E=1 if external */
-} machine_word_t;
+typedef uint32_t machine_word_t;
+
+#define WORD_ARE_BITS 3                     /* ARE occupies bits 0-2 */
+#define WORD_VALUE_MASK 0x1FFFFFUL          /* 21-bit value */
+#define WORD_ARE_MASK 0x07UL                /* 3 ARE bits */
+
+/* Build a word from a value and ARE bits, keeping the low 21 bits of the value */
+#define WORD_MAKE(value, are) \
+    ((machine_word_t)((((unsigned long)(value) & WORD_VALUE_MASK) << WORD_ARE_BITS) | \
+                      ((unsigned long)(are) & WORD_ARE_MASK)))
+
+/* The 21-bit value and the ARE bits of a word */
+#define WORD_VALUE(word) ((unsigned long)((word) >> WORD_ARE_BITS) & WORD_VALUE_MASK)
+#define WORD_ARE(word) ((unsigned long)(word) & WORD_ARE_MASK)
 
 /**
  * @brief A/R/E values for machine words
@@ -26,6 +40,19 @@ typedef enum {
     WORD_ARE_ABSOLUTE = 4        /* A bit = 1 (binary 100) */
 } are_type_t;
 
+/**
+ * @brief Fields of a decoded instruction word
+ */
+typedef struct {
+    instruction_id_t instruction;  /* Which instruction the word encodes */
+    int operand_count;             /* Number of operands (0-2) */
+    addressing_method_t src_addr;  /* Source addressing method (two-operand instructions) */
+    addressing_method_t dst_addr;  /* Destination addressing method (or the only operand's) */
+    int src_reg;                   /* Source register field */
+    int dst_reg;                   /* Destination register field */
+    int length;                    /* Instruction length in words */
+} decoded_instruction_t;
+
 /**
  * @brief Initialize a machine word
  * @param word Pointer to the machine word to initialize
@@ -91,6 +118,20 @@ void word_set_are(machine_word_t *word, are_type_t are);
  */
 void word_to_string(const machine_word_t *word, char *buffer, size_t size);
 
+/**
+ * @brief Get the 24-bit form of a machine word (value above the ARE bits)
+ * @param word The machine word
+ * @return The 24-bit word
+ */
+unsigned long word_to_bits(machine_word_t word);
+
+/**
+ * @brief Build a machine word from its 24-bit form
+ * @param bits The 24-bit word
+ * @return The machine word
+ */
+machine_word_t word_from_bits(unsigned long bits);
+
 /**
  * @brief Encode the first word of an instruction
  * @param opcode The operation code
@@ -138,4 +179,19 @@ machine_word_t encode_direct_address(int address, bool is_external);
  */
 machine_word_t encode_relative_address(int distance);
 
+/**
+ * @brief Decode the first word of an instruction
+ * @param word The instruction word
+ * @param decoded Output parameter for the decoded fields
+ * @return true if the word encodes a valid instruction, false otherwise
+ */
+bool decode_instruction_word(machine_word_t word, decoded_instruction_t *decoded);
+
+/**
+ * @brief Get the mnemonic of an instruction
+ * @param instruction The instruction identifier
+ * @return The mnemonic, or "?" if the identifier is invalid
+ */
+const char *instruction_name(instruction_id_t instruction);
+
 #endif /* MACHINE_WORD_H */
\ No newline at end of file
@@ -0,0 +1,99 @@
+/**
+ * @file macro_library.h
+ * @brief Precompiled macro libraries (.mlib)
+ *
+ * A macro library holds macro definitions compiled once from mcro/mcroend
+ * sources: a fixed header, an open-addressing hash index, one record per
+ * macro and a text section with the names and bodies. Each body is stored
+ * as its lines joined with '\n', exactly as the pre-assembler writes them,
+ * so an expansion is a single copy out of the mapped file. Fields are in
+ * host byte order; the header_size check rejects files from a host with
+ * the other byte order.
+ */
+
+#ifndef MACRO_LIBRARY_H
+#define MACRO_LIBRARY_H
+
+#include <stdint.h>
+#include "assembler.h"
+#include "pre_assembler.h"
+#include "error.h"
+
+#define MACRO_LIBRARY_MAGIC "TPML"    /* First four bytes of every .mlib file */
+#define MACRO_LIBRARY_VERSION 1       /* Current format version */
+
+/**
+ * @brief Fixed file header (40 bytes)
+ *
+ * Section offsets are relative to the start of the file.
+ */
+typedef struct {
+    char magic[4];                /* MACRO_LIBRARY_MAGIC */
+    uint16_t version;             /* MACRO_LIBRARY_VERSION */
+    uint16_t reserved;            /* Must be zero */
+    uint32_t header_size;         /* sizeof(macro_library_header_t) */
+    uint32_t macro_count;         /* Records in the macro table */
+    uint32_t slot_count;          /* Hash slots (power of two) */
+    uint32_t slots_offset;        /* Offset of the slots: macro index + 1, 0 = empty */
+    uint32_t macros_offset;       /* Offset of the macro table */
+    uint32_t text_offset;         /* Offset of the names and bodies */
+    uint32_t text_size;           /* Bytes in the text section */
+    uint32_t file_size;           /* Total file size in bytes */
+} macro_library_header_t;
+
+/**
+ * @brief Macro record
+ */
+typedef struct {
+    uint32_t hash;                /* hash_string(name), truncated to 32 bits */
+    uint32_t name_offset;         /* Offset of the NUL-terminated name in the text section */
+    uint32_t body_offset;         /* Offset of the body in the text section */
+    uint32_t body_size;           /* Bytes in the body (every line ends with '\n') */
+    uint32_t line_count;          /* Lines in the body */
+} macro_library_entry_t;
+
+/**
+ * @brief Read-only view of a macro library backed by mmap
+ */
+typedef struct macro_library {
+    const macro_library_header_t *header;
+    const uint32_t *slots;
+    const macro_library_entry_t *macros;
+    const char *text;
+    void *mapping;                /* Mapped region */
+    size_t mapping_size;          /* Size of the mapped region */
+} macro_library_t;
+
+/**
+ * @brief Compile the macros of a table into a macro library file
+ * @param path The .mlib file path
+ * @param table The macros to store
+ * @param context Error context for reporting issues
+ * @return true if writing was successful, false otherwise
+ */
+bool write_macro_library(const char *path, const macro_table_t *table, error_context_t *context);
+
+/**
+ * @brief Map a macro library file and validate it
+ * @param path The .mlib file path
+ * @param library Output parameter for the library view
+ * @param context Error context for reporting issues
+ * @return true if the file is a valid macro library, false otherwise
+ */
+bool open_macro_library(const char *path, macro_library_t *library, error_context_t *context);
+
+/**
+ * @brief Release a macro library opened with open_macro_library
+ * @param library The library view
+ */
+void close_macro_library(macro_library_t *library);
+
+/**
+ * @brief Find a macro in a library
+ * @param library The library view
+ * @param name The name of the macro to find
+ * @return Pointer to the macro record if found, NULL otherwise
+ */
+const macro_library_entry_t *find_library_macro(const macro_library_t *library, const char *name);
+
+#endif /* MACRO_LIBRARY_H */
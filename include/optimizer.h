@@ -0,0 +1,85 @@
+/**
+ * @file optimizer.h
+ * @brief Optional optimization passes run between the first and second pass
+ */
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "assembler.h"
+#include "first_pass.h"
+#include "symbol_table.h"
+#include "error.h"
+
+/**
+ * @brief One line of the expanded source (.am)
+ */
+typedef struct {
+    char text[MAX_LINE_LENGTH];   /* Line as read from the .am file */
+    parsed_line_t parsed;         /* Parsed form (INST_TYPE_INVALID for blank and comment lines) */
+    bool removed;                 /* Dropped by an optimization */
+    bool rewritten;               /* parsed no longer matches text */
+} program_line_t;
+
+/**
+ * @brief The expanded source as a list of parsed lines
+ */
+typedef struct {
+    program_line_t *lines;
+    int count;
+} program_t;
+
+/**
+ * @brief Label of a pooled data block, now pointing into the block that kept the words
+ */
+typedef struct {
+    char label[MAX_LABEL_LENGTH];   /* Label of the removed block */
+    char target[MAX_LABEL_LENGTH];  /* Label of the block holding the shared words */
+    int offset;                     /* Word offset of the shared words in the target block */
+} data_alias_t;
+
+/**
+ * @brief What the optimization passes changed
+ */
+typedef struct {
+    bool changed;                 /* The .am file was rewritten */
+    data_alias_t *aliases;        /* Labels to define after the first pass reruns */
+    int alias_count;
+} optimization_result_t;
+
+/**
+ * @brief Run the enabled optimization passes over a file that passed the first pass
+ * @param filename The source filename (the .am file next to it is rewritten unless the options
+ *                 name an archive or an I/O engine), or NULL for a source assembled from memory (nothing is
+ *                 written or printed)
+ * @param source The expanded source (replaced by the optimized lines when they change)
+ * @param symbols The symbol table built by the first pass
+ * @param options The command-line options selecting the passes
+ * @param result Output parameter describing the changes (release with free_optimization_result)
+ * @param context Error context for reporting issues
+ * @return true if the passes ran successfully, false otherwise
+ *
+ * Removed lines are kept as comments and rewritten lines stay in place, so
+ * the line numbers of later diagnostics still match the original .am. When
+ * the program changed the caller reruns the first pass to recompute the label
+ * addresses and then calls apply_data_aliases.
+ */
+bool optimize_program(const char *filename, struct expanded_source *source, symbol_table_t *symbols,
+                      const assembler_options_t *options, optimization_result_t *result, error_context_t *context);
+
+/**
+ * @brief Define the labels of pooled data blocks at their shared addresses
+ * @param symbols The symbol table built by the rerun first pass
+ * @param result The result of optimize_program
+ * @param context Error context for reporting issues
+ * @return true if every alias was defined, false otherwise
+ */
+bool apply_data_aliases(symbol_table_t *symbols, const optimization_result_t *result, error_context_t *context);
+
+/**
+ * @brief Release the memory held by an optimization result
+ * @param result The result of optimize_program
+ */
+void free_optimization_result(optimization_result_t *result);
+
+#endif /* OPTIMIZER_H */
@@ -9,8 +9,12 @@
 #include "assembler.h"
 #include "symbol_table.h"
 #include "second_pass.h"
+#include "archive.h"
+#include "async_io.h"
 #include "error.h"
 
+#define STREAM_FRAME_MAGIC "TPS1"     /* First field of every frame header written with -o - */
+
 /**
  * @brief Output files structure
  */
@@ -27,7 +31,7 @@ typedef struct
  * @param symbols The symbol table
  * @param code_image The code image
  * @param data_image The data image
- * @param ext_refs The list of external references
+ * @param ext_refs The external references
  * @param ICF The final instruction counter
  * @param DCF The final data counter
  * @param context Error context for reporting issues
@@ -35,7 +39,7 @@ typedef struct
  */
 bool generate_output_files(const char* filename, symbol_table_t* symbols,
                            machine_word_t* code_image, machine_word_t* data_image,
-                           external_reference_t* ext_refs, int ICF, int DCF,
+                           const external_table_t* ext_refs, int ICF, int DCF,
                            error_context_t* context);
 
 /**
@@ -65,13 +69,93 @@ bool write_entries_file(const char* filename, symbol_table_t* symbols,
 /**
  * @brief Write the externals file
  * @param filename The base filename
- * @param ext_refs The list of external references
+ * @param ext_refs The external references
  * @param context Error context for reporting issues
  * @return true if writing was successful, false otherwise
  */
-bool write_externals_file(const char* filename, external_reference_t* ext_refs,
+bool write_externals_file(const char* filename, const external_table_t* ext_refs,
+                         error_context_t* context);
+
+/**
+ * @brief Add the object, entries and externals outputs of a module to an archive
+ * @param archive The archive being written
+ * @param module The module name
+ * @param symbols The symbol table
+ * @param code_image The code image
+ * @param data_image The data image
+ * @param ext_refs The external references
+ * @param ICF The final instruction counter
+ * @param DCF The final data counter
+ * @param context Error context for reporting issues
+ * @return true if every output was added, false otherwise
+ *
+ * The members hold exactly what generate_output_files would write, and the
+ * .ent and .ext members are left out when those files would be.
+ */
+bool archive_output_files(archive_writer_t* archive, const char* module, symbol_table_t* symbols,
+                          machine_word_t* code_image, machine_word_t* data_image,
+                          const external_table_t* ext_refs, int ICF, int DCF,
+                          error_context_t* context);
+
+/**
+ * @brief Write the object, entries and externals outputs of a module to a framed stream
+ * @param stream The stream
+ * @param module The module name
+ * @param symbols The symbol table
+ * @param code_image The code image
+ * @param data_image The data image
+ * @param ext_refs The external references
+ * @param ICF Final instruction counter
+ * @param DCF Final data counter
+ * @param context Error context for reporting issues
+ * @return true if every frame was written, false otherwise
+ *
+ * The ob, ent and ext frames hold exactly what generate_output_files would
+ * write, and the ent and ext frames are left out when those files would be.
+ * An empty end frame closes the module.
+ */
+bool stream_output_files(FILE* stream, const char* module, symbol_table_t* symbols,
+                         machine_word_t* code_image, machine_word_t* data_image,
+                         const external_table_t* ext_refs, int ICF, int DCF,
                          error_context_t* context);
 
+/**
+ * @brief Write one frame to a framed output stream
+ * @param stream The stream
+ * @param module The module name
+ * @param section The section: ob, ent, ext, end, or error for a module that failed
+ * @param data The payload
+ * @param size The number of bytes in the payload
+ * @param context Error context for reporting issues
+ * @return true if the frame was written, false otherwise
+ *
+ * A frame is the header line "TPS1 <section> <size> <module>" followed by
+ * exactly size bytes of payload.
+ */
+bool write_stream_frame(FILE* stream, const char* module, const char* section, const char* data,
+                        size_t size, error_context_t* context);
+
+/**
+ * @brief Start writing the output files in the background
+ * @param io The I/O engine
+ * @param filename The base filename
+ * @param symbols The symbol table
+ * @param code_image The code image
+ * @param data_image The data image
+ * @param ext_refs The external references
+ * @param ICF The final instruction counter
+ * @param DCF The final data counter
+ * @param context Error context for reporting issues
+ * @return true if every write was started, false otherwise
+ *
+ * The files and their contents are those of generate_output_files; failed
+ * writes are reported when the engine reaps them.
+ */
+bool queue_output_files(async_io_t* io, const char* filename, symbol_table_t* symbols,
+                        machine_word_t* code_image, machine_word_t* data_image,
+                        const external_table_t* ext_refs, int ICF, int DCF,
+                        error_context_t* context);
+
 /**
  * @brief Check if symbol table has entries
  * @param symbols The symbol table
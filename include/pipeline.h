@@ -0,0 +1,78 @@
+/**
+ * @file pipeline.h
+ * @brief Running the pre-assembler and the first pass as concurrent stages
+ *
+ * With --pipeline the macro expander runs on its own thread and hands every
+ * line of the expanded source to the first pass as soon as it is added,
+ * through a single-producer single-consumer ring. The first pass runs on the
+ * calling thread, so symbols are collected while later lines are still being
+ * expanded. The pass structure is unchanged: the optimizer and the second
+ * pass start once both stages are done.
+ *
+ * The ring carries references to the line templates, whose text buffers do
+ * not move while the source grows, so no line is copied. Lines are published
+ * in batches of PIPELINE_BATCH and a full ring stops the expander until the
+ * first pass catches up; either stage spins for a while before it sleeps.
+ *
+ * Errors cross the stages both ways. The expander closes the ring with its
+ * result, and a first pass over a source that did not expand is discarded.
+ * A first pass that cannot go on cancels the ring, after which the expander
+ * finishes without waiting for it. The messages of the first pass are held
+ * back and reported after those of the pre-assembler, so the output is the
+ * same as that of the sequential stages.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "assembler.h"
+#include "pre_assembler.h"
+#include "expanded_source.h"
+#include "symbol_table.h"
+#include "error.h"
+
+#define PIPELINE_CAPACITY 4096        /* Lines in flight (a power of two) */
+#define PIPELINE_BATCH 64             /* Lines added before they are published to the first pass */
+#define PIPELINE_SPINS 1000           /* Polls of the other stage before waiting on it */
+
+struct line_pipe;
+
+/**
+ * @brief Outcome of a first pass run alongside the pre-assembler
+ */
+typedef struct {
+    bool success;                 /* The first pass succeeded */
+    diagnostic_list_t diagnostics; /* Its messages, not reported yet */
+} pipelined_pass_t;
+
+/**
+ * @brief Expand the macros of a source file while its first pass runs on the lines expanded so far
+ * @param filename The name of the source file
+ * @param text The contents of the source file, or NULL to read it
+ * @param length The length of the contents in bytes
+ * @param library Precompiled macros used when a name is not defined locally (NULL for none)
+ * @param macros Table for the file's macro definitions (reset first)
+ * @param expanded Output parameter for the expanded source, initialized by the caller (reset first)
+ * @param write_output Write the .am file
+ * @param symbols The symbol table filled by the first pass (reset first)
+ * @param pass Output parameter for the first pass, valid when the source expanded; its diagnostics
+ *             are released by the caller with free_diagnostics
+ * @param context Error context for reporting issues of the pre-assembler
+ * @return true if the pre-assembler was successful, false otherwise
+ */
+bool pipeline_first_pass(const char *filename, const char *text, size_t length,
+                         const struct macro_library *library, macro_table_t *macros, expanded_source_t *expanded,
+                         bool write_output, symbol_table_t *symbols, pipelined_pass_t *pass,
+                         error_context_t *context);
+
+/**
+ * @brief Hand a line just added to the expanded source to the first pass
+ * @param pipe The ring of the expanded source
+ * @param text The text of the line's template (it must stay in place until the first pass ends)
+ * @param template_index The index of the line's template
+ *
+ * A full ring waits for the first pass; a cancelled ring drops the line.
+ */
+void push_pipeline_line(struct line_pipe *pipe, const char *text, int template_index);
+
+#endif /* PIPELINE_H */
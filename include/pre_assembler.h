@@ -8,6 +8,9 @@
 
 #include "assembler.h"
 #include "error.h"
+#include "expanded_source.h"
+
+struct macro_library;
 
 /**
  * @brief Macro definition structure
@@ -17,6 +20,9 @@ typedef struct macro {
     char **lines;                 /* Array of lines in the macro */
     int line_count;               /* Number of lines in the macro */
     int usage_count;              /* Number of times the macro is used */
+    bool borrowed;                /* Lines belong to a cached header, not to this table */
+    int first_template;           /* First template of the body in the expanded source */
+    int template_count;           /* Templates of the body (0 = not expanded yet) */
     struct macro *next;           /* Pointer to the next macro in the list */
 } macro_t;
 
@@ -25,6 +31,7 @@ typedef struct macro {
  */
 typedef struct macro_table {
     macro_t *head;                /* Pointer to the first macro in the list */
+    macro_t *spare;               /* Entries kept by reset_macro_table for reuse */
 } macro_table_t;
 
 /**
@@ -59,23 +66,94 @@ bool add_line_to_macro(macro_table_t *table, const char *line, error_context_t *
  */
 macro_t* find_macro(macro_table_t *table, const char *name);
 
+/**
+ * @brief Empty the table, keeping its entries and line arrays for the macros added next
+ * @param table The macro table
+ */
+void reset_macro_table(macro_table_t *table);
+
 /**
  * @brief Free the macro table and all its entries
  * @param table The macro table to free
  */
 void free_macro_table(macro_table_t *table);
 
+/**
+ * @brief Collect the macros defined by a definitions file
+ * @param path The file holding mcro/mcroend blocks (and .include lines)
+ * @param table The table to add the macros to (their lines stay in the include cache)
+ * @param context Error context for reporting issues
+ * @return true if the file holds only valid macro definitions, false otherwise
+ */
+bool collect_macro_definitions(const char *path, macro_table_t *table, error_context_t *context);
+
 /**
  * @brief Process a source file to expand macros
  * @param filename The name of the source file
+ * @param library Precompiled macros used when a name is not defined locally (NULL for none)
+ * @param macros Table for the file's macro definitions (reset first, so it can serve many files)
+ * @param expanded Output parameter for the expanded source, initialized by the caller (it is
+ *                 reset first, so it can serve many files)
+ * @param write_output Write the .am file (false when the caller stores the expanded source elsewhere)
  * @param context Error context for reporting issues
  * @return true if processing was successful, false otherwise
  *
  * This function reads an assembly source file, expands all macros using the
  * specified syntax (mcro/mcroend), and writes the expanded code to a new file.
+ * The passes read the expanded source from memory: each macro body is added
+ * once and every invocation refers to its lines.
  * Macros are defined with the 'mcro' directive and terminated with 'mcroend'.
  * Macro invocation is done by simply using the macro name as a token.
+ *
+ * A '.include "path"' line (path relative to the including file) expands the
+ * header in place; each header is expanded at most once per file. Headers are
+ * parsed once per process and cached by path, inode, size and modification
+ * time (to the nanosecond), so the macros and lines of a shared header are
+ * reused by every file including it.
+ */
+bool process_file(const char *filename, const struct macro_library *library, macro_table_t *macros,
+                  expanded_source_t *expanded, bool write_output, error_context_t *context);
+
+/**
+ * @brief Expand the macros of a source file whose contents were already read
+ * @param filename The name of the source file
+ * @param text The contents of the source file (need not be NUL-terminated)
+ * @param length The length of the contents in bytes
+ * @param library Precompiled macros used when a name is not defined locally (NULL for none)
+ * @param macros Table for the file's macro definitions (reset first)
+ * @param expanded Output parameter for the expanded source, initialized by the caller (reset first)
+ * @param write_output Write the .am file (false when the caller stores the expanded source elsewhere)
+ * @param context Error context for reporting issues
+ * @return true if processing was successful, false otherwise
+ *
+ * Works exactly like process_file on the same contents, for callers that
+ * read the file ahead of time.
+ */
+bool process_loaded_file(const char *filename, const char *text, size_t length, const struct macro_library *library,
+                         macro_table_t *macros, expanded_source_t *expanded, bool write_output,
+                         error_context_t *context);
+
+/**
+ * @brief Expand the macros of a source held in memory
+ * @param text The source text (need not be NUL-terminated)
+ * @param length The length of the text in bytes
+ * @param library Precompiled macros used when a name is not defined locally (NULL for none)
+ * @param macros Table for the source's macro definitions (reset first)
+ * @param expanded Output parameter for the expanded source, initialized by the caller (reset first)
+ * @param context Error context for reporting issues
+ * @return true if processing was successful, false otherwise
+ *
+ * Works like process_file without touching the filesystem: no .am file is
+ * written and .include lines are reported as errors.
+ */
+bool process_source_text(const char *text, size_t length, const struct macro_library *library,
+                         macro_table_t *macros, expanded_source_t *expanded, error_context_t *context);
+
+/**
+ * @brief Release the headers cached by .include directives
+ *
+ * Must not be called while another thread is inside process_file.
  */
-bool process_file(const char *filename, error_context_t *context);
+void clear_include_cache(void);
 
 #endif /* PRE_ASSEMBLER_H */
\ No newline at end of file
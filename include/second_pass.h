@@ -11,6 +11,7 @@
 #include "first_pass.h"
 #include "error.h"
 #include "machine_word.h"
+#include "external_table.h"
 
 /**
  * @brief Instruction code structure
@@ -20,15 +21,6 @@ typedef struct {
     int word_count;
 } instruction_code_t;
 
-/**
- * @brief External reference structure
- */
-typedef struct external_reference {
-    char name[MAX_LABEL_LENGTH];
-    int address;
-    struct external_reference *next;
-} external_reference_t;
-
 /**
  * @brief Determine the addressing method for an operand
  * @param operand The operand string
@@ -51,7 +43,7 @@ addressing_method_t get_addressing_method(const char *operand);
 bool encode_operand_word(machine_word_t *word, const char *operand,
                          addressing_method_t addr_method,
                          symbol_table_t *symbols, int current_address,
-                         int word_offset, external_reference_t **ext_refs,
+                         int word_offset, external_table_t *ext_refs,
                          error_context_t *context);
 
 /**
@@ -66,7 +58,7 @@ bool encode_operand_word(machine_word_t *word, const char *operand,
  */
 bool encode_instruction(parsed_line_t *line, symbol_table_t *symbols,
                        instruction_code_t *code, int current_address,
-                       external_reference_t **ext_refs, error_context_t *context);
+                       external_table_t *ext_refs, error_context_t *context);
 
 /**
  * @brief Process an entry directive
@@ -77,37 +69,23 @@ bool encode_instruction(parsed_line_t *line, symbol_table_t *symbols,
  */
 bool process_entry_second_pass(parsed_line_t *line, symbol_table_t *symbols, error_context_t *context);
 
-/**
- * @brief Add an external reference
- * @param ext_refs Pointer to the list of external references
- * @param name The name of the external symbol
- * @param address The address where it's referenced
- * @param context Error context for reporting issues
- * @return true if the reference was added successfully, false otherwise
- */
-bool add_external_reference(external_reference_t **ext_refs, const char *name, int address, error_context_t *context);
-
-/**
- * @brief Free the list of external references
- * @param ext_refs The list of external references
- */
-void free_external_references(external_reference_t *ext_refs);
-
 /**
  * @brief Main function for the second pass
- * @param filename The name of the source file
+ * @param filename The name of the source file (NULL for a source assembled from memory)
+ * @param source The expanded source produced by the pre-assembler
  * @param symbols The symbol table
- * @param code_image Output parameter for the code image
- * @param data_image Output parameter for the data image
- * @param ext_refs Output parameter for external references
+ * @param code_image Output parameter for the code image, grown to fit (a buffer left by an earlier call is reused);
+ *                   NULL resolves the operands and reports errors without building either image
+ * @param data_image Output parameter for the data image (a buffer left by an earlier call is reused)
+ * @param ext_refs Output parameter for the external references (a table initialized by the caller)
  * @param ICF Output parameter for the final instruction counter
  * @param DCF Output parameter for the final data counter
  * @param context Error context for reporting issues
  * @return true if the second pass was successful, false otherwise
  */
-bool second_pass(const char *filename, symbol_table_t *symbols,
+bool second_pass(const char *filename, struct expanded_source *source, symbol_table_t *symbols,
                 machine_word_t **code_image, machine_word_t **data_image,
-                external_reference_t **ext_refs, int *ICF, int *DCF,
+                external_table_t *ext_refs, int *ICF, int *DCF,
                 error_context_t *context);
 
 #endif /* SECOND_PASS_H */
\ No newline at end of file
@@ -0,0 +1,39 @@
+/**
+ * @file simulator.h
+ * @brief Instruction-set simulator for assembled binary objects
+ */
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "assembler.h"
+
+#define SIM_REGISTER_COUNT 8      /* r0-r7 */
+#define SIM_STACK_DEPTH 1024      /* Maximum nesting of jsr calls */
+
+/**
+ * @brief Simulator settings
+ */
+typedef struct {
+    unsigned long max_steps;      /* Stop after this many instructions (0 = no limit) */
+    bool profile;                 /* Count hits and estimate cycles per instruction */
+} sim_options_t;
+
+/**
+ * @brief Load a binary object and run it from its first code word
+ * @param path The .tpo file (a module without external references, or a linked image)
+ * @param options The simulator settings
+ * @return true if the program reached stop, false on a load error, fault or step limit
+ *
+ * Every code address is predecoded once into a micro-op whose operands are
+ * resolved to the register, memory cell or constant they name, so execution
+ * never looks at addressing modes again. Registers and memory cells hold
+ * 21-bit two's complement values. cmp sets the zero flag from
+ * (source - destination) and bne branches while it is clear; prn prints the
+ * operand in decimal on its own line and red reads a decimal integer (0 when
+ * none can be read). Writes to code addresses update memory but not the
+ * predecoded instructions.
+ */
+bool simulate_object(const char *path, const sim_options_t *options);
+
+#endif /* SIMULATOR_H */
@@ -34,6 +34,7 @@ typedef struct symbol {
  */
 typedef struct symbol_table {
     symbol_t *head;               /* Pointer to the first symbol in the list */
+    symbol_t *spare;              /* Entries kept by reset_symbol_table for reuse */
 } symbol_table_t;
 
 /**
@@ -107,6 +108,12 @@ void update_data_symbols(symbol_table_t *table, int offset);
  */
 void print_symbol_table(symbol_table_t *table);
 
+/**
+ * @brief Empty the table, keeping its entries for the symbols added next
+ * @param table The symbol table
+ */
+void reset_symbol_table(symbol_table_t *table);
+
 /**
  * @brief Free the symbol table and all its entries
  * @param table The symbol table to free
@@ -37,6 +37,44 @@ bool is_register(const char *str);
  */
 int get_register_number(const char *reg_str);
 
+#define WORD_NUMBER_MIN (-1048576L)   /* Smallest 21-bit two's complement value */
+#define WORD_NUMBER_MAX 1048575L      /* Largest 21-bit two's complement value */
+
+/**
+ * @brief Result of parsing a number for a machine word
+ */
+typedef enum {
+    NUMBER_OK,              /* A decimal integer within the 21-bit range */
+    NUMBER_INVALID,         /* Not an optionally signed decimal integer */
+    NUMBER_OUT_OF_RANGE     /* A decimal integer outside the 21-bit range */
+} number_status_t;
+
+/**
+ * @brief Parse one optionally signed decimal integer for a 21-bit machine word
+ * @param str Start of the text
+ * @param end End of the text (the number also stops at a comma)
+ * @param next Output parameter set to the comma or end that stopped the scan
+ * @param value Output parameter for the value (set only for NUMBER_OK)
+ * @return NUMBER_OK, NUMBER_INVALID or NUMBER_OUT_OF_RANGE
+ *
+ * Whitespace may surround the number. Sign, digits and range are checked in
+ * a single scan that converts eight digits at a time when eight bytes remain.
+ */
+number_status_t parse_word_number(const char *str, const char *end, const char **next, int *value);
+
+/**
+ * @brief Parse one item of a comma-separated .data list
+ * @param item Start of the item
+ * @param end End of the list
+ * @param next Output parameter set to the comma or end after the item
+ * @param value Output parameter for the value (set only on success)
+ * @param context Error context for reporting an empty, malformed or out-of-range item (can be NULL)
+ * @return true if the item is a number for a 21-bit word, false otherwise
+ *
+ * Every pass and the optimizer read .data lists through this, so they agree on their length.
+ */
+bool parse_data_item(const char *item, const char *end, const char **next, int *value, error_context_t *context);
+
 /**
  * @brief Check if a string is a valid integer
  * @param str The string to check
@@ -58,6 +96,13 @@ int string_to_int(const char *str);
  */
 char* str_duplicate(const char *str);
 
+/**
+ * @brief Hash a string (djb2) for hash table lookups
+ * @param str The string to hash
+ * @return The hash value
+ */
+unsigned long hash_string(const char *str);
+
 /**
  * @brief Check if a string is a reserved word (instruction or directive)
  * @param str The string to check
@@ -0,0 +1,37 @@
+/**
+ * @file watch.h
+ * @brief Re-assembling the sources of a directory as they change
+ *
+ * Watch mode assembles every .as file of a directory once, then waits for
+ * inotify events and assembles a file again when it is written or renamed
+ * into place. Events arriving within WATCH_DEBOUNCE_MS of each other are
+ * handled as one burst, so an editor's write-and-rename or a checkout
+ * touching many files assembles each file once. A file whose contents hash
+ * to what was last assembled is skipped.
+ *
+ * One assembler context serves the whole session, so its tables and buffers
+ * keep their size, and the headers cached by .include stay parsed until
+ * they change on disk. Each module keeps the headers and .incbin files its
+ * last assembly read. Their directories are watched as well, so a change to
+ * one of them assembles the modules reading it again, and their contents are
+ * hashed with the module's.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "assembler.h"
+#include "assembler_context.h"
+
+#define WATCH_DEBOUNCE_MS 50          /* Quiet time that ends a burst of events */
+
+/**
+ * @brief Assemble the sources of a directory and again whenever they change
+ * @param directory The directory watched
+ * @param ctx The context every file is assembled with
+ * @param options The command-line options
+ * @return true if the watch ran until the directory was removed or moved, false if it could not be started
+ */
+bool watch_directory(const char *directory, assembler_context_t *ctx, const assembler_options_t *options);
+
+#endif /* WATCH_H */
@@ -0,0 +1,593 @@
+/**
+ * @file archive.c
+ * @brief Implementation of the output archive (.tpa)
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/archive.h"
+#include "../include/utils.h"
+
+#define ARCHIVE_MODULE_BYTES 72       /* Size of an index record in the file */
+
+/* Extensions of the members, in archive_member_t order */
+static const char *const member_extensions[ARCHIVE_MEMBER_COUNT] = {
+    EXT_MACRO, EXT_OBJECT, EXT_ENTRY, EXT_EXTERN
+};
+
+/**
+ * @brief Module record being ordered for the index
+ */
+typedef struct {
+    const char *name;             /* Module name in the writer's name pool */
+    int index;                    /* Position in the order the modules were added */
+} index_key_t;
+
+/* Forward declarations for internal functions */
+static bool start_module(archive_writer_t *archive, const char *module, error_context_t *context);
+static bool index_module_name(archive_writer_t *archive, int index);
+static bool write_index(archive_writer_t *archive, error_context_t *context);
+static int compare_index_keys(const void *a, const void *b);
+static bool write_member_file(const char *path, const char *data, size_t size, error_context_t *context);
+static bool create_parent_directories(char *path);
+static bool is_safe_module_name(const char *name);
+static void put_u16(unsigned char *p, uint16_t value);
+static void put_u32(unsigned char *p, uint32_t value);
+static void put_u64(unsigned char *p, uint64_t value);
+
+/* Create an archive file and write its placeholder header */
+bool open_archive_writer(archive_writer_t *archive, const char *path, error_context_t *context) {
+    unsigned char header[sizeof(archive_header_t)];
+
+    memset(archive, 0, sizeof(archive_writer_t));
+    strncpy(archive->path, path, MAX_FILENAME_LENGTH - 1);
+    archive->path[MAX_FILENAME_LENGTH - 1] = '\0';
+
+    archive->file = fopen(path, "wb");
+    if (!archive->file) {
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    /* Filled in by close_archive_writer once the index is known */
+    memset(header, 0, sizeof(header));
+    if (fwrite(header, 1, sizeof(header), archive->file) != sizeof(header)) {
+        report_context_error(context, "Could not write file: %s", path);
+        fclose(archive->file);
+        archive->file = NULL;
+        return false;
+    }
+    archive->offset = sizeof(header);
+
+    return true;
+}
+
+/* Append one output of a module to the archive */
+bool add_archive_member(archive_writer_t *archive, const char *module, archive_member_t member,
+                        const char *data, size_t size, error_context_t *context) {
+    archive_module_t *record;
+
+    if (!archive->file) {
+        return false;
+    }
+
+    /* A module starts with its .am; the other outputs belong to the module added last */
+    if (member == ARCHIVE_MEMBER_SOURCE || archive->module_count == 0 ||
+        strcmp(archive->names + archive->modules[archive->module_count - 1].name_offset, module) != 0) {
+        if (!start_module(archive, module, context)) {
+            return false;
+        }
+    }
+
+    if (size > 0 && fwrite(data, 1, size, archive->file) != size) {
+        report_context_error(context, "Could not write file: %s", archive->path);
+        return false;
+    }
+
+    record = &archive->modules[archive->module_count - 1];
+    record->members |= 1u << member;
+    record->extents[member].offset = archive->offset;
+    record->extents[member].size = size;
+    archive->offset += size;
+
+    return true;
+}
+
+/* Write the index and the header, then close the archive */
+bool close_archive_writer(archive_writer_t *archive, error_context_t *context) {
+    bool success = false;
+
+    if (archive->file) {
+        success = write_index(archive, context);
+        if (fclose(archive->file) != 0 && success) {
+            report_context_error(context, "Could not write file: %s", archive->path);
+            success = false;
+        }
+    }
+
+    free(archive->modules);
+    free(archive->names);
+    free(archive->slots);
+    memset(archive, 0, sizeof(archive_writer_t));
+
+    return success;
+}
+
+/* Map an archive file and validate its header and index */
+bool open_archive(const char *path, archive_t *archive, error_context_t *context) {
+    const archive_header_t *header;
+    const archive_extent_t *extent;
+    struct stat st;
+    void *mapping;
+    size_t size;
+    uint32_t i;
+    int member;
+    int fd;
+
+    memset(archive, 0, sizeof(archive_t));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(archive_header_t)) {
+        close(fd);
+        report_context_error(context, "Not an archive file: %s", path);
+        return false;
+    }
+
+    size = (size_t)st.st_size;
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        report_context_error(context, "Could not map file: %s", path);
+        return false;
+    }
+
+    archive->mapping = mapping;
+    archive->mapping_size = size;
+    archive->base = (const unsigned char *)mapping;
+    header = (const archive_header_t *)mapping;
+
+    if (memcmp(header->magic, ARCHIVE_MAGIC, 4) != 0) {
+        report_context_error(context, "Not an archive file: %s", path);
+        close_archive(archive);
+        return false;
+    }
+
+    /* A byte-swapped header_size means the file was read on a big-endian host */
+    if (header->header_size != sizeof(archive_header_t) || header->version != ARCHIVE_VERSION) {
+        report_context_error(context, "Unsupported archive version or byte order: %s", path);
+        close_archive(archive);
+        return false;
+    }
+
+    if (header->file_size > size || header->index_offset % ARCHIVE_INDEX_ALIGN != 0 ||
+        header->index_offset > size ||
+        header->module_count > (size - header->index_offset) / sizeof(archive_module_t) ||
+        header->names_offset > size || header->names_size > size - header->names_offset ||
+        (header->names_size > 0 && archive->base[header->names_offset + header->names_size - 1] != '\0')) {
+        report_context_error(context, "Archive index is truncated or damaged: %s", path);
+        close_archive(archive);
+        return false;
+    }
+
+    archive->header = header;
+    archive->modules = (const archive_module_t *)(archive->base + header->index_offset);
+    archive->names = (const char *)(archive->base + header->names_offset);
+
+    /* Every name and payload must lie inside the file */
+    for (i = 0; i < header->module_count; i++) {
+        if (archive->modules[i].name_offset >= header->names_size) {
+            report_context_error(context, "Archive module name out of range: %s", path);
+            close_archive(archive);
+            return false;
+        }
+        for (member = 0; member < ARCHIVE_MEMBER_COUNT; member++) {
+            extent = &archive->modules[i].extents[member];
+            if ((archive->modules[i].members & (1u << member)) &&
+                (extent->offset > size || extent->size > size - extent->offset)) {
+                report_context_error(context, "Archive payload out of range: %s", path);
+                close_archive(archive);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Release an archive view */
+void close_archive(archive_t *archive) {
+    if (archive->mapping) {
+        munmap(archive->mapping, archive->mapping_size);
+    }
+    memset(archive, 0, sizeof(archive_t));
+}
+
+/* Find a module by name with a binary search of the sorted index */
+const archive_module_t *find_archive_module(const archive_t *archive, const char *name) {
+    int low = 0, high = (int)archive->header->module_count - 1, middle, order;
+
+    while (low <= high) {
+        middle = low + (high - low) / 2;
+        order = strcmp(name, archive->names + archive->modules[middle].name_offset);
+        if (order == 0) {
+            return &archive->modules[middle];
+        }
+        if (order < 0) {
+            high = middle - 1;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/* Get the name of a module */
+const char *archive_module_name(const archive_t *archive, const archive_module_t *module) {
+    return archive->names + module->name_offset;
+}
+
+/* Get one output of a module */
+const char *archive_member_data(const archive_t *archive, const archive_module_t *module,
+                                archive_member_t member, size_t *size) {
+    if (!(module->members & (1u << member))) {
+        *size = 0;
+        return NULL;
+    }
+
+    *size = (size_t)module->extents[member].size;
+    return (const char *)(archive->base + module->extents[member].offset);
+}
+
+/* Get the file extension of an output */
+const char *archive_member_extension(archive_member_t member) {
+    return member_extensions[member];
+}
+
+/* Write the outputs of a module back out as files */
+bool extract_archive_module(const archive_t *archive, const archive_module_t *module,
+                            const char *directory, error_context_t *context) {
+    char path[2 * MAX_FILENAME_LENGTH + 8];
+    const char *name = archive_module_name(archive, module);
+    const char *data;
+    size_t size;
+    int member;
+    bool success = true;
+
+    if (strlen(name) + (directory ? strlen(directory) + 1 : 0) + 8 > sizeof(path)) {
+        report_context_error(context, "Module name too long: %s", name);
+        return false;
+    }
+
+    /* Every file lands under the target directory, whatever the archive says */
+    if (!is_safe_module_name(name)) {
+        report_context_error(context, "Unsafe module name in archive: %s", name);
+        return false;
+    }
+
+    for (member = 0; member < ARCHIVE_MEMBER_COUNT; member++) {
+        data = archive_member_data(archive, module, (archive_member_t)member, &size);
+        if (!data) {
+            continue;
+        }
+
+        if (directory) {
+            sprintf(path, "%s/%s%s", directory, name, member_extensions[member]);
+        } else {
+            sprintf(path, "%s%s", name, member_extensions[member]);
+        }
+
+        if (!create_parent_directories(path)) {
+            report_context_error(context, "Could not create the directory of %s", path);
+            success = false;
+        } else if (!write_member_file(path, data, size, context)) {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+/* Get the name a source file is stored under in an archive */
+void make_archive_module_name(const char *filename, char *module) {
+    const char *component = filename, *extension;
+    size_t length, used = 0;
+
+    /* Like tar, drop a leading '/' and the ".." components that would climb above it, so the name stays
+     * relative; "." components go, and ".." takes back the component before it */
+    while (*component) {
+        length = strcspn(component, "/");
+
+        if (length == 2 && component[0] == '.' && component[1] == '.') {
+            while (used > 0 && module[used - 1] != '/') {
+                used--;
+            }
+            if (used > 0) {
+                used--;
+            }
+        } else if (length > 0 && !(length == 1 && component[0] == '.')) {
+            if (used > 0) {
+                module[used++] = '/';
+            }
+            memcpy(module + used, component, length);
+            used += length;
+        }
+
+        component += length;
+        if (*component == '/') {
+            component++;
+        }
+    }
+    module[used] = '\0';
+
+    /* The source extension is not part of the name */
+    extension = strrchr(module, '.');
+    if (extension && extension > module && !strchr(extension, '/') && extension[-1] != '/') {
+        module[extension - module] = '\0';
+    }
+}
+
+/* Helper function to add an empty record for the next module */
+static bool start_module(archive_writer_t *archive, const char *module, error_context_t *context) {
+    archive_module_t *modules;
+    char *names;
+    size_t length = strlen(module) + 1;
+    size_t index;
+    int capacity;
+
+    /* Two sources with one name would share the index record, and one's outputs would be lost */
+    if (archive->slot_count > 0) {
+        index = hash_string(module) & (archive->slot_count - 1);
+        while (archive->slots[index] != 0) {
+            if (strcmp(archive->names + archive->modules[archive->slots[index] - 1].name_offset, module) == 0) {
+                report_context_error(context, "Module %s is already in the archive", module);
+                return false;
+            }
+            index = (index + 1) & (archive->slot_count - 1);
+        }
+    }
+
+    if (archive->module_count == archive->module_capacity) {
+        capacity = archive->module_capacity ? archive->module_capacity * 2 : 64;
+        modules = (archive_module_t *)realloc(archive->modules, capacity * sizeof(archive_module_t));
+        if (!modules) {
+            report_context_error(context, "Memory allocation error for archive index");
+            return false;
+        }
+        archive->modules = modules;
+        archive->module_capacity = capacity;
+    }
+
+    if (archive->names_size + length > archive->names_capacity) {
+        capacity = archive->names_capacity ? (int)archive->names_capacity * 2 : 4096;
+        while ((size_t)capacity < archive->names_size + length) {
+            capacity *= 2;
+        }
+        names = (char *)realloc(archive->names, (size_t)capacity);
+        if (!names) {
+            report_context_error(context, "Memory allocation error for archive index");
+            return false;
+        }
+        archive->names = names;
+        archive->names_capacity = (size_t)capacity;
+    }
+
+    memset(&archive->modules[archive->module_count], 0, sizeof(archive_module_t));
+    archive->modules[archive->module_count].name_offset = (uint32_t)archive->names_size;
+    memcpy(archive->names + archive->names_size, module, length);
+    archive->names_size += length;
+    archive->module_count++;
+
+    if (!index_module_name(archive, archive->module_count - 1)) {
+        report_context_error(context, "Memory allocation error for archive index");
+        return false;
+    }
+
+    return true;
+}
+
+/* Helper function to add a module's name to the hash, doubling the slots to keep it at most half full */
+static bool index_module_name(archive_writer_t *archive, int index) {
+    size_t slot_count, slot;
+    int *slots;
+    int i, first = index;
+
+    if ((size_t)(index + 1) * 2 > archive->slot_count) {
+        slot_count = archive->slot_count ? archive->slot_count * 2 : 64;
+        slots = (int *)calloc(slot_count, sizeof(int));
+        if (!slots) {
+            return false;
+        }
+        free(archive->slots);
+        archive->slots = slots;
+        archive->slot_count = slot_count;
+        first = 0;
+    }
+
+    for (i = first; i <= index; i++) {
+        slot = hash_string(archive->names + archive->modules[i].name_offset) & (archive->slot_count - 1);
+        while (archive->slots[slot] != 0) {
+            slot = (slot + 1) & (archive->slot_count - 1);
+        }
+        archive->slots[slot] = i + 1;
+    }
+
+    return true;
+}
+
+/* Helper function to write the sorted index and the name pool after the payloads, then the header */
+static bool write_index(archive_writer_t *archive, error_context_t *context) {
+    index_key_t *keys;
+    unsigned char *buffer, *p;
+    unsigned char header[sizeof(archive_header_t)];
+    const archive_module_t *record;
+    uint64_t index_offset;
+    size_t padding, size;
+    int i, kept = 0, member;
+    bool success;
+
+    keys = (index_key_t *)malloc((archive->module_count + 1) * sizeof(index_key_t));
+    padding = (size_t)((ARCHIVE_INDEX_ALIGN - archive->offset % ARCHIVE_INDEX_ALIGN) % ARCHIVE_INDEX_ALIGN);
+    size = padding + (size_t)archive->module_count * ARCHIVE_MODULE_BYTES + archive->names_size;
+    buffer = (unsigned char *)calloc(size + 1, 1);
+    if (!keys || !buffer) {
+        free(keys);
+        free(buffer);
+        report_context_error(context, "Memory allocation error for archive index");
+        return false;
+    }
+
+    for (i = 0; i < archive->module_count; i++) {
+        keys[i].name = archive->names + archive->modules[i].name_offset;
+        keys[i].index = i;
+    }
+    qsort(keys, archive->module_count, sizeof(index_key_t), compare_index_keys);
+
+    /* One record per name; a module assembled twice keeps its last outputs */
+    p = buffer + padding;
+    for (i = 0; i < archive->module_count; i++) {
+        if (i + 1 < archive->module_count && strcmp(keys[i].name, keys[i + 1].name) == 0) {
+            continue;
+        }
+        record = &archive->modules[keys[i].index];
+        put_u32(p, record->name_offset);
+        put_u32(p + 4, record->members);
+        for (member = 0; member < ARCHIVE_MEMBER_COUNT; member++) {
+            put_u64(p + 8 + 16 * member, record->extents[member].offset);
+            put_u64(p + 16 + 16 * member, record->extents[member].size);
+        }
+        p += ARCHIVE_MODULE_BYTES;
+        kept++;
+    }
+    if (archive->names_size > 0) {
+        memcpy(p, archive->names, archive->names_size);
+    }
+    p += archive->names_size;
+    free(keys);
+
+    index_offset = archive->offset + padding;
+    success = fwrite(buffer, 1, (size_t)(p - buffer), archive->file) == (size_t)(p - buffer);
+    free(buffer);
+
+    /* The header goes in the space left at the start */
+    memset(header, 0, sizeof(header));
+    memcpy(header, ARCHIVE_MAGIC, 4);
+    put_u16(header + 4, ARCHIVE_VERSION);
+    put_u16(header + 6, sizeof(archive_header_t));
+    put_u32(header + 8, (uint32_t)kept);
+    put_u32(header + 12, (uint32_t)archive->names_size);
+    put_u64(header + 16, index_offset);
+    put_u64(header + 24, index_offset + (uint64_t)kept * ARCHIVE_MODULE_BYTES);
+    put_u64(header + 32, index_offset + (uint64_t)kept * ARCHIVE_MODULE_BYTES + archive->names_size);
+
+    success = success && fseek(archive->file, 0L, SEEK_SET) == 0 &&
+              fwrite(header, 1, sizeof(header), archive->file) == sizeof(header);
+    if (!success) {
+        report_context_error(context, "Could not write file: %s", archive->path);
+    }
+
+    return success;
+}
+
+/* Helper function to order index keys by name, then by the order the modules were added */
+static int compare_index_keys(const void *a, const void *b) {
+    const index_key_t *key_a = (const index_key_t *)a;
+    const index_key_t *key_b = (const index_key_t *)b;
+    int order = strcmp(key_a->name, key_b->name);
+
+    return order != 0 ? order : key_a->index - key_b->index;
+}
+
+/* Helper function to write one extracted output */
+static bool write_member_file(const char *path, const char *data, size_t size, error_context_t *context) {
+    FILE *file;
+    bool success;
+
+    file = fopen(path, "wb");
+    if (!file) {
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    success = fwrite(data, 1, size, file) == size;
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    if (!success) {
+        report_context_error(context, "Could not write file: %s", path);
+    }
+
+    return success;
+}
+
+/* Helper function to create every missing directory on the way to a file */
+static bool create_parent_directories(char *path) {
+    char *slash;
+
+    for (slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+            *slash = '/';
+            return false;
+        }
+        *slash = '/';
+    }
+
+    return true;
+}
+
+/* Helper function to check that a module name is a relative path that does not climb out of its directory */
+static bool is_safe_module_name(const char *name) {
+    const char *component = name;
+    size_t length;
+
+    if (name[0] == '\0' || name[0] == '/') {
+        return false;
+    }
+
+    while (*component) {
+        length = strcspn(component, "/");
+        if (length == 2 && component[0] == '.' && component[1] == '.') {
+            return false;
+        }
+        component += length;
+        if (*component == '/') {
+            component++;
+        }
+    }
+
+    return true;
+}
+
+/* Helper function to store a little-endian 16-bit value */
+static void put_u16(unsigned char *p, uint16_t value) {
+    p[0] = (unsigned char)(value & 0xFF);
+    p[1] = (unsigned char)((value >> 8) & 0xFF);
+}
+
+/* Helper function to store a little-endian 32-bit value */
+static void put_u32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value & 0xFF);
+    p[1] = (unsigned char)((value >> 8) & 0xFF);
+    p[2] = (unsigned char)((value >> 16) & 0xFF);
+    p[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+/* Helper function to store a little-endian 64-bit value */
+static void put_u64(unsigned char *p, uint64_t value) {
+    put_u32(p, (uint32_t)(value & 0xFFFFFFFFu));
+    put_u32(p + 4, (uint32_t)(value >> 32));
+}
@@ -0,0 +1,519 @@
+/**
+ * @file assembler_context.c
+ * @brief Implementation of the reusable per-file assembler state
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/assembler_context.h"
+#include "../include/first_pass.h"
+#include "../include/second_pass.h"
+#include "../include/optimizer.h"
+#include "../include/output.h"
+#include "../include/binary_object.h"
+#include "../include/archive.h"
+#include "../include/pipeline.h"
+#include "../include/utils.h"
+
+#define READ_STREAM_CHUNK 65536       /* First buffer size for a source read from a stream */
+
+/* Forward declarations for internal functions */
+static bool assemble_source(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                            const assembler_options_t *options);
+static bool store_deferred_outputs(assembler_context_t *ctx, const char *filename,
+                                   const assembler_options_t *options, bool assembled, int ICF, int DCF);
+static bool archive_module(assembler_context_t *ctx, const char *filename, archive_writer_t *archive,
+                           bool assembled, int ICF, int DCF);
+static bool assemble_next_queued(assembler_queue_t *queue);
+static char *read_source_file(const char *filename, size_t *length, error_context_t *context);
+static bool stream_source(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                          const assembler_options_t *options);
+static char *read_stream(FILE *stream, size_t *length, error_context_t *context);
+static bool run_passes(assembler_context_t *ctx, const char *filename, const assembler_options_t *options,
+                       const pipelined_pass_t *pass, int *ICF, int *DCF);
+static bool expand_file(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                        const assembler_options_t *options, bool write_output, pipelined_pass_t *pass);
+
+/* Initialize a context with empty tables */
+bool init_assembler_context(assembler_context_t *ctx) {
+    memset(ctx, 0, sizeof(assembler_context_t));
+    init_expanded_source(&ctx->source);
+    init_external_table(&ctx->ext_refs);
+
+    ctx->macros = create_macro_table();
+    ctx->symbols = create_symbol_table();
+    if (!ctx->macros || !ctx->symbols) {
+        free_assembler_context(ctx);
+        return false;
+    }
+
+    return true;
+}
+
+/* Release everything a context holds */
+void free_assembler_context(assembler_context_t *ctx) {
+    free_macro_table(ctx->macros);
+    free_expanded_source(&ctx->source);
+    free_symbol_table(ctx->symbols);
+    free_external_table(&ctx->ext_refs);
+    free(ctx->code_image);
+    free(ctx->data_image);
+    ctx->macros = NULL;
+    ctx->symbols = NULL;
+    ctx->code_image = NULL;
+    ctx->data_image = NULL;
+}
+
+/* Assemble one source file and write its output files */
+bool assemble_file(assembler_context_t *ctx, const char *filename, const assembler_options_t *options) {
+    return assemble_source(ctx, filename, NULL, 0, options);
+}
+
+/* Assemble one source file from contents already in memory */
+bool assemble_loaded_file(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                          const assembler_options_t *options) {
+    return assemble_source(ctx, filename, text, length, options);
+}
+
+/* Start a queue of files to assemble */
+bool init_assembler_queue(assembler_queue_t *queue, assembler_context_t *ctx, const assembler_options_t *options,
+                          int window) {
+    memset(queue, 0, sizeof(assembler_queue_t));
+    queue->ctx = ctx;
+    queue->options = options;
+    queue->success = true;
+
+    /* Without an I/O engine nothing is read ahead */
+    queue->window = options->io ? window : 0;
+    if (queue->window > ASYNC_IO_MAX_REQUESTS / 2) {
+        queue->window = ASYNC_IO_MAX_REQUESTS / 2;
+    }
+    if (queue->window <= 0) {
+        queue->window = 0;
+        return true;
+    }
+
+    queue->names = (char (*)[MAX_FILENAME_LENGTH])malloc(queue->window * sizeof(*queue->names));
+    queue->reads = (int *)malloc(queue->window * sizeof(int));
+    if (!queue->names || !queue->reads) {
+        free(queue->names);
+        free(queue->reads);
+        return false;
+    }
+
+    return true;
+}
+
+/* Add a file to the queue */
+void queue_file(assembler_queue_t *queue, const char *filename) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char source_filename[MAX_FILENAME_LENGTH];
+    int slot;
+
+    /* Standard input ("-") is read when its turn comes */
+    if (queue->window == 0 || strcmp(filename, "-") == 0 ||
+        strlen(filename) + strlen(EXT_SOURCE) >= MAX_FILENAME_LENGTH) {
+        if (!assemble_file(queue->ctx, filename, queue->options)) {
+            queue->success = false;
+        }
+        return;
+    }
+
+    /* The oldest file is assembled once the window is full */
+    if (queue->count == queue->window && !assemble_next_queued(queue)) {
+        queue->success = false;
+    }
+
+    slot = (queue->first + queue->count) % queue->window;
+    strcpy(queue->names[slot], filename);
+    get_base_filename(filename, base_filename);
+    create_filename(base_filename, EXT_SOURCE, source_filename);
+    queue->reads[slot] = async_read_file(queue->options->io, source_filename);
+    queue->count++;
+}
+
+/* Assemble every file left in the queue and wait for the outputs */
+bool finish_assembler_queue(assembler_queue_t *queue) {
+    while (queue->count > 0) {
+        if (!assemble_next_queued(queue)) {
+            queue->success = false;
+        }
+    }
+
+    if (queue->options->io && !drain_async_io(queue->options->io)) {
+        queue->success = false;
+    }
+
+    free(queue->names);
+    free(queue->reads);
+    queue->names = NULL;
+    queue->reads = NULL;
+
+    return queue->success;
+}
+
+/* Run the passes over the expanded source held by the context */
+bool assemble_expanded_source(assembler_context_t *ctx, const char *filename, const assembler_options_t *options,
+                              int *ICF, int *DCF) {
+    return run_passes(ctx, filename, options, NULL, ICF, DCF);
+}
+
+/* Helper function to run the pre-assembler, with the first pass alongside it when pipelined */
+static bool expand_file(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                        const assembler_options_t *options, bool write_output, pipelined_pass_t *pass) {
+    if (options->pipeline) {
+        return pipeline_first_pass(filename, text, length, options->macro_library, ctx->macros, &ctx->source,
+                                   write_output, ctx->symbols, pass, &ctx->error);
+    }
+    if (text) {
+        return process_loaded_file(filename, text, length, options->macro_library, ctx->macros, &ctx->source,
+                                   write_output, &ctx->error);
+    }
+    return process_file(filename, options->macro_library, ctx->macros, &ctx->source, write_output, &ctx->error);
+}
+
+/* Helper function to run the passes over the expanded source, taking the result of a first pass
+ * already run alongside the pre-assembler when pass is not NULL */
+static bool run_passes(assembler_context_t *ctx, const char *filename, const assembler_options_t *options,
+                       const pipelined_pass_t *pass, int *ICF, int *DCF) {
+    optimization_result_t optimized;
+    const char *progress = options->stream ? NULL : filename; /* The framed stream owns standard output */
+    bool first_pass_done;
+
+    /* Step 2: Empty the symbol table and perform first pass; a pipelined one reports its messages now,
+     * after those of the pre-assembler */
+    if (pass) {
+        replay_diagnostics(&ctx->error, &pass->diagnostics);
+        ctx->error.line_number = ctx->source.line_count;
+        first_pass_done = pass->success;
+    } else {
+        reset_symbol_table(ctx->symbols);
+        first_pass_done = first_pass(filename, &ctx->source, ctx->symbols, &ctx->error);
+    }
+    if (!first_pass_done) {
+        if (filename) {
+            fprintf(stderr, "Error in first pass phase for %s\n", filename);
+        }
+        return false;
+    }
+
+    if (progress) {
+        printf("First pass phase successful for %s\n", filename);
+    }
+
+    /* Optional optimization passes; a rewritten program gets fresh label addresses */
+    if (!optimize_program(progress, &ctx->source, ctx->symbols, options, &optimized, &ctx->error)) {
+        if (filename) {
+            fprintf(stderr, "Error in optimization phase for %s\n", filename);
+        }
+        return false;
+    }
+
+    if (optimized.changed) {
+        reset_symbol_table(ctx->symbols);
+        if (!first_pass(filename, &ctx->source, ctx->symbols, &ctx->error) ||
+            !apply_data_aliases(ctx->symbols, &optimized, &ctx->error)) {
+            if (filename) {
+                fprintf(stderr, "Error in first pass phase for %s\n", filename);
+            }
+            free_optimization_result(&optimized);
+            return false;
+        }
+    }
+    free_optimization_result(&optimized);
+
+    /* Step 3: Perform second pass - encode instructions */
+    if (!second_pass(filename, &ctx->source, ctx->symbols, options->check ? NULL : &ctx->code_image,
+                     &ctx->data_image, &ctx->ext_refs, ICF, DCF, &ctx->error)) {
+        if (filename) {
+            fprintf(stderr, "Error in second pass phase for %s\n", filename);
+        }
+        return false;
+    }
+
+    if (progress) {
+        printf("Second pass phase successful for %s\n", filename);
+    }
+
+    return true;
+}
+
+/* Helper function to add a module's outputs to the archive */
+static bool archive_module(assembler_context_t *ctx, const char *filename, archive_writer_t *archive,
+                           bool assembled, int ICF, int DCF) {
+    char module[MAX_FILENAME_LENGTH];
+    char *text;
+    size_t length;
+    bool success;
+
+    make_archive_module_name(filename, module);
+    ctx->error.line_number = 0;
+
+    text = format_expanded_source(&ctx->source, &length);
+    if (!text) {
+        report_context_error(&ctx->error, "Memory allocation error for expanded source");
+        return false;
+    }
+    success = add_archive_member(archive, module, ARCHIVE_MEMBER_SOURCE, text, length, &ctx->error);
+    free(text);
+
+    if (success && assembled) {
+        success = archive_output_files(archive, module, ctx->symbols, ctx->code_image, ctx->data_image,
+                                       &ctx->ext_refs, ICF, DCF, &ctx->error);
+    }
+
+    return success;
+}
+
+/* Helper function to assemble one file, from contents read ahead when text is not NULL */
+static bool assemble_source(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                            const assembler_options_t *options) {
+    bool deferred = !options->check && (options->archive || options->io);
+    bool write_expanded = !options->check && !deferred;
+    bool expanded, assembled, written;
+    pipelined_pass_t pass;
+    char *loaded = NULL;
+    int ICF = 0, DCF = 0;
+
+    /* With -o - the outputs are framed into the stream and nothing else is printed to it */
+    if (options->stream) {
+        return stream_source(ctx, filename, text, length, options);
+    }
+
+    /* Initialize error context */
+    init_error_context(&ctx->error, filename);
+
+    printf("Processing file: %s\n", filename);
+
+    /* A deferred .am is only stored for a source that could be read, as process_file only writes one then */
+    if (deferred && !text) {
+        text = loaded = read_source_file(filename, &length, &ctx->error);
+        if (!text) {
+            fprintf(stderr, "Error in pre-assembler phase for %s\n", filename);
+            return false;
+        }
+    }
+
+    /* Step 1: Pre-assembler (macro processor); a deferred .am is stored with the other outputs */
+    memset(&pass, 0, sizeof(pass));
+    expanded = expand_file(ctx, filename, text, length, options, write_expanded, &pass);
+    free(loaded);
+    if (!expanded) {
+        free_diagnostics(&pass.diagnostics);
+        fprintf(stderr, "Error in pre-assembler phase for %s\n", filename);
+        if (deferred) {
+            store_deferred_outputs(ctx, filename, options, false, 0, 0);
+        }
+        return false;
+    }
+
+    printf("Pre-assembler phase successful for %s\n", filename);
+
+    /* Steps 2 and 3: First pass, optimizations and second pass */
+    assembled = run_passes(ctx, filename, options, options->pipeline ? &pass : NULL, &ICF, &DCF);
+    free_diagnostics(&pass.diagnostics);
+    if (!assembled) {
+        if (deferred) {
+            store_deferred_outputs(ctx, filename, options, false, 0, 0);
+        }
+        return false;
+    }
+
+    /* Step 4: Generate output files, unless the file was only checked */
+    if (options->check) {
+        printf("Successfully checked %s\n", filename);
+        return true;
+    } else if (deferred) {
+        written = store_deferred_outputs(ctx, filename, options, true, ICF, DCF);
+    } else if (options->format == FORMAT_TEXT) {
+        written = generate_output_files(filename, ctx->symbols, ctx->code_image, ctx->data_image,
+                                        &ctx->ext_refs, ICF, DCF, &ctx->error);
+    } else {
+        written = write_binary_object_file(filename, ctx->symbols, ctx->code_image, ctx->data_image,
+                                           &ctx->ext_refs, ICF, DCF,
+                                           options->format == FORMAT_BINARY_PACKED ? BINARY_WORD_PACKED
+                                                                                   : BINARY_WORD_WIDE,
+                                           &ctx->error);
+    }
+
+    if (!written) {
+        fprintf(stderr, "Error in output generation phase for %s\n", filename);
+        return false;
+    }
+
+    printf("Successfully processed %s\n", filename);
+
+    return true;
+}
+
+/* Helper function to hand the outputs to the archive or the I/O engine: the .am always, like the
+ * file written by the pre-assembler, and the other outputs once the module assembled */
+static bool store_deferred_outputs(assembler_context_t *ctx, const char *filename,
+                                   const assembler_options_t *options, bool assembled, int ICF, int DCF) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char am_filename[MAX_FILENAME_LENGTH];
+    char *text;
+    size_t length;
+
+    if (options->archive) {
+        return archive_module(ctx, filename, options->archive, assembled, ICF, DCF);
+    }
+
+    get_base_filename(filename, base_filename);
+    create_filename(base_filename, EXT_MACRO, am_filename);
+    ctx->error.line_number = 0;
+
+    text = format_expanded_source(&ctx->source, &length);
+    if (!text) {
+        report_context_error(&ctx->error, "Memory allocation error for output file: %s", am_filename);
+        return false;
+    }
+    if (!async_write_file(options->io, am_filename, text, length, &ctx->error)) {
+        return false;
+    }
+
+    if (!assembled) {
+        return true;
+    }
+
+    /* Binary objects are still written in place */
+    if (options->format == FORMAT_TEXT) {
+        return queue_output_files(options->io, filename, ctx->symbols, ctx->code_image, ctx->data_image,
+                                  &ctx->ext_refs, ICF, DCF, &ctx->error);
+    }
+    return write_binary_object_file(filename, ctx->symbols, ctx->code_image, ctx->data_image, &ctx->ext_refs,
+                                    ICF, DCF,
+                                    options->format == FORMAT_BINARY_PACKED ? BINARY_WORD_PACKED : BINARY_WORD_WIDE,
+                                    &ctx->error);
+}
+
+/* Helper function to assemble the oldest queued file with the contents read ahead for it */
+static bool assemble_next_queued(assembler_queue_t *queue) {
+    const char *filename = queue->names[queue->first];
+    int read = queue->reads[queue->first];
+    char *text = NULL;
+    size_t length = 0;
+    bool success;
+
+    queue->first = (queue->first + 1) % queue->window;
+    queue->count--;
+
+    /* A source that could not be read ahead goes through the blocking path, which reports why */
+    if (read >= 0 && !wait_async_read(queue->options->io, read, &text, &length)) {
+        text = NULL;
+    }
+
+    success = assemble_source(queue->ctx, filename, text, length, queue->options);
+
+    free(text);
+    return success;
+}
+
+/* Helper function to read a whole source file with blocking calls, reporting failure like process_file */
+static char *read_source_file(const char *filename, size_t *length, error_context_t *context) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char source_filename[MAX_FILENAME_LENGTH];
+    FILE *file;
+    char *text = NULL;
+    long size;
+
+    get_base_filename(filename, base_filename);
+    create_filename(base_filename, EXT_SOURCE, source_filename);
+
+    file = fopen(source_filename, "rb");
+    if (!file) {
+        report_context_error(context, "Could not open source file: %s", source_filename);
+        return NULL;
+    }
+
+    if (fseek(file, 0L, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0L, SEEK_SET) == 0) {
+        text = (char *)malloc((size_t)size + 1);
+        if (text && fread(text, 1, (size_t)size, file) != (size_t)size) {
+            free(text);
+            text = NULL;
+        }
+        *length = (size_t)size;
+    }
+    fclose(file);
+
+    if (!text) {
+        report_context_error(context, "Could not read source file: %s", source_filename);
+    }
+    return text;
+}
+
+/* Helper function to assemble one file into the framed output stream, reading standard input for "-" */
+static bool stream_source(assembler_context_t *ctx, const char *filename, const char *text, size_t length,
+                          const assembler_options_t *options) {
+    bool from_stdin = strcmp(filename, "-") == 0;
+    const char *name = from_stdin ? STDIN_SOURCE_NAME : filename;
+    char module[MAX_FILENAME_LENGTH];
+    pipelined_pass_t pass;
+    char *loaded = NULL;
+    int ICF = 0, DCF = 0;
+    bool success;
+
+    init_error_context(&ctx->error, name);
+    get_base_filename(name, module);
+
+    if (!text) {
+        text = loaded = from_stdin ? read_stream(stdin, &length, &ctx->error)
+                                   : read_source_file(filename, &length, &ctx->error);
+    }
+
+    /* Nothing touches the filesystem: the .am stays in memory and the outputs go to the stream */
+    memset(&pass, 0, sizeof(pass));
+    if (!text || !expand_file(ctx, name, text, length, options, false, &pass)) {
+        fprintf(stderr, "Error in pre-assembler phase for %s\n", name);
+        success = false;
+    } else {
+        success = run_passes(ctx, name, options, options->pipeline ? &pass : NULL, &ICF, &DCF);
+    }
+    free_diagnostics(&pass.diagnostics);
+    free(loaded);
+
+    if (!success) {
+        write_stream_frame(options->stream, module, "error", "", 0, &ctx->error);
+    } else if (options->check) {
+        success = write_stream_frame(options->stream, module, "end", "", 0, &ctx->error);
+    } else {
+        ctx->error.line_number = 0;
+        success = stream_output_files(options->stream, module, ctx->symbols, ctx->code_image, ctx->data_image,
+                                      &ctx->ext_refs, ICF, DCF, &ctx->error);
+    }
+
+    /* The next stage of a pipe can start on the module as soon as it is complete */
+    fflush(options->stream);
+    return success;
+}
+
+/* Helper function to read a whole stream, such as standard input */
+static char *read_stream(FILE *stream, size_t *length, error_context_t *context) {
+    size_t capacity = READ_STREAM_CHUNK;
+    size_t count = 0;
+    char *text, *grown;
+
+    text = (char *)malloc(capacity);
+    while (text) {
+        count += fread(text + count, 1, capacity - count, stream);
+        if (count < capacity) {
+            break;
+        }
+        capacity *= 2;
+        grown = (char *)realloc(text, capacity);
+        if (!grown) {
+            free(text);
+        }
+        text = grown;
+    }
+
+    if (!text || ferror(stream)) {
+        free(text);
+        report_context_error(context, "Could not read source file: %s", STDIN_SOURCE_NAME);
+        return NULL;
+    }
+
+    *length = count;
+    return text;
+}
@@ -0,0 +1,743 @@
+/**
+ * @file async_io.c
+ * @brief Implementation of the asynchronous file I/O engine
+ */
+
+#define _DEFAULT_SOURCE /* syscall() and AT_FDCWD */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../include/async_io.h"
+
+/* The io_uring backend talks to the kernel directly; -DASYNC_IO_NO_URING leaves only the thread backend */
+#if defined(__linux__) && defined(__GNUC__) && !defined(ASYNC_IO_NO_URING)
+#define ASYNC_IO_HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#define READ_CHUNK 65536              /* First read buffer size when the file size is unknown */
+#define FILE_MODE 0666                /* Mode of created files, before the umask, as with fopen */
+
+/**
+ * @brief Life cycle of a request slot
+ */
+typedef enum {
+    REQUEST_FREE,                 /* Slot unused */
+    REQUEST_PENDING,              /* Queued or in progress */
+    REQUEST_DONE                  /* Finished; a read waits to be claimed */
+} request_state_t;
+
+/**
+ * @brief Operation a request has in flight
+ */
+typedef enum {
+    STEP_OPEN,
+    STEP_TRANSFER,                /* Read or write */
+    STEP_CLOSE
+} request_step_t;
+
+/**
+ * @brief One whole-file read or write
+ */
+typedef struct {
+    request_state_t state;
+    request_step_t step;
+    bool is_write;
+    char path[MAX_FILENAME_LENGTH];
+    char source[MAX_FILENAME_LENGTH]; /* File whose output a write is, for error messages */
+    int fd;
+    char *data;
+    size_t size;                  /* Bytes read so far, or bytes to write */
+    size_t capacity;              /* Bytes allocated for a read */
+    size_t done;                  /* Bytes written so far */
+    int error;                    /* errno of the first failure (0 = none) */
+    int next;                     /* Next job in the thread backend's queue (-1 = last) */
+} io_request_t;
+
+#ifdef ASYNC_IO_HAVE_URING
+/**
+ * @brief Shared rings of an io_uring instance
+ */
+typedef struct {
+    int fd;                       /* -1 when io_uring is not used */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *rings;                  /* Mapped submission and completion rings */
+    size_t rings_size;
+    size_t sqes_size;
+    unsigned to_submit;           /* Entries queued since the last io_uring_enter */
+} uring_t;
+#endif
+
+/**
+ * @brief State behind an async_io_t
+ */
+struct async_io {
+    async_io_backend_t backend;
+    io_request_t requests[ASYNC_IO_MAX_REQUESTS];
+    int writes;                   /* Writes not yet reaped */
+    bool write_failed;            /* A write failed since the last drain */
+#ifdef ASYNC_IO_HAVE_URING
+    uring_t uring;
+#endif
+    /* Thread backend */
+    pthread_t threads[ASYNC_IO_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;          /* A job was queued or the workers must stop */
+    pthread_cond_t finished;      /* A job finished */
+    int queue_head;               /* Jobs waiting for a worker (-1 = none) */
+    int queue_tail;
+    unsigned long completed;      /* Jobs finished so far */
+    unsigned long reaped;         /* Value of completed at the last reap */
+    bool stopping;
+};
+
+/* Forward declarations for internal functions */
+static int acquire_request(async_io_t *io);
+static void start_request(async_io_t *io, int index);
+static void reap_completions(async_io_t *io, bool wait);
+static request_state_t request_state(async_io_t *io, int index);
+static void finish_write(async_io_t *io, io_request_t *request);
+static bool start_threads(async_io_t *io);
+static void *worker_main(void *arg);
+static void perform_request(io_request_t *request);
+#ifdef ASYNC_IO_HAVE_URING
+static bool uring_init(uring_t *ring, unsigned entries);
+static void uring_free(uring_t *ring);
+static void uring_queue_step(async_io_t *io, int index);
+static void uring_complete(async_io_t *io, int index, int result);
+static void uring_reap(async_io_t *io, bool wait);
+#endif
+
+/* Create an I/O engine */
+async_io_t *create_async_io(async_io_backend_t backend) {
+    async_io_t *io;
+
+    io = (async_io_t *)calloc(1, sizeof(async_io_t));
+    if (!io) {
+        return NULL;
+    }
+
+    io->queue_head = -1;
+    io->queue_tail = -1;
+
+#ifdef ASYNC_IO_HAVE_URING
+    io->uring.fd = -1;
+    if (backend == ASYNC_IO_BACKEND_URING && uring_init(&io->uring, ASYNC_IO_MAX_REQUESTS)) {
+        io->backend = ASYNC_IO_BACKEND_URING;
+        return io;
+    }
+#endif
+
+    /* No io_uring here (old kernel, seccomp filter or another system): use the threads */
+    io->backend = ASYNC_IO_BACKEND_THREADS;
+    if (pthread_mutex_init(&io->lock, NULL) != 0) {
+        free(io);
+        return NULL;
+    }
+    if (pthread_cond_init(&io->work, NULL) != 0) {
+        pthread_mutex_destroy(&io->lock);
+        free(io);
+        return NULL;
+    }
+    if (pthread_cond_init(&io->finished, NULL) != 0) {
+        pthread_cond_destroy(&io->work);
+        pthread_mutex_destroy(&io->lock);
+        free(io);
+        return NULL;
+    }
+    if (!start_threads(io)) {
+        destroy_async_io(io);
+        return NULL;
+    }
+
+    return io;
+}
+
+/* Get the backend an engine actually uses */
+async_io_backend_t async_io_backend(const async_io_t *io) {
+    return io->backend;
+}
+
+/* Start reading a whole file */
+int async_read_file(async_io_t *io, const char *path) {
+    io_request_t *request;
+    int index;
+
+    if (strlen(path) >= MAX_FILENAME_LENGTH) {
+        return -1;
+    }
+
+    index = acquire_request(io);
+    if (index < 0) {
+        return -1;
+    }
+
+    request = &io->requests[index];
+    request->is_write = false;
+    strcpy(request->path, path);
+    request->source[0] = '\0';
+    request->data = NULL;
+    request->size = 0;
+    request->capacity = 0;
+
+    start_request(io, index);
+    return index;
+}
+
+/* Wait for a read started with async_read_file */
+bool wait_async_read(async_io_t *io, int request, char **data, size_t *size) {
+    io_request_t *slot = &io->requests[request];
+    bool success;
+
+    while (request_state(io, request) != REQUEST_DONE) {
+        reap_completions(io, true);
+    }
+
+    success = slot->error == 0;
+    *data = success ? slot->data : NULL;
+    *size = success ? slot->size : 0;
+    if (!success) {
+        free(slot->data);
+    }
+
+    slot->data = NULL;
+    slot->state = REQUEST_FREE;
+    return success;
+}
+
+/* Start writing a whole file */
+bool async_write_file(async_io_t *io, const char *path, char *data, size_t size, error_context_t *context) {
+    io_request_t *request;
+    int index;
+
+    if (strlen(path) >= MAX_FILENAME_LENGTH) {
+        free(data);
+        report_context_error(context, "File name too long: %s", path);
+        return false;
+    }
+
+    index = acquire_request(io);
+    if (index < 0) {
+        free(data);
+        report_context_error(context, "Could not start writing file: %s", path);
+        return false;
+    }
+
+    request = &io->requests[index];
+    request->is_write = true;
+    strcpy(request->path, path);
+    strncpy(request->source, context ? context->filename : path, MAX_FILENAME_LENGTH - 1);
+    request->source[MAX_FILENAME_LENGTH - 1] = '\0';
+    request->data = data;
+    request->size = size;
+    request->done = 0;
+    io->writes++;
+
+    start_request(io, index);
+    return true;
+}
+
+/* Wait for every write started so far */
+bool drain_async_io(async_io_t *io) {
+    bool success;
+
+    while (io->writes > 0) {
+        reap_completions(io, true);
+    }
+
+    success = !io->write_failed;
+    io->write_failed = false;
+    return success;
+}
+
+/* Wait for outstanding requests and release an engine */
+void destroy_async_io(async_io_t *io) {
+    int i;
+
+    if (!io) {
+        return;
+    }
+
+    /* Unclaimed reads are finished and dropped, writes are completed */
+    for (i = 0; i < ASYNC_IO_MAX_REQUESTS; i++) {
+        if (request_state(io, i) != REQUEST_FREE && !io->requests[i].is_write) {
+            while (request_state(io, i) != REQUEST_DONE) {
+                reap_completions(io, true);
+            }
+            free(io->requests[i].data);
+            io->requests[i].state = REQUEST_FREE;
+        }
+    }
+    drain_async_io(io);
+
+#ifdef ASYNC_IO_HAVE_URING
+    if (io->backend == ASYNC_IO_BACKEND_URING) {
+        uring_free(&io->uring);
+        free(io);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&io->lock);
+    io->stopping = true;
+    pthread_cond_broadcast(&io->work);
+    pthread_mutex_unlock(&io->lock);
+    for (i = 0; i < io->thread_count; i++) {
+        pthread_join(io->threads[i], NULL);
+    }
+    pthread_cond_destroy(&io->finished);
+    pthread_cond_destroy(&io->work);
+    pthread_mutex_destroy(&io->lock);
+    free(io);
+}
+
+/* Helper function to find a free request slot, reaping finished writes while there is none */
+static int acquire_request(async_io_t *io) {
+    int i;
+
+    for (;;) {
+        for (i = 0; i < ASYNC_IO_MAX_REQUESTS; i++) {
+            if (request_state(io, i) == REQUEST_FREE) {
+                memset(&io->requests[i], 0, sizeof(io_request_t));
+                io->requests[i].fd = -1;
+                io->requests[i].next = -1;
+                return i;
+            }
+        }
+
+        /* Only writes free their slots by themselves; unclaimed reads never do */
+        if (io->writes == 0) {
+            return -1;
+        }
+        reap_completions(io, true);
+    }
+}
+
+/* Helper function to hand a filled-in request to the backend */
+static void start_request(async_io_t *io, int index) {
+    io_request_t *request = &io->requests[index];
+
+    request->step = STEP_OPEN;
+
+#ifdef ASYNC_IO_HAVE_URING
+    if (io->backend == ASYNC_IO_BACKEND_URING) {
+        request->state = REQUEST_PENDING;
+        uring_queue_step(io, index);
+
+        /* Submit at once, picking up whatever else has completed */
+        uring_reap(io, false);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&io->lock);
+    request->state = REQUEST_PENDING;
+    if (io->queue_tail >= 0) {
+        io->requests[io->queue_tail].next = index;
+    } else {
+        io->queue_head = index;
+    }
+    io->queue_tail = index;
+    pthread_cond_signal(&io->work);
+    pthread_mutex_unlock(&io->lock);
+}
+
+/* Helper function to process every completion available, waiting for one first if asked */
+static void reap_completions(async_io_t *io, bool wait) {
+    int i;
+
+#ifdef ASYNC_IO_HAVE_URING
+    if (io->backend == ASYNC_IO_BACKEND_URING) {
+        uring_reap(io, wait);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&io->lock);
+    while (wait && io->completed == io->reaped) {
+        pthread_cond_wait(&io->finished, &io->lock);
+    }
+    io->reaped = io->completed;
+
+    /* Finished writes release their buffers and slots in one sweep */
+    for (i = 0; i < ASYNC_IO_MAX_REQUESTS; i++) {
+        if (io->requests[i].state == REQUEST_DONE && io->requests[i].is_write) {
+            finish_write(io, &io->requests[i]);
+        }
+    }
+    pthread_mutex_unlock(&io->lock);
+}
+
+/* Helper function to read the state of a request, which the workers of the thread backend change */
+static request_state_t request_state(async_io_t *io, int index) {
+    request_state_t state;
+
+#ifdef ASYNC_IO_HAVE_URING
+    if (io->backend == ASYNC_IO_BACKEND_URING) {
+        return io->requests[index].state;
+    }
+#endif
+
+    pthread_mutex_lock(&io->lock);
+    state = io->requests[index].state;
+    pthread_mutex_unlock(&io->lock);
+    return state;
+}
+
+/* Helper function to release a finished write, reporting its failure */
+static void finish_write(async_io_t *io, io_request_t *request) {
+    error_context_t context;
+
+    if (request->error != 0) {
+        init_error_context(&context, request->source);
+        report_context_error(&context, "Could not write file: %s (%s)", request->path, strerror(request->error));
+        io->write_failed = true;
+    }
+
+    free(request->data);
+    request->data = NULL;
+    request->state = REQUEST_FREE;
+    io->writes--;
+}
+
+/* Helper function to start the worker threads of the thread backend */
+static bool start_threads(async_io_t *io) {
+    while (io->thread_count < ASYNC_IO_THREADS &&
+           pthread_create(&io->threads[io->thread_count], NULL, worker_main, io) == 0) {
+        io->thread_count++;
+    }
+
+    return io->thread_count > 0;
+}
+
+/* Helper function run by each worker: take jobs until the engine stops */
+static void *worker_main(void *arg) {
+    async_io_t *io = (async_io_t *)arg;
+    int index;
+
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        while (io->queue_head < 0 && !io->stopping) {
+            pthread_cond_wait(&io->work, &io->lock);
+        }
+        if (io->queue_head < 0) {
+            break;
+        }
+
+        index = io->queue_head;
+        io->queue_head = io->requests[index].next;
+        if (io->queue_head < 0) {
+            io->queue_tail = -1;
+        }
+
+        /* The blocking calls run without the lock */
+        pthread_mutex_unlock(&io->lock);
+        perform_request(&io->requests[index]);
+        pthread_mutex_lock(&io->lock);
+
+        io->requests[index].state = REQUEST_DONE;
+        io->completed++;
+        pthread_cond_broadcast(&io->finished);
+    }
+    pthread_mutex_unlock(&io->lock);
+
+    return NULL;
+}
+
+/* Helper function to open, read or write, and close a file with blocking calls */
+static void perform_request(io_request_t *request) {
+    struct stat st;
+    char *grown;
+    ssize_t count;
+
+    request->fd = request->is_write ? open(request->path, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE)
+                                    : open(request->path, O_RDONLY);
+    if (request->fd < 0) {
+        request->error = errno;
+        return;
+    }
+
+    if (request->is_write) {
+        while (request->done < request->size) {
+            count = write(request->fd, request->data + request->done, request->size - request->done);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                request->error = count < 0 ? errno : EIO;
+                break;
+            }
+            request->done += (size_t)count;
+        }
+    } else {
+        /* Size the buffer from the file, growing it if the file grows meanwhile */
+        request->capacity = fstat(request->fd, &st) == 0 && st.st_size > 0 ? (size_t)st.st_size + 1 : READ_CHUNK;
+        request->data = (char *)malloc(request->capacity);
+        while (request->data) {
+            if (request->size == request->capacity) {
+                grown = (char *)realloc(request->data, request->capacity * 2);
+                if (!grown) {
+                    break;
+                }
+                request->data = grown;
+                request->capacity *= 2;
+            }
+            count = read(request->fd, request->data + request->size, request->capacity - request->size);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                request->error = errno;
+                break;
+            }
+            if (count == 0) {
+                break;
+            }
+            request->size += (size_t)count;
+        }
+        if (!request->error && (!request->data || request->size == request->capacity)) {
+            request->error = ENOMEM;
+        }
+    }
+
+    if (close(request->fd) != 0 && request->error == 0) {
+        request->error = errno;
+    }
+    request->fd = -1;
+}
+
+#ifdef ASYNC_IO_HAVE_URING
+/* Helper function to set up an io_uring instance and map its rings */
+static bool uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params params;
+    struct io_uring_probe *probe;
+    unsigned char *rings;
+    size_t probe_size;
+    bool supported;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return false;
+    }
+
+    /* Open, read, write and close are all needed (Linux 5.6 and later) */
+    probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    probe = (struct io_uring_probe *)calloc(1, probe_size);
+    supported = probe && (params.features & IORING_FEAT_SINGLE_MMAP) &&
+                syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                probe->last_op >= IORING_OP_WRITE &&
+                (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED) &&
+                (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) {
+        close(ring->fd);
+        ring->fd = -1;
+        return false;
+    }
+
+    /* One mapping holds both rings */
+    ring->rings_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > ring->rings_size) {
+        ring->rings_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    }
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                             ring->fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || (void *)ring->sqes == MAP_FAILED) {
+        if (ring->rings != MAP_FAILED) {
+            munmap(ring->rings, ring->rings_size);
+        }
+        if ((void *)ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        close(ring->fd);
+        ring->fd = -1;
+        return false;
+    }
+
+    rings = (unsigned char *)ring->rings;
+    ring->sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(rings + params.sq_off.array);
+    ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+    ring->to_submit = 0;
+
+    return true;
+}
+
+/* Helper function to unmap the rings and close an io_uring instance */
+static void uring_free(uring_t *ring) {
+    if (ring->fd < 0) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/* Helper function to queue the operation for a request's current step
+ * The ring has an entry per request slot and a request has one operation in
+ * flight at a time, so the submission queue never overflows.
+ */
+static void uring_queue_step(async_io_t *io, int index) {
+    uring_t *ring = &io->uring;
+    io_request_t *request = &io->requests[index];
+    struct io_uring_sqe *sqe;
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    char *grown;
+
+    sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = (unsigned long)index;
+
+    switch (request->step) {
+    case STEP_OPEN:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)request->path;
+        sqe->open_flags = request->is_write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+        sqe->len = request->is_write ? FILE_MODE : 0;
+        break;
+    case STEP_TRANSFER:
+        if (request->is_write) {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (unsigned long)(request->data + request->done);
+            sqe->len = (unsigned)(request->size - request->done);
+            sqe->off = request->done;
+        } else {
+            /* The size is unknown until the end of the file, so the buffer doubles as it fills */
+            if (request->size == request->capacity) {
+                grown = (char *)realloc(request->data, request->capacity ? request->capacity * 2 : READ_CHUNK);
+                if (!grown) {
+                    request->error = ENOMEM;
+                    request->step = STEP_CLOSE;
+                    uring_queue_step(io, index);
+                    return;
+                }
+                request->data = grown;
+                request->capacity = request->capacity ? request->capacity * 2 : READ_CHUNK;
+            }
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (unsigned long)(request->data + request->size);
+            sqe->len = (unsigned)(request->capacity - request->size);
+            sqe->off = request->size;
+        }
+        sqe->fd = request->fd;
+        break;
+    case STEP_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = request->fd;
+        break;
+    }
+
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+/* Helper function to advance a request by the result of its last operation */
+static void uring_complete(async_io_t *io, int index, int result) {
+    io_request_t *request = &io->requests[index];
+
+    switch (request->step) {
+    case STEP_OPEN:
+        if (result < 0) {
+            request->error = -result;
+            request->state = REQUEST_DONE;
+            break;
+        }
+        request->fd = result;
+        request->step = request->is_write && request->size == 0 ? STEP_CLOSE : STEP_TRANSFER;
+        uring_queue_step(io, index);
+        return;
+    case STEP_TRANSFER:
+        if (result == -EINTR || result == -EAGAIN) {
+            uring_queue_step(io, index);
+            return;
+        }
+        if (result < 0) {
+            request->error = -result;
+        } else if (request->is_write) {
+            request->done += (size_t)result;
+            if (result == 0) {
+                request->error = EIO;
+            } else if (request->done < request->size) {
+                uring_queue_step(io, index);
+                return;
+            }
+        } else if (result > 0) {
+            request->size += (size_t)result;
+            uring_queue_step(io, index);
+            return;
+        }
+        request->step = STEP_CLOSE;
+        uring_queue_step(io, index);
+        return;
+    case STEP_CLOSE:
+        if (result < 0 && request->error == 0) {
+            request->error = -result;
+        }
+        request->fd = -1;
+        request->state = REQUEST_DONE;
+        break;
+    }
+
+    if (request->is_write) {
+        finish_write(io, request);
+    }
+}
+
+/* Helper function to submit queued operations and process every completion available */
+static void uring_reap(async_io_t *io, bool wait) {
+    uring_t *ring = &io->uring;
+    struct io_uring_cqe *cqe;
+    unsigned head, tail;
+    long submitted;
+
+    /* One system call submits everything queued and, when asked, waits for a completion */
+    do {
+        submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait ? 1 : 0,
+                            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted > 0) {
+        ring->to_submit -= (unsigned)submitted;
+    }
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        uring_complete(io, (int)cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif /* ASYNC_IO_HAVE_URING */
@@ -0,0 +1,725 @@
+/**
+ * @file binary_object.c
+ * @brief Implementation of the binary object format (.tpo)
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/binary_object.h"
+#include "../include/output.h"
+#include "../include/utils.h"
+
+/* Base64-like character set used by the text .ob format */
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * @brief String pool with hashed de-duplication of names
+ */
+typedef struct {
+    char *data;                   /* Concatenated NUL-terminated names */
+    size_t size;                  /* Bytes used */
+    size_t capacity;              /* Bytes allocated */
+    uint32_t *slots;              /* Hash slots holding offset + 1 (0 = empty) */
+    size_t slot_count;            /* Number of slots (power of two) */
+} string_pool_t;
+
+/* Forward declarations for internal functions */
+static bool write_binary_object(const char *path, symbol_table_t *symbols,
+                                machine_word_t *code_image, machine_word_t *data_image,
+                                const external_table_t *ext_refs, int ICF, int DCF,
+                                int word_bytes, error_context_t *context);
+static bool pool_init(string_pool_t *pool, size_t name_count);
+static bool pool_add(string_pool_t *pool, const char *name, uint32_t *offset);
+static void pool_free(string_pool_t *pool);
+static uint32_t align_offset(uint32_t offset);
+static void put_u16(unsigned char *p, uint16_t value);
+static void put_u32(unsigned char *p, uint32_t value);
+static void put_word(unsigned char *p, uint32_t word, int word_bytes);
+static uint32_t get_word(const unsigned char *p, int word_bytes);
+static int base64_index(char c);
+
+/* Write a binary object file */
+bool write_binary_object_file(const char *filename, symbol_table_t *symbols,
+                              machine_word_t *code_image, machine_word_t *data_image,
+                              const external_table_t *ext_refs, int ICF, int DCF,
+                              int word_bytes, error_context_t *context) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char tpo_filename[MAX_FILENAME_LENGTH];
+
+    /* Build the .tpo filename */
+    get_base_filename(filename, base_filename);
+    create_filename(base_filename, EXT_BINARY, tpo_filename);
+
+    return write_binary_object(tpo_filename, symbols, code_image, data_image,
+                               ext_refs, ICF, DCF, word_bytes, context);
+}
+
+/* Map a binary object file and validate its header */
+bool open_binary_object(const char *path, binary_object_t *object, error_context_t *context) {
+    struct stat st;
+    void *mapping;
+    int fd;
+
+    if (!path || !object) {
+        report_context_error(context, "Invalid parameters for open_binary_object");
+        return false;
+    }
+
+    memset(object, 0, sizeof(binary_object_t));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(binary_object_header_t)) {
+        close(fd);
+        report_context_error(context, "Not a binary object file: %s", path);
+        return false;
+    }
+
+    mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        report_context_error(context, "Could not map file: %s", path);
+        return false;
+    }
+
+    if (!load_binary_object(mapping, (size_t)st.st_size, object, context)) {
+        munmap(mapping, (size_t)st.st_size);
+        return false;
+    }
+
+    object->mapping = mapping;
+    object->mapping_size = (size_t)st.st_size;
+
+    return true;
+}
+
+/* Validate a binary object held in memory */
+bool load_binary_object(const void *buffer, size_t size, binary_object_t *object,
+                        error_context_t *context) {
+    const unsigned char *base = (const unsigned char *)buffer;
+    const binary_object_header_t *header;
+    uint32_t i;
+
+    if (!buffer || !object) {
+        report_context_error(context, "Invalid parameters for load_binary_object");
+        return false;
+    }
+
+    memset(object, 0, sizeof(binary_object_t));
+
+    /* The tables are read in place, so the buffer must be word aligned */
+    if (size < sizeof(binary_object_header_t) || ((size_t)base & 3) != 0) {
+        report_context_error(context, "Binary object is truncated or misaligned");
+        return false;
+    }
+
+    header = (const binary_object_header_t *)buffer;
+    if (memcmp(header->magic, BINARY_OBJECT_MAGIC, 4) != 0) {
+        report_context_error(context, "Bad binary object magic");
+        return false;
+    }
+
+    /* A byte-swapped header_size means the file was read on a big-endian host */
+    if (header->header_size != sizeof(binary_object_header_t) ||
+        header->version != BINARY_OBJECT_VERSION) {
+        report_context_error(context, "Unsupported binary object version or byte order");
+        return false;
+    }
+
+    if (header->word_bytes != BINARY_WORD_PACKED && header->word_bytes != BINARY_WORD_WIDE) {
+        report_context_error(context, "Unsupported binary object word size: %d",
+                             (int)header->word_bytes);
+        return false;
+    }
+
+    /* Every section has to fit inside the buffer */
+    if (header->file_size > size ||
+        header->code_offset > size || header->icf > (size - header->code_offset) / header->word_bytes ||
+        header->data_offset > size || header->dcf > (size - header->data_offset) / header->word_bytes ||
+        header->entries_offset > size ||
+        header->entry_count > (size - header->entries_offset) / sizeof(binary_symbol_t) ||
+        header->externs_offset > size ||
+        header->extern_count > (size - header->externs_offset) / sizeof(binary_symbol_t) ||
+        header->strings_offset > size || header->strings_size > size - header->strings_offset) {
+        report_context_error(context, "Binary object section exceeds file size");
+        return false;
+    }
+
+    if (header->entries_offset % BINARY_SECTION_ALIGN != 0 ||
+        header->externs_offset % BINARY_SECTION_ALIGN != 0) {
+        report_context_error(context, "Binary object tables are not aligned");
+        return false;
+    }
+
+    if (header->strings_size > 0 && base[header->strings_offset + header->strings_size - 1] != '\0') {
+        report_context_error(context, "Binary object string pool is not terminated");
+        return false;
+    }
+
+    object->header = header;
+    object->code = base + header->code_offset;
+    object->data = base + header->data_offset;
+    object->entries = (const binary_symbol_t *)(base + header->entries_offset);
+    object->externs = (const binary_symbol_t *)(base + header->externs_offset);
+    object->strings = (const char *)(base + header->strings_offset);
+
+    /* Names must point inside the string pool */
+    for (i = 0; i < header->entry_count; i++) {
+        if (object->entries[i].name_offset >= header->strings_size) {
+            report_context_error(context, "Binary object entry name out of range");
+            return false;
+        }
+    }
+    for (i = 0; i < header->extern_count; i++) {
+        if (object->externs[i].name_offset >= header->strings_size) {
+            report_context_error(context, "Binary object external name out of range");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Release a binary object view */
+void close_binary_object(binary_object_t *object) {
+    if (!object) {
+        return;
+    }
+
+    if (object->mapping) {
+        munmap(object->mapping, object->mapping_size);
+    }
+
+    memset(object, 0, sizeof(binary_object_t));
+}
+
+/* Get a code word of a binary object */
+uint32_t binary_object_code_word(const binary_object_t *object, int index) {
+    return get_word(object->code + (size_t)index * object->header->word_bytes,
+                    object->header->word_bytes);
+}
+
+/* Get a data word of a binary object */
+uint32_t binary_object_data_word(const binary_object_t *object, int index) {
+    return get_word(object->data + (size_t)index * object->header->word_bytes,
+                    object->header->word_bytes);
+}
+
+/* Get the name of an entry or external reference record */
+const char *binary_object_name(const binary_object_t *object, const binary_symbol_t *record) {
+    return object->strings + record->name_offset;
+}
+
+/* Convert a binary object into the text .ob/.ent/.ext files */
+bool convert_binary_to_text(const char *path, const char *base, error_context_t *context) {
+    binary_object_t object;
+    symbol_table_t *symbols = NULL;
+    machine_word_t *code_image = NULL;
+    machine_word_t *data_image = NULL;
+    external_table_t ext_refs;
+    int ICF, DCF, i;
+    bool success = true;
+
+    if (!open_binary_object(path, &object, context)) {
+        return false;
+    }
+
+    /* The text format always places code at MEMORY_START */
+    if (object.header->code_start != MEMORY_START) {
+        report_context_error(context, "Cannot convert %s: code starts at %lu, text objects start at %d",
+                             path, (unsigned long)object.header->code_start, MEMORY_START);
+        close_binary_object(&object);
+        return false;
+    }
+
+    ICF = (int)object.header->icf;
+    DCF = (int)object.header->dcf;
+
+    init_external_table(&ext_refs);
+    symbols = create_symbol_table();
+    code_image = (machine_word_t *)calloc(MEMORY_START + ICF + 1, sizeof(machine_word_t));
+    data_image = (machine_word_t *)calloc(DCF + 1, sizeof(machine_word_t));
+    if (!symbols || !code_image || !data_image) {
+        report_context_error(context, "Memory allocation error");
+        success = false;
+    }
+
+    for (i = 0; success && i < ICF; i++) {
+        code_image[MEMORY_START + i] = word_from_bits(binary_object_code_word(&object, i));
+    }
+    for (i = 0; success && i < DCF; i++) {
+        data_image[i] = word_from_bits(binary_object_data_word(&object, i));
+    }
+
+    /* add_symbol prepends, so insert in reverse to keep the original order */
+    for (i = (int)object.header->entry_count - 1; success && i >= 0; i--) {
+        if (!add_symbol(symbols, binary_object_name(&object, &object.entries[i]),
+                        (int)object.entries[i].address, SYMBOL_ATTR_ENTRY)) {
+            report_context_error(context, "Duplicate entry '%s' in %s",
+                                 binary_object_name(&object, &object.entries[i]), path);
+            success = false;
+        }
+    }
+
+    for (i = 0; success && i < (int)object.header->extern_count; i++) {
+        if (!add_external_reference(&ext_refs, binary_object_name(&object, &object.externs[i]),
+                                    (int)object.externs[i].address, context)) {
+            success = false;
+        }
+    }
+
+    if (success) {
+        success = generate_output_files(base, symbols, code_image, data_image,
+                                        &ext_refs, ICF, DCF, context);
+    }
+
+    close_binary_object(&object);
+    free_symbol_table(symbols);
+    free(code_image);
+    free(data_image);
+    free_external_table(&ext_refs);
+
+    return success;
+}
+
+/* Convert the text .ob/.ent/.ext files into a binary object */
+bool convert_text_to_binary(const char *base, const char *path, int word_bytes,
+                            error_context_t *context) {
+    char filename[MAX_FILENAME_LENGTH];
+    char name[MAX_LABEL_LENGTH];
+    char encoded[3];
+    FILE *file;
+    symbol_table_t *symbols = NULL;
+    machine_word_t *code_image = NULL;
+    machine_word_t *data_image = NULL;
+    external_table_t ext_refs;
+    symbol_t *reversed = NULL, *symbol;
+    int ICF, DCF, address, i, high, low;
+    bool success = true;
+
+    /* Read the object file */
+    create_filename(base, EXT_OBJECT, filename);
+    file = fopen(filename, "r");
+    if (!file) {
+        report_context_error(context, "Could not open file: %s", filename);
+        return false;
+    }
+
+    if (fscanf(file, "%d %d", &ICF, &DCF) != 2 || ICF < 0 || DCF < 0) {
+        fclose(file);
+        report_context_error(context, "Invalid object file header: %s", filename);
+        return false;
+    }
+
+    init_external_table(&ext_refs);
+    symbols = create_symbol_table();
+    code_image = (machine_word_t *)calloc(MEMORY_START + ICF + 1, sizeof(machine_word_t));
+    data_image = (machine_word_t *)calloc(DCF + 1, sizeof(machine_word_t));
+    if (!symbols || !code_image || !data_image) {
+        report_context_error(context, "Memory allocation error");
+        success = false;
+    }
+
+    for (i = 0; success && i < ICF + DCF; i++) {
+        if (fscanf(file, "%d %2s", &address, encoded) != 2 || strlen(encoded) != 2) {
+            report_context_error(context, "Truncated object file: %s", filename);
+            success = false;
+            break;
+        }
+
+        high = base64_index(encoded[0]);
+        low = base64_index(encoded[1]);
+        if (high < 0 || low < 0) {
+            report_context_error(context, "Invalid word encoding '%s' in %s", encoded, filename);
+            success = false;
+            break;
+        }
+
+        /* The text form carries bits 6-17 of the word */
+        if (i < ICF) {
+            code_image[MEMORY_START + i] = word_from_bits(((unsigned long)high << 12) | (low << 6));
+        } else {
+            data_image[i - ICF] = word_from_bits(((unsigned long)high << 12) | (low << 6));
+        }
+    }
+    fclose(file);
+
+    /* Read the entries file, if present */
+    create_filename(base, EXT_ENTRY, filename);
+    file = success ? fopen(filename, "r") : NULL;
+    if (file) {
+        /* Collect in file order, then prepend in reverse to keep that order */
+        while (success && fscanf(file, "%31s %d", name, &address) == 2) {
+            symbol = (symbol_t *)malloc(sizeof(symbol_t));
+            if (!symbol) {
+                report_context_error(context, "Memory allocation error");
+                success = false;
+                break;
+            }
+            strcpy(symbol->name, name);
+            symbol->value = address;
+            symbol->next = reversed;
+            reversed = symbol;
+        }
+        fclose(file);
+
+        while (reversed) {
+            symbol = reversed->next;
+            if (success && !add_symbol(symbols, reversed->name, reversed->value, SYMBOL_ATTR_ENTRY)) {
+                report_context_error(context, "Duplicate entry '%s' in %s", reversed->name, filename);
+                success = false;
+            }
+            free(reversed);
+            reversed = symbol;
+        }
+    }
+
+    /* Read the externals file, if present */
+    create_filename(base, EXT_EXTERN, filename);
+    file = success ? fopen(filename, "r") : NULL;
+    if (file) {
+        while (success && fscanf(file, "%31s %d", name, &address) == 2) {
+            success = add_external_reference(&ext_refs, name, address, context);
+        }
+        fclose(file);
+    }
+
+    if (success) {
+        success = write_binary_object(path, symbols, code_image, data_image,
+                                      &ext_refs, ICF, DCF, word_bytes, context);
+    }
+
+    free_symbol_table(symbols);
+    free(code_image);
+    free(data_image);
+    free_external_table(&ext_refs);
+
+    return success;
+}
+
+/* Write an in-memory image as a binary object file */
+bool write_binary_image(const char *path, const binary_image_t *image, error_context_t *context) {
+    binary_object_header_t header;
+    string_pool_t pool;
+    unsigned char *buffer, *p;
+    uint32_t i, name_offset;
+    int word_bytes;
+    FILE *file;
+    bool success = true;
+
+    if (!path || !image) {
+        report_context_error(context, "Invalid parameters for write_binary_image");
+        return false;
+    }
+
+    word_bytes = image->word_bytes;
+    if (word_bytes != BINARY_WORD_PACKED && word_bytes != BINARY_WORD_WIDE) {
+        report_context_error(context, "Unsupported binary word size: %d", word_bytes);
+        return false;
+    }
+
+    if (!pool_init(&pool, image->entry_count + image->extern_count)) {
+        report_context_error(context, "Memory allocation error for string pool");
+        return false;
+    }
+
+    /* Add every name first so the pool size is known before layout */
+    for (i = 0; i < image->entry_count && success; i++) {
+        success = pool_add(&pool, image->entries[i].name, &name_offset);
+    }
+    for (i = 0; i < image->extern_count && success; i++) {
+        success = pool_add(&pool, image->externs[i].name, &name_offset);
+    }
+    if (!success) {
+        pool_free(&pool);
+        report_context_error(context, "Memory allocation error for string pool");
+        return false;
+    }
+
+    /* Lay out the sections */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_OBJECT_MAGIC, 4);
+    header.version = BINARY_OBJECT_VERSION;
+    header.word_bytes = (uint16_t)word_bytes;
+    header.header_size = sizeof(binary_object_header_t);
+    header.code_start = image->code_start;
+    header.icf = image->icf;
+    header.dcf = image->dcf;
+    header.entry_count = image->entry_count;
+    header.extern_count = image->extern_count;
+    header.strings_size = (uint32_t)pool.size;
+    header.code_offset = align_offset(sizeof(binary_object_header_t));
+    header.data_offset = align_offset(header.code_offset + image->icf * word_bytes);
+    header.entries_offset = align_offset(header.data_offset + image->dcf * word_bytes);
+    header.externs_offset = align_offset(header.entries_offset + image->entry_count * sizeof(binary_symbol_t));
+    header.strings_offset = align_offset(header.externs_offset + image->extern_count * sizeof(binary_symbol_t));
+    header.file_size = header.strings_offset + header.strings_size;
+
+    buffer = (unsigned char *)calloc(header.file_size, 1);
+    if (!buffer) {
+        pool_free(&pool);
+        report_context_error(context, "Memory allocation error for binary object");
+        return false;
+    }
+
+    /* Header, written field by field in little-endian order */
+    memcpy(buffer, header.magic, 4);
+    put_u16(buffer + 4, header.version);
+    put_u16(buffer + 6, header.word_bytes);
+    put_u32(buffer + 8, header.header_size);
+    put_u32(buffer + 12, header.code_start);
+    put_u32(buffer + 16, header.icf);
+    put_u32(buffer + 20, header.dcf);
+    put_u32(buffer + 24, header.entry_count);
+    put_u32(buffer + 28, header.extern_count);
+    put_u32(buffer + 32, header.strings_size);
+    put_u32(buffer + 36, header.code_offset);
+    put_u32(buffer + 40, header.data_offset);
+    put_u32(buffer + 44, header.entries_offset);
+    put_u32(buffer + 48, header.externs_offset);
+    put_u32(buffer + 52, header.strings_offset);
+    put_u32(buffer + 56, header.file_size);
+
+    /* Code and data words */
+    p = buffer + header.code_offset;
+    for (i = 0; i < image->icf; i++, p += word_bytes) {
+        put_word(p, image->code[i], word_bytes);
+    }
+    p = buffer + header.data_offset;
+    for (i = 0; i < image->dcf; i++, p += word_bytes) {
+        put_word(p, image->data[i], word_bytes);
+    }
+
+    /* Entry and external reference tables */
+    p = buffer + header.entries_offset;
+    for (i = 0; i < image->entry_count; i++, p += sizeof(binary_symbol_t)) {
+        pool_add(&pool, image->entries[i].name, &name_offset);
+        put_u32(p, name_offset);
+        put_u32(p + 4, image->entries[i].address);
+    }
+    p = buffer + header.externs_offset;
+    for (i = 0; i < image->extern_count; i++, p += sizeof(binary_symbol_t)) {
+        pool_add(&pool, image->externs[i].name, &name_offset);
+        put_u32(p, name_offset);
+        put_u32(p + 4, image->externs[i].address);
+    }
+
+    /* String pool */
+    if (pool.size > 0) {
+        memcpy(buffer + header.strings_offset, pool.data, pool.size);
+    }
+    pool_free(&pool);
+
+    file = fopen(path, "wb");
+    if (!file) {
+        free(buffer);
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    if (fwrite(buffer, 1, header.file_size, file) != header.file_size) {
+        report_context_error(context, "Could not write file: %s", path);
+        success = false;
+    }
+
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    free(buffer);
+
+    return success;
+}
+
+/* Helper function to gather the assembler's outputs into an image and write it */
+static bool write_binary_object(const char *path, symbol_table_t *symbols,
+                                machine_word_t *code_image, machine_word_t *data_image,
+                                const external_table_t *ext_refs, int ICF, int DCF,
+                                int word_bytes, error_context_t *context) {
+    binary_image_t image;
+    uint32_t *code, *data;
+    binary_record_t *entries, *externs;
+    symbol_t *symbol;
+    uint32_t entry_count = 0, extern_count;
+    int i;
+    bool success;
+
+    /* Count the records */
+    for (symbol = symbols ? symbols->head : NULL; symbol; symbol = symbol->next) {
+        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
+            entry_count++;
+        }
+    }
+    extern_count = (uint32_t)ext_refs->count;
+
+    code = (uint32_t *)malloc((ICF + 1) * sizeof(uint32_t));
+    data = (uint32_t *)malloc((DCF + 1) * sizeof(uint32_t));
+    entries = (binary_record_t *)malloc((entry_count + 1) * sizeof(binary_record_t));
+    externs = (binary_record_t *)malloc((extern_count + 1) * sizeof(binary_record_t));
+    if (!code || !data || !entries || !externs) {
+        free(code);
+        free(data);
+        free(entries);
+        free(externs);
+        report_context_error(context, "Memory allocation error for binary object");
+        return false;
+    }
+
+    /* The images already hold 24-bit words */
+    memcpy(code, code_image + MEMORY_START, ICF * sizeof(uint32_t));
+    memcpy(data, data_image, DCF * sizeof(uint32_t));
+
+    /* Entries in symbol table order like the .ent file */
+    entry_count = 0;
+    for (symbol = symbols ? symbols->head : NULL; symbol; symbol = symbol->next) {
+        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
+            entries[entry_count].name = symbol->name;
+            entries[entry_count].address = (uint32_t)symbol->value;
+            entry_count++;
+        }
+    }
+
+    /* External references in reference order like the .ext file */
+    for (i = 0; i < ext_refs->count; i++) {
+        externs[i].name = external_reference_name(ext_refs, &ext_refs->refs[i]);
+        externs[i].address = (uint32_t)ext_refs->refs[i].address;
+    }
+
+    image.code_start = MEMORY_START;
+    image.code = code;
+    image.icf = (uint32_t)ICF;
+    image.data = data;
+    image.dcf = (uint32_t)DCF;
+    image.entries = entries;
+    image.entry_count = entry_count;
+    image.externs = externs;
+    image.extern_count = extern_count;
+    image.word_bytes = word_bytes;
+
+    success = write_binary_image(path, &image, context);
+
+    free(code);
+    free(data);
+    free(entries);
+    free(externs);
+
+    return success;
+}
+
+/* Helper function to initialize a string pool sized for name_count names */
+static bool pool_init(string_pool_t *pool, size_t name_count) {
+    pool->size = 0;
+    pool->capacity = 256;
+    pool->slot_count = 16;
+    while (pool->slot_count < name_count * 2) {
+        pool->slot_count *= 2;
+    }
+
+    pool->data = (char *)malloc(pool->capacity);
+    pool->slots = (uint32_t *)calloc(pool->slot_count, sizeof(uint32_t));
+    if (!pool->data || !pool->slots) {
+        pool_free(pool);
+        return false;
+    }
+
+    return true;
+}
+
+/* Helper function to add a name to the pool, reusing an existing copy */
+static bool pool_add(string_pool_t *pool, const char *name, uint32_t *offset) {
+    size_t slot, len;
+    char *grown;
+
+    slot = hash_string(name) & (pool->slot_count - 1);
+    while (pool->slots[slot] != 0) {
+        if (strcmp(pool->data + pool->slots[slot] - 1, name) == 0) {
+            *offset = pool->slots[slot] - 1;
+            return true;
+        }
+        slot = (slot + 1) & (pool->slot_count - 1);
+    }
+
+    len = strlen(name) + 1;
+    if (pool->size + len > pool->capacity) {
+        while (pool->size + len > pool->capacity) {
+            pool->capacity *= 2;
+        }
+        grown = (char *)realloc(pool->data, pool->capacity);
+        if (!grown) {
+            return false;
+        }
+        pool->data = grown;
+    }
+
+    memcpy(pool->data + pool->size, name, len);
+    *offset = (uint32_t)pool->size;
+    pool->slots[slot] = (uint32_t)pool->size + 1;
+    pool->size += len;
+
+    return true;
+}
+
+/* Helper function to free a string pool */
+static void pool_free(string_pool_t *pool) {
+    free(pool->data);
+    free(pool->slots);
+    pool->data = NULL;
+    pool->slots = NULL;
+}
+
+/* Helper function to round an offset up to the section alignment */
+static uint32_t align_offset(uint32_t offset) {
+    return (offset + BINARY_SECTION_ALIGN - 1) & ~(uint32_t)(BINARY_SECTION_ALIGN - 1);
+}
+
+/* Helper function to store a little-endian 16-bit value */
+static void put_u16(unsigned char *p, uint16_t value) {
+    p[0] = (unsigned char)(value & 0xFF);
+    p[1] = (unsigned char)((value >> 8) & 0xFF);
+}
+
+/* Helper function to store a little-endian 32-bit value */
+static void put_u32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value & 0xFF);
+    p[1] = (unsigned char)((value >> 8) & 0xFF);
+    p[2] = (unsigned char)((value >> 16) & 0xFF);
+    p[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+/* Helper function to store a 24-bit word in 3 or 4 bytes */
+static void put_word(unsigned char *p, uint32_t word, int word_bytes) {
+    p[0] = (unsigned char)(word & 0xFF);
+    p[1] = (unsigned char)((word >> 8) & 0xFF);
+    p[2] = (unsigned char)((word >> 16) & 0xFF);
+    if (word_bytes == BINARY_WORD_WIDE) {
+        p[3] = 0;
+    }
+}
+
+/* Helper function to load a 24-bit word stored in 3 or 4 bytes */
+static uint32_t get_word(const unsigned char *p, int word_bytes) {
+    (void)word_bytes; /* The fourth byte of a wide word is always zero */
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+}
+
+/* Helper function to map a base64 character back to its 6-bit index */
+static int base64_index(char c) {
+    const char *found;
+
+    if (c == '\0') {
+        return -1;
+    }
+
+    found = strchr(base64_chars, c);
+    return found ? (int)(found - base64_chars) : -1;
+}
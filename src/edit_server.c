@@ -0,0 +1,509 @@
+/**
+ * @file edit_server.c
+ * @brief Implementation of the JSON-lines edit protocol
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/edit_server.h"
+#include "../include/incremental.h"
+#include "../include/error.h"
+
+#define JSON_MAX_DEPTH 32         /* Nesting of skipped values */
+
+/**
+ * @brief One decoded request line
+ */
+typedef struct {
+    long id;
+    bool has_id;
+    char op[16];
+    long start;
+    long end;
+    bool has_start;
+    bool has_end;
+    char *text;                   /* Decoded "text" (NULL if absent) */
+    size_t text_length;
+} edit_request_t;
+
+/* Forward declarations for internal functions */
+static bool read_request_line(FILE *input, char **buffer, size_t *capacity);
+static bool parse_request(const char *line, edit_request_t *request, const char **error);
+static bool parse_json_string(const char **cursor, char **value, size_t *length);
+static bool parse_json_integer(const char **cursor, long *value);
+static bool skip_json_value(const char **cursor, int depth);
+static const char *skip_json_space(const char *cursor);
+static char *encode_utf8(char *out, unsigned long code);
+static int hex_value(char c);
+static void write_response(FILE *output, const edit_request_t *request, edit_session_t *session, long time_us,
+                           int consistent);
+static void write_error(FILE *output, const edit_request_t *request, const char *message);
+static void write_json_string(FILE *output, const char *text);
+static long elapsed_us(const struct timespec *start);
+
+/* Serve edit requests for one source file until exit or end of input */
+bool serve_edit_session(const char *filename, FILE *input, FILE *output) {
+    edit_session_t *session;
+    edit_request_t request;
+    diagnostic_list_t failures;
+    error_context_t context;
+    struct timespec start;
+    char *line = NULL;
+    size_t capacity = 0;
+    const char *error;
+    bool applied;
+    int consistent;
+    long time_us;
+
+    init_error_context(&context, filename);
+    session = create_edit_session(filename, &context);
+    if (!session) {
+        return false;
+    }
+
+    /* Failures of a request are collected and returned in its response */
+    memset(&failures, 0, sizeof(failures));
+    context.diagnostics = &failures;
+
+    while (read_request_line(input, &line, &capacity)) {
+        if (*skip_json_space(line) == '\0') {
+            continue;
+        }
+
+        if (!parse_request(line, &request, &error)) {
+            write_error(output, &request, error);
+            free(request.text);
+            continue;
+        }
+
+        clear_diagnostics(&failures);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        applied = true;
+        consistent = -1;
+
+        if (strcmp(request.op, "exit") == 0) {
+            free(request.text);
+            break;
+        } else if (strcmp(request.op, "edit") == 0) {
+            if (!request.has_start || !request.has_end || !request.text) {
+                write_error(output, &request, "edit needs start, end and text");
+                free(request.text);
+                continue;
+            }
+            applied = apply_source_edit(session, (int)request.start, (int)request.end, request.text,
+                                        request.text_length, &context);
+        } else if (strcmp(request.op, "verify") == 0) {
+            consistent = verify_edit_session(session, &context) ? 1 : 0;
+        } else if (strcmp(request.op, "diagnostics") != 0) {
+            write_error(output, &request, "Unknown op");
+            free(request.text);
+            continue;
+        }
+        time_us = elapsed_us(&start);
+
+        if (applied) {
+            write_response(output, &request, session, time_us, consistent);
+        } else {
+            write_error(output, &request, failures.count > 0 ? failures.items[0].message : "edit failed");
+        }
+        free(request.text);
+    }
+
+    free(line);
+    free_diagnostics(&failures);
+    destroy_edit_session(session);
+    return true;
+}
+
+/* Helper function to read one line of any length, without its newline */
+static bool read_request_line(FILE *input, char **buffer, size_t *capacity) {
+    size_t length = 0;
+    char *grown;
+    int c;
+
+    while ((c = getc(input)) != EOF && c != '\n') {
+        if (length + 1 >= *capacity) {
+            grown = (char *)realloc(*buffer, *capacity ? *capacity * 2 : 256);
+            if (!grown) {
+                return false;
+            }
+            *buffer = grown;
+            *capacity = *capacity ? *capacity * 2 : 256;
+        }
+        (*buffer)[length++] = (char)c;
+    }
+
+    if (c == EOF && length == 0) {
+        return false;
+    }
+    if (!*buffer) {
+        *buffer = (char *)malloc(1);
+        if (!*buffer) {
+            return false;
+        }
+        *capacity = 1;
+    }
+    (*buffer)[length] = '\0';
+    return true;
+}
+
+/* Helper function to decode a request object, skipping members it does not know */
+static bool parse_request(const char *line, edit_request_t *request, const char **error) {
+    const char *cursor = skip_json_space(line);
+    char *key, *op;
+    size_t length;
+    bool ok;
+
+    memset(request, 0, sizeof(*request));
+    *error = "Malformed request";
+
+    if (*cursor != '{') {
+        return false;
+    }
+    cursor = skip_json_space(cursor + 1);
+    if (*cursor == '}') {
+        *error = "Missing op";
+        return false;
+    }
+
+    for (;;) {
+        if (!parse_json_string(&cursor, &key, &length)) {
+            return false;
+        }
+        cursor = skip_json_space(cursor);
+        if (*cursor != ':') {
+            free(key);
+            return false;
+        }
+        cursor = skip_json_space(cursor + 1);
+
+        if (strcmp(key, "id") == 0) {
+            ok = request->has_id = parse_json_integer(&cursor, &request->id);
+        } else if (strcmp(key, "start") == 0) {
+            ok = request->has_start = parse_json_integer(&cursor, &request->start);
+        } else if (strcmp(key, "end") == 0) {
+            ok = request->has_end = parse_json_integer(&cursor, &request->end);
+        } else if (strcmp(key, "op") == 0) {
+            ok = parse_json_string(&cursor, &op, &length);
+            if (ok) {
+                strncpy(request->op, op, sizeof(request->op) - 1);
+                free(op);
+            }
+        } else if (strcmp(key, "text") == 0 && !request->text) {
+            ok = parse_json_string(&cursor, &request->text, &request->text_length);
+        } else {
+            ok = skip_json_value(&cursor, 0);
+        }
+        free(key);
+        if (!ok) {
+            return false;
+        }
+
+        cursor = skip_json_space(cursor);
+        if (*cursor == '}') {
+            break;
+        }
+        if (*cursor != ',') {
+            return false;
+        }
+        cursor = skip_json_space(cursor + 1);
+    }
+
+    if (*skip_json_space(cursor + 1) != '\0') {
+        return false;
+    }
+    if (request->op[0] == '\0') {
+        *error = "Missing op";
+        return false;
+    }
+    return true;
+}
+
+/* Helper function to decode a string into a new buffer (escapes never make it longer than its source) */
+static bool parse_json_string(const char **cursor, char **value, size_t *length) {
+    const char *p = *cursor, *end;
+    unsigned long code, low;
+    char *out;
+    int i, digit;
+
+    *value = NULL;
+    if (*p != '"') {
+        return false;
+    }
+    for (end = p + 1; *end && *end != '"'; end++) {
+        if (*end == '\\' && end[1]) {
+            end++;
+        }
+    }
+    if (*end != '"') {
+        return false;
+    }
+
+    *value = out = (char *)malloc((size_t)(end - p));
+    if (!out) {
+        return false;
+    }
+
+    for (p++; p < end; p++) {
+        if ((unsigned char)*p < 0x20) {
+            break;
+        }
+        if (*p != '\\') {
+            *out++ = *p;
+            continue;
+        }
+        switch (*++p) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u':
+                code = 0;
+                for (i = 1; i <= 4 && (digit = hex_value(p[i])) >= 0; i++) {
+                    code = code * 16 + (unsigned long)digit;
+                }
+                if (i <= 4) {
+                    p = end;
+                    break;
+                }
+                p += 4;
+
+                /* A high surrogate followed by a low one is one code point */
+                if (code >= 0xD800 && code < 0xDC00 && p[1] == '\\' && p[2] == 'u') {
+                    low = 0;
+                    for (i = 3; i <= 6 && (digit = hex_value(p[i])) >= 0; i++) {
+                        low = low * 16 + (unsigned long)digit;
+                    }
+                    if (i > 6 && low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                out = encode_utf8(out, code);
+                break;
+            default:
+                p = end;
+                break;
+        }
+        if (p >= end) {
+            break;
+        }
+    }
+
+    if (p < end) {
+        free(*value);
+        *value = NULL;
+        return false;
+    }
+
+    *out = '\0';
+    *length = (size_t)(out - *value);
+    *cursor = end + 1;
+    return true;
+}
+
+/* Helper function to decode an integer */
+static bool parse_json_integer(const char **cursor, long *value) {
+    char *end;
+
+    if (**cursor != '-' && (**cursor < '0' || **cursor > '9')) {
+        return false;
+    }
+    *value = strtol(*cursor, &end, 10);
+    if (*end == '.' || *end == 'e' || *end == 'E') {
+        return false;
+    }
+    *cursor = end;
+    return true;
+}
+
+/* Helper function to step over a value of any type */
+static bool skip_json_value(const char **cursor, int depth) {
+    const char *p = *cursor;
+    char *text;
+    size_t length;
+    char close;
+
+    if (*p == '"') {
+        if (!parse_json_string(cursor, &text, &length)) {
+            return false;
+        }
+        free(text);
+        return true;
+    }
+
+    if (*p == '{' || *p == '[') {
+        if (depth >= JSON_MAX_DEPTH) {
+            return false;
+        }
+        close = *p == '{' ? '}' : ']';
+        p = skip_json_space(p + 1);
+        while (*p != close) {
+            if (close == '}') {
+                if (!parse_json_string(&p, &text, &length)) {
+                    return false;
+                }
+                free(text);
+                p = skip_json_space(p);
+                if (*p != ':') {
+                    return false;
+                }
+                p = skip_json_space(p + 1);
+            }
+            if (!skip_json_value(&p, depth + 1)) {
+                return false;
+            }
+            p = skip_json_space(p);
+            if (*p == ',') {
+                p = skip_json_space(p + 1);
+            } else if (*p != close) {
+                return false;
+            }
+        }
+        *cursor = p + 1;
+        return true;
+    }
+
+    if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0) {
+        *cursor = p + 4;
+        return true;
+    }
+    if (strncmp(p, "false", 5) == 0) {
+        *cursor = p + 5;
+        return true;
+    }
+
+    /* Numbers, integer or not */
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        strtod(p, &text);
+        *cursor = text;
+        return true;
+    }
+
+    return false;
+}
+
+/* Helper function to skip JSON whitespace */
+static const char *skip_json_space(const char *cursor) {
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n') {
+        cursor++;
+    }
+    return cursor;
+}
+
+/* Helper function to write a code point as UTF-8 */
+static char *encode_utf8(char *out, unsigned long code) {
+    if (code < 0x80) {
+        *out++ = (char)code;
+    } else if (code < 0x800) {
+        *out++ = (char)(0xC0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *out++ = (char)(0xE0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    }
+    return out;
+}
+
+/* Helper function to get the value of a hex digit (-1 if it is not one) */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Helper function to write the state of the session after a request */
+static void write_response(FILE *output, const edit_request_t *request, edit_session_t *session, long time_us,
+                           int consistent) {
+    const diagnostic_t *diagnostics;
+    edit_stats_t stats;
+    int count, i;
+
+    get_edit_stats(session, &stats);
+    diagnostics = get_session_diagnostics(session, &count);
+
+    if (request->has_id) {
+        fprintf(output, "{\"id\":%ld,", request->id);
+    } else {
+        fprintf(output, "{\"id\":null,");
+    }
+    fprintf(output, "\"ok\":true,\"source_lines\":%d,\"lines\":%d,\"relexed\":%d,\"encoded\":%d,\"success\":%s,",
+            stats.source_lines, stats.lines, stats.relexed, stats.encoded, stats.success ? "true" : "false");
+    if (consistent >= 0) {
+        fprintf(output, "\"consistent\":%s,", consistent ? "true" : "false");
+    }
+    fprintf(output, "\"time_us\":%ld,\"diagnostics\":[", time_us);
+
+    for (i = 0; i < count; i++) {
+        fprintf(output, "%s{\"line\":%d,\"severity\":\"%s\",\"message\":", i > 0 ? "," : "",
+                diagnostics[i].line_number,
+                diagnostics[i].severity == DIAGNOSTIC_WARNING ? "warning" : "error");
+        write_json_string(output, diagnostics[i].message);
+        fputc('}', output);
+    }
+
+    fprintf(output, "]}\n");
+    fflush(output);
+}
+
+/* Helper function to write the response to a request that could not be carried out */
+static void write_error(FILE *output, const edit_request_t *request, const char *message) {
+    if (request->has_id) {
+        fprintf(output, "{\"id\":%ld,\"ok\":false,\"error\":", request->id);
+    } else {
+        fprintf(output, "{\"id\":null,\"ok\":false,\"error\":");
+    }
+    write_json_string(output, message);
+    fprintf(output, "}\n");
+    fflush(output);
+}
+
+/* Helper function to write a string with JSON escapes */
+static void write_json_string(FILE *output, const char *text) {
+    const unsigned char *p;
+
+    fputc('"', output);
+    for (p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(output, "\\%c", *p);
+        } else if (*p == '\n') {
+            fprintf(output, "\\n");
+        } else if (*p == '\t') {
+            fprintf(output, "\\t");
+        } else if (*p < 0x20) {
+            fprintf(output, "\\u%04x", *p);
+        } else {
+            fputc(*p, output);
+        }
+    }
+    fputc('"', output);
+}
+
+/* Helper function to get the microseconds since a point in time */
+static long elapsed_us(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000L;
+}
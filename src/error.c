@@ -3,8 +3,16 @@
  * @brief Implementation of the error handling system
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include "../include/error.h"
 
+#define DIAGNOSTIC_MAX_LENGTH 512  /* Longest collected message, terminator included */
+
+/* Forward declarations for internal functions */
+static void add_diagnostic(diagnostic_list_t *list, diagnostic_severity_t severity, int line_number,
+                           const char *format, va_list args);
+
 /* Initialize an error context */
 void init_error_context(error_context_t *context, const char *filename) {
     if (!context) {
@@ -21,6 +29,7 @@ void init_error_context(error_context_t *context, const char *filename) {
     }
 
     context->line_number = 0;
+    context->diagnostics = NULL;
 }
 
 /* Report an error with the current context */
@@ -34,7 +43,15 @@ void report_context_error(error_context_t *context, const char *format, ...) {
     /* Mark that an error occurred */
     context->had_error = true;
 
-    /* Print the error message */
+    if (context->diagnostics) {
+        va_start(args, format);
+        add_diagnostic(context->diagnostics, DIAGNOSTIC_ERROR, context->line_number, format, args);
+        va_end(args);
+        return;
+    }
+
+    /* Print the error message as one unit, even with several threads reporting */
+    flockfile(stderr);
     fprintf(stderr, "Error in %s, line %d: ",
             context->filename[0] ? context->filename : "unknown",
             context->line_number);
@@ -44,6 +61,60 @@ void report_context_error(error_context_t *context, const char *format, ...) {
     va_end(args);
 
     fprintf(stderr, "\n");
+    funlockfile(stderr);
+}
+
+/* Report a warning with the current context */
+void report_context_warning(error_context_t *context, const char *format, ...) {
+    va_list args;
+
+    if (!format) {
+        return;
+    }
+
+    va_start(args, format);
+    if (context && context->diagnostics) {
+        add_diagnostic(context->diagnostics, DIAGNOSTIC_WARNING, context->line_number, format, args);
+    } else {
+        flockfile(stderr);
+        fprintf(stderr, "Warning: ");
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+        funlockfile(stderr);
+    }
+    va_end(args);
+}
+
+/* Remove the diagnostics from a list, keeping its array */
+void clear_diagnostics(diagnostic_list_t *list) {
+    int i;
+
+    for (i = 0; i < list->count; i++) {
+        free(list->items[i].message);
+    }
+    list->count = 0;
+}
+
+/* Release the memory held by a diagnostics list */
+void free_diagnostics(diagnostic_list_t *list) {
+    clear_diagnostics(list);
+    free(list->items);
+    list->items = NULL;
+    list->capacity = 0;
+}
+
+/* Report collected diagnostics again, in order, through another context */
+void replay_diagnostics(error_context_t *context, const diagnostic_list_t *list) {
+    int i;
+
+    for (i = 0; i < list->count; i++) {
+        context->line_number = list->items[i].line_number;
+        if (list->items[i].severity == DIAGNOSTIC_ERROR) {
+            report_context_error(context, "%s", list->items[i].message);
+        } else {
+            report_context_warning(context, "%s", list->items[i].message);
+        }
+    }
 }
 
 /* Set the current line number in the error context */
@@ -70,4 +141,35 @@ void cleanup_resources(FILE *file, void *ptr1, void *ptr2, void *ptr3) {
     if (ptr3) {
         free(ptr3);
     }
-}
\ No newline at end of file
+}
+
+/* Helper function to format a message into a list; a message that cannot be stored is dropped */
+static void add_diagnostic(diagnostic_list_t *list, diagnostic_severity_t severity, int line_number,
+                           const char *format, va_list args) {
+    char buffer[DIAGNOSTIC_MAX_LENGTH];
+    diagnostic_t *items;
+    int capacity;
+    char *message;
+
+    if (list->count == list->capacity) {
+        capacity = list->capacity ? list->capacity * 2 : 16;
+        items = (diagnostic_t *)realloc(list->items, capacity * sizeof(diagnostic_t));
+        if (!items) {
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    message = (char *)malloc(strlen(buffer) + 1);
+    if (!message) {
+        return;
+    }
+    strcpy(message, buffer);
+
+    list->items[list->count].severity = severity;
+    list->items[list->count].line_number = line_number;
+    list->items[list->count].message = message;
+    list->count++;
+}
@@ -0,0 +1,305 @@
+/**
+ * @file expanded_source.c
+ * @brief Implementation of the in-memory expanded source
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/expanded_source.h"
+#include "../include/pipeline.h"
+
+/* Initialize an empty expanded source */
+void init_expanded_source(expanded_source_t *source) {
+    memset(source, 0, sizeof(expanded_source_t));
+}
+
+/* Empty an expanded source, keeping its arrays and line buffers */
+void reset_expanded_source(expanded_source_t *source) {
+    int i;
+
+    source->template_count = 0;
+    source->span_count = 0;
+    source->line_count = 0;
+    source->incbin_count = 0;
+    for (i = 0; i < source->header_count; i++) {
+        free(source->headers[i]);
+    }
+    source->header_count = 0;
+}
+
+/* Release the templates and spans of an expanded source */
+void free_expanded_source(expanded_source_t *source) {
+    int i;
+
+    /* Templates past template_count still own the buffers of a reset source */
+    for (i = 0; i < source->template_capacity; i++) {
+        free(source->templates[i].text);
+    }
+    free(source->templates);
+    free(source->spans);
+    free(source->incbin_sizes);
+    for (i = 0; i < source->header_count; i++) {
+        free(source->headers[i]);
+    }
+    free(source->headers);
+    init_expanded_source(source);
+}
+
+/* Add one template as it is */
+int add_source_line(expanded_source_t *source, const char *text, size_t length, bool joined) {
+    source_template_t *templates, *line;
+    char *text_buffer;
+    int capacity, i;
+
+    if (source->template_count == source->template_capacity) {
+        capacity = source->template_capacity ? source->template_capacity * 2 : 64;
+        templates = (source_template_t *)realloc(source->templates, capacity * sizeof(source_template_t));
+        if (!templates) {
+            return -1;
+        }
+        for (i = source->template_capacity; i < capacity; i++) {
+            templates[i].text = NULL;
+            templates[i].text_capacity = 0;
+        }
+        source->templates = templates;
+        source->template_capacity = capacity;
+    }
+
+    /* Reuse the buffer a reset source left in this slot when the line fits */
+    line = &source->templates[source->template_count];
+    if (line->text_capacity < length + 1) {
+        text_buffer = (char *)realloc(line->text, length + 1);
+        if (!text_buffer) {
+            return -1;
+        }
+        line->text = text_buffer;
+        line->text_capacity = length + 1;
+    }
+    memcpy(line->text, text, length);
+    line->text[length] = '\0';
+    line->joined = joined;
+    line->is_parsed = false;
+
+    return source->template_count++;
+}
+
+/* Add the templates for a line of text, split the way fgets would read it back */
+int add_source_templates(expanded_source_t *source, const char *text, size_t length, int *count) {
+    size_t chunk = MAX_LINE_LENGTH - 1;
+    int first = source->template_count;
+
+    /* fgets returns full chunks without a newline; the newline goes with the last, possibly empty, piece */
+    *count = 0;
+    while (length >= chunk) {
+        if (add_source_line(source, text, chunk, true) < 0) {
+            return -1;
+        }
+        text += chunk;
+        length -= chunk;
+        (*count)++;
+    }
+    if (add_source_line(source, text, length, false) < 0) {
+        return -1;
+    }
+    (*count)++;
+
+    return first;
+}
+
+/* Append consecutive templates as the next lines of the source */
+bool add_source_span(expanded_source_t *source, int first, int count) {
+    source_span_t *spans, *last;
+    int capacity, i;
+
+    if (count <= 0) {
+        return true;
+    }
+
+    /* A pipelined first pass starts on the lines as they are added */
+    if (source->pipe) {
+        for (i = 0; i < count; i++) {
+            push_pipeline_line(source->pipe, source->templates[first + i].text, first + i);
+        }
+    }
+
+    /* Consecutive source lines and back-to-back expansions share a span */
+    if (source->span_count > 0) {
+        last = &source->spans[source->span_count - 1];
+        if (last->first + last->count == first) {
+            last->count += count;
+            source->line_count += count;
+            return true;
+        }
+    }
+
+    if (source->span_count == source->span_capacity) {
+        capacity = source->span_capacity ? source->span_capacity * 2 : 64;
+        spans = (source_span_t *)realloc(source->spans, capacity * sizeof(source_span_t));
+        if (!spans) {
+            return false;
+        }
+        source->spans = spans;
+        source->span_capacity = capacity;
+    }
+
+    source->spans[source->span_count].first = first;
+    source->spans[source->span_count].count = count;
+    source->span_count++;
+    source->line_count += count;
+
+    return true;
+}
+
+/* Append a line of text as the next line(s) of the source */
+bool append_source_text(expanded_source_t *source, const char *text) {
+    int first, count;
+
+    first = add_source_templates(source, text, strlen(text), &count);
+    return first >= 0 && add_source_span(source, first, count);
+}
+
+/* Record a file named by a .include directive */
+bool add_source_header(expanded_source_t *source, const char *path) {
+    char **headers;
+    int capacity, i;
+
+    for (i = 0; i < source->header_count; i++) {
+        if (strcmp(source->headers[i], path) == 0) {
+            return true;
+        }
+    }
+
+    if (source->header_count == source->header_capacity) {
+        capacity = source->header_capacity ? source->header_capacity * 2 : 8;
+        headers = (char **)realloc(source->headers, capacity * sizeof(char *));
+        if (!headers) {
+            return false;
+        }
+        source->headers = headers;
+        source->header_capacity = capacity;
+    }
+
+    source->headers[source->header_count] = (char *)malloc(strlen(path) + 1);
+    if (!source->headers[source->header_count]) {
+        return false;
+    }
+    strcpy(source->headers[source->header_count], path);
+    source->header_count++;
+
+    return true;
+}
+
+/* Lay out the expanded source as the text of its .am file */
+char *format_expanded_source(const expanded_source_t *source, size_t *length) {
+    const source_template_t *line;
+    char *text;
+    size_t size = 1;
+    int i, k;
+
+    for (i = 0; i < source->span_count; i++) {
+        for (k = 0; k < source->spans[i].count; k++) {
+            line = &source->templates[source->spans[i].first + k];
+            size += strlen(line->text) + 1;
+        }
+    }
+
+    text = (char *)malloc(size);
+    if (!text) {
+        return NULL;
+    }
+
+    *length = 0;
+    for (i = 0; i < source->span_count; i++) {
+        for (k = 0; k < source->spans[i].count; k++) {
+            line = &source->templates[source->spans[i].first + k];
+            size = strlen(line->text);
+            memcpy(text + *length, line->text, size);
+            *length += size;
+            if (!line->joined) {
+                text[(*length)++] = '\n';
+            }
+        }
+    }
+
+    return text;
+}
+
+/* Write the expanded source as a .am file */
+bool write_expanded_source(const expanded_source_t *source, const char *path, error_context_t *context) {
+    FILE *file;
+    char *text;
+    size_t length;
+    bool success;
+
+    text = format_expanded_source(source, &length);
+    if (!text) {
+        report_context_error(context, "Memory allocation error for output file: %s", path);
+        return false;
+    }
+
+    file = fopen(path, "w");
+    if (!file) {
+        free(text);
+        report_context_error(context, "Could not open output file: %s", path);
+        return false;
+    }
+
+    success = fwrite(text, 1, length, file) == length;
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    free(text);
+
+    if (!success) {
+        report_context_error(context, "Error writing file: %s", path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Start a walk over the lines of the expanded source */
+void init_source_cursor(source_cursor_t *cursor) {
+    cursor->span = 0;
+    cursor->offset = 0;
+    cursor->line_number = 0;
+}
+
+/* Move to the next line of the expanded source */
+source_template_t *next_source_line(const expanded_source_t *source, source_cursor_t *cursor) {
+    const source_span_t *span;
+
+    if (cursor->span >= source->span_count) {
+        return NULL;
+    }
+
+    span = &source->spans[cursor->span];
+    cursor->line_number++;
+    if (++cursor->offset == span->count) {
+        cursor->span++;
+        cursor->offset = 0;
+        return &source->templates[span->first + span->count - 1];
+    }
+
+    return &source->templates[span->first + cursor->offset - 1];
+}
+
+/* Parse a line of the expanded source, reusing an earlier parse of its template */
+bool parse_source_line(source_template_t *line, int line_number, parsed_line_t *parsed, error_context_t *context) {
+    if (context) {
+        context->line_number = line_number;
+    }
+
+    if (!line->is_parsed) {
+        if (!parse_line(line->text, &line->parsed, line_number, context)) {
+            return false;
+        }
+        line->is_parsed = true;
+    }
+
+    *parsed = line->parsed;
+    parsed->line_number = line_number;
+
+    return true;
+}
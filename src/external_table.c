@@ -0,0 +1,176 @@
+/**
+ * @file external_table.c
+ * @brief Implementation of the external reference table
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../include/external_table.h"
+#include "../include/utils.h"
+
+/* Forward declarations for internal functions */
+static int add_external_symbol(external_table_t *table, const char *name);
+static bool grow_slots(external_table_t *table);
+
+/* Initialize an empty table */
+void init_external_table(external_table_t *table) {
+    memset(table, 0, sizeof(external_table_t));
+}
+
+/* Empty a table, keeping its arrays */
+void reset_external_table(external_table_t *table) {
+    table->count = 0;
+    table->symbol_count = 0;
+    if (table->slots) {
+        memset(table->slots, 0, table->slot_count * sizeof(int));
+    }
+}
+
+/* Release the memory held by a table */
+void free_external_table(external_table_t *table) {
+    free(table->refs);
+    free(table->symbols);
+    free(table->slots);
+    init_external_table(table);
+}
+
+/* Add an external reference */
+bool add_external_reference(external_table_t *table, const char *name, int address, error_context_t *context) {
+    external_reference_t *refs, *ref;
+    external_symbol_t *symbol;
+    int capacity, id;
+
+    /* Validate parameters */
+    if (!table || !name) {
+        report_context_error(context, "Invalid parameters for add_external_reference");
+        return false;
+    }
+
+    id = find_external_symbol(table, name);
+    if (id < 0) {
+        id = add_external_symbol(table, name);
+    }
+
+    if (id >= 0 && table->count == table->capacity) {
+        capacity = table->capacity ? table->capacity * 2 : 64;
+        refs = (external_reference_t *)realloc(table->refs, capacity * sizeof(external_reference_t));
+        if (!refs) {
+            id = -1;
+        } else {
+            table->refs = refs;
+            table->capacity = capacity;
+        }
+    }
+
+    if (id < 0) {
+        report_context_error(context, "Memory allocation error for external reference");
+        return false;
+    }
+
+    /* Append the record and link it to the end of the symbol's chain */
+    ref = &table->refs[table->count];
+    ref->symbol = id;
+    ref->address = address;
+    ref->next = -1;
+
+    symbol = &table->symbols[id];
+    if (symbol->count == 0) {
+        symbol->first = table->count;
+    } else {
+        table->refs[symbol->last].next = table->count;
+    }
+    symbol->last = table->count;
+    symbol->count++;
+    table->count++;
+
+    return true;
+}
+
+/* Find the id of a referenced external symbol */
+int find_external_symbol(const external_table_t *table, const char *name) {
+    size_t index;
+
+    if (table->slot_count == 0) {
+        return -1;
+    }
+
+    index = hash_string(name) & (table->slot_count - 1);
+    while (table->slots[index] != 0) {
+        if (strcmp(table->symbols[table->slots[index] - 1].name, name) == 0) {
+            return table->slots[index] - 1;
+        }
+        index = (index + 1) & (table->slot_count - 1);
+    }
+
+    return -1;
+}
+
+/* Get the name of the symbol a reference points at */
+const char *external_reference_name(const external_table_t *table, const external_reference_t *ref) {
+    return table->symbols[ref->symbol].name;
+}
+
+/* Helper function to give a new symbol the next id, returning -1 when out of memory */
+static int add_external_symbol(external_table_t *table, const char *name) {
+    external_symbol_t *symbols, *symbol;
+    size_t index;
+    int capacity;
+
+    /* Keep the hash at most half full */
+    if ((size_t)(table->symbol_count + 1) * 2 > table->slot_count && !grow_slots(table)) {
+        return -1;
+    }
+
+    if (table->symbol_count == table->symbol_capacity) {
+        capacity = table->symbol_capacity ? table->symbol_capacity * 2 : 16;
+        symbols = (external_symbol_t *)realloc(table->symbols, capacity * sizeof(external_symbol_t));
+        if (!symbols) {
+            return -1;
+        }
+        table->symbols = symbols;
+        table->symbol_capacity = capacity;
+    }
+
+    symbol = &table->symbols[table->symbol_count];
+    strncpy(symbol->name, name, MAX_LABEL_LENGTH - 1);
+    symbol->name[MAX_LABEL_LENGTH - 1] = '\0';
+    symbol->length = (int)strlen(symbol->name);
+    symbol->first = -1;
+    symbol->last = -1;
+    symbol->count = 0;
+
+    index = hash_string(symbol->name) & (table->slot_count - 1);
+    while (table->slots[index] != 0) {
+        index = (index + 1) & (table->slot_count - 1);
+    }
+    table->slots[index] = table->symbol_count + 1;
+
+    return table->symbol_count++;
+}
+
+/* Helper function to double the hash slots and reinsert every symbol */
+static bool grow_slots(external_table_t *table) {
+    size_t slot_count = table->slot_count ? table->slot_count * 2 : 32;
+    size_t index;
+    int *slots;
+    int i;
+
+    slots = (int *)calloc(slot_count, sizeof(int));
+    if (!slots) {
+        return false;
+    }
+
+    for (i = 0; i < table->symbol_count; i++) {
+        index = hash_string(table->symbols[i].name) & (slot_count - 1);
+        while (slots[index] != 0) {
+            index = (index + 1) & (slot_count - 1);
+        }
+        slots[index] = i + 1;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+
+    return true;
+}
@@ -3,11 +3,15 @@
  * @brief Implementation of the first pass of the assembler
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "../include/first_pass.h"
+#include "../include/expanded_source.h"
 #include "../include/utils.h"
 
 /* Forward declarations for internal functions */
@@ -16,6 +20,7 @@ static bool process_label(const char *label, symbol_table_t *symbols, int addres
 static instruction_type_t get_directive_type(const char *directive);
 static int parse_numbers_list(const char *str, int numbers[], int max_count, error_context_t *context);
 static char *safe_strtok_r(char *str, const char *delim, char **saveptr);
+static bool record_incbin_size(first_pass_state_t *state, long size, error_context_t *context);
 
 /* Parse a line into its components */
 bool parse_line(const char *line, parsed_line_t *parsed, int line_number, error_context_t *context) {
@@ -145,6 +150,79 @@ bool parse_line(const char *line, parsed_line_t *parsed, int line_number, error_
                 parsed->operand_count = 1;
             }
         }
+        else if (parsed->type == INST_TYPE_INCBIN) {
+            /* A quoted path, optionally followed by ", offset, length" */
+            token = safe_strtok_r(NULL, "", &saveptr);
+            token = token ? trim(token) : NULL;
+            if (!token || token[0] != '"' || !(next_token = strchr(token + 1, '"'))) {
+                report_context_error(context, "File name must be enclosed in quotes for .incbin directive");
+                return false;
+            }
+            if (next_token == token + 1) {
+                report_context_error(context, "Empty file name for .incbin directive");
+                return false;
+            }
+            if (next_token - token - 1 >= MAX_OPERAND_LENGTH) {
+                report_context_error(context, "File name too long for .incbin directive");
+                return false;
+            }
+
+            /* Store the path without quotes */
+            memcpy(parsed->operands[0], token + 1, next_token - token - 1);
+            parsed->operands[0][next_token - token - 1] = '\0';
+            parsed->operand_count = 1;
+
+            /* Store the range, if any */
+            token = trim(next_token + 1);
+            if (*token) {
+                if (*token != ',') {
+                    report_context_error(context, "Extra tokens after file name in .incbin directive");
+                    return false;
+                }
+                token = trim(token + 1);
+                if (strlen(token) >= MAX_OPERAND_LENGTH) {
+                    report_context_error(context, "Invalid range for .incbin directive: %s", token);
+                    return false;
+                }
+                strcpy(parsed->operands[1], token);
+                parsed->operand_count = 2;
+            }
+        }
+        else if (parsed->type == INST_TYPE_FILL) {
+            /* ".space count" or ".fill count, value" */
+            bool is_fill = strcmp(token, ".fill") == 0;
+
+            token = safe_strtok_r(NULL, "", &saveptr);
+            token = token ? trim(token) : NULL;
+            if (!token || !*token) {
+                report_context_error(context, "No count specified for %s directive", is_fill ? ".fill" : ".space");
+                return false;
+            }
+
+            next_token = strchr(token, ',');
+            if (is_fill != (next_token != NULL)) {
+                report_context_error(context, is_fill ? "Expected count, value for .fill directive" :
+                                                        "Too many values for .space directive");
+                return false;
+            }
+            if (next_token) {
+                *next_token = '\0';
+                next_token = trim(next_token + 1);
+            }
+
+            /* Store the count and the .fill value */
+            token = trim(token);
+            if (strlen(token) >= MAX_OPERAND_LENGTH || (next_token && strlen(next_token) >= MAX_OPERAND_LENGTH)) {
+                report_context_error(context, "Operand too long for %s directive", is_fill ? ".fill" : ".space");
+                return false;
+            }
+            strcpy(parsed->operands[0], token);
+            parsed->operand_count = 1;
+            if (next_token) {
+                strcpy(parsed->operands[1], next_token);
+                parsed->operand_count = 2;
+            }
+        }
         else if (parsed->type == INST_TYPE_ENTRY || parsed->type == INST_TYPE_EXTERN) {
             /* Get the symbol name */
             token = safe_strtok_r(NULL, " \t", &saveptr);
@@ -277,6 +355,144 @@ bool process_string_directive(parsed_line_t *line, symbol_table_t *symbols, int
     return true;
 }
 
+/* Process a .incbin directive */
+bool process_incbin_directive(parsed_line_t *line, symbol_table_t *symbols, int *DC, const char *source,
+                              error_context_t *context) {
+    incbin_range_t range;
+
+    /* Set current line number in error context */
+    if (context) {
+        context->line_number = line->line_number;
+    }
+
+    /* Process the label if present */
+    if (line->label[0] != '\0') {
+        if (!process_label(line->label, symbols, *DC + MEMORY_START, SYMBOL_ATTR_DATA, context)) {
+            return false;
+        }
+    }
+
+    /* Reserve one data word per byte */
+    if (!resolve_incbin(line, source, &range, context)) {
+        return false;
+    }
+    *DC += (int)range.length;
+
+    return true;
+}
+
+/* Resolve the file and byte range of a .incbin directive */
+bool resolve_incbin(const parsed_line_t *line, const char *source, incbin_range_t *range, error_context_t *context) {
+    struct stat info;
+    const char *path = line->operands[0];
+    const char *slash, *end, *next;
+    size_t directory = 0;
+    int offset, length;
+
+    if (!source) {
+        report_context_error(context, ".incbin is not available for a source assembled from memory");
+        return false;
+    }
+
+    /* Relative paths are taken from the directory of the source file */
+    slash = strrchr(source, '/');
+    if (path[0] != '/' && slash) {
+        directory = (size_t)(slash - source) + 1;
+    }
+    if (directory + strlen(path) >= MAX_FILENAME_LENGTH) {
+        report_context_error(context, "File name too long: %s", path);
+        return false;
+    }
+    memcpy(range->path, source, directory);
+    strcpy(range->path + directory, path);
+
+    if (stat(range->path, &info) != 0 || !S_ISREG(info.st_mode)) {
+        report_context_error(context, "Could not open file: %s", range->path);
+        return false;
+    }
+    range->offset = 0;
+    range->length = (long)info.st_size;
+
+    /* "offset, length" selects part of the file; a range that includes nothing is a mistake */
+    if (line->operand_count > 1) {
+        end = line->operands[1] + strlen(line->operands[1]);
+        if (parse_word_number(line->operands[1], end, &next, &offset) != NUMBER_OK || *next != ',' ||
+            parse_word_number(next + 1, end, &next, &length) != NUMBER_OK || next != end ||
+            offset < 0 || length < 0) {
+            report_context_error(context, "Invalid range for .incbin directive (expected offset, length): %s",
+                                 line->operands[1]);
+            return false;
+        }
+        if (length == 0) {
+            report_context_error(context, "Empty range for .incbin directive: %s", line->operands[1]);
+            return false;
+        }
+        if ((long)offset + length > range->length) {
+            report_context_error(context, "Range %d, %d is past the end of %s (%ld bytes)",
+                                 offset, length, range->path, range->length);
+            return false;
+        }
+        range->offset = offset;
+        range->length = length;
+    }
+
+    return true;
+}
+
+/* Process a .space or .fill directive */
+bool process_fill_directive(parsed_line_t *line, symbol_table_t *symbols, int *DC, error_context_t *context) {
+    int count, value;
+
+    /* Set current line number in error context */
+    if (context) {
+        context->line_number = line->line_number;
+    }
+
+    /* Process the label if present */
+    if (line->label[0] != '\0') {
+        if (!process_label(line->label, symbols, *DC + MEMORY_START, SYMBOL_ATTR_DATA, context)) {
+            return false;
+        }
+    }
+
+    /* The count alone advances the data counter */
+    if (!parse_fill_directive(line, &count, &value, context)) {
+        return false;
+    }
+    *DC += count;
+
+    return true;
+}
+
+/* Get the word count and value of a .space or .fill directive */
+bool parse_fill_directive(const parsed_line_t *line, int *count, int *value, error_context_t *context) {
+    const char *end, *next;
+    number_status_t status;
+
+    end = line->operands[0] + strlen(line->operands[0]);
+    status = parse_word_number(line->operands[0], end, &next, count);
+    if (status != NUMBER_OK || next != end || *count < 0) {
+        report_context_error(context, "Invalid count: %s", line->operands[0]);
+        return false;
+    }
+
+    *value = 0;
+    if (line->operand_count > 1) {
+        end = line->operands[1] + strlen(line->operands[1]);
+        status = parse_word_number(line->operands[1], end, &next, value);
+        if (status == NUMBER_OUT_OF_RANGE) {
+            report_context_error(context, "Number out of 21-bit range: %s", line->operands[1]);
+            return false;
+        }
+        if (status != NUMBER_OK || next != end) {
+            report_context_error(context, "Invalid number format: %s", line->operands[1]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /* Process a .extern directive */
 bool process_extern_directive(parsed_line_t *line, symbol_table_t *symbols, error_context_t *context) {
     const char *symbol_name = line->operands[0];
@@ -427,9 +643,9 @@ int calculate_instruction_length(const char *opcode, const char *operand1, const
             length++;
         }
 
-        /* Special case: if both operands are registers, they share a word */
+        /* Special case: if both operands are registers, they share one extra register word */
         if (src_addr == ADDR_REGISTER && dst_addr == ADDR_REGISTER) {
-            length--;
+            length++;
         }
 
         /* Validate lea instruction - source operand must be a label (direct addressing) */
@@ -501,98 +717,143 @@ int calculate_instruction_length(const char *opcode, const char *operand1, const
     return -1;
 }
 
-/* Main function for the first pass */
-bool first_pass(const char *filename, symbol_table_t *symbols, error_context_t *context) {
-    FILE *file;
-    char base_filename[MAX_FILENAME_LENGTH];
-    char am_filename[MAX_FILENAME_LENGTH];
-    char line_buf[MAX_LINE_LENGTH];
-    parsed_line_t parsed_line;
-    int IC = 0;  /* Instruction Counter */
-    int DC = 0;  /* Data Counter */
-    int line_number = 0;
-    bool success = true;
+/* Start a first pass over a file */
+void begin_first_pass(first_pass_state_t *state, const char *filename, error_context_t *context) {
+    state->IC = 0;
+    state->DC = 0;
+    state->success = true;
+    state->incbin_sizes = NULL;
+    state->incbin_count = 0;
+    state->incbin_capacity = 0;
 
     /* Initialize/update error context */
-    if (context) {
+    if (context && filename) {
         strncpy(context->filename, filename, MAX_FILENAME_LENGTH - 1);
         context->filename[MAX_FILENAME_LENGTH - 1] = '\0';
         context->line_number = 0;
     }
+}
 
-    /* Build the .am filename */
-    get_base_filename(filename, base_filename);
-    create_filename(base_filename, EXT_MACRO, am_filename);
+/* Process one parsed line of the expanded source */
+void first_pass_line(first_pass_state_t *state, parsed_line_t *parsed_line, const char *filename,
+                     symbol_table_t *symbols, error_context_t *context) {
+    bool success = true;
+    int start;
+    int start_IC = state->IC, start_DC = state->DC;
 
-    /* Open the file */
-    file = fopen(am_filename, "r");
-    if (!file) {
-        report_context_error(context, "Could not open file: %s", am_filename);
-        return false;
+    /* Skip empty lines, comments, and invalid lines */
+    if (parsed_line->type == INST_TYPE_INVALID) {
+        return;
     }
 
-    /* First pass through the file */
-    while (fgets(line_buf, MAX_LINE_LENGTH, file)) {
-        line_number++;
-        if (context) {
-            context->line_number = line_number;
-        }
+    /* Process the line based on its type */
+    switch (parsed_line->type) {
+        case INST_TYPE_DATA:
+            success = process_data_directive(parsed_line, symbols, &state->DC, context);
+            break;
+
+        case INST_TYPE_STRING:
+            success = process_string_directive(parsed_line, symbols, &state->DC, context);
+            break;
+
+        case INST_TYPE_INCBIN:
+            /* The second pass encodes the size found here, whatever the file holds by then */
+            start = state->DC;
+            success = process_incbin_directive(parsed_line, symbols, &state->DC, filename, context) &&
+                      record_incbin_size(state, state->DC - start, context);
+            break;
+
+        case INST_TYPE_FILL:
+            success = process_fill_directive(parsed_line, symbols, &state->DC, context);
+            break;
 
-        /* Parse the line */
-        if (!parse_line(line_buf, &parsed_line, line_number, context)) {
+        case INST_TYPE_EXTERN:
+            success = process_extern_directive(parsed_line, symbols, context);
+            break;
+
+        case INST_TYPE_ENTRY:
+            success = process_entry_directive(parsed_line, context);
+            break;
+
+        case INST_TYPE_CODE:
+            success = process_instruction(parsed_line, symbols, &state->IC, context);
+            break;
+
+        default:
+            report_context_error(context, "Unknown instruction type");
             success = false;
-            continue;
-        }
+            break;
+    }
 
-        /* Skip empty lines, comments, and invalid lines */
-        if (parsed_line.type == INST_TYPE_INVALID) {
-            continue;
-        }
+    /* Labels and the simulator address memory with 21 bits; a line that does not fit leaves the counters as they were */
+    if (success && state->IC + state->DC > MEMORY_END - MEMORY_START) {
+        report_context_error(context, "Program exceeds the 21-bit address space");
+        state->IC = start_IC;
+        state->DC = start_DC;
+        success = false;
+    }
 
-        /* Process the line based on its type */
-        switch (parsed_line.type) {
-            case INST_TYPE_DATA:
-                if (!process_data_directive(&parsed_line, symbols, &DC, context)) {
-                    success = false;
-                }
-                break;
+    if (!success) {
+        state->success = false;
+    }
+}
 
-            case INST_TYPE_STRING:
-                if (!process_string_directive(&parsed_line, symbols, &DC, context)) {
-                    success = false;
-                }
-                break;
+/* Finish a first pass once every line was processed */
+bool end_first_pass(first_pass_state_t *state, symbol_table_t *symbols, expanded_source_t *source) {
+    /* Update addresses of data symbols to be after code section */
+    update_data_symbols(symbols, state->IC);
 
-            case INST_TYPE_EXTERN:
-                if (!process_extern_directive(&parsed_line, symbols, context)) {
-                    success = false;
-                }
-                break;
+    /* The sizes replace those of an earlier pass over the source */
+    free(source->incbin_sizes);
+    source->incbin_sizes = state->incbin_sizes;
+    source->incbin_count = state->incbin_count;
+    state->incbin_sizes = NULL;
 
-            case INST_TYPE_ENTRY:
-                if (!process_entry_directive(&parsed_line, context)) {
-                    success = false;
-                }
-                break;
+    return state->success;
+}
 
-            case INST_TYPE_CODE:
-                if (!process_instruction(&parsed_line, symbols, &IC, context)) {
-                    success = false;
-                }
-                break;
+/* Main function for the first pass */
+bool first_pass(const char *filename, expanded_source_t *source, symbol_table_t *symbols, error_context_t *context) {
+    first_pass_state_t state;
+    source_cursor_t cursor;
+    source_template_t *line;
+    parsed_line_t parsed_line;
 
-            default:
-                report_context_error(context, "Unknown instruction type");
-                success = false;
-                break;
+    begin_first_pass(&state, filename, context);
+
+    /* First pass through the expanded source */
+    init_source_cursor(&cursor);
+    while ((line = next_source_line(source, &cursor)) != NULL) {
+        /* Parse the line (macro lines reuse the parse of their first expansion) */
+        if (!parse_source_line(line, cursor.line_number, &parsed_line, context)) {
+            state.success = false;
+            continue;
         }
+
+        first_pass_line(&state, &parsed_line, filename, symbols, context);
     }
 
-    /* Update addresses of data symbols to be after code section */
-    update_data_symbols(symbols, IC);
+    return end_first_pass(&state, symbols, source);
+}
 
-    fclose(file);
-    return success;
+/* Helper function to remember the size of a .incbin line */
+static bool record_incbin_size(first_pass_state_t *state, long size, error_context_t *context) {
+    long *sizes;
+    int capacity;
+
+    if (state->incbin_count == state->incbin_capacity) {
+        capacity = state->incbin_capacity ? state->incbin_capacity * 2 : 8;
+        sizes = (long *)realloc(state->incbin_sizes, capacity * sizeof(long));
+        if (!sizes) {
+            report_context_error(context, "Memory allocation error for .incbin sizes");
+            return false;
+        }
+        state->incbin_sizes = sizes;
+        state->incbin_capacity = capacity;
+    }
+
+    state->incbin_sizes[state->incbin_count++] = size;
+    return true;
 }
 
 /* Helper function to process a label */
@@ -633,18 +894,23 @@ static instruction_type_t get_directive_type(const char *directive) {
     else if (strcmp(directive, ".entry") == 0) {
         return INST_TYPE_ENTRY;
     }
+    else if (strcmp(directive, ".space") == 0 || strcmp(directive, ".fill") == 0) {
+        return INST_TYPE_FILL;
+    }
+    else if (strcmp(directive, ".incbin") == 0) {
+        return INST_TYPE_INCBIN;
+    }
     else if (strcmp(directive, ".extern") == 0) {
         return INST_TYPE_EXTERN;
     }
     return INST_TYPE_INVALID;
 }
 
-/* Helper function to parse a list of comma-separated numbers */
+/* Helper function to parse a list of comma-separated numbers in one scan */
 static int parse_numbers_list(const char *str, int numbers[], int max_count, error_context_t *context) {
-    char str_copy[MAX_LINE_LENGTH];
-    char *token;
-    char *saveptr = NULL;
+    const char *end, *item, *next;
     int count = 0;
+    int value = 0;
 
     /* Check for NULL pointer */
     if (!str) {
@@ -652,38 +918,28 @@ static int parse_numbers_list(const char *str, int numbers[], int max_count, err
         return 0;
     }
 
-    /* Copy the string for tokenization */
-    strncpy(str_copy, str, MAX_LINE_LENGTH - 1);
-    str_copy[MAX_LINE_LENGTH - 1] = '\0';
-
-    /* Get the first token */
-    token = safe_strtok_r(str_copy, ",", &saveptr);
-
-    /* Parse each token */
-    while (token && count < max_count) {
-        /* Trim whitespace */
-        token = trim(token);
+    /* Every item up to the end, so a trailing comma leaves an empty one */
+    end = str + strlen(str);
+    for (item = str; ; item = next + 1) {
+        if (!parse_data_item(item, end, &next, &value, context)) {
+            return -1;
+        }
 
-        /* Check if the token is a valid integer */
-        if (!is_integer(token)) {
-            report_context_error(context, "Invalid number format: %s", token);
+        /* Check if we have more numbers than room */
+        if (count >= max_count) {
+            report_context_error(context, "Too many numbers in list");
             return -1;
         }
 
-        /* Convert to integer and store */
+        /* Store the value */
         if (numbers) {
-            numbers[count] = string_to_int(token);
+            numbers[count] = value;
         }
         count++;
 
-        /* Get next token */
-        token = safe_strtok_r(NULL, ",", &saveptr);
-    }
-
-    /* Check if we have more tokens (too many numbers) */
-    if (token && count >= max_count) {
-        report_context_error(context, "Too many numbers in list");
-        return -1;
+        if (next == end) {
+            break;
+        }
     }
 
     return count;
@@ -0,0 +1,1032 @@
+/**
+ * @file incremental.c
+ * @brief Implementation of incremental re-assembly for editor integration
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/incremental.h"
+#include "../include/assembler_context.h"
+#include "../include/first_pass.h"
+#include "../include/second_pass.h"
+#include "../include/utils.h"
+
+/**
+ * @brief Cache entry for one line of the expanded source
+ *
+ * Entries live in a pool and keep their index while lines are inserted and
+ * removed around them; the session's order array lists them by position.
+ * Reference chains link operands, numbered entry * MAX_OPERANDS + operand.
+ */
+typedef struct {
+    bool live;                    /* The entry holds a line */
+    char *text;                   /* Line text, compared with the next expansion (NULL = never equal) */
+    size_t length;
+    size_t capacity;
+    bool joined;                  /* Template flag, compared as well */
+    int position;                 /* Index of the line in the expanded source */
+    bool parsed_ok;               /* The line parsed */
+    bool valid;                   /* The line passed the first pass checks that need no symbols */
+    bool failed;                  /* The first pass fails on this line */
+    bool pending;                 /* The entry is in the queue of lines to encode */
+    bool encode_failed;           /* The second pass fails on this line */
+    bool relative;                /* An operand uses relative addressing */
+    parsed_line_t parsed;
+    int size;                     /* Words the line adds to IC or DC */
+    int ic;                       /* Instruction counter before the line (-1 = not placed yet) */
+    int dc;                       /* Data counter before the line */
+    int symbol;                   /* Symbol the line defines or declares external (-1 = none) */
+    int prev_definition;          /* Neighbours in the symbol's chain of definitions */
+    int next_definition;
+    int references[MAX_OPERANDS]; /* Symbols the operands refer to (-1 = none) */
+    int prev_reference[MAX_OPERANDS];
+    int next_reference[MAX_OPERANDS];
+    instruction_code_t code;      /* Encoding of an instruction */
+    diagnostic_list_t local;      /* First pass: parse errors and checks that need no symbols */
+    diagnostic_list_t conflicts;  /* First pass: a symbol defined again */
+    diagnostic_list_t encoding;   /* Second pass */
+} cached_line_t;
+
+/**
+ * @brief A name defined or referred to somewhere in the file
+ */
+typedef struct {
+    char name[MAX_LABEL_LENGTH];
+    int definitions;              /* Chain of lines defining or declaring it (-1 = none) */
+    int references;               /* Chain of operands referring to it (-1 = none) */
+    symbol_attr_t attributes;     /* As the first pass resolves it (SYMBOL_ATTR_NONE = undefined) */
+    int value;
+    bool dirty;                   /* Queued to be resolved again */
+} session_symbol_t;
+
+/**
+ * @brief State of an edit session
+ */
+struct edit_session {
+    char filename[MAX_FILENAME_LENGTH];
+    char *text;                   /* Source text, every line ending with a newline */
+    size_t length;
+    size_t capacity;
+    int source_lines;
+    assembler_context_t assembler; /* Macro table and expanded source reused by every update */
+    bool expanded;                /* The last expansion succeeded */
+    diagnostic_list_t expansion;  /* Diagnostics of the last expansion */
+    cached_line_t *lines;         /* Pool of cache entries */
+    int pool_size;
+    int *free_lines;              /* Unused entries of the pool */
+    int free_count;
+    int *order;                   /* Entries by position */
+    int line_count;
+    int order_capacity;
+    source_template_t **fresh;    /* Lines of the new expansion */
+    int fresh_capacity;
+    session_symbol_t *symbols;
+    int symbol_count;
+    int symbol_capacity;
+    int *slots;                   /* Hash slots holding symbol id + 1 (0 = empty) */
+    size_t slot_count;
+    int *dirty;                   /* Symbols to resolve again */
+    int dirty_count;
+    int *pending;                 /* Entries to encode once the first pass succeeds */
+    int pending_count;
+    int failed_lines;             /* Lines the first pass fails on */
+    int encode_failures;          /* Lines the second pass fails on */
+    int ICF;                      /* Final instruction counter */
+    symbol_table_t *scratch;      /* Symbols of the line being encoded */
+    external_table_t scratch_refs;
+    diagnostic_t *report;         /* Diagnostics of the current text */
+    int report_count;
+    int report_capacity;
+    edit_stats_t stats;
+};
+
+/* Forward declarations for internal functions */
+static bool update_session(edit_session_t *session, error_context_t *context);
+static bool reserve_lines(edit_session_t *session, int needed);
+static bool same_line(const cached_line_t *line, const source_template_t *template);
+static void lex_line(edit_session_t *session, int entry, source_template_t *template, int position);
+static void release_line(edit_session_t *session, int entry);
+static void place_lines(edit_session_t *session, int start, int window_end, bool shifted);
+static void resolve_symbol(edit_session_t *session, int id);
+static void encode_line(edit_session_t *session, int entry);
+static void update_line_status(edit_session_t *session, int entry);
+static void queue_encode(edit_session_t *session, int entry);
+static void mark_dirty(edit_session_t *session, int id);
+static int intern_symbol(edit_session_t *session, const char *name);
+static bool grow_symbol_slots(edit_session_t *session);
+static void define_symbol(edit_session_t *session, int entry, const char *name);
+static void add_reference(edit_session_t *session, int entry, int operand, const char *name);
+static void unlink_reference(edit_session_t *session, int node);
+static bool build_report(edit_session_t *session, error_context_t *context);
+static bool append_report(edit_session_t *session, const diagnostic_list_t *list, int line_number);
+static size_t line_offset(const char *text, size_t length, int line);
+
+/* Load a source file into a new session and check it */
+edit_session_t *create_edit_session(const char *filename, error_context_t *context) {
+    edit_session_t *session;
+    FILE *file;
+    long size;
+    size_t i;
+
+    if (strlen(filename) >= MAX_FILENAME_LENGTH) {
+        report_context_error(context, "File name too long: %s", filename);
+        return NULL;
+    }
+
+    session = (edit_session_t *)calloc(1, sizeof(edit_session_t));
+    if (!session || !init_assembler_context(&session->assembler)) {
+        free(session);
+        report_context_error(context, "Memory allocation error for edit session");
+        return NULL;
+    }
+    strcpy(session->filename, filename);
+    init_external_table(&session->scratch_refs);
+    session->scratch = create_symbol_table();
+
+    file = fopen(filename, "rb");
+    if (!file) {
+        report_context_error(context, "Could not open source file: %s", filename);
+        destroy_edit_session(session);
+        return NULL;
+    }
+
+    /* The text always ends with a newline, so an edit can append lines */
+    if (fseek(file, 0L, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0L, SEEK_SET) == 0) {
+        session->capacity = (size_t)size + 2;
+        session->text = (char *)malloc(session->capacity);
+        if (session->text && fread(session->text, 1, (size_t)size, file) == (size_t)size) {
+            session->length = (size_t)size;
+        } else {
+            free(session->text);
+            session->text = NULL;
+        }
+    }
+    fclose(file);
+
+    if (!session->text || !session->scratch) {
+        report_context_error(context, "Could not read source file: %s", filename);
+        destroy_edit_session(session);
+        return NULL;
+    }
+    if (session->length > 0 && session->text[session->length - 1] != '\n') {
+        session->text[session->length++] = '\n';
+    }
+    for (i = 0; i < session->length; i++) {
+        if (session->text[i] == '\n') {
+            session->source_lines++;
+        }
+    }
+
+    if (!update_session(session, context)) {
+        destroy_edit_session(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+/* Replace a range of source lines and check the result */
+bool apply_source_edit(edit_session_t *session, int first, int last, const char *text, size_t length,
+                       error_context_t *context) {
+    size_t start, end, added, new_length, capacity;
+    char *buffer;
+    int lines = 0;
+    size_t i;
+
+    if (first < 1 || first > session->source_lines + 1 || last < first - 1 || last > session->source_lines) {
+        report_context_error(context, "Invalid line range %d-%d (the text has %d lines)", first, last,
+                             session->source_lines);
+        return false;
+    }
+
+    /* The new lines, with a newline after the last one */
+    for (i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            lines++;
+        }
+    }
+    added = length;
+    if (length > 0 && text[length - 1] != '\n') {
+        added++;
+        lines++;
+    }
+
+    start = line_offset(session->text, session->length, first);
+    end = line_offset(session->text, session->length, last + 1);
+    new_length = session->length - (end - start) + added;
+
+    if (new_length > session->capacity) {
+        capacity = session->capacity * 2 > new_length ? session->capacity * 2 : new_length;
+        buffer = (char *)realloc(session->text, capacity);
+        if (!buffer) {
+            report_context_error(context, "Memory allocation error for source text");
+            return false;
+        }
+        session->text = buffer;
+        session->capacity = capacity;
+    }
+
+    memmove(session->text + start + added, session->text + end, session->length - end);
+    memcpy(session->text + start, text, length);
+    if (added > length) {
+        session->text[start + length] = '\n';
+    }
+    session->length = new_length;
+    session->source_lines += lines - (last - first + 1);
+
+    return update_session(session, context);
+}
+
+/* Get the diagnostics of the current text */
+const diagnostic_t *get_session_diagnostics(const edit_session_t *session, int *count) {
+    *count = session->report_count;
+    return session->report;
+}
+
+/* Get what the last update did */
+void get_edit_stats(const edit_session_t *session, edit_stats_t *stats) {
+    *stats = session->stats;
+}
+
+/* Check the current text from scratch and compare with the session */
+bool verify_edit_session(edit_session_t *session, error_context_t *context) {
+    assembler_context_t *ctx = &session->assembler;
+    diagnostic_list_t full;
+    error_context_t error;
+    int ICF = 0, DCF = 0, i;
+    bool same;
+
+    /* The passes --check runs, with the messages collected */
+    memset(&full, 0, sizeof(full));
+    init_error_context(&error, session->filename);
+    error.diagnostics = &full;
+    if (process_loaded_file(session->filename, session->text, session->length, NULL, ctx->macros, &ctx->source,
+                            false, &error)) {
+        reset_symbol_table(ctx->symbols);
+        if (first_pass(session->filename, &ctx->source, ctx->symbols, &error)) {
+            second_pass(session->filename, &ctx->source, ctx->symbols, NULL, &ctx->data_image, &ctx->ext_refs,
+                        &ICF, &DCF, &error);
+        }
+    }
+
+    same = full.count == session->report_count;
+    for (i = 0; same && i < full.count; i++) {
+        same = full.items[i].severity == session->report[i].severity &&
+               full.items[i].line_number == session->report[i].line_number &&
+               strcmp(full.items[i].message, session->report[i].message) == 0;
+    }
+    if (!same) {
+        report_context_error(context, "Incremental diagnostics differ from a full check (%d and %d messages)",
+                             session->report_count, full.count);
+    }
+
+    free_diagnostics(&full);
+    return same;
+}
+
+/* Release a session */
+void destroy_edit_session(edit_session_t *session) {
+    int i;
+
+    if (!session) {
+        return;
+    }
+
+    for (i = 0; i < session->pool_size; i++) {
+        free(session->lines[i].text);
+        free_diagnostics(&session->lines[i].local);
+        free_diagnostics(&session->lines[i].conflicts);
+        free_diagnostics(&session->lines[i].encoding);
+    }
+    free(session->lines);
+    free(session->free_lines);
+    free(session->order);
+    free(session->fresh);
+    free(session->symbols);
+    free(session->slots);
+    free(session->dirty);
+    free(session->pending);
+    free(session->report);
+    free(session->text);
+    free_diagnostics(&session->expansion);
+    free_external_table(&session->scratch_refs);
+    free_symbol_table(session->scratch);
+    free_assembler_context(&session->assembler);
+    free(session);
+}
+
+/* Helper function to bring the cache up to date with the text, redoing only what the edit touched */
+static bool update_session(edit_session_t *session, error_context_t *context) {
+    error_context_t error;
+    source_cursor_t cursor;
+    source_template_t *template, **fresh;
+    cached_line_t *line;
+    int old_count = session->line_count;
+    int new_count, prefix = 0, suffix = 0, removed, added, capacity, entry, i;
+    int *order;
+
+    session->stats.relexed = 0;
+    session->stats.encoded = 0;
+
+    /* Expand the macros again; the cache keeps the last successful expansion */
+    init_error_context(&error, session->filename);
+    clear_diagnostics(&session->expansion);
+    error.diagnostics = &session->expansion;
+    session->expanded = process_loaded_file(session->filename, session->text, session->length, NULL,
+                                            session->assembler.macros, &session->assembler.source, false, &error);
+    if (!session->expanded) {
+        return build_report(session, context);
+    }
+
+    /* Lines of the new expansion */
+    new_count = session->assembler.source.line_count;
+    if (new_count > session->fresh_capacity) {
+        capacity = session->fresh_capacity ? session->fresh_capacity : 64;
+        while (capacity < new_count) {
+            capacity *= 2;
+        }
+        fresh = (source_template_t **)realloc(session->fresh, capacity * sizeof(source_template_t *));
+        if (!fresh) {
+            report_context_error(context, "Memory allocation error for edit session");
+            return false;
+        }
+        session->fresh = fresh;
+        session->fresh_capacity = capacity;
+    }
+    init_source_cursor(&cursor);
+    for (i = 0; i < new_count && (template = next_source_line(&session->assembler.source, &cursor)) != NULL; i++) {
+        session->fresh[i] = template;
+    }
+    new_count = i;
+
+    /* Unchanged lines at both ends keep their cache entries */
+    while (prefix < old_count && prefix < new_count &&
+           same_line(&session->lines[session->order[prefix]], session->fresh[prefix])) {
+        prefix++;
+    }
+    while (suffix < old_count - prefix && suffix < new_count - prefix &&
+           same_line(&session->lines[session->order[old_count - 1 - suffix]],
+                     session->fresh[new_count - 1 - suffix])) {
+        suffix++;
+    }
+    removed = old_count - prefix - suffix;
+    added = new_count - prefix - suffix;
+
+    /* Reserve everything before touching the cache, so it is never left half updated */
+    if (new_count > session->order_capacity) {
+        capacity = session->order_capacity ? session->order_capacity : 64;
+        while (capacity < new_count) {
+            capacity *= 2;
+        }
+        order = (int *)realloc(session->order, capacity * sizeof(int));
+        if (!order) {
+            report_context_error(context, "Memory allocation error for edit session");
+            return false;
+        }
+        session->order = order;
+        session->order_capacity = capacity;
+    }
+    if (!reserve_lines(session, session->pool_size - session->free_count + added)) {
+        report_context_error(context, "Memory allocation error for edit session");
+        return false;
+    }
+
+    for (i = prefix; i < prefix + removed; i++) {
+        release_line(session, session->order[i]);
+    }
+    memmove(session->order + prefix + added, session->order + prefix + removed, suffix * sizeof(int));
+    session->line_count = new_count;
+
+    for (i = prefix; i < prefix + added; i++) {
+        entry = session->free_lines[--session->free_count];
+        session->order[i] = entry;
+        lex_line(session, entry, session->fresh[i], i);
+    }
+    session->stats.relexed = added;
+
+    /* Addresses from the first changed line on, then the symbols that moved or changed */
+    place_lines(session, prefix, prefix + added, removed != added);
+    for (i = 0; i < session->dirty_count; i++) {
+        resolve_symbol(session, session->dirty[i]);
+    }
+    session->dirty_count = 0;
+
+    /* The second pass only runs on a file the first pass accepts */
+    if (session->failed_lines == 0) {
+        for (i = 0; i < session->pending_count; i++) {
+            entry = session->pending[i];
+            line = &session->lines[entry];
+            line->pending = false;
+
+            /* The entry may have been released and reused by another kind of line since it was queued */
+            if (line->live && line->parsed_ok &&
+                (line->parsed.type == INST_TYPE_CODE || line->parsed.type == INST_TYPE_ENTRY)) {
+                encode_line(session, entry);
+            }
+        }
+        session->pending_count = 0;
+    }
+
+    return build_report(session, context);
+}
+
+/* Helper function to make room for the given number of live cache entries */
+static bool reserve_lines(edit_session_t *session, int needed) {
+    cached_line_t *lines;
+    int *free_lines, *pending;
+    int size = session->pool_size ? session->pool_size : 64;
+    int i;
+
+    if (needed <= session->pool_size) {
+        return true;
+    }
+    while (size < needed) {
+        size *= 2;
+    }
+
+    /* Every entry can be free or pending at most once */
+    lines = (cached_line_t *)realloc(session->lines, size * sizeof(cached_line_t));
+    if (!lines) {
+        return false;
+    }
+    session->lines = lines;
+    free_lines = (int *)realloc(session->free_lines, size * sizeof(int));
+    if (!free_lines) {
+        return false;
+    }
+    session->free_lines = free_lines;
+    pending = (int *)realloc(session->pending, size * sizeof(int));
+    if (!pending) {
+        return false;
+    }
+    session->pending = pending;
+
+    /* New entries go on the free list, lowest index on top */
+    memset(lines + session->pool_size, 0, (size - session->pool_size) * sizeof(cached_line_t));
+    for (i = size - 1; i >= session->pool_size; i--) {
+        session->free_lines[session->free_count++] = i;
+    }
+    session->pool_size = size;
+
+    return true;
+}
+
+/* Helper function to compare a cached line with a line of the new expansion */
+static bool same_line(const cached_line_t *line, const source_template_t *template) {
+    size_t length = strlen(template->text);
+
+    return line->text && line->length == length && line->joined == template->joined &&
+           memcmp(line->text, template->text, length) == 0;
+}
+
+/* Helper function to parse a new line and run the first pass checks that need no symbols */
+static void lex_line(edit_session_t *session, int entry, source_template_t *template, int position) {
+    cached_line_t *line = &session->lines[entry];
+    error_context_t error;
+    parsed_line_t unlabeled;
+    addressing_method_t method;
+    size_t length = strlen(template->text);
+    char *text;
+    int i;
+
+    /* The text decides whether the next expansion changed the line */
+    if (length + 1 > line->capacity) {
+        text = (char *)realloc(line->text, length + 1);
+        if (text) {
+            line->text = text;
+            line->capacity = length + 1;
+        }
+    }
+    if (line->capacity >= length + 1) {
+        memcpy(line->text, template->text, length + 1);
+        line->length = length;
+    } else {
+        free(line->text);
+        line->text = NULL;
+        line->capacity = 0;
+    }
+    line->joined = template->joined;
+
+    /* The pending flag stays: the queue may still hold this entry from its last line */
+    line->live = true;
+    line->position = position;
+    line->valid = true;
+    line->failed = false;
+    line->encode_failed = false;
+    line->relative = false;
+    line->size = 0;
+    line->ic = -1;
+    line->dc = -1;
+    line->symbol = -1;
+    for (i = 0; i < MAX_OPERANDS; i++) {
+        line->references[i] = -1;
+    }
+    clear_diagnostics(&line->local);
+    clear_diagnostics(&line->conflicts);
+    clear_diagnostics(&line->encoding);
+
+    init_error_context(&error, session->filename);
+    error.diagnostics = &line->local;
+    line->parsed_ok = parse_source_line(template, position + 1, &line->parsed, &error);
+    if (!line->parsed_ok) {
+        update_line_status(session, entry);
+        return;
+    }
+
+    /* The label is left to the session's symbols, which know the lines before this one */
+    unlabeled = line->parsed;
+    unlabeled.label[0] = '\0';
+    switch (line->parsed.type) {
+        case INST_TYPE_DATA:
+            line->valid = process_data_directive(&unlabeled, session->scratch, &line->size, &error);
+            break;
+
+        case INST_TYPE_STRING:
+            line->valid = process_string_directive(&unlabeled, session->scratch, &line->size, &error);
+            break;
+
+        case INST_TYPE_INCBIN:
+            line->valid = process_incbin_directive(&unlabeled, session->scratch, &line->size, session->filename,
+                                                   &error);
+            break;
+
+        case INST_TYPE_FILL:
+            line->valid = process_fill_directive(&unlabeled, session->scratch, &line->size, &error);
+            break;
+
+        case INST_TYPE_CODE:
+            line->valid = process_instruction(&unlabeled, session->scratch, &line->size, &error);
+            for (i = 0; i < line->parsed.operand_count && i < MAX_OPERANDS; i++) {
+                method = get_addressing_method(line->parsed.operands[i]);
+                if (method == ADDR_DIRECT) {
+                    add_reference(session, entry, i, line->parsed.operands[i]);
+                } else if (method == ADDR_RELATIVE) {
+                    add_reference(session, entry, i, line->parsed.operands[i] + 1);
+                    line->relative = true;
+                }
+            }
+            queue_encode(session, entry);
+            break;
+
+        case INST_TYPE_EXTERN:
+            /* A labeled .extern fails before it declares anything */
+            if (line->parsed.label[0] != '\0') {
+                line->valid = process_extern_directive(&line->parsed, session->scratch, &error);
+            } else {
+                define_symbol(session, entry, line->parsed.operands[0]);
+            }
+            break;
+
+        case INST_TYPE_ENTRY:
+            line->valid = process_entry_directive(&line->parsed, &error);
+            add_reference(session, entry, 0, line->parsed.operands[0]);
+            queue_encode(session, entry);
+            break;
+
+        default:
+            break;
+    }
+
+    /* The first pass defines a label before it checks the rest of the line */
+    if (line->parsed.label[0] != '\0' && line->parsed.type != INST_TYPE_EXTERN &&
+        line->parsed.type != INST_TYPE_ENTRY && line->parsed.type != INST_TYPE_INVALID) {
+        define_symbol(session, entry, line->parsed.label);
+    }
+
+    update_line_status(session, entry);
+}
+
+/* Helper function to drop a line that is no longer in the expansion */
+static void release_line(edit_session_t *session, int entry) {
+    cached_line_t *line = &session->lines[entry];
+    session_symbol_t *symbol;
+    int i;
+
+    if (line->symbol >= 0) {
+        symbol = &session->symbols[line->symbol];
+        if (line->prev_definition >= 0) {
+            session->lines[line->prev_definition].next_definition = line->next_definition;
+        } else {
+            symbol->definitions = line->next_definition;
+        }
+        if (line->next_definition >= 0) {
+            session->lines[line->next_definition].prev_definition = line->prev_definition;
+        }
+        mark_dirty(session, line->symbol);
+    }
+    for (i = 0; i < MAX_OPERANDS; i++) {
+        if (line->references[i] >= 0) {
+            unlink_reference(session, entry * MAX_OPERANDS + i);
+        }
+    }
+
+    if (line->failed) {
+        session->failed_lines--;
+    }
+    if (line->encode_failed) {
+        session->encode_failures--;
+    }
+    line->live = false;
+    session->free_lines[session->free_count++] = entry;
+}
+
+/* Helper function to recompute the counters from a position on, stopping once nothing moves */
+static void place_lines(edit_session_t *session, int start, int window_end, bool shifted) {
+    cached_line_t *line;
+    int ic = 0, dc = 0, position, i;
+
+    if (start > 0) {
+        line = &session->lines[session->order[start - 1]];
+        ic = line->ic;
+        dc = line->dc;
+        if (line->parsed_ok && line->parsed.type == INST_TYPE_CODE) {
+            ic += line->size;
+        } else if (line->parsed_ok) {
+            dc += line->size;
+        }
+    }
+
+    for (position = start; position < session->line_count; position++) {
+        line = &session->lines[session->order[position]];
+
+        /* Past the edit, lines in place at the same counters stay as they are, and so does ICF */
+        if (position >= window_end && !shifted && line->ic == ic && line->dc == dc) {
+            return;
+        }
+
+        line->position = position;
+        if (line->ic != ic || line->dc != dc) {
+            line->ic = ic;
+            line->dc = dc;
+            if (line->symbol >= 0) {
+                mark_dirty(session, line->symbol);
+            }
+            if (line->relative) {
+                queue_encode(session, session->order[position]);
+            }
+        }
+
+        if (line->parsed_ok && line->parsed.type == INST_TYPE_CODE) {
+            ic += line->size;
+        } else if (line->parsed_ok) {
+            dc += line->size;
+        }
+    }
+
+    /* Data labels follow the code, so all of them move with ICF */
+    if (ic != session->ICF) {
+        session->ICF = ic;
+        for (i = 0; i < session->symbol_count; i++) {
+            if (session->symbols[i].attributes & SYMBOL_ATTR_DATA) {
+                mark_dirty(session, i);
+            }
+        }
+    }
+}
+
+/* Helper function to settle which line defines a symbol, as the first pass would, and its value */
+static void resolve_symbol(edit_session_t *session, int id) {
+    session_symbol_t *symbol = &session->symbols[id];
+    cached_line_t *first = NULL, *line;
+    symbol_attr_t attributes = SYMBOL_ATTR_NONE;
+    error_context_t error;
+    int value = 0, entry, node;
+
+    symbol->dirty = false;
+    for (entry = symbol->definitions; entry >= 0; entry = session->lines[entry].next_definition) {
+        line = &session->lines[entry];
+        if (!first || line->position < first->position) {
+            first = line;
+        }
+    }
+
+    /* Later definitions conflict with the first, with the messages of process_label and process_extern_directive */
+    for (entry = symbol->definitions; entry >= 0; entry = line->next_definition) {
+        line = &session->lines[entry];
+        clear_diagnostics(&line->conflicts);
+        if (line != first) {
+            init_error_context(&error, session->filename);
+            error.diagnostics = &line->conflicts;
+            error.line_number = line->position + 1;
+            if (first->parsed.type == INST_TYPE_EXTERN) {
+                if (line->parsed.type != INST_TYPE_EXTERN) {
+                    report_context_error(&error, "Label '%s' already defined as external", symbol->name);
+                }
+            } else if (line->parsed.type == INST_TYPE_EXTERN) {
+                report_context_error(&error, "Symbol '%s' already defined as non-external", symbol->name);
+            } else {
+                report_context_error(&error, "Label '%s' already defined", symbol->name);
+            }
+        }
+        update_line_status(session, entry);
+    }
+
+    if (first && first->parsed.type == INST_TYPE_EXTERN) {
+        attributes = SYMBOL_ATTR_EXTERNAL;
+    } else if (first && first->parsed.type == INST_TYPE_CODE) {
+        attributes = SYMBOL_ATTR_CODE;
+        value = MEMORY_START + first->ic;
+    } else if (first) {
+        attributes = SYMBOL_ATTR_DATA;
+        value = MEMORY_START + session->ICF + first->dc;
+    }
+
+    /* Only the operands referring to a changed symbol are encoded again */
+    if (attributes != symbol->attributes || value != symbol->value) {
+        symbol->attributes = attributes;
+        symbol->value = value;
+        for (node = symbol->references; node >= 0;
+             node = session->lines[node / MAX_OPERANDS].next_reference[node % MAX_OPERANDS]) {
+            queue_encode(session, node / MAX_OPERANDS);
+        }
+    }
+}
+
+/* Helper function to run the second pass over one instruction or .entry line */
+static void encode_line(edit_session_t *session, int entry) {
+    cached_line_t *line = &session->lines[entry];
+    session_symbol_t *symbol;
+    error_context_t error;
+    bool success;
+    int i;
+
+    /* The line sees only the symbols it refers to */
+    reset_symbol_table(session->scratch);
+    reset_external_table(&session->scratch_refs);
+    for (i = 0; i < MAX_OPERANDS; i++) {
+        if (line->references[i] >= 0) {
+            symbol = &session->symbols[line->references[i]];
+            if (symbol->attributes != SYMBOL_ATTR_NONE) {
+                add_symbol(session->scratch, symbol->name, symbol->value, symbol->attributes);
+            }
+        }
+    }
+
+    clear_diagnostics(&line->encoding);
+    init_error_context(&error, session->filename);
+    error.diagnostics = &line->encoding;
+    line->parsed.line_number = line->position + 1;
+    if (line->parsed.type == INST_TYPE_CODE) {
+        success = encode_instruction(&line->parsed, session->scratch, &line->code, MEMORY_START + line->ic,
+                                     &session->scratch_refs, &error);
+    } else {
+        success = process_entry_second_pass(&line->parsed, session->scratch, &error);
+    }
+
+    if (success == line->encode_failed) {
+        session->encode_failures += success ? -1 : 1;
+        line->encode_failed = !success;
+    }
+    session->stats.encoded++;
+}
+
+/* Helper function to keep the count of lines the first pass fails on */
+static void update_line_status(edit_session_t *session, int entry) {
+    cached_line_t *line = &session->lines[entry];
+    bool failed = !line->parsed_ok || !line->valid || line->conflicts.count > 0;
+
+    if (failed != line->failed) {
+        session->failed_lines += failed ? 1 : -1;
+        line->failed = failed;
+    }
+}
+
+/* Helper function to queue a line for encoding (each entry is queued at most once) */
+static void queue_encode(edit_session_t *session, int entry) {
+    if (!session->lines[entry].pending) {
+        session->lines[entry].pending = true;
+        session->pending[session->pending_count++] = entry;
+    }
+}
+
+/* Helper function to queue a symbol to be resolved again */
+static void mark_dirty(edit_session_t *session, int id) {
+    /* The list holds every symbol at most once and grows with the symbols */
+    if (session->symbols[id].dirty) {
+        return;
+    }
+    session->symbols[id].dirty = true;
+    session->dirty[session->dirty_count++] = id;
+}
+
+/* Helper function to get the id of a name, adding it the first time (-1 when out of memory) */
+static int intern_symbol(edit_session_t *session, const char *name) {
+    session_symbol_t *symbols, *symbol;
+    char key[MAX_LABEL_LENGTH];
+    size_t index;
+    int capacity, *dirty;
+
+    strncpy(key, name, MAX_LABEL_LENGTH - 1);
+    key[MAX_LABEL_LENGTH - 1] = '\0';
+
+    if (session->slot_count > 0) {
+        index = hash_string(key) & (session->slot_count - 1);
+        while (session->slots[index] != 0) {
+            if (strcmp(session->symbols[session->slots[index] - 1].name, key) == 0) {
+                return session->slots[index] - 1;
+            }
+            index = (index + 1) & (session->slot_count - 1);
+        }
+    }
+
+    /* Keep the hash at most half full */
+    if ((size_t)(session->symbol_count + 1) * 2 > session->slot_count && !grow_symbol_slots(session)) {
+        return -1;
+    }
+    if (session->symbol_count == session->symbol_capacity) {
+        capacity = session->symbol_capacity ? session->symbol_capacity * 2 : 64;
+        symbols = (session_symbol_t *)realloc(session->symbols, capacity * sizeof(session_symbol_t));
+        if (!symbols) {
+            return -1;
+        }
+        session->symbols = symbols;
+        dirty = (int *)realloc(session->dirty, capacity * sizeof(int));
+        if (!dirty) {
+            return -1;
+        }
+        session->dirty = dirty;
+        session->symbol_capacity = capacity;
+    }
+
+    symbol = &session->symbols[session->symbol_count];
+    strcpy(symbol->name, key);
+    symbol->definitions = -1;
+    symbol->references = -1;
+    symbol->attributes = SYMBOL_ATTR_NONE;
+    symbol->value = 0;
+    symbol->dirty = false;
+
+    index = hash_string(key) & (session->slot_count - 1);
+    while (session->slots[index] != 0) {
+        index = (index + 1) & (session->slot_count - 1);
+    }
+    session->slots[index] = session->symbol_count + 1;
+
+    return session->symbol_count++;
+}
+
+/* Helper function to double the symbol hash slots and reinsert every symbol */
+static bool grow_symbol_slots(edit_session_t *session) {
+    size_t slot_count = session->slot_count ? session->slot_count * 2 : 128;
+    size_t index;
+    int *slots;
+    int i;
+
+    slots = (int *)calloc(slot_count, sizeof(int));
+    if (!slots) {
+        return false;
+    }
+
+    for (i = 0; i < session->symbol_count; i++) {
+        index = hash_string(session->symbols[i].name) & (slot_count - 1);
+        while (slots[index] != 0) {
+            index = (index + 1) & (slot_count - 1);
+        }
+        slots[index] = i + 1;
+    }
+
+    free(session->slots);
+    session->slots = slots;
+    session->slot_count = slot_count;
+
+    return true;
+}
+
+/* Helper function to record that a line defines a label or declares it external */
+static void define_symbol(edit_session_t *session, int entry, const char *name) {
+    cached_line_t *line = &session->lines[entry];
+    int id = intern_symbol(session, name);
+
+    if (id < 0) {
+        return;
+    }
+
+    line->symbol = id;
+    line->prev_definition = -1;
+    line->next_definition = session->symbols[id].definitions;
+    if (line->next_definition >= 0) {
+        session->lines[line->next_definition].prev_definition = entry;
+    }
+    session->symbols[id].definitions = entry;
+    mark_dirty(session, id);
+}
+
+/* Helper function to record that an operand of a line refers to a symbol */
+static void add_reference(edit_session_t *session, int entry, int operand, const char *name) {
+    cached_line_t *line = &session->lines[entry];
+    int id = intern_symbol(session, name);
+    int node = entry * MAX_OPERANDS + operand;
+    int next;
+
+    if (id < 0) {
+        return;
+    }
+
+    next = session->symbols[id].references;
+    line->references[operand] = id;
+    line->prev_reference[operand] = -1;
+    line->next_reference[operand] = next;
+    if (next >= 0) {
+        session->lines[next / MAX_OPERANDS].prev_reference[next % MAX_OPERANDS] = node;
+    }
+    session->symbols[id].references = node;
+}
+
+/* Helper function to take an operand out of its symbol's chain of references */
+static void unlink_reference(edit_session_t *session, int node) {
+    cached_line_t *line = &session->lines[node / MAX_OPERANDS];
+    int operand = node % MAX_OPERANDS;
+    int prev = line->prev_reference[operand];
+    int next = line->next_reference[operand];
+
+    if (prev >= 0) {
+        session->lines[prev / MAX_OPERANDS].next_reference[prev % MAX_OPERANDS] = next;
+    } else {
+        session->symbols[line->references[operand]].references = next;
+    }
+    if (next >= 0) {
+        session->lines[next / MAX_OPERANDS].prev_reference[next % MAX_OPERANDS] = prev;
+    }
+    line->references[operand] = -1;
+}
+
+/* Helper function to list the diagnostics in the order a full check reports them */
+static bool build_report(edit_session_t *session, error_context_t *context) {
+    const cached_line_t *line;
+    const diagnostic_list_t *list;
+    bool success;
+    int i;
+
+    session->report_count = 0;
+    success = append_report(session, &session->expansion, -1);
+
+    if (session->expanded) {
+        /* First pass: a line that lost its label to an earlier definition reports only that */
+        for (i = 0; success && i < session->line_count; i++) {
+            line = &session->lines[session->order[i]];
+            list = line->parsed_ok && line->conflicts.count > 0 ? &line->conflicts : &line->local;
+            success = append_report(session, list, i + 1);
+        }
+
+        /* Second pass */
+        for (i = 0; success && session->failed_lines == 0 && i < session->line_count; i++) {
+            success = append_report(session, &session->lines[session->order[i]].encoding, i + 1);
+        }
+    }
+
+    session->stats.source_lines = session->source_lines;
+    session->stats.lines = session->line_count;
+
+    /* Warnings, such as an unused macro, do not fail the file */
+    session->stats.success = session->expanded && session->failed_lines == 0 && session->encode_failures == 0;
+
+    if (!success) {
+        report_context_error(context, "Memory allocation error for diagnostics");
+    }
+    return success;
+}
+
+/* Helper function to add a list to the report, at the given line (-1 keeps each message's own) */
+static bool append_report(edit_session_t *session, const diagnostic_list_t *list, int line_number) {
+    diagnostic_t *report;
+    int capacity, i;
+
+    if (session->report_count + list->count > session->report_capacity) {
+        capacity = session->report_capacity ? session->report_capacity : 32;
+        while (capacity < session->report_count + list->count) {
+            capacity *= 2;
+        }
+        report = (diagnostic_t *)realloc(session->report, capacity * sizeof(diagnostic_t));
+        if (!report) {
+            return false;
+        }
+        session->report = report;
+        session->report_capacity = capacity;
+    }
+
+    for (i = 0; i < list->count; i++) {
+        session->report[session->report_count] = list->items[i];
+        if (line_number >= 0) {
+            session->report[session->report_count].line_number = line_number;
+        }
+        session->report_count++;
+    }
+
+    return true;
+}
+
+/* Helper function to find where a 1-based line starts (the end of the text past the last line) */
+static size_t line_offset(const char *text, size_t length, int line) {
+    const char *end;
+    size_t offset = 0;
+
+    while (--line > 0 && offset < length) {
+        end = (const char *)memchr(text + offset, '\n', length - offset);
+        offset = end ? (size_t)(end - text) + 1 : length;
+    }
+
+    return offset;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file libassembler.c
+ * @brief Implementation of the embeddable in-memory assembler API
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../include/libassembler.h"
+#include "../include/assembler_context.h"
+
+/**
+ * @brief State behind an asm_context_t
+ */
+struct asm_context {
+    assembler_context_t assembler; /* Tables and buffers reused by every call */
+    assembler_options_t options;
+    diagnostic_list_t diagnostics; /* Diagnostics of the last call */
+    asm_symbol_t *symbols;        /* Entries followed by external references of the last call */
+    int symbol_capacity;
+};
+
+/* Forward declarations for internal functions */
+static bool collect_symbols(asm_context_t *ctx, asm_result_t *out);
+
+/* Create an assembler context */
+asm_context_t *asm_create_context(const assembler_options_t *options) {
+    asm_context_t *ctx;
+
+    ctx = (asm_context_t *)calloc(1, sizeof(asm_context_t));
+    if (!ctx) {
+        return NULL;
+    }
+
+    if (!init_assembler_context(&ctx->assembler)) {
+        free(ctx);
+        return NULL;
+    }
+
+    if (options) {
+        ctx->options = *options;
+    }
+    ctx->options.format = FORMAT_TEXT;
+    ctx->options.archive = NULL;
+    ctx->options.io = NULL;
+    ctx->options.check = false;
+    ctx->options.stream = NULL;
+    ctx->options.pipeline = false;
+
+    return ctx;
+}
+
+/* Assemble a source held in memory */
+bool asm_assemble(asm_context_t *ctx, const char *src, size_t len, asm_result_t *out) {
+    error_context_t *error = &ctx->assembler.error;
+    int ICF = 0, DCF = 0;
+    bool success;
+
+    memset(out, 0, sizeof(asm_result_t));
+    clear_diagnostics(&ctx->diagnostics);
+
+    /* Messages go to the context's list instead of stderr */
+    init_error_context(error, ASM_SOURCE_NAME);
+    error->diagnostics = &ctx->diagnostics;
+
+    success = process_source_text(src, len, ctx->options.macro_library, ctx->assembler.macros,
+                                  &ctx->assembler.source, error) &&
+              assemble_expanded_source(&ctx->assembler, NULL, &ctx->options, &ICF, &DCF) &&
+              collect_symbols(ctx, out);
+
+    if (success) {
+        out->code = ctx->assembler.code_image + MEMORY_START;
+        out->code_size = ICF;
+        out->code_start = MEMORY_START;
+        out->data = ctx->assembler.data_image;
+        out->data_size = DCF;
+    }
+
+    out->success = success;
+    out->diagnostics = ctx->diagnostics.items;
+    out->diagnostic_count = ctx->diagnostics.count;
+
+    return success;
+}
+
+/* Release a context and every result it returned */
+void asm_destroy_context(asm_context_t *ctx) {
+    if (!ctx) {
+        return;
+    }
+
+    free_assembler_context(&ctx->assembler);
+    free_diagnostics(&ctx->diagnostics);
+    free(ctx->symbols);
+    free(ctx);
+}
+
+/* Helper function to list the entries and external references of the last assembly */
+static bool collect_symbols(asm_context_t *ctx, asm_result_t *out) {
+    const external_table_t *ext_refs = &ctx->assembler.ext_refs;
+    asm_symbol_t *symbols;
+    symbol_t *symbol;
+    int entry_count = 0, needed, capacity, i;
+
+    for (symbol = ctx->assembler.symbols->head; symbol; symbol = symbol->next) {
+        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
+            entry_count++;
+        }
+    }
+
+    needed = entry_count + ext_refs->count;
+    if (needed > ctx->symbol_capacity) {
+        capacity = ctx->symbol_capacity ? ctx->symbol_capacity : 16;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        symbols = (asm_symbol_t *)realloc(ctx->symbols, capacity * sizeof(asm_symbol_t));
+        if (!symbols) {
+            report_context_error(&ctx->assembler.error, "Memory allocation error for symbol list");
+            return false;
+        }
+        ctx->symbols = symbols;
+        ctx->symbol_capacity = capacity;
+    }
+
+    /* Entries in symbol table order like the .ent file */
+    i = 0;
+    for (symbol = ctx->assembler.symbols->head; symbol; symbol = symbol->next) {
+        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
+            ctx->symbols[i].name = symbol->name;
+            ctx->symbols[i].address = symbol->value;
+            i++;
+        }
+    }
+
+    /* External references in address order like the .ext file */
+    for (i = 0; i < ext_refs->count; i++) {
+        ctx->symbols[entry_count + i].name = external_reference_name(ext_refs, &ext_refs->refs[i]);
+        ctx->symbols[entry_count + i].address = ext_refs->refs[i].address;
+    }
+
+    out->entries = ctx->symbols;
+    out->entry_count = entry_count;
+    out->externs = ctx->symbols + entry_count;
+    out->extern_count = ext_refs->count;
+
+    return true;
+}
@@ -0,0 +1,525 @@
+/**
+ * @file linker.c
+ * @brief Implementation of the multi-module linker
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../include/linker.h"
+#include "../include/binary_object.h"
+#include "../include/machine_word.h"
+#include "../include/utils.h"
+
+/**
+ * @brief Entry symbol in the global hash table
+ */
+typedef struct {
+    const char *name;             /* Name in the defining module's string pool (NULL = empty slot) */
+    uint32_t address;             /* Linked address */
+    int module;                   /* Index of the defining module */
+} global_symbol_t;
+
+/**
+ * @brief Problem found while resolving a module, reported after all workers finish
+ */
+typedef struct {
+    const char *message;          /* Static description */
+    const char *name;             /* Symbol name, or NULL */
+    uint32_t address;             /* Module-local address of the offending word */
+} link_problem_t;
+
+/**
+ * @brief Per-module linker state
+ */
+typedef struct {
+    const char *path;
+    error_context_t context;
+    binary_object_t object;
+    bool loaded;                  /* object is mapped and valid */
+    uint32_t start;               /* Module-local address of the first code word */
+    uint32_t icf, dcf;
+    uint32_t code_base;           /* Linked address of the first code word */
+    uint32_t data_base;           /* Linked address of the first data word */
+    link_problem_t *problems;
+    int problem_count;
+    int problem_capacity;
+} link_module_t;
+
+/**
+ * @brief Whole-link state shared by the worker threads
+ */
+typedef struct link_state {
+    link_module_t *modules;
+    int count;
+    global_symbol_t *slots;       /* Open-addressing hash of entry symbols */
+    size_t slot_count;            /* Power of two */
+    uint32_t *code;               /* Linked code image */
+    uint32_t *data;               /* Linked data image */
+    uint32_t base;                /* Linked address of the first code word */
+    uint32_t code_size;           /* Words in the linked code image */
+    int next;                     /* Next module index to hand out */
+    pthread_mutex_t lock;
+    void (*job)(struct link_state *state, int index);
+} link_state_t;
+
+/* Forward declarations for internal functions */
+static bool run_parallel(link_state_t *state, int threads, void (*job)(link_state_t *, int));
+static void *worker_main(void *arg);
+static void load_module(link_state_t *state, int index);
+static void resolve_module(link_state_t *state, int index);
+static bool build_symbol_table(link_state_t *state);
+static const global_symbol_t *lookup_symbol(const link_state_t *state, const char *name);
+static bool relocate(const link_module_t *module, uint32_t address, uint32_t *linked);
+static void add_problem(link_module_t *module, const char *message, const char *name, uint32_t address);
+static bool report_problems(link_state_t *state);
+static bool write_linked_object(link_state_t *state, const link_options_t *options);
+
+/* Link binary objects into one image */
+bool link_objects(const char **paths, int count, const link_options_t *options) {
+    link_state_t state;
+    uint32_t data_size = 0;
+    int i, threads;
+    bool success = true;
+
+    if (!paths || count <= 0 || !options) {
+        fprintf(stderr, "No objects to link\n");
+        return false;
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.count = count;
+    state.base = (uint32_t)options->base;
+    state.modules = (link_module_t *)calloc(count, sizeof(link_module_t));
+    if (!state.modules) {
+        fprintf(stderr, "Memory allocation error for linker modules\n");
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        state.modules[i].path = paths[i];
+        init_error_context(&state.modules[i].context, paths[i]);
+    }
+
+    threads = options->threads > 0 ? options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    if (pthread_mutex_init(&state.lock, NULL) != 0) {
+        free(state.modules);
+        fprintf(stderr, "Could not create linker lock\n");
+        return false;
+    }
+
+    /* Step 1: Map and validate every module in parallel */
+    success = run_parallel(&state, threads, load_module);
+    for (i = 0; success && i < count; i++) {
+        if (!state.modules[i].loaded) {
+            success = false;
+        }
+    }
+
+    /* Step 2: Lay out code sections, then data sections */
+    if (success) {
+        for (i = 0; i < count; i++) {
+            state.modules[i].code_base = state.base + state.code_size;
+            state.code_size += state.modules[i].icf;
+        }
+        for (i = 0; i < count; i++) {
+            state.modules[i].data_base = state.base + state.code_size + data_size;
+            data_size += state.modules[i].dcf;
+        }
+
+        state.code = (uint32_t *)calloc(state.code_size + 1, sizeof(uint32_t));
+        state.data = (uint32_t *)calloc(data_size + 1, sizeof(uint32_t));
+        if (!state.code || !state.data) {
+            fprintf(stderr, "Memory allocation error for linked image\n");
+            success = false;
+        }
+    }
+
+    /* Step 3: Hash every entry symbol once */
+    if (success) {
+        success = build_symbol_table(&state);
+    }
+
+    /* Step 4: Relocate and patch every module in parallel; duplicates do not
+     * stop resolution, so every problem is reported in one run */
+    if (state.slots) {
+        if (!run_parallel(&state, threads, resolve_module) || !report_problems(&state)) {
+            success = false;
+        }
+    }
+
+    /* Step 5: Write the linked object */
+    if (success) {
+        success = write_linked_object(&state, options);
+    }
+
+    for (i = 0; i < count; i++) {
+        close_binary_object(&state.modules[i].object);
+        free(state.modules[i].problems);
+    }
+    pthread_mutex_destroy(&state.lock);
+    free(state.modules);
+    free(state.slots);
+    free(state.code);
+    free(state.data);
+
+    return success;
+}
+
+/* Helper function to run a job for every module on a pool of threads */
+static bool run_parallel(link_state_t *state, int threads, void (*job)(link_state_t *, int)) {
+    pthread_t *workers;
+    int i, started;
+
+    state->job = job;
+    state->next = 0;
+
+    /* A single thread runs the job inline */
+    if (threads <= 1) {
+        worker_main(state);
+        return true;
+    }
+
+    workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (!workers) {
+        fprintf(stderr, "Memory allocation error for linker threads\n");
+        return false;
+    }
+
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, worker_main, state) != 0) {
+            break;
+        }
+    }
+
+    /* Threads that could not start are covered by the calling thread */
+    if (started == 0) {
+        worker_main(state);
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    return true;
+}
+
+/* Helper function for worker threads: take modules until none are left */
+static void *worker_main(void *arg) {
+    link_state_t *state = (link_state_t *)arg;
+    int index;
+
+    for (;;) {
+        pthread_mutex_lock(&state->lock);
+        index = state->next++;
+        pthread_mutex_unlock(&state->lock);
+
+        if (index >= state->count) {
+            break;
+        }
+
+        state->job(state, index);
+    }
+
+    return NULL;
+}
+
+/* Helper function to map and validate one module */
+static void load_module(link_state_t *state, int index) {
+    link_module_t *module = &state->modules[index];
+
+    if (!open_binary_object(module->path, &module->object, &module->context)) {
+        return;
+    }
+
+    module->start = module->object.header->code_start;
+    module->icf = module->object.header->icf;
+    module->dcf = module->object.header->dcf;
+    module->problem_capacity = (int)module->object.header->extern_count + 1;
+    module->problems = (link_problem_t *)malloc(module->problem_capacity * sizeof(link_problem_t));
+    if (!module->problems) {
+        report_context_error(&module->context, "Memory allocation error");
+        return;
+    }
+
+    module->loaded = true;
+}
+
+/* Helper function to insert all entry symbols into the global hash table */
+static bool build_symbol_table(link_state_t *state) {
+    link_module_t *module;
+    global_symbol_t *slot;
+    const char *name;
+    size_t total = 0, index;
+    uint32_t i, address;
+    int m;
+    bool success = true;
+
+    for (m = 0; m < state->count; m++) {
+        total += state->modules[m].object.header->entry_count;
+    }
+
+    state->slot_count = 16;
+    while (state->slot_count < total * 2) {
+        state->slot_count *= 2;
+    }
+
+    state->slots = (global_symbol_t *)calloc(state->slot_count, sizeof(global_symbol_t));
+    if (!state->slots) {
+        fprintf(stderr, "Memory allocation error for linker symbol table\n");
+        return false;
+    }
+
+    for (m = 0; m < state->count; m++) {
+        module = &state->modules[m];
+
+        for (i = 0; i < module->object.header->entry_count; i++) {
+            name = binary_object_name(&module->object, &module->object.entries[i]);
+
+            if (!relocate(module, module->object.entries[i].address, &address)) {
+                report_context_error(&module->context, "Entry '%s' has address %lu outside the module",
+                                     name, (unsigned long)module->object.entries[i].address);
+                success = false;
+                continue;
+            }
+
+            index = hash_string(name) & (state->slot_count - 1);
+            slot = &state->slots[index];
+            while (slot->name && strcmp(slot->name, name) != 0) {
+                index = (index + 1) & (state->slot_count - 1);
+                slot = &state->slots[index];
+            }
+
+            /* Keep the first definition and report every duplicate */
+            if (slot->name) {
+                report_context_error(&module->context, "Duplicate entry symbol '%s' (first defined in %s)",
+                                     name, state->modules[slot->module].path);
+                success = false;
+                continue;
+            }
+
+            slot->name = name;
+            slot->address = address;
+            slot->module = m;
+        }
+    }
+
+    return success;
+}
+
+/* Helper function to find an entry symbol in the global hash table */
+static const global_symbol_t *lookup_symbol(const link_state_t *state, const char *name) {
+    size_t index = hash_string(name) & (state->slot_count - 1);
+
+    while (state->slots[index].name) {
+        if (strcmp(state->slots[index].name, name) == 0) {
+            return &state->slots[index];
+        }
+        index = (index + 1) & (state->slot_count - 1);
+    }
+
+    return NULL;
+}
+
+/* Helper function to copy one module into the linked image, relocating and patching it */
+static void resolve_module(link_state_t *state, int index) {
+    link_module_t *module = &state->modules[index];
+    const binary_object_t *object = &module->object;
+    uint32_t *code = state->code + (module->code_base - state->base);
+    uint32_t *data = state->data + (module->data_base - state->base - state->code_size);
+    const global_symbol_t *symbol;
+    decoded_instruction_t decoded;
+    machine_word_t word;
+    addressing_method_t modes[2];
+    uint32_t i, address, linked;
+    int operand, mode_count, w;
+    const char *name;
+
+    for (i = 0; i < module->dcf; i++) {
+        data[i] = binary_object_data_word(object, (int)i);
+    }
+    for (i = 0; i < module->icf; i++) {
+        code[i] = binary_object_code_word(object, (int)i);
+    }
+
+    /* Walk the instructions and relocate direct (R) operand words */
+    i = 0;
+    while (i < module->icf) {
+        if (!decode_instruction_word(word_from_bits(code[i]), &decoded) || i + decoded.length > module->icf) {
+            add_problem(module, "Invalid instruction word", NULL, module->start + i);
+            return;
+        }
+
+        /* Operand words follow in source, destination order; registers share or skip words */
+        mode_count = 0;
+        if (decoded.operand_count == 2 &&
+            !(decoded.src_addr == ADDR_REGISTER && decoded.dst_addr == ADDR_REGISTER)) {
+            modes[mode_count++] = decoded.src_addr;
+        }
+        if (decoded.operand_count >= 1) {
+            modes[mode_count++] = decoded.dst_addr;
+        }
+
+        w = 1;
+        for (operand = 0; operand < mode_count; operand++) {
+            if (modes[operand] == ADDR_REGISTER) {
+                continue;
+            }
+
+            word = code[i + w];
+            if (modes[operand] == ADDR_DIRECT && WORD_ARE(word) == WORD_ARE_RELOCATABLE) {
+                if (!relocate(module, WORD_VALUE(word), &linked)) {
+                    add_problem(module, "Direct address outside the module", NULL, module->start + i + w);
+                } else {
+                    code[i + w] = encode_direct_address((int)linked, false);
+                }
+            }
+            w++;
+        }
+
+        i += (uint32_t)decoded.length;
+    }
+
+    /* Patch every external reference through the global hash */
+    for (i = 0; i < object->header->extern_count; i++) {
+        name = binary_object_name(object, &object->externs[i]);
+        address = object->externs[i].address;
+
+        if (address < module->start || address - module->start >= module->icf ||
+            WORD_ARE(code[address - module->start]) != WORD_ARE_EXTERNAL) {
+            add_problem(module, "External reference does not point at an external word", name, address);
+            continue;
+        }
+
+        symbol = lookup_symbol(state, name);
+        if (!symbol) {
+            add_problem(module, "Undefined symbol", name, address);
+            continue;
+        }
+
+        code[address - module->start] = encode_direct_address((int)symbol->address, false);
+    }
+}
+
+/* Helper function to map a module-local address to its linked address */
+static bool relocate(const link_module_t *module, uint32_t address, uint32_t *linked) {
+    if (address >= module->start && address - module->start < module->icf) {
+        *linked = module->code_base + (address - module->start);
+        return true;
+    }
+
+    if (address >= module->start + module->icf && address - module->start - module->icf < module->dcf) {
+        *linked = module->data_base + (address - module->start - module->icf);
+        return true;
+    }
+
+    return false;
+}
+
+/* Helper function to record a problem for later bulk reporting */
+static void add_problem(link_module_t *module, const char *message, const char *name, uint32_t address) {
+    link_problem_t *grown;
+
+    if (module->problem_count == module->problem_capacity) {
+        grown = (link_problem_t *)realloc(module->problems,
+                                          module->problem_capacity * 2 * sizeof(link_problem_t));
+        if (!grown) {
+            return;
+        }
+        module->problems = grown;
+        module->problem_capacity *= 2;
+    }
+
+    module->problems[module->problem_count].message = message;
+    module->problems[module->problem_count].name = name;
+    module->problems[module->problem_count].address = address;
+    module->problem_count++;
+}
+
+/* Helper function to print every recorded problem in module order */
+static bool report_problems(link_state_t *state) {
+    link_problem_t *problem;
+    int m, i, total = 0;
+
+    for (m = 0; m < state->count; m++) {
+        for (i = 0; i < state->modules[m].problem_count; i++) {
+            problem = &state->modules[m].problems[i];
+            if (problem->name) {
+                report_context_error(&state->modules[m].context, "%s '%s' at address %04lu",
+                                     problem->message, problem->name, (unsigned long)problem->address);
+            } else {
+                report_context_error(&state->modules[m].context, "%s at address %04lu",
+                                     problem->message, (unsigned long)problem->address);
+            }
+            total++;
+        }
+    }
+
+    if (total > 0) {
+        fprintf(stderr, "Link failed with %d unresolved problem%s\n", total, total == 1 ? "" : "s");
+    }
+
+    return total == 0;
+}
+
+/* Helper function to write the linked image with the entries of every module */
+static bool write_linked_object(link_state_t *state, const link_options_t *options) {
+    binary_image_t image;
+    binary_record_t *entries;
+    error_context_t context;
+    uint32_t entry_count = 0, code_size = 0, data_size = 0, i;
+    int m;
+    bool success;
+
+    for (m = 0; m < state->count; m++) {
+        entry_count += state->modules[m].object.header->entry_count;
+        code_size += state->modules[m].icf;
+        data_size += state->modules[m].dcf;
+    }
+
+    entries = (binary_record_t *)malloc((entry_count + 1) * sizeof(binary_record_t));
+    if (!entries) {
+        fprintf(stderr, "Memory allocation error for linked entries\n");
+        return false;
+    }
+
+    /* Entries in module order, at their linked addresses */
+    entry_count = 0;
+    for (m = 0; m < state->count; m++) {
+        const binary_object_t *object = &state->modules[m].object;
+        for (i = 0; i < object->header->entry_count; i++) {
+            entries[entry_count].name = binary_object_name(object, &object->entries[i]);
+            relocate(&state->modules[m], object->entries[i].address, &entries[entry_count].address);
+            entry_count++;
+        }
+    }
+
+    image.code_start = state->base;
+    image.code = state->code;
+    image.icf = code_size;
+    image.data = state->data;
+    image.dcf = data_size;
+    image.entries = entries;
+    image.entry_count = entry_count;
+    image.externs = NULL;
+    image.extern_count = 0;
+    image.word_bytes = options->word_bytes;
+
+    init_error_context(&context, options->output);
+    success = write_binary_image(options->output, &image, &context);
+
+    free(entries);
+    return success;
+}
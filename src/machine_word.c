@@ -20,6 +20,8 @@
  * |     |           |2 bit|         |2 bit|       |        |       |
  */
 
+/* Field positions within the 21-bit value; the 24-bit word holds the value above the ARE bits */
+
 /* Bits 18-21: Operation code (15 possible values) */
 #define OPCODE_SHIFT 18
 #define OPCODE_MASK 0x0F
@@ -44,10 +46,76 @@
 #define FUNCT_SHIFT 3
 #define FUNCT_MASK 0x0F
 
-/* Bits 0-2: ARE flags (Absolute/Relocatable/External) */
-#define ARE_MASK 0x07
-
+/* A field of the value placed in the 24-bit word (bits pushed past the value are dropped) */
+#define FIELD(field, shift) WORD_MAKE((unsigned long)(field) << (shift), 0)
+
+/* Opcode with absolute ARE: the starting point of every instruction word */
+#define OPCODE_TEMPLATE(op) (FIELD(op, OPCODE_SHIFT) | ARE_ABSOLUTE)
+
+/* Source and destination addressing methods of one operand combination */
+#define ADDRESSING_FIELDS(src) \
+    {FIELD(src, SRC_ADDR_SHIFT) | FIELD(0, DST_ADDR_SHIFT), FIELD(src, SRC_ADDR_SHIFT) | FIELD(1, DST_ADDR_SHIFT), \
+     FIELD(src, SRC_ADDR_SHIFT) | FIELD(2, DST_ADDR_SHIFT), FIELD(src, SRC_ADDR_SHIFT) | FIELD(3, DST_ADDR_SHIFT)}
+
+/* Source and destination registers of one register combination */
+#define REGISTER_FIELDS(src) \
+    {FIELD(src, SRC_REG_SHIFT) | FIELD(0, DST_REG_SHIFT), FIELD(src, SRC_REG_SHIFT) | FIELD(1, DST_REG_SHIFT), \
+     FIELD(src, SRC_REG_SHIFT) | FIELD(2, DST_REG_SHIFT), FIELD(src, SRC_REG_SHIFT) | FIELD(3, DST_REG_SHIFT), \
+     FIELD(src, SRC_REG_SHIFT) | FIELD(4, DST_REG_SHIFT), FIELD(src, SRC_REG_SHIFT) | FIELD(5, DST_REG_SHIFT), \
+     FIELD(src, SRC_REG_SHIFT) | FIELD(6, DST_REG_SHIFT), FIELD(src, SRC_REG_SHIFT) | FIELD(7, DST_REG_SHIFT)}
+
+static const machine_word_t opcode_templates[OPCODE_MASK + 1] = {
+    OPCODE_TEMPLATE(0), OPCODE_TEMPLATE(1), OPCODE_TEMPLATE(2), OPCODE_TEMPLATE(3),
+    OPCODE_TEMPLATE(4), OPCODE_TEMPLATE(5), OPCODE_TEMPLATE(6), OPCODE_TEMPLATE(7),
+    OPCODE_TEMPLATE(8), OPCODE_TEMPLATE(9), OPCODE_TEMPLATE(10), OPCODE_TEMPLATE(11),
+    OPCODE_TEMPLATE(12), OPCODE_TEMPLATE(13), OPCODE_TEMPLATE(14), OPCODE_TEMPLATE(15)
+};
+
+static const machine_word_t funct_fields[FUNCT_MASK + 1] = {
+    FIELD(0, FUNCT_SHIFT), FIELD(1, FUNCT_SHIFT), FIELD(2, FUNCT_SHIFT), FIELD(3, FUNCT_SHIFT),
+    FIELD(4, FUNCT_SHIFT), FIELD(5, FUNCT_SHIFT), FIELD(6, FUNCT_SHIFT), FIELD(7, FUNCT_SHIFT),
+    FIELD(8, FUNCT_SHIFT), FIELD(9, FUNCT_SHIFT), FIELD(10, FUNCT_SHIFT), FIELD(11, FUNCT_SHIFT),
+    FIELD(12, FUNCT_SHIFT), FIELD(13, FUNCT_SHIFT), FIELD(14, FUNCT_SHIFT), FIELD(15, FUNCT_SHIFT)
+};
+
+static const machine_word_t addressing_fields[SRC_ADDR_MASK + 1][DST_ADDR_MASK + 1] = {
+    ADDRESSING_FIELDS(0), ADDRESSING_FIELDS(1), ADDRESSING_FIELDS(2), ADDRESSING_FIELDS(3)
+};
+
+static const machine_word_t register_fields[SRC_REG_MASK + 1][DST_REG_MASK + 1] = {
+    REGISTER_FIELDS(0), REGISTER_FIELDS(1), REGISTER_FIELDS(2), REGISTER_FIELDS(3),
+    REGISTER_FIELDS(4), REGISTER_FIELDS(5), REGISTER_FIELDS(6), REGISTER_FIELDS(7)
+};
 
+/**
+ * Instruction table in instruction_id_t order. The 21-bit value field keeps
+ * only the low three opcode bits, so decoding matches those bits together
+ * with funct; lea and red still collide and are told apart by the source
+ * addressing method (lea always has a direct source operand).
+ */
+static const struct {
+    const char *name;
+    opcode_t opcode;
+    funct_t funct;
+    int operand_count;
+} instruction_table[INSN_COUNT] = {
+    {"mov", OP_MOV, FUNCT_NONE, 2},
+    {"cmp", OP_CMP, FUNCT_NONE, 2},
+    {"add", OP_ADD, FUNCT_ADD, 2},
+    {"sub", OP_SUB, FUNCT_SUB, 2},
+    {"lea", OP_LEA, FUNCT_NONE, 2},
+    {"clr", OP_CLR, FUNCT_CLR, 1},
+    {"not", OP_NOT, FUNCT_NOT, 1},
+    {"inc", OP_INC, FUNCT_INC, 1},
+    {"dec", OP_DEC, FUNCT_DEC, 1},
+    {"jmp", OP_JMP, FUNCT_JMP, 1},
+    {"bne", OP_BNE, FUNCT_BNE, 1},
+    {"jsr", OP_JSR, FUNCT_JSR, 1},
+    {"red", OP_RED, FUNCT_NONE, 1},
+    {"prn", OP_PRN, FUNCT_NONE, 1},
+    {"rts", OP_RTS, FUNCT_NONE, 0},
+    {"stop", OP_STOP, FUNCT_NONE, 0}
+};
 
 /* Initialize a machine word */
 void word_init(machine_word_t *word, unsigned int value, are_type_t are) {
@@ -55,8 +123,7 @@ void word_init(machine_word_t *word, unsigned int value, are_type_t are) {
         return;
     }
 
-    word->value = value & 0x1FFFFF; /* 21 bits */
-    word->are = are & ARE_MASK;     /* 3 bits */
+    *word = WORD_MAKE(value, are);
 }
 
 /* Set the opcode field in a machine word */
@@ -66,8 +133,7 @@ void word_set_opcode(machine_word_t *word, opcode_t opcode) {
     }
 
     /* Clear the opcode field and set the new value */
-    word->value &= ~(OPCODE_MASK << OPCODE_SHIFT);
-    word->value |= ((opcode & OPCODE_MASK) << OPCODE_SHIFT);
+    *word = (*word & ~FIELD(OPCODE_MASK, OPCODE_SHIFT)) | FIELD(opcode & OPCODE_MASK, OPCODE_SHIFT);
 }
 
 /* Set the function code field in a machine word */
@@ -77,8 +143,7 @@ void word_set_funct(machine_word_t *word, funct_t funct) {
     }
 
     /* Clear the funct field and set the new value */
-    word->value &= ~(FUNCT_MASK << FUNCT_SHIFT);
-    word->value |= ((funct & FUNCT_MASK) << FUNCT_SHIFT);
+    *word = (*word & ~FIELD(FUNCT_MASK, FUNCT_SHIFT)) | funct_fields[funct & FUNCT_MASK];
 }
 
 /* Set the source addressing method field in a machine word */
@@ -88,8 +153,7 @@ void word_set_src_addr(machine_word_t *word, addressing_method_t addr) {
     }
 
     /* Clear the source addressing field and set the new value */
-    word->value &= ~(SRC_ADDR_MASK << SRC_ADDR_SHIFT);
-    word->value |= ((addr & SRC_ADDR_MASK) << SRC_ADDR_SHIFT);
+    *word = (*word & ~FIELD(SRC_ADDR_MASK, SRC_ADDR_SHIFT)) | FIELD(addr & SRC_ADDR_MASK, SRC_ADDR_SHIFT);
 }
 
 /* Set the destination addressing method field in a machine word */
@@ -99,8 +163,7 @@ void word_set_dst_addr(machine_word_t *word, addressing_method_t addr) {
     }
 
     /* Clear the destination addressing field and set the new value */
-    word->value &= ~(DST_ADDR_MASK << DST_ADDR_SHIFT);
-    word->value |= ((addr & DST_ADDR_MASK) << DST_ADDR_SHIFT);
+    *word = (*word & ~FIELD(DST_ADDR_MASK, DST_ADDR_SHIFT)) | FIELD(addr & DST_ADDR_MASK, DST_ADDR_SHIFT);
 }
 
 /* Set the source register field in a machine word */
@@ -110,8 +173,7 @@ void word_set_src_reg(machine_word_t *word, int reg) {
     }
 
     /* Clear the source register field and set the new value */
-    word->value &= ~(SRC_REG_MASK << SRC_REG_SHIFT);
-    word->value |= ((reg & SRC_REG_MASK) << SRC_REG_SHIFT);
+    *word = (*word & ~FIELD(SRC_REG_MASK, SRC_REG_SHIFT)) | register_fields[reg & SRC_REG_MASK][0];
 }
 
 /* Set the destination register field in a machine word */
@@ -121,8 +183,7 @@ void word_set_dst_reg(machine_word_t *word, int reg) {
     }
 
     /* Clear the destination register field and set the new value */
-    word->value &= ~(DST_REG_MASK << DST_REG_SHIFT);
-    word->value |= ((reg & DST_REG_MASK) << DST_REG_SHIFT);
+    *word = (*word & ~FIELD(DST_REG_MASK, DST_REG_SHIFT)) | register_fields[0][reg & DST_REG_MASK];
 }
 
 /* Set the ARE bits of a machine word */
@@ -131,7 +192,7 @@ void word_set_are(machine_word_t *word, are_type_t are) {
         return;
     }
 
-    word->are = are & ARE_MASK;
+    *word = (*word & ~(machine_word_t)WORD_ARE_MASK) | (are & WORD_ARE_MASK);
 }
 
 /* Get a string representation of a machine word for debugging */
@@ -143,85 +204,114 @@ void word_to_string(const machine_word_t *word, char *buffer, size_t size) {
     }
 
     /* Create ARE string representation first */
-    are_str[0] = (word->are & WORD_ARE_ABSOLUTE) ? 'A' : '-';
-    are_str[1] = (word->are & WORD_ARE_RELOCATABLE) ? 'R' : '-';
-    are_str[2] = (word->are & WORD_ARE_EXTERNAL) ? 'E' : '-';
+    are_str[0] = (WORD_ARE(*word) & WORD_ARE_ABSOLUTE) ? 'A' : '-';
+    are_str[1] = (WORD_ARE(*word) & WORD_ARE_RELOCATABLE) ? 'R' : '-';
+    are_str[2] = (WORD_ARE(*word) & WORD_ARE_EXTERNAL) ? 'E' : '-';
     are_str[3] = '\0';
 
     /* Format using sprintf (C90 compliant) */
-    sprintf(buffer, "Value: 0x%06X, ARE: %s",
-            (word->value << 3) | word->are, are_str);
+    sprintf(buffer, "Value: 0x%06lX, ARE: %s", (unsigned long)*word, are_str);
 }
 
-/* Encode the first word of an instruction */
+/* Get the 24-bit form of a machine word */
+unsigned long word_to_bits(machine_word_t word) {
+    return (unsigned long)word;
+}
+
+/* Build a machine word from its 24-bit form */
+machine_word_t word_from_bits(unsigned long bits) {
+    return (machine_word_t)(bits & ((WORD_VALUE_MASK << WORD_ARE_BITS) | WORD_ARE_MASK));
+}
+
+/* Encode the first word of an instruction from the precomputed field tables */
 machine_word_t encode_instruction_word(opcode_t opcode,
                                      addressing_method_t src_addr,
                                      int src_reg,
                                      addressing_method_t dst_addr,
                                      int dst_reg,
                                      funct_t funct) {
-    machine_word_t word;
-
-    /* Initialize with zero value and absolute ARE */
-    word_init(&word, 0, WORD_ARE_ABSOLUTE);
-
-    /* Set the fields */
-    word_set_opcode(&word, opcode);
-    word_set_src_addr(&word, src_addr);
-    word_set_src_reg(&word, src_reg);
-    word_set_dst_addr(&word, dst_addr);
-    word_set_dst_reg(&word, dst_reg);
-    word_set_funct(&word, funct);
-
-    return word;
+    return opcode_templates[opcode & OPCODE_MASK] | funct_fields[funct & FUNCT_MASK] |
+           addressing_fields[src_addr & SRC_ADDR_MASK][dst_addr & DST_ADDR_MASK] |
+           register_fields[src_reg & SRC_REG_MASK][dst_reg & DST_REG_MASK];
 }
 
 /* Encode a register operand word */
 machine_word_t encode_register_word(int src_reg, int dst_reg) {
-    machine_word_t word;
-
-    /* Initialize with zero value and absolute ARE */
-    word_init(&word, 0, WORD_ARE_ABSOLUTE);
-
-    /* Set register fields */
-    if (src_reg >= 0) {
-        word_set_src_reg(&word, src_reg);
-    }
-
-    if (dst_reg >= 0) {
-        word_set_dst_reg(&word, dst_reg);
-    }
-
-    return word;
+    return register_fields[src_reg >= 0 ? src_reg & SRC_REG_MASK : 0][dst_reg >= 0 ? dst_reg & DST_REG_MASK : 0] |
+           ARE_ABSOLUTE;
 }
 
 /* Encode an immediate operand */
 machine_word_t encode_immediate(int value) {
-    machine_word_t word;
-
-    /* Initialize with the immediate value and absolute ARE */
-    word_init(&word, value & 0x1FFFFF, WORD_ARE_ABSOLUTE);
-
-    return word;
+    return WORD_MAKE(value, WORD_ARE_ABSOLUTE);
 }
 
 /* Encode a direct address operand */
 machine_word_t encode_direct_address(int address, bool is_external) {
-    machine_word_t word;
-
-    /* Initialize with the address value and appropriate ARE */
-    word_init(&word, address & 0x1FFFFF,
-             is_external ? WORD_ARE_EXTERNAL : WORD_ARE_RELOCATABLE);
-
-    return word;
+    return WORD_MAKE(address, is_external ? WORD_ARE_EXTERNAL : WORD_ARE_RELOCATABLE);
 }
 
 /* Encode a relative address operand */
 machine_word_t encode_relative_address(int distance) {
-    machine_word_t word;
+    return WORD_MAKE(distance, WORD_ARE_RELOCATABLE);
+}
+
+/* Decode the first word of an instruction */
+bool decode_instruction_word(machine_word_t word, decoded_instruction_t *decoded) {
+    unsigned int stored_opcode, funct;
+    addressing_method_t src_addr;
+    int i;
+
+    if (!decoded || WORD_ARE(word) != WORD_ARE_ABSOLUTE) {
+        return false;
+    }
 
-    /* Initialize with the distance value and relocatable ARE */
-    word_init(&word, distance & 0x1FFFFF, WORD_ARE_RELOCATABLE);
+    stored_opcode = (WORD_VALUE(word) >> OPCODE_SHIFT) & OPCODE_MASK;
+    funct = (WORD_VALUE(word) >> FUNCT_SHIFT) & FUNCT_MASK;
+    src_addr = (addressing_method_t)((WORD_VALUE(word) >> SRC_ADDR_SHIFT) & SRC_ADDR_MASK);
+
+    for (i = 0; i < INSN_COUNT; i++) {
+        /* Compare the opcode bits that survive the 21-bit value field */
+        if ((((unsigned int)instruction_table[i].opcode << OPCODE_SHIFT) & 0x1FFFFF) >> OPCODE_SHIFT != stored_opcode ||
+            (unsigned int)instruction_table[i].funct != funct) {
+            continue;
+        }
+        if (i == INSN_LEA && src_addr != ADDR_DIRECT) {
+            continue;
+        }
+        break;
+    }
+
+    if (i == INSN_COUNT) {
+        return false;
+    }
+
+    decoded->instruction = (instruction_id_t)i;
+    decoded->operand_count = instruction_table[i].operand_count;
+    decoded->src_addr = src_addr;
+    decoded->dst_addr = (addressing_method_t)((WORD_VALUE(word) >> DST_ADDR_SHIFT) & DST_ADDR_MASK);
+    decoded->src_reg = (WORD_VALUE(word) >> SRC_REG_SHIFT) & SRC_REG_MASK;
+    decoded->dst_reg = (WORD_VALUE(word) >> DST_REG_SHIFT) & DST_REG_MASK;
+
+    /* Same rules as calculate_instruction_length */
+    decoded->length = 1;
+    if (decoded->operand_count == 2) {
+        if (decoded->src_addr == ADDR_REGISTER && decoded->dst_addr == ADDR_REGISTER) {
+            decoded->length = 2;
+        } else {
+            decoded->length += (decoded->src_addr != ADDR_REGISTER) + (decoded->dst_addr != ADDR_REGISTER);
+        }
+    } else if (decoded->operand_count == 1) {
+        decoded->length += decoded->dst_addr != ADDR_REGISTER;
+    }
+
+    return true;
+}
 
-    return word;
+/* Get the mnemonic of an instruction */
+const char *instruction_name(instruction_id_t instruction) {
+    if ((int)instruction < 0 || instruction >= INSN_COUNT) {
+        return "?";
+    }
+    return instruction_table[instruction].name;
 }
\ No newline at end of file
@@ -0,0 +1,258 @@
+/**
+ * @file macro_library.c
+ * @brief Implementation of precompiled macro libraries (.mlib)
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/macro_library.h"
+#include "../include/utils.h"
+
+#define MACRO_LIBRARY_ALIGN 16    /* Alignment of every section in bytes */
+
+/* Forward declarations for internal functions */
+static uint32_t align_section(uint32_t offset);
+static bool validate_macro_library(const unsigned char *base, size_t size, macro_library_t *library,
+                                   error_context_t *context);
+
+/* Compile the macros of a table into a macro library file */
+bool write_macro_library(const char *path, const macro_table_t *table, error_context_t *context) {
+    macro_library_header_t header;
+    macro_library_entry_t *entry;
+    const macro_t *macro;
+    unsigned char *buffer;
+    uint32_t *slots;
+    uint32_t count = 0, slot, index, text_size = 0, text;
+    FILE *file;
+    int i;
+    bool success;
+
+    if (!path || !table) {
+        report_context_error(context, "Invalid parameters for write_macro_library");
+        return false;
+    }
+
+    for (macro = table->head; macro; macro = macro->next) {
+        count++;
+        text_size += (uint32_t)strlen(macro->name) + 1;
+        for (i = 0; i < macro->line_count; i++) {
+            text_size += (uint32_t)strlen(macro->lines[i]) + 1;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MACRO_LIBRARY_MAGIC, 4);
+    header.version = MACRO_LIBRARY_VERSION;
+    header.header_size = sizeof(macro_library_header_t);
+    header.macro_count = count;
+    header.slot_count = 16;
+    while (header.slot_count < count * 2) {
+        header.slot_count *= 2;
+    }
+    header.slots_offset = align_section(sizeof(macro_library_header_t));
+    header.macros_offset = align_section(header.slots_offset + header.slot_count * sizeof(uint32_t));
+    header.text_offset = align_section(header.macros_offset + count * sizeof(macro_library_entry_t));
+    header.text_size = text_size;
+    header.file_size = header.text_offset + text_size;
+
+    buffer = (unsigned char *)calloc(header.file_size, 1);
+    if (!buffer) {
+        report_context_error(context, "Memory allocation error");
+        return false;
+    }
+    memcpy(buffer, &header, sizeof(header));
+    slots = (uint32_t *)(buffer + header.slots_offset);
+    entry = (macro_library_entry_t *)(buffer + header.macros_offset);
+
+    /* Names and bodies go to the text section; bodies keep the expanded line layout */
+    text = 0;
+    for (macro = table->head, index = 0; macro; macro = macro->next, index++, entry++) {
+        entry->hash = (uint32_t)hash_string(macro->name);
+        entry->name_offset = text;
+        strcpy((char *)buffer + header.text_offset + text, macro->name);
+        text += (uint32_t)strlen(macro->name) + 1;
+
+        entry->body_offset = text;
+        for (i = 0; i < macro->line_count; i++) {
+            size_t length = strlen(macro->lines[i]);
+            memcpy(buffer + header.text_offset + text, macro->lines[i], length);
+            buffer[header.text_offset + text + length] = '\n';
+            text += (uint32_t)length + 1;
+        }
+        entry->body_size = text - entry->body_offset;
+        entry->line_count = (uint32_t)macro->line_count;
+
+        slot = entry->hash & (header.slot_count - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (header.slot_count - 1);
+        }
+        slots[slot] = index + 1;
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        free(buffer);
+        report_context_error(context, "Could not open output file: %s", path);
+        return false;
+    }
+    success = fwrite(buffer, 1, header.file_size, file) == header.file_size;
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    free(buffer);
+
+    if (!success) {
+        report_context_error(context, "Could not write macro library: %s", path);
+    }
+
+    return success;
+}
+
+/* Map a macro library file and validate it */
+bool open_macro_library(const char *path, macro_library_t *library, error_context_t *context) {
+    struct stat st;
+    void *mapping;
+    int fd;
+
+    if (!path || !library) {
+        report_context_error(context, "Invalid parameters for open_macro_library");
+        return false;
+    }
+
+    memset(library, 0, sizeof(macro_library_t));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(macro_library_header_t)) {
+        close(fd);
+        report_context_error(context, "Not a macro library: %s", path);
+        return false;
+    }
+
+    mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        report_context_error(context, "Could not map file: %s", path);
+        return false;
+    }
+
+    if (!validate_macro_library((const unsigned char *)mapping, (size_t)st.st_size, library, context)) {
+        munmap(mapping, (size_t)st.st_size);
+        return false;
+    }
+
+    library->mapping = mapping;
+    library->mapping_size = (size_t)st.st_size;
+
+    return true;
+}
+
+/* Release a macro library view */
+void close_macro_library(macro_library_t *library) {
+    if (!library) {
+        return;
+    }
+
+    if (library->mapping) {
+        munmap(library->mapping, library->mapping_size);
+    }
+    memset(library, 0, sizeof(macro_library_t));
+}
+
+/* Find a macro in a library */
+const macro_library_entry_t *find_library_macro(const macro_library_t *library, const char *name) {
+    const macro_library_entry_t *entry;
+    uint32_t hash, slot, mask;
+
+    if (!library || !library->header) {
+        return NULL;
+    }
+
+    hash = (uint32_t)hash_string(name);
+    mask = library->header->slot_count - 1;
+    for (slot = hash & mask; library->slots[slot] != 0; slot = (slot + 1) & mask) {
+        entry = &library->macros[library->slots[slot] - 1];
+        if (entry->hash == hash && strcmp(library->text + entry->name_offset, name) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Helper function to round an offset up to the section alignment */
+static uint32_t align_section(uint32_t offset) {
+    return (offset + MACRO_LIBRARY_ALIGN - 1) & ~(uint32_t)(MACRO_LIBRARY_ALIGN - 1);
+}
+
+/* Helper function to check that every section and record lies inside the file */
+static bool validate_macro_library(const unsigned char *base, size_t size, macro_library_t *library,
+                                   error_context_t *context) {
+    const macro_library_header_t *header = (const macro_library_header_t *)base;
+    const macro_library_entry_t *entry;
+    uint32_t i, empty = 0;
+
+    if (memcmp(header->magic, MACRO_LIBRARY_MAGIC, 4) != 0) {
+        report_context_error(context, "Bad macro library magic");
+        return false;
+    }
+
+    /* A byte-swapped header_size means the file was written on a host with the other byte order */
+    if (header->header_size != sizeof(macro_library_header_t) || header->version != MACRO_LIBRARY_VERSION) {
+        report_context_error(context, "Unsupported macro library version or byte order");
+        return false;
+    }
+
+    if (header->file_size > size || header->slot_count == 0 ||
+        (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->slots_offset % MACRO_LIBRARY_ALIGN != 0 || header->macros_offset % MACRO_LIBRARY_ALIGN != 0 ||
+        header->slots_offset > size || header->slot_count > (size - header->slots_offset) / sizeof(uint32_t) ||
+        header->macros_offset > size ||
+        header->macro_count > (size - header->macros_offset) / sizeof(macro_library_entry_t) ||
+        header->text_offset > size || header->text_size > size - header->text_offset) {
+        report_context_error(context, "Macro library section exceeds file size");
+        return false;
+    }
+
+    library->header = header;
+    library->slots = (const uint32_t *)(base + header->slots_offset);
+    library->macros = (const macro_library_entry_t *)(base + header->macros_offset);
+    library->text = (const char *)(base + header->text_offset);
+
+    /* Lookups stop at an empty slot and follow slot values into the table */
+    for (i = 0; i < header->slot_count; i++) {
+        if (library->slots[i] == 0) {
+            empty++;
+        } else if (library->slots[i] > header->macro_count) {
+            report_context_error(context, "Macro library index out of range");
+            return false;
+        }
+    }
+    if (empty == 0) {
+        report_context_error(context, "Macro library index is full");
+        return false;
+    }
+
+    for (i = 0; i < header->macro_count; i++) {
+        entry = &library->macros[i];
+        if (entry->name_offset >= header->text_size ||
+            memchr(library->text + entry->name_offset, '\0', header->text_size - entry->name_offset) == NULL ||
+            entry->body_offset > header->text_size || entry->body_size > header->text_size - entry->body_offset) {
+            report_context_error(context, "Macro library record out of range");
+            return false;
+        }
+    }
+
+    return true;
+}
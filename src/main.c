@@ -8,83 +8,388 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include "../include/assembler.h"
+#include "../include/assembler_context.h"
 #include "../include/utils.h"
 #include "../include/pre_assembler.h"
-#include "../include/first_pass.h"
-#include "../include/second_pass.h"
-#include "../include/symbol_table.h"
-#include "../include/output.h"
+#include "../include/macro_library.h"
+#include "../include/binary_object.h"
+#include "../include/linker.h"
+#include "../include/simulator.h"
+#include "../include/archive.h"
+#include "../include/async_io.h"
+#include "../include/edit_server.h"
+#include "../include/watch.h"
 #include "../include/error.h"
 
 /**
- * @brief Process a single assembly file
- * @param filename The name of the source file
- * @return true if processing was successful, false otherwise
+ * @brief Queue every file named in a file list
+ * @param queue The queue assembling the files with one context
+ * @param list The list file, or "-" for standard input
+ * @return true if the list was read, false otherwise (failures of the files are kept by the queue)
+ *
+ * The list holds one file name per line; leading and trailing whitespace is
+ * ignored, as are empty lines. Names are assembled as they are read, so the
+ * list may be longer than any command line.
  */
-bool process_assembly_file(const char *filename) {
-    symbol_table_t *symbols = NULL;
-    machine_word_t *code_image = NULL;
-    machine_word_t *data_image = NULL;
-    external_reference_t *ext_refs = NULL;
-    int ICF = 0, DCF = 0;
-    error_context_t context;
+static bool process_file_list(assembler_queue_t *queue, const char *list) {
+    FILE *file;
+    char line[MAX_FILENAME_LENGTH + 2];
+    char *name;
+    size_t length;
+    bool success = true;
+    int c;
 
-    /* Initialize error context */
-    init_error_context(&context, filename);
+    file = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open file list: %s\n", list);
+        return false;
+    }
 
-    printf("Processing file: %s\n", filename);
+    while (fgets(line, sizeof(line), file)) {
+        length = strlen(line);
 
-    /* Step 1: Pre-assembler (macro processor) */
-    if (!process_file(filename, &context)) {
-        fprintf(stderr, "Error in pre-assembler phase for %s\n", filename);
-        return false;
+        /* A name that fills the buffer without its newline is too long; skip the rest of it */
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            fprintf(stderr, "File name too long in %s: %.40s...\n", list, line);
+            success = false;
+            while ((c = getc(file)) != EOF && c != '\n') {
+            }
+            continue;
+        }
+
+        while (length > 0 && isspace((unsigned char)line[length - 1])) {
+            line[--length] = '\0';
+        }
+        name = line;
+        while (isspace((unsigned char)*name)) {
+            name++;
+        }
+
+        if (*name) {
+            queue_file(queue, name);
+        }
+    }
+
+    if (ferror(file)) {
+        fprintf(stderr, "Error reading file list: %s\n", list);
+        success = false;
+    }
+    if (file != stdin) {
+        fclose(file);
     }
 
-    printf("Pre-assembler phase successful for %s\n", filename);
+    return success;
+}
 
-    /* Step 2: Create symbol table and perform first pass */
-    symbols = create_symbol_table();
-    if (!symbols) {
-        report_context_error(&context, "Memory allocation error for symbol table");
+/**
+ * @brief Parse a --format= option value
+ * @param value The text after "--format="
+ * @param format Output parameter for the format
+ * @return true if the value names a known format, false otherwise
+ */
+static bool parse_format(const char *value, output_format_t *format) {
+    if (strcmp(value, "text") == 0) {
+        *format = FORMAT_TEXT;
+    } else if (strcmp(value, "bin") == 0) {
+        *format = FORMAT_BINARY;
+    } else if (strcmp(value, "bin24") == 0) {
+        *format = FORMAT_BINARY_PACKED;
+    } else {
+        fprintf(stderr, "Unknown format: %s (expected text, bin or bin24)\n", value);
         return false;
     }
+    return true;
+}
 
-    if (!first_pass(filename, symbols, &context)) {
-        fprintf(stderr, "Error in first pass phase for %s\n", filename);
-        free_symbol_table(symbols);
-        return false;
+/**
+ * @brief Convert between the text and binary object formats
+ * @param argc Number of arguments after the subcommand
+ * @param argv The arguments after the subcommand
+ * @return 0 on success, non-zero on failure
+ *
+ * A .tpo input is expanded into the text .ob/.ent/.ext files named after the
+ * output; any other input names the text files to pack into the .tpo output.
+ */
+static int run_convert(int argc, char *argv[]) {
+    output_format_t format = FORMAT_BINARY;
+    error_context_t context;
+    char base[MAX_FILENAME_LENGTH];
+    const char *input, *output, *ext;
+
+    if (argc == 3 && strncmp(argv[0], "--format=", 9) == 0) {
+        if (!parse_format(argv[0] + 9, &format) || format == FORMAT_TEXT) {
+            return 1;
+        }
+        argc--;
+        argv++;
     }
 
-    printf("First pass phase successful for %s\n", filename);
+    if (argc != 2) {
+        fprintf(stderr, "Usage: assembler convert [--format=bin|bin24] input output\n");
+        return 1;
+    }
 
-    /* Step 3: Perform second pass - encode instructions */
-    if (!second_pass(filename, symbols, &code_image, &data_image, &ext_refs, &ICF, &DCF, &context)) {
-        fprintf(stderr, "Error in second pass phase for %s\n", filename);
-        free_symbol_table(symbols);
-        return false;
+    input = argv[0];
+    output = argv[1];
+    init_error_context(&context, input);
+
+    ext = strrchr(input, '.');
+    if (ext && strcmp(ext, EXT_BINARY) == 0) {
+        get_base_filename(output, base);
+        return convert_binary_to_text(input, base, &context) ? 0 : 1;
     }
 
-    printf("Second pass phase successful for %s\n", filename);
+    get_base_filename(input, base);
+    return convert_text_to_binary(base, output,
+                                  format == FORMAT_BINARY_PACKED ? BINARY_WORD_PACKED : BINARY_WORD_WIDE,
+                                  &context) ? 0 : 1;
+}
 
-    /* Step 4: Generate output files */
-    if (!generate_output_files(filename, symbols, code_image, data_image, ext_refs, ICF, DCF, &context)) {
-        fprintf(stderr, "Error in output generation phase for %s\n", filename);
-        cleanup_resources(NULL, symbols, code_image, data_image);
-        free_external_references(ext_refs);
-        return false;
+/**
+ * @brief Link binary objects into one image
+ * @param argc Number of arguments after the subcommand
+ * @param argv The arguments after the subcommand
+ * @return 0 on success, non-zero on failure
+ */
+static int run_link(int argc, char *argv[]) {
+    link_options_t options;
+    output_format_t format = FORMAT_BINARY;
+    const char **paths;
+    int i, count = 0;
+    bool success;
+
+    options.output = LINK_DEFAULT_OUTPUT;
+    options.base = MEMORY_START;
+    options.threads = 0;
+
+    paths = (const char **)malloc((argc + 1) * sizeof(const char *));
+    if (!paths) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && is_integer(argv[i + 1])) {
+            options.threads = string_to_int(argv[++i]);
+        } else if (strncmp(argv[i], "--base=", 7) == 0 && is_integer(argv[i] + 7)) {
+            options.base = string_to_int(argv[i] + 7);
+        } else if (strncmp(argv[i], "--format=", 9) == 0) {
+            if (!parse_format(argv[i] + 9, &format) || format == FORMAT_TEXT) {
+                free(paths);
+                return 1;
+            }
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown link option: %s\n", argv[i]);
+            free(paths);
+            return 1;
+        } else {
+            paths[count++] = argv[i];
+        }
     }
 
-    printf("Successfully processed %s\n", filename);
+    if (count == 0 || options.base < 0) {
+        fprintf(stderr, "Usage: assembler link [-o out.tpo] [--base=N] [-j threads] [--format=bin|bin24] file.tpo ...\n");
+        free(paths);
+        return 1;
+    }
 
-    /* Clean up resources */
-    free_symbol_table(symbols);
-    free(code_image);
-    free(data_image);
-    free_external_references(ext_refs);
+    options.word_bytes = format == FORMAT_BINARY_PACKED ? BINARY_WORD_PACKED : BINARY_WORD_WIDE;
+    success = link_objects(paths, count, &options);
 
-    return true;
+    free(paths);
+    return success ? 0 : 1;
+}
+
+/**
+ * @brief Run a binary object in the simulator
+ * @param argc Number of arguments after the subcommand
+ * @param argv The arguments after the subcommand
+ * @return 0 if the program reached stop, non-zero otherwise
+ */
+static int run_sim(int argc, char *argv[]) {
+    sim_options_t options;
+    const char *path = NULL;
+    int i;
+
+    options.max_steps = 0;
+    options.profile = false;
+
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0) {
+            options.profile = true;
+        } else if (strncmp(argv[i], "--max-steps=", 12) == 0 && is_integer(argv[i] + 12) &&
+                   string_to_int(argv[i] + 12) > 0) {
+            options.max_steps = (unsigned long)string_to_int(argv[i] + 12);
+        } else if (argv[i][0] == '-' || path) {
+            path = NULL;
+            break;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (!path) {
+        fprintf(stderr, "Usage: assembler sim [--profile] [--max-steps=N] file.tpo\n");
+        return 1;
+    }
+
+    return simulate_object(path, &options) ? 0 : 1;
+}
+
+/**
+ * @brief Serve edits of one source file over standard input and output
+ * @param argc Number of arguments after the subcommand
+ * @param argv The arguments after the subcommand
+ * @return 0 when the session ends, non-zero if the file could not be loaded
+ */
+static int run_serve(int argc, char *argv[]) {
+    if (argc != 1 || argv[0][0] == '-') {
+        fprintf(stderr, "Usage: assembler serve file.as\n");
+        return 1;
+    }
+
+    return serve_edit_session(argv[0], stdin, stdout) ? 0 : 1;
+}
+
+/**
+ * @brief Compile macro definitions into a macro library
+ * @param argc Number of arguments after the subcommand
+ * @param argv The arguments after the subcommand
+ * @return 0 on success, non-zero on failure
+ */
+static int run_mlib(int argc, char *argv[]) {
+    const char *output = NULL;
+    macro_table_t *table;
+    error_context_t context;
+    int i, count = 0;
+    bool success = true;
+
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] == '-') {
+            output = NULL;
+            break;
+        } else {
+            count++;
+        }
+    }
+
+    if (!output || count == 0) {
+        fprintf(stderr, "Usage: assembler mlib -o out.mlib definitions ...\n");
+        return 1;
+    }
+
+    table = create_macro_table();
+    if (!table) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0) {
+            i++;
+            continue;
+        }
+        init_error_context(&context, argv[i]);
+        if (!collect_macro_definitions(argv[i], table, &context)) {
+            success = false;
+        }
+    }
+
+    if (success) {
+        init_error_context(&context, output);
+        success = write_macro_library(output, table, &context);
+    }
+
+    free_macro_table(table);
+    clear_include_cache();
+
+    return success ? 0 : 1;
+}
+
+/**
+ * @brief List or extract the modules of an output archive
+ * @param argc Number of arguments after the subcommand
+ * @param argv The arguments after the subcommand
+ * @return 0 on success, non-zero on failure
+ *
+ * Without module names every module is handled; a name may be given with or
+ * without its source extension and is looked up in the archive's index.
+ */
+static int run_extract(int argc, char *argv[]) {
+    const char *path = NULL, *directory = NULL;
+    const archive_module_t *module;
+    archive_t archive;
+    error_context_t context;
+    char name[MAX_FILENAME_LENGTH];
+    size_t size;
+    uint32_t index;
+    int i, member, first = argc;
+    bool list = false, success = true;
+
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            directory = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0) {
+            list = true;
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+            first = i + 1;
+            break;
+        } else {
+            break;
+        }
+    }
+
+    if (!path) {
+        fprintf(stderr, "Usage: assembler extract [-l] [-C dir] archive.tpa [module ...]\n");
+        return 1;
+    }
+
+    init_error_context(&context, path);
+    if (!open_archive(path, &archive, &context)) {
+        return 1;
+    }
+
+    for (i = first, index = 0; first < argc ? i < argc : index < archive.header->module_count; i++, index++) {
+        if (first < argc) {
+            if (strlen(argv[i]) >= MAX_FILENAME_LENGTH) {
+                fprintf(stderr, "Module name too long: %.40s...\n", argv[i]);
+                success = false;
+                continue;
+            }
+            make_archive_module_name(argv[i], name);
+            module = find_archive_module(&archive, name);
+            if (!module) {
+                fprintf(stderr, "No module %s in %s\n", name, path);
+                success = false;
+                continue;
+            }
+        } else {
+            module = &archive.modules[index];
+        }
+
+        if (list) {
+            printf("%s", archive_module_name(&archive, module));
+            for (member = 0; member < ARCHIVE_MEMBER_COUNT; member++) {
+                if (archive_member_data(&archive, module, (archive_member_t)member, &size)) {
+                    printf(" %s:%lu", archive_member_extension((archive_member_t)member), (unsigned long)size);
+                }
+            }
+            printf("\n");
+        } else if (!extract_archive_module(&archive, module, directory, &context)) {
+            success = false;
+        }
+    }
+
+    close_archive(&archive);
+    return success ? 0 : 1;
 }
 
 /**
@@ -95,20 +400,248 @@ bool process_assembly_file(const char *filename) {
  */
 int main(int argc, char *argv[]) {
     int i;
+    int file_count = 0;
     bool success = true;
+    assembler_options_t options;
+    const char *macro_library_path = NULL;
+    const char *archive_path = NULL;
+    const char *watch_path = NULL;
+    int stdin_sources = 0;
+    bool stdin_list = false;
+    archive_writer_t archive;
+    const char *io_backend = "sync";
+    int prefetch = DEFAULT_PREFETCH;
+    assembler_queue_t queue;
+    macro_library_t macro_library;
+    error_context_t context;
+    assembler_context_t assembler;
+
+    /* Subcommands */
+    if (argc >= 2 && strcmp(argv[1], "convert") == 0) {
+        return run_convert(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "link") == 0) {
+        return run_link(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "sim") == 0) {
+        return run_sim(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        return run_serve(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "mlib") == 0) {
+        return run_mlib(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "extract") == 0) {
+        return run_extract(argc - 2, argv + 2);
+    }
+
+    /* Parse options */
+    options.format = FORMAT_TEXT;
+    options.optimize = false;
+    options.outline_min_saving = 0;
+    options.gc_data = false;
+    options.pool_data = false;
+    options.macro_library = NULL;
+    options.archive = NULL;
+    options.io = NULL;
+    options.check = false;
+    options.stream = NULL;
+    options.pipeline = false;
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--format=", 9) == 0) {
+            if (!parse_format(argv[i] + 9, &options.format)) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--check") == 0) {
+            options.check = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            options.pipeline = true;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            options.optimize = true;
+        } else if (strcmp(argv[i], "--outline") == 0) {
+            options.outline_min_saving = 1;
+        } else if (strncmp(argv[i], "--outline=", 10) == 0 && is_integer(argv[i] + 10) &&
+                   string_to_int(argv[i] + 10) > 0) {
+            options.outline_min_saving = string_to_int(argv[i] + 10);
+        } else if (strcmp(argv[i], "--gc-data") == 0) {
+            options.gc_data = true;
+        } else if (strcmp(argv[i], "--pool-data") == 0) {
+            options.pool_data = true;
+        } else if (strcmp(argv[i], "--macro-lib") == 0 && i + 1 < argc) {
+            macro_library_path = argv[++i];
+        } else if (strncmp(argv[i], "--macro-lib=", 12) == 0) {
+            macro_library_path = argv[i] + 12;
+        } else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+            archive_path = argv[++i];
+        } else if (strncmp(argv[i], "--archive=", 10) == 0 && argv[i][10] != '\0') {
+            archive_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            if (strcmp(argv[++i], "-") != 0) {
+                fprintf(stderr, "-o only accepts - (standard output); output files are named after each source\n");
+                return 1;
+            }
+            options.stream = stdout;
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watch_path = argv[++i];
+        } else if (strncmp(argv[i], "--watch=", 8) == 0 && argv[i][8] != '\0') {
+            watch_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--io=uring") == 0 || strcmp(argv[i], "--io=threads") == 0 ||
+                   strcmp(argv[i], "--io=sync") == 0) {
+            io_backend = argv[i] + 5;
+        } else if (strncmp(argv[i], "--prefetch=", 11) == 0 && is_integer(argv[i] + 11) &&
+                   string_to_int(argv[i] + 11) > 0) {
+            prefetch = string_to_int(argv[i] + 11);
+        } else if (strncmp(argv[i], "--files-from=", 13) == 0 && argv[i][13] != '\0') {
+            if (strcmp(argv[i] + 13, "-") == 0) {
+                stdin_list = true;
+            }
+            file_count++;
+        } else if (strcmp(argv[i], "-") == 0) {
+            stdin_sources++;
+            file_count++;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        } else {
+            file_count++;
+        }
+    }
 
     /* Check command-line arguments */
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s file1 file2 ...\n", argv[0]);
+    if (file_count == 0 && !watch_path) {
+        fprintf(stderr, "Usage: %s [--watch dir] [--check] [--pipeline] [-o -] [-O] [--outline[=N]] [--gc-data] [--pool-data] [--macro-lib lib.mlib] [--format=text|bin|bin24] [--archive out.tpa] [--io=uring|threads|sync] [--prefetch=N] file1 - @list --files-from=list|- ...\n", argv[0]);
+        fprintf(stderr, "       %s convert [--format=bin|bin24] input output\n", argv[0]);
+        fprintf(stderr, "       %s link [-o out.tpo] [--base=N] [-j threads] file.tpo ...\n", argv[0]);
+        fprintf(stderr, "       %s sim [--profile] [--max-steps=N] file.tpo\n", argv[0]);
+        fprintf(stderr, "       %s serve file.as\n", argv[0]);
+        fprintf(stderr, "       %s mlib -o out.mlib definitions ...\n", argv[0]);
+        fprintf(stderr, "       %s extract [-l] [-C dir] archive.tpa [module ...]\n", argv[0]);
+        return 1;
+    }
+
+    /* The archive holds the text outputs only */
+    if (archive_path && options.format != FORMAT_TEXT) {
+        fprintf(stderr, "--archive cannot be combined with --format=bin or bin24\n");
+        return 1;
+    }
+
+    /* Watch mode assembles the directory's sources and runs until it is stopped */
+    if (watch_path && (file_count > 0 || archive_path)) {
+        fprintf(stderr, "--watch cannot be combined with file names or --archive\n");
+        return 1;
+    }
+
+    /* A source read from standard input has no name to derive output files from */
+    if (stdin_sources > 0 && !options.stream) {
+        fprintf(stderr, "Reading the source from standard input (-) needs -o -\n");
+        return 1;
+    }
+    if (stdin_sources + (stdin_list ? 1 : 0) > 1) {
+        fprintf(stderr, "Standard input can only be read once\n");
+        return 1;
+    }
+
+    /* The stream holds the text outputs of the modules, one after the other */
+    if (options.stream && (archive_path || watch_path || options.format != FORMAT_TEXT)) {
+        fprintf(stderr, "-o - cannot be combined with --archive, --watch or --format=bin|bin24\n");
+        return 1;
+    }
+
+    /* A check writes nothing, not even an archive */
+    if (archive_path && options.check) {
+        fprintf(stderr, "--archive cannot be combined with --check\n");
+        return 1;
+    }
+
+    /* The macro library stays mapped for every file */
+    if (macro_library_path) {
+        init_error_context(&context, macro_library_path);
+        if (!open_macro_library(macro_library_path, &macro_library, &context)) {
+            return 1;
+        }
+        options.macro_library = &macro_library;
+    }
+
+    if (!init_assembler_context(&assembler)) {
+        fprintf(stderr, "Memory allocation error\n");
+        if (options.macro_library) {
+            close_macro_library(&macro_library);
+        }
         return 1;
     }
 
-    /* Process each file */
+    /* Every module's outputs are appended to one archive */
+    if (archive_path) {
+        init_error_context(&context, archive_path);
+        if (!open_archive_writer(&archive, archive_path, &context)) {
+            free_assembler_context(&assembler);
+            if (options.macro_library) {
+                close_macro_library(&macro_library);
+            }
+            return 1;
+        }
+        options.archive = &archive;
+    }
+
+    /* Sources are read ahead and outputs written behind by the I/O engine */
+    if (strcmp(io_backend, "sync") != 0) {
+        options.io = create_async_io(strcmp(io_backend, "uring") == 0 ? ASYNC_IO_BACKEND_URING
+                                                                      : ASYNC_IO_BACKEND_THREADS);
+        if (!options.io) {
+            fprintf(stderr, "Could not start the I/O engine; using blocking I/O\n");
+        }
+    }
+
+    if (!init_assembler_queue(&queue, &assembler, &options, prefetch)) {
+        fprintf(stderr, "Memory allocation error\n");
+        queue.window = 0;
+        success = false;
+    }
+
+    if (watch_path && !watch_directory(watch_path, &assembler, &options)) {
+        success = false;
+    }
+
+    /* Process each file, reusing one context; @list and --files-from= name more files */
     for (i = 1; i < argc; i++) {
-        if (!process_assembly_file(argv[i])) {
+        if (strcmp(argv[i], "--macro-lib") == 0 || strcmp(argv[i], "--archive") == 0 ||
+            strcmp(argv[i], "--watch") == 0 || strcmp(argv[i], "-o") == 0) {
+            i++;
+            continue;
+        }
+        if (strncmp(argv[i], "--files-from=", 13) == 0) {
+            if (!process_file_list(&queue, argv[i] + 13)) {
+                success = false;
+            }
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            continue;
+        }
+        if (argv[i][0] == '@') {
+            if (!process_file_list(&queue, argv[i] + 1)) {
+                success = false;
+            }
+        } else {
+            queue_file(&queue, argv[i]);
+        }
+    }
+    if (!finish_assembler_queue(&queue)) {
+        success = false;
+    }
+    destroy_async_io(options.io);
+    if (options.archive) {
+        init_error_context(&context, archive_path);
+        if (!close_archive_writer(&archive, &context)) {
             success = false;
         }
     }
+    free_assembler_context(&assembler);
+    clear_include_cache();
+    if (options.macro_library) {
+        close_macro_library(&macro_library);
+    }
 
     return success ? 0 : 1;
 }
\ No newline at end of file
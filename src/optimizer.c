@@ -0,0 +1,1426 @@
+/**
+ * @file optimizer.c
+ * @brief Implementation of the optional optimization passes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/optimizer.h"
+#include "../include/expanded_source.h"
+#include "../include/utils.h"
+
+#define MAX_JUMP_THREADING 64     /* Longest jmp chain followed by jump threading */
+#define DATA_WORD_MASK 0x1FFFFF   /* Data words keep the low 21 bits of each value */
+#define OUTLINE_LABEL_PREFIX "OUTLINED"  /* Labels of outlined subroutines: OUTLINED1, OUTLINED2, ... */
+#define OUTLINE_CALL_WORDS 2      /* jsr LABEL */
+#define OUTLINE_RETURN_WORDS 1    /* rts */
+
+/**
+ * @brief A labeled data directive and the unlabeled data directives after it
+ */
+typedef struct {
+    const char *label;            /* Label of the first directive */
+    int *words;                   /* Word values of the whole block */
+    int length;                   /* Number of words */
+    bool string_tail;             /* The last directive is a .string, so the block ends in a NUL */
+    bool pooled;                  /* Removed in favor of another block */
+    bool opaque;                  /* Holds words not listed in the source text (.incbin, .space, .fill) */
+    bool written;                 /* Written by an instruction here, or by another module through .entry */
+} data_block_t;
+
+/**
+ * @brief Where a run of words starts in a kept data block
+ */
+typedef struct {
+    int block;                    /* Index of the kept block (-1 = empty slot) */
+    int offset;                   /* Word offset into the block */
+    unsigned long hash;           /* hash_words of the words from offset to the end */
+} pool_slot_t;
+
+/**
+ * @brief The instructions of the program as a token string for the outliner
+ */
+typedef struct {
+    int *tokens;                  /* Instruction id, or a unique negative separator */
+    int *lines;                   /* Program line of each token */
+    int *words;                   /* Code words of each instruction */
+    int count;
+} instruction_stream_t;
+
+/**
+ * @brief The most profitable repeated sequence found so far
+ */
+typedef struct {
+    int length;                   /* Instructions in the sequence */
+    int *positions;               /* Stream positions of the non-overlapping occurrences */
+    int occurrence_count;
+    int saving;                   /* Code words saved by outlining it */
+} outline_candidate_t;
+
+/**
+ * @brief Suffix array of an instruction stream and the common prefixes of its neighbours
+ */
+typedef struct {
+    int *suffixes;                /* Stream positions in the order of the token strings starting there */
+    int *ranks;                   /* Entry of each stream position in suffixes */
+    int *prefix;                  /* prefix[i]: tokens shared by suffixes[i - 1] and suffixes[i] */
+    int *word_sums;               /* word_sums[i]: code words of the tokens before position i */
+} suffix_index_t;
+
+/**
+ * @brief A sequence repeated by the suffixes of a range of the suffix array
+ */
+typedef struct {
+    int first;                    /* First suffix array entry of the occurrences */
+    int last;                     /* Last suffix array entry of the occurrences */
+    int length;                   /* Instructions in the sequence */
+    int saving;                   /* Code words saved when every occurrence is free */
+} repeat_t;
+
+/* Forward declarations for internal functions */
+static bool load_program(expanded_source_t *source, program_t *program, error_context_t *context);
+static bool store_program(const program_t *program, expanded_source_t *source, const char *am_filename,
+                          error_context_t *context);
+static void free_program(program_t *program);
+static int count_code_words(const program_t *program);
+static bool peephole_pass(program_t *program, symbol_table_t *symbols);
+static int outline_pass(program_t *program, symbol_table_t *symbols, int min_saving, error_context_t *context);
+static bool build_instruction_stream(const program_t *program, instruction_stream_t *stream);
+static bool build_suffix_index(const instruction_stream_t *stream, suffix_index_t *index);
+static int find_repeats(const instruction_stream_t *stream, const suffix_index_t *index, int min_saving,
+                        repeat_t *repeats, int *positions);
+static bool evaluate_repeat(const suffix_index_t *index, int first, int last, int parent, int prefix,
+                            int *positions, repeat_t *repeat);
+static bool consider_length(const suffix_index_t *index, int position, int occurrences, int length,
+                            repeat_t *repeat, bool found);
+static int count_disjoint(int *positions, int count, int length, const char *claimed);
+static bool claim_occurrences(const suffix_index_t *index, const repeat_t *repeat, const char *claimed,
+                              outline_candidate_t *candidate);
+static int compare_repeats(const void *a, const void *b);
+static int compare_positions(const void *a, const void *b);
+static bool outline_candidate(program_t *program, const instruction_stream_t *stream,
+                              const outline_candidate_t *candidate, const char *label);
+static bool append_line(program_t *program, const char *label, const parsed_line_t *parsed);
+static bool is_outlinable(const parsed_line_t *parsed);
+static void format_instruction(const parsed_line_t *parsed, char *buffer);
+static int gc_data_pass(program_t *program);
+static bool pool_data_pass(program_t *program, optimization_result_t *result, int *saved,
+                           error_context_t *context);
+static int collect_data_blocks(program_t *program, data_block_t **blocks, int **block_of,
+                               error_context_t *context);
+static int append_data_words(const parsed_line_t *parsed, int *words);
+static unsigned long hash_words(const int *words, int count);
+static void mark_written_blocks(const program_t *program, data_block_t *blocks, int count);
+static bool is_referenced(const program_t *program, const char *label);
+static int count_data_words(const parsed_line_t *parsed);
+static bool rewrite_short_form(program_line_t *line);
+static bool thread_jump(program_t *program, program_line_t *line, symbol_table_t *symbols);
+static bool remove_unreachable_code(program_t *program);
+static bool remove_jump_to_next(program_t *program, int index, symbol_table_t *symbols);
+static bool commit_line(program_line_t *line, const parsed_line_t *candidate);
+static void remove_line(program_line_t *line);
+static const char *jump_target(const parsed_line_t *parsed, symbol_table_t *symbols);
+static int find_label_line(const program_t *program, const char *label);
+static int next_code_line(const program_t *program, int index);
+static bool is_code_line(const program_line_t *line);
+static bool is_immediate_value(const char *operand, int value);
+
+/* Run the enabled optimization passes */
+bool optimize_program(const char *filename, expanded_source_t *source, symbol_table_t *symbols,
+                      const assembler_options_t *options, optimization_result_t *result, error_context_t *context) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char am_filename[MAX_FILENAME_LENGTH];
+    program_t program;
+    int words_before, code_saved, data_saved;
+    bool modified = false;
+    bool success = true;
+
+    memset(result, 0, sizeof(optimization_result_t));
+    if (!options->optimize && options->outline_min_saving <= 0 && !options->gc_data && !options->pool_data) {
+        return true;
+    }
+
+    if (filename) {
+        get_base_filename(filename, base_filename);
+        create_filename(base_filename, EXT_MACRO, am_filename);
+    }
+
+    if (!load_program(source, &program, context)) {
+        return false;
+    }
+
+    words_before = count_code_words(&program);
+
+    /* A pass that only retargets jumps changes the program without saving words */
+    if (options->optimize && peephole_pass(&program, symbols)) {
+        modified = true;
+        code_saved = words_before - count_code_words(&program);
+        if (filename && code_saved > 0) {
+            printf("Optimizer saved %d code words in %s\n", code_saved, filename);
+        }
+    }
+
+    if (options->outline_min_saving > 0) {
+        words_before = outline_pass(&program, symbols, options->outline_min_saving, context);
+        if (words_before < 0) {
+            free_program(&program);
+            return false;
+        }
+        if (words_before > 0) {
+            modified = true;
+            if (filename) {
+                printf("Outlining saved %d code words in %s\n", words_before, filename);
+            }
+        }
+    }
+
+    /* Runs after the peephole pass, whose removed code no longer references data */
+    if (options->gc_data) {
+        data_saved = gc_data_pass(&program);
+        if (data_saved > 0) {
+            modified = true;
+        }
+        if (filename) {
+            printf("Data GC saved %d data words in %s\n", data_saved, filename);
+        }
+    }
+
+    if (options->pool_data) {
+        data_saved = 0;
+        success = pool_data_pass(&program, result, &data_saved, context);
+        if (success) {
+            if (data_saved > 0) {
+                modified = true;
+            }
+            if (filename) {
+                printf("Data pooling saved %d data words in %s\n", data_saved, filename);
+            }
+        }
+    }
+
+    if (success && modified) {
+        success = store_program(&program, source, filename && !options->archive && !options->io && !options->check ? am_filename : NULL, context);
+    }
+
+    free_program(&program);
+    result->changed = modified && success;
+    if (!success) {
+        free_optimization_result(result);
+    }
+    return success;
+}
+
+/* Define the labels of pooled data blocks */
+bool apply_data_aliases(symbol_table_t *symbols, const optimization_result_t *result, error_context_t *context) {
+    const data_alias_t *alias;
+    symbol_t *target;
+    int i;
+
+    for (i = 0; i < result->alias_count; i++) {
+        alias = &result->aliases[i];
+        target = find_symbol(symbols, alias->target);
+        if (!target || !add_symbol(symbols, alias->label, target->value + alias->offset, SYMBOL_ATTR_DATA)) {
+            report_context_error(context, "Could not alias pooled data label '%s' to '%s'",
+                                 alias->label, alias->target);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Release the memory held by an optimization result */
+void free_optimization_result(optimization_result_t *result) {
+    free(result->aliases);
+    result->aliases = NULL;
+    result->alias_count = 0;
+}
+
+/* Helper function to parse every line of the expanded source */
+static bool load_program(expanded_source_t *source, program_t *program, error_context_t *context) {
+    source_cursor_t cursor;
+    source_template_t *line;
+    program_line_t *current;
+
+    program->count = 0;
+    program->lines = (program_line_t *)malloc((source->line_count + 1) * sizeof(program_line_t));
+    if (!program->lines) {
+        report_context_error(context, "Memory allocation error for optimizer");
+        return false;
+    }
+
+    /* The text keeps the newline, as fgets would return it */
+    init_source_cursor(&cursor);
+    while ((line = next_source_line(source, &cursor)) != NULL) {
+        current = &program->lines[program->count];
+        sprintf(current->text, "%s%s", line->text, line->joined ? "" : "\n");
+        current->removed = false;
+        current->rewritten = false;
+        if (!parse_source_line(line, cursor.line_number, &current->parsed, context)) {
+            free_program(program);
+            return false;
+        }
+        program->count++;
+    }
+
+    return true;
+}
+
+/* Helper function to replace the expanded source with the optimized program and write the .am file */
+static bool store_program(const program_t *program, expanded_source_t *source, const char *am_filename,
+                          error_context_t *context) {
+    char text[MAX_LINE_LENGTH + 2];
+    const program_line_t *line;
+    size_t length;
+    bool joined;
+    int i, index;
+
+    reset_expanded_source(source);
+    for (i = 0; i < program->count; i++) {
+        line = &program->lines[i];
+        strcpy(text, line->text);
+        length = strlen(text);
+        joined = length == 0 || text[length - 1] != '\n';
+        if (!joined) {
+            text[--length] = '\0';
+        }
+
+        /* Keep removed lines as comments so the line numbers do not move */
+        if (line->removed) {
+            while (length > 0 && text[length - 1] == '\r') {
+                text[--length] = '\0';
+            }
+            memmove(text + 2, text, length + 1);
+            text[0] = ';';
+            text[1] = ' ';
+            length = length + 2 > MAX_LINE_LENGTH - 2 ? MAX_LINE_LENGTH - 2 : length + 2;
+            text[length] = '\0';
+            joined = false;
+        }
+
+        index = add_source_line(source, text, length, joined);
+        if (index < 0 || !add_source_span(source, index, 1)) {
+            report_context_error(context, "Memory allocation error for optimizer");
+            return false;
+        }
+    }
+
+    return !am_filename || write_expanded_source(source, am_filename, context);
+}
+
+/* Helper function to free the program lines */
+static void free_program(program_t *program) {
+    free(program->lines);
+    program->lines = NULL;
+    program->count = 0;
+}
+
+/* Helper function to count the code words of the remaining instructions */
+static int count_code_words(const program_t *program) {
+    const parsed_line_t *parsed;
+    int i, length, words = 0;
+
+    for (i = 0; i < program->count; i++) {
+        if (!is_code_line(&program->lines[i])) {
+            continue;
+        }
+        parsed = &program->lines[i].parsed;
+        length = calculate_instruction_length(parsed->opcode,
+                                              parsed->operand_count > 0 ? parsed->operands[0] : NULL,
+                                              parsed->operand_count > 1 ? parsed->operands[1] : NULL,
+                                              NULL);
+        if (length > 0) {
+            words += length;
+        }
+    }
+
+    return words;
+}
+
+/* Apply the peephole rewrites until none of them changes the program */
+static bool peephole_pass(program_t *program, symbol_table_t *symbols) {
+    bool changed, any = false;
+    int i;
+
+    do {
+        changed = false;
+
+        for (i = 0; i < program->count; i++) {
+            if (!is_code_line(&program->lines[i])) {
+                continue;
+            }
+            if (remove_jump_to_next(program, i, symbols) ||
+                rewrite_short_form(&program->lines[i]) ||
+                thread_jump(program, &program->lines[i], symbols)) {
+                changed = true;
+            }
+        }
+
+        if (remove_unreachable_code(program)) {
+            changed = true;
+        }
+
+        any = any || changed;
+    } while (changed);
+
+    return any;
+}
+
+/* Replace repeated instruction sequences with jsr to one copy ending in rts; returns the words saved or -1 */
+static int outline_pass(program_t *program, symbol_table_t *symbols, int min_saving, error_context_t *context) {
+    instruction_stream_t stream;
+    suffix_index_t index;
+    outline_candidate_t candidate;
+    repeat_t *repeats = NULL;
+    char label[MAX_LABEL_LENGTH];
+    char *claimed = NULL;
+    int repeat_count, outlined, i, k;
+    int next_label = 1, saved = 0;
+
+    /* Each round outlines every profitable repeat that does not overlap one outlined before it */
+    do {
+        outlined = 0;
+        memset(&stream, 0, sizeof(stream));
+        memset(&index, 0, sizeof(index));
+        memset(&candidate, 0, sizeof(candidate));
+        if (!build_instruction_stream(program, &stream)) {
+            report_context_error(context, "Memory allocation error for outlining");
+            return -1;
+        }
+
+        repeats = (repeat_t *)malloc((stream.count + 1) * sizeof(repeat_t));
+        claimed = (char *)calloc(stream.count + 1, sizeof(char));
+        candidate.positions = (int *)malloc((stream.count + 1) * sizeof(int));
+        repeat_count = -1;
+        if (repeats && claimed && candidate.positions && build_suffix_index(&stream, &index)) {
+            repeat_count = find_repeats(&stream, &index, min_saving, repeats, candidate.positions);
+        }
+        if (repeat_count < 0) {
+            report_context_error(context, "Memory allocation error for outlining");
+            saved = -1;
+        } else {
+            qsort(repeats, repeat_count, sizeof(repeat_t), compare_repeats);
+
+            for (i = 0; i < repeat_count; i++) {
+                /* A repeat that lost occurrences to an earlier one waits for the next round's search */
+                if (!claim_occurrences(&index, &repeats[i], claimed, &candidate) ||
+                    candidate.saving < repeats[i].saving) {
+                    continue;
+                }
+
+                do {
+                    sprintf(label, "%s%d", OUTLINE_LABEL_PREFIX, next_label++);
+                } while (find_symbol(symbols, label) || find_label_line(program, label) >= 0);
+
+                if (!outline_candidate(program, &stream, &candidate, label)) {
+                    report_context_error(context, "Memory allocation error for outlining");
+                    saved = -1;
+                    break;
+                }
+                for (k = 0; k < candidate.occurrence_count; k++) {
+                    memset(claimed + candidate.positions[k], 1, candidate.length);
+                }
+                saved += candidate.saving;
+                outlined++;
+            }
+        }
+
+        free(stream.tokens);
+        free(stream.lines);
+        free(stream.words);
+        free(index.suffixes);
+        free(index.ranks);
+        free(index.prefix);
+        free(index.word_sums);
+        free(repeats);
+        free(claimed);
+        free(candidate.positions);
+    } while (outlined > 0 && saved >= 0);
+
+    return saved;
+}
+
+/* Helper function to turn the code lines into tokens; labels and control flow become separators */
+static bool build_instruction_stream(const program_t *program, instruction_stream_t *stream) {
+    char text[MAX_LINE_LENGTH * 2];
+    char **names;
+    const parsed_line_t *parsed;
+    size_t slot_count = 16, index;
+    int *ids;
+    int i, next_id = 0, separator = -1;
+    bool success = true;
+
+    while (slot_count < (size_t)program->count * 2) {
+        slot_count *= 2;
+    }
+
+    stream->count = 0;
+    stream->tokens = (int *)malloc((program->count * 2 + 1) * sizeof(int));
+    stream->lines = (int *)malloc((program->count * 2 + 1) * sizeof(int));
+    stream->words = (int *)malloc((program->count * 2 + 1) * sizeof(int));
+    names = (char **)calloc(slot_count, sizeof(char *));
+    ids = (int *)malloc(slot_count * sizeof(int));
+    if (!stream->tokens || !stream->lines || !stream->words || !names || !ids) {
+        free(names);
+        free(ids);
+        return false;
+    }
+
+    for (i = 0; i < program->count && success; i++) {
+        if (!is_code_line(&program->lines[i])) {
+            continue;
+        }
+        parsed = &program->lines[i].parsed;
+
+        /* A label may only start a sequence, and control flow never joins one */
+        if (parsed->label[0] || !is_outlinable(parsed)) {
+            stream->tokens[stream->count] = separator--;
+            stream->lines[stream->count] = -1;
+            stream->words[stream->count++] = 0;
+            if (!is_outlinable(parsed)) {
+                continue;
+            }
+        }
+
+        /* Equal instruction text (opcode and operands) gets the same id */
+        format_instruction(parsed, text);
+        index = hash_string(text) & (slot_count - 1);
+        while (names[index] && strcmp(names[index], text) != 0) {
+            index = (index + 1) & (slot_count - 1);
+        }
+        if (!names[index]) {
+            names[index] = (char *)malloc(strlen(text) + 1);
+            if (!names[index]) {
+                success = false;
+                break;
+            }
+            strcpy(names[index], text);
+            ids[index] = next_id++;
+        }
+
+        stream->tokens[stream->count] = ids[index];
+        stream->lines[stream->count] = i;
+        stream->words[stream->count++] = calculate_instruction_length(parsed->opcode,
+                                            parsed->operand_count > 0 ? parsed->operands[0] : NULL,
+                                            parsed->operand_count > 1 ? parsed->operands[1] : NULL, NULL);
+    }
+
+    for (index = 0; index < slot_count; index++) {
+        free(names[index]);
+    }
+    free(names);
+    free(ids);
+    if (!success) {
+        free(stream->tokens);
+        free(stream->lines);
+        free(stream->words);
+    }
+    return success;
+}
+
+/* Helper function to build the suffix array of the token string by prefix doubling with counting sorts,
+ * then the common prefix of neighbours (Kasai); false if out of memory */
+static bool build_suffix_index(const instruction_stream_t *stream, suffix_index_t *index) {
+    int n = stream->count;
+    int *order, *next_ranks, *counts;
+    int i, step, classes, buckets, current, previous;
+    bool success = false;
+
+    index->suffixes = (int *)malloc((n + 1) * sizeof(int));
+    index->ranks = (int *)malloc((n + 1) * sizeof(int));
+    index->prefix = (int *)malloc((n + 1) * sizeof(int));
+    index->word_sums = (int *)malloc((n + 1) * sizeof(int));
+    order = (int *)malloc((n + 1) * sizeof(int));
+    next_ranks = (int *)malloc((n + 1) * sizeof(int));
+    counts = (int *)malloc((2 * n + 1) * sizeof(int));
+    if (!index->suffixes || !index->ranks || !index->prefix || !index->word_sums || !order || !next_ranks ||
+        !counts) {
+        goto cleanup;
+    }
+
+    index->word_sums[0] = 0;
+    for (i = 0; i < n; i++) {
+        index->word_sums[i + 1] = index->word_sums[i] + stream->words[i];
+    }
+
+    /* Separators run from -1 down to -n, so token + n ranks every token from 0 */
+    buckets = 2 * n + 1;
+    memset(counts, 0, buckets * sizeof(int));
+    for (i = 0; i < n; i++) {
+        index->ranks[i] = stream->tokens[i] + n;
+        counts[index->ranks[i]]++;
+    }
+    for (i = 1; i < buckets; i++) {
+        counts[i] += counts[i - 1];
+    }
+    for (i = n - 1; i >= 0; i--) {
+        index->suffixes[--counts[index->ranks[i]]] = i;
+    }
+
+    /* Sort by the first 2 * step tokens from the order by the first step tokens */
+    for (step = 1; step < n; step *= 2) {
+        classes = 0;
+        for (i = n - step; i < n; i++) {
+            order[classes++] = i;
+        }
+        for (i = 0; i < n; i++) {
+            if (index->suffixes[i] >= step) {
+                order[classes++] = index->suffixes[i] - step;
+            }
+        }
+
+        memset(counts, 0, buckets * sizeof(int));
+        for (i = 0; i < n; i++) {
+            counts[index->ranks[i]]++;
+        }
+        for (i = 1; i < buckets; i++) {
+            counts[i] += counts[i - 1];
+        }
+        for (i = n - 1; i >= 0; i--) {
+            index->suffixes[--counts[index->ranks[order[i]]]] = order[i];
+        }
+
+        classes = 1;
+        next_ranks[index->suffixes[0]] = 0;
+        for (i = 1; i < n; i++) {
+            current = index->suffixes[i];
+            previous = index->suffixes[i - 1];
+            if (index->ranks[current] != index->ranks[previous] ||
+                (current + step < n ? index->ranks[current + step] : -1) !=
+                    (previous + step < n ? index->ranks[previous + step] : -1)) {
+                classes++;
+            }
+            next_ranks[current] = classes - 1;
+        }
+        memcpy(index->ranks, next_ranks, n * sizeof(int));
+        buckets = classes;
+        if (classes == n) {
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        index->ranks[index->suffixes[i]] = i;
+    }
+
+    /* Each separator is unique, so no common prefix runs across one */
+    current = 0;
+    for (i = 0; i < n; i++) {
+        if (index->ranks[i] == 0) {
+            index->prefix[0] = 0;
+            current = 0;
+            continue;
+        }
+        previous = index->suffixes[index->ranks[i] - 1];
+        while (i + current < n && previous + current < n &&
+               stream->tokens[i + current] == stream->tokens[previous + current]) {
+            current++;
+        }
+        index->prefix[index->ranks[i]] = current;
+        if (current > 0) {
+            current--;
+        }
+    }
+    success = true;
+
+cleanup:
+    free(order);
+    free(next_ranks);
+    free(counts);
+    return success;
+}
+
+/* Helper function to list the repeats saving at least min_saving words: one per group of suffixes sharing a
+ * prefix (an LCP interval), at its most profitable length; returns the number found or -1 */
+static int find_repeats(const instruction_stream_t *stream, const suffix_index_t *index, int min_saving,
+                        repeat_t *repeats, int *positions) {
+    int *stack;
+    int depth, count = 0, i, current, first, parent;
+
+    stack = (int *)malloc((2 * stream->count + 2) * sizeof(int));
+    if (!stack) {
+        return -1;
+    }
+
+    /* Walk the intervals bottom-up; the stack holds (shared prefix, first entry) pairs */
+    stack[0] = 0;
+    stack[1] = 0;
+    depth = 1;
+    for (i = 1; i <= stream->count; i++) {
+        current = i < stream->count ? index->prefix[i] : 0;
+        first = i - 1;
+        while (current < stack[2 * (depth - 1)]) {
+            depth--;
+            first = stack[2 * depth + 1];
+            parent = current > stack[2 * (depth - 1)] ? current : stack[2 * (depth - 1)];
+            if (evaluate_repeat(index, first, i - 1, parent, stack[2 * depth], positions, &repeats[count]) &&
+                repeats[count].saving >= min_saving) {
+                count++;
+            }
+        }
+        if (current > stack[2 * (depth - 1)]) {
+            stack[2 * depth] = current;
+            stack[2 * depth + 1] = first;
+            depth++;
+        }
+    }
+
+    free(stack);
+    return count;
+}
+
+/* Helper function to pick the most profitable length, longer than parent and at most prefix, for the
+ * occurrences in suffix array entries first to last; false if none occurs twice without overlapping */
+static bool evaluate_repeat(const suffix_index_t *index, int first, int last, int parent, int prefix,
+                            int *positions, repeat_t *repeat) {
+    int count = last - first + 1;
+    int gap = prefix, length, occurrences, i;
+    bool found = false;
+
+    memcpy(positions, index->suffixes + first, count * sizeof(int));
+    qsort(positions, count, sizeof(int), compare_positions);
+    for (i = 1; i < count; i++) {
+        if (positions[i] - positions[i - 1] < gap) {
+            gap = positions[i] - positions[i - 1];
+        }
+    }
+
+    /* Up to the smallest gap every occurrence fits, so the longest such length saves the most */
+    length = gap < prefix ? gap : prefix;
+    if (length > parent) {
+        found = consider_length(index, positions[0], count, length, repeat, found);
+    }
+    for (length = (gap > parent ? gap : parent) + 1; length <= prefix; length++) {
+        occurrences = count_disjoint(positions, count, length, NULL);
+        found = consider_length(index, positions[0], occurrences, length, repeat, found);
+    }
+
+    repeat->first = first;
+    repeat->last = last;
+    return found;
+}
+
+/* Helper function to keep a length in the repeat if it saves more than the one kept so far */
+static bool consider_length(const suffix_index_t *index, int position, int occurrences, int length,
+                            repeat_t *repeat, bool found) {
+    int words, saving;
+
+    if (occurrences < 2) {
+        return found;
+    }
+
+    /* Every site becomes a call; the body is kept once with a return */
+    words = index->word_sums[position + length] - index->word_sums[position];
+    saving = occurrences * words - occurrences * OUTLINE_CALL_WORDS - words - OUTLINE_RETURN_WORDS;
+    if (!found || saving > repeat->saving) {
+        repeat->length = length;
+        repeat->saving = saving;
+    }
+    return true;
+}
+
+/* Helper function to count the occurrences kept in program order when overlapping ones are skipped, also
+ * skipping tokens already claimed when claimed is not NULL; the kept positions move to the front */
+static int count_disjoint(int *positions, int count, int length, const char *claimed) {
+    int i, k, occurrences = 0, end = -1;
+
+    for (i = 0; i < count; i++) {
+        if (positions[i] < end) {
+            continue;
+        }
+        if (claimed) {
+            for (k = 0; k < length && !claimed[positions[i] + k]; k++) {
+            }
+            if (k < length) {
+                continue;
+            }
+        }
+        end = positions[i] + length;
+        positions[occurrences++] = positions[i];
+    }
+    return occurrences;
+}
+
+/* Helper function to collect the occurrences of a repeat that are still free in this round */
+static bool claim_occurrences(const suffix_index_t *index, const repeat_t *repeat, const char *claimed,
+                              outline_candidate_t *candidate) {
+    int count = repeat->last - repeat->first + 1;
+    int words;
+
+    memcpy(candidate->positions, index->suffixes + repeat->first, count * sizeof(int));
+    qsort(candidate->positions, count, sizeof(int), compare_positions);
+
+    candidate->length = repeat->length;
+    candidate->occurrence_count = count_disjoint(candidate->positions, count, repeat->length, claimed);
+    if (candidate->occurrence_count < 2) {
+        return false;
+    }
+
+    words = index->word_sums[candidate->positions[0] + repeat->length] -
+            index->word_sums[candidate->positions[0]];
+    candidate->saving = candidate->occurrence_count * words - candidate->occurrence_count * OUTLINE_CALL_WORDS -
+                        words - OUTLINE_RETURN_WORDS;
+    return true;
+}
+
+/* Helper function to order repeats by saving, most first (then by suffix array entry and length) */
+static int compare_repeats(const void *a, const void *b) {
+    const repeat_t *x = (const repeat_t *)a;
+    const repeat_t *y = (const repeat_t *)b;
+
+    if (x->saving != y->saving) {
+        return x->saving > y->saving ? -1 : 1;
+    }
+    if (x->first != y->first) {
+        return x->first < y->first ? -1 : 1;
+    }
+    return y->length - x->length;
+}
+
+/* Helper function to order stream positions */
+static int compare_positions(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Helper function to replace every occurrence with a call and append the outlined body */
+static bool outline_candidate(program_t *program, const instruction_stream_t *stream,
+                              const outline_candidate_t *candidate, const char *label) {
+    parsed_line_t call, body;
+    int i, k, first = candidate->positions[0];
+
+    /* Copy the body before the sites are rewritten */
+    for (k = 0; k < candidate->length; k++) {
+        body = program->lines[stream->lines[first + k]].parsed;
+        body.label[0] = '\0';
+        if (!append_line(program, k == 0 ? label : NULL, &body)) {
+            return false;
+        }
+    }
+    memset(&body, 0, sizeof(body));
+    body.type = INST_TYPE_CODE;
+    strcpy(body.opcode, "rts");
+    if (!append_line(program, NULL, &body)) {
+        return false;
+    }
+
+    for (i = 0; i < candidate->occurrence_count; i++) {
+        call = program->lines[stream->lines[candidate->positions[i]]].parsed;
+        strcpy(call.opcode, "jsr");
+        strcpy(call.operands[0], label);
+        call.operands[1][0] = '\0';
+        call.operand_count = 1;
+        commit_line(&program->lines[stream->lines[candidate->positions[i]]], &call);
+
+        for (k = 1; k < candidate->length; k++) {
+            remove_line(&program->lines[stream->lines[candidate->positions[i] + k]]);
+        }
+    }
+
+    return true;
+}
+
+/* Helper function to add an instruction line at the end of the program */
+static bool append_line(program_t *program, const char *label, const parsed_line_t *parsed) {
+    program_line_t *lines, *line;
+    char text[MAX_LINE_LENGTH * 2];
+
+    lines = (program_line_t *)realloc(program->lines, (program->count + 1) * sizeof(program_line_t));
+    if (!lines) {
+        return false;
+    }
+    program->lines = lines;
+
+    line = &program->lines[program->count++];
+    line->parsed = *parsed;
+    line->parsed.line_number = program->count;
+    line->removed = false;
+    line->rewritten = true;
+
+    if (label) {
+        strcpy(line->parsed.label, label);
+        sprintf(text, "%s: ", label);
+    } else {
+        strcpy(text, "        ");
+    }
+    format_instruction(parsed, text + strlen(text));
+    text[MAX_LINE_LENGTH - 3] = '\0';
+    strcat(text, "\n");
+    strcpy(line->text, text);
+    return true;
+}
+
+/* Helper function to check whether an instruction may be moved into an outlined subroutine */
+static bool is_outlinable(const parsed_line_t *parsed) {
+    return strcmp(parsed->opcode, "jmp") != 0 && strcmp(parsed->opcode, "bne") != 0 &&
+           strcmp(parsed->opcode, "jsr") != 0 && strcmp(parsed->opcode, "rts") != 0 &&
+           strcmp(parsed->opcode, "stop") != 0;
+}
+
+/* Helper function to write an instruction as "opcode op1, op2" */
+static void format_instruction(const parsed_line_t *parsed, char *buffer) {
+    int i;
+
+    strcpy(buffer, parsed->opcode);
+    for (i = 0; i < parsed->operand_count; i++) {
+        strcat(buffer, i == 0 ? " " : ", ");
+        strcat(buffer, parsed->operands[i]);
+    }
+}
+
+/* Drop data blocks whose label is not referenced; returns the data words saved */
+static int gc_data_pass(program_t *program) {
+    program_line_t *line;
+    bool dropping = false;
+    int i, saved = 0;
+
+    for (i = 0; i < program->count; i++) {
+        line = &program->lines[i];
+        if (!line->removed && line->parsed.type == INST_TYPE_INCBIN) {
+            /* Included files are always kept; a label on one starts a kept block */
+            if (line->parsed.label[0]) {
+                dropping = false;
+            }
+            continue;
+        }
+        if (line->removed || (line->parsed.type != INST_TYPE_DATA && line->parsed.type != INST_TYPE_STRING &&
+                              line->parsed.type != INST_TYPE_FILL)) {
+            continue;
+        }
+
+        /* A block is a labeled directive and the unlabeled directives after it */
+        if (line->parsed.label[0]) {
+            dropping = !is_referenced(program, line->parsed.label);
+        }
+
+        if (dropping) {
+            saved += count_data_words(&line->parsed);
+            remove_line(line);
+        }
+    }
+
+    return saved;
+}
+
+/* Share identical data blocks and NUL-terminated suffixes; labels of removed blocks become aliases */
+static bool pool_data_pass(program_t *program, optimization_result_t *result, int *saved,
+                           error_context_t *context) {
+    data_block_t *blocks = NULL;
+    pool_slot_t *slots = NULL;
+    int *block_of = NULL, *order = NULL;
+    int block_count, slot_count = 16, total = 0;
+    int i, j, b, k, offset;
+    unsigned long hash;
+    size_t index;
+    bool success = false;
+
+    block_count = collect_data_blocks(program, &blocks, &block_of, context);
+    if (block_count < 0) {
+        return false;
+    }
+
+    for (i = 0; i < block_count; i++) {
+        total += blocks[i].length;
+    }
+    while (slot_count < total * 2) {
+        slot_count *= 2;
+    }
+
+    order = (int *)malloc((block_count + 1) * sizeof(int));
+    slots = (pool_slot_t *)malloc(slot_count * sizeof(pool_slot_t));
+    result->aliases = (data_alias_t *)malloc((block_count + 1) * sizeof(data_alias_t));
+    if (!order || !slots || !result->aliases) {
+        report_context_error(context, "Memory allocation error for data pooling");
+        goto cleanup;
+    }
+    for (i = 0; i < slot_count; i++) {
+        slots[i].block = -1;
+    }
+
+    /* Longest blocks first, so shorter ones can become their suffixes (stable for equal lengths) */
+    for (i = 0; i < block_count; i++) {
+        for (j = i; j > 0 && blocks[order[j - 1]].length < blocks[i].length; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    for (i = 0; i < block_count; i++) {
+        b = order[i];
+        if (blocks[b].opaque || blocks[b].written) {
+            continue;
+        }
+        hash = hash_words(blocks[b].words, blocks[b].length);
+
+        /* Look for the same words at the end of a kept block */
+        for (index = hash & (slot_count - 1); slots[index].block >= 0; index = (index + 1) & (slot_count - 1)) {
+            k = slots[index].block;
+            offset = slots[index].offset;
+            if (slots[index].hash == hash && blocks[k].length - offset == blocks[b].length &&
+                memcmp(blocks[k].words + offset, blocks[b].words, blocks[b].length * sizeof(int)) == 0) {
+                break;
+            }
+        }
+
+        if (slots[index].block >= 0) {
+            blocks[b].pooled = true;
+            strcpy(result->aliases[result->alias_count].label, blocks[b].label);
+            strcpy(result->aliases[result->alias_count].target, blocks[slots[index].block].label);
+            result->aliases[result->alias_count].offset = slots[index].offset;
+            result->alias_count++;
+            *saved += blocks[b].length;
+            continue;
+        }
+
+        /* Keep the block; strings also offer every suffix, hashed from the end */
+        hash = hash_words(NULL, 0);
+        for (offset = blocks[b].length - 1; offset >= 0; offset--) {
+            hash = hash * 33 + (unsigned long)blocks[b].words[offset];
+            if (offset > 0 && !blocks[b].string_tail) {
+                continue;
+            }
+            for (index = hash & (slot_count - 1); slots[index].block >= 0;
+                 index = (index + 1) & (slot_count - 1)) {
+            }
+            slots[index].block = b;
+            slots[index].offset = offset;
+            slots[index].hash = hash;
+        }
+    }
+
+    for (i = 0; i < program->count; i++) {
+        if (block_of[i] >= 0 && blocks[block_of[i]].pooled) {
+            remove_line(&program->lines[i]);
+        }
+    }
+    success = true;
+
+cleanup:
+    for (i = 0; i < block_count; i++) {
+        free(blocks[i].words);
+    }
+    free(blocks);
+    free(block_of);
+    free(order);
+    free(slots);
+    return success;
+}
+
+/* Helper function to split the data directives into labeled blocks; returns the block count or -1 */
+static int collect_data_blocks(program_t *program, data_block_t **blocks, int **block_of,
+                               error_context_t *context) {
+    data_block_t *block = NULL;
+    parsed_line_t *parsed;
+    int *words;
+    int i, count = 0;
+
+    *blocks = (data_block_t *)calloc(program->count + 1, sizeof(data_block_t));
+    *block_of = (int *)malloc((program->count + 1) * sizeof(int));
+    if (!*blocks || !*block_of) {
+        report_context_error(context, "Memory allocation error for data pooling");
+        free(*blocks);
+        free(*block_of);
+        return -1;
+    }
+
+    for (i = 0; i < program->count; i++) {
+        (*block_of)[i] = -1;
+        parsed = &program->lines[i].parsed;
+        if (program->lines[i].removed || (parsed->type != INST_TYPE_DATA && parsed->type != INST_TYPE_STRING &&
+                                          parsed->type != INST_TYPE_INCBIN && parsed->type != INST_TYPE_FILL)) {
+            continue;
+        }
+
+        /* Unlabeled data before the first label has no name to alias and stays in place */
+        if (parsed->label[0]) {
+            block = &(*blocks)[count++];
+            block->label = parsed->label;
+        }
+        if (!block) {
+            continue;
+        }
+        if (parsed->type == INST_TYPE_INCBIN || parsed->type == INST_TYPE_FILL) {
+            block->opaque = true;
+            continue;
+        }
+
+        words = (int *)realloc(block->words, (block->length + MAX_LINE_LENGTH) * sizeof(int));
+        if (!words) {
+            report_context_error(context, "Memory allocation error for data pooling");
+            for (i = 0; i < count; i++) {
+                free((*blocks)[i].words);
+            }
+            free(*blocks);
+            free(*block_of);
+            return -1;
+        }
+        block->words = words;
+        block->length += append_data_words(parsed, block->words + block->length);
+        block->string_tail = parsed->type == INST_TYPE_STRING;
+        (*block_of)[i] = (int)(block - *blocks);
+    }
+
+    mark_written_blocks(program, *blocks, count);
+    return count;
+}
+
+/* Helper function to mark the blocks an instruction writes to, which must keep words of their own; a block behind
+ * a .entry label counts too, as a module linked with this one can write it through an extern */
+static void mark_written_blocks(const program_t *program, data_block_t *blocks, int count) {
+    static const char *const writing_opcodes[] = {"mov", "add", "sub", "clr", "not", "inc", "dec", "red"};
+    const parsed_line_t *parsed;
+    const char *destination;
+    int i, j, k;
+
+    for (i = 0; i < program->count; i++) {
+        parsed = &program->lines[i].parsed;
+        if (!program->lines[i].removed && parsed->type == INST_TYPE_ENTRY && parsed->operand_count > 0) {
+            for (k = 0; k < count; k++) {
+                if (strcmp(blocks[k].label, parsed->operands[0]) == 0) {
+                    blocks[k].written = true;
+                }
+            }
+            continue;
+        }
+        if (program->lines[i].removed || parsed->type != INST_TYPE_CODE || parsed->operand_count == 0) {
+            continue;
+        }
+        for (j = 0; j < (int)(sizeof(writing_opcodes) / sizeof(writing_opcodes[0])); j++) {
+            if (strcmp(parsed->opcode, writing_opcodes[j]) == 0) {
+                break;
+            }
+        }
+        if (j == (int)(sizeof(writing_opcodes) / sizeof(writing_opcodes[0]))) {
+            continue;
+        }
+
+        /* The destination is the last operand, of one-operand and two-operand instructions alike */
+        destination = parsed->operands[parsed->operand_count - 1];
+        for (k = 0; k < count; k++) {
+            if (strcmp(blocks[k].label, destination) == 0) {
+                blocks[k].written = true;
+            }
+        }
+    }
+}
+
+/* Helper function to decode the words of a .data or .string directive, as the second pass encodes them
+ * (NULL words only counts them) */
+static int append_data_words(const parsed_line_t *parsed, int *words) {
+    const char *str = parsed->operands[0];
+    const char *end, *item, *next;
+    int i, len, value, count = 0;
+
+    if (parsed->type == INST_TYPE_STRING) {
+        len = (int)strlen(str) - 2;
+        for (i = 0; i < len; i++) {
+            if (words) {
+                words[count] = str[i + 1] & DATA_WORD_MASK;
+            }
+            count++;
+        }
+        if (words) {
+            words[count] = 0;
+        }
+        return count + 1;
+    }
+
+    /* The item parser of both passes; the first pass already rejected any list it fails on */
+    end = str + strlen(str);
+    for (item = str; ; item = next + 1) {
+        if (!parse_data_item(item, end, &next, &value, NULL)) {
+            return count;
+        }
+        if (words) {
+            words[count] = value & DATA_WORD_MASK;
+        }
+        count++;
+        if (next == end) {
+            break;
+        }
+    }
+    return count;
+}
+
+/* Helper function to hash a run of words from the last word to the first */
+static unsigned long hash_words(const int *words, int count) {
+    unsigned long hash = 5381;
+    int i;
+
+    for (i = count - 1; i >= 0; i--) {
+        hash = hash * 33 + (unsigned long)words[i];
+    }
+    return hash;
+}
+
+/* Helper function to check whether an instruction operand or .entry names a label */
+static bool is_referenced(const program_t *program, const char *label) {
+    const parsed_line_t *parsed;
+    const char *operand;
+    int i, j;
+
+    for (i = 0; i < program->count; i++) {
+        if (program->lines[i].removed) {
+            continue;
+        }
+        parsed = &program->lines[i].parsed;
+
+        if (parsed->type == INST_TYPE_ENTRY && strcmp(parsed->operands[0], label) == 0) {
+            return true;
+        }
+        if (parsed->type != INST_TYPE_CODE) {
+            continue;
+        }
+        for (j = 0; j < parsed->operand_count; j++) {
+            operand = parsed->operands[j];
+            if (operand[0] == '&') {
+                operand++;
+            }
+            if (strcmp(operand, label) == 0) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/* Helper function to count the words a .data, .string, .space or .fill directive occupies */
+static int count_data_words(const parsed_line_t *parsed) {
+    int words, value;
+
+    if (parsed->type == INST_TYPE_FILL) {
+        return parse_fill_directive(parsed, &words, &value, NULL) ? words : 0;
+    }
+
+    /* Counted by the same decoder that appends them, so the two agree */
+    return append_data_words(parsed, NULL);
+}
+
+/* Helper function to replace mov #0 / add #1 / sub #1 with the shorter clr / inc / dec */
+static bool rewrite_short_form(program_line_t *line) {
+    const parsed_line_t *parsed = &line->parsed;
+    parsed_line_t candidate;
+    const char *replacement;
+    const char *destination;
+
+    if (parsed->operand_count != 2) {
+        return false;
+    }
+
+    if (strcmp(parsed->opcode, "mov") == 0 && is_immediate_value(parsed->operands[0], 0)) {
+        replacement = "clr";
+    } else if (strcmp(parsed->opcode, "add") == 0 && is_immediate_value(parsed->operands[0], 1)) {
+        replacement = "inc";
+    } else if (strcmp(parsed->opcode, "sub") == 0 && is_immediate_value(parsed->operands[0], 1)) {
+        replacement = "dec";
+    } else {
+        return false;
+    }
+
+    /* Only registers and labels can be the operand of the one-operand forms */
+    destination = parsed->operands[1];
+    if (destination[0] == '#' || destination[0] == '&') {
+        return false;
+    }
+
+    candidate = *parsed;
+    strcpy(candidate.opcode, replacement);
+    strcpy(candidate.operands[0], destination);
+    candidate.operands[1][0] = '\0';
+    candidate.operand_count = 1;
+
+    return commit_line(line, &candidate);
+}
+
+/* Helper function to retarget a jump whose target is itself an unconditional jmp */
+static bool thread_jump(program_t *program, program_line_t *line, symbol_table_t *symbols) {
+    parsed_line_t candidate;
+    const char *target = jump_target(&line->parsed, symbols);
+    const char *next;
+    int hops, target_line;
+
+    if (!target) {
+        return false;
+    }
+
+    for (hops = 0; hops < MAX_JUMP_THREADING; hops++) {
+        target_line = find_label_line(program, target);
+        if (target_line < 0 || strcmp(program->lines[target_line].parsed.opcode, "jmp") != 0) {
+            break;
+        }
+        next = jump_target(&program->lines[target_line].parsed, symbols);
+        if (!next || strcmp(next, target) == 0) {
+            break;
+        }
+        target = next;
+    }
+
+    if (strcmp(target, jump_target(&line->parsed, symbols)) == 0) {
+        return false;
+    }
+
+    /* Keep the addressing method of the original operand */
+    candidate = line->parsed;
+    if (candidate.operands[0][0] == '&') {
+        sprintf(candidate.operands[0], "&%.*s", MAX_OPERAND_LENGTH - 2, target);
+    } else {
+        sprintf(candidate.operands[0], "%.*s", MAX_OPERAND_LENGTH - 1, target);
+    }
+
+    return commit_line(line, &candidate);
+}
+
+/* Helper function to drop unlabeled instructions that follow stop, rts or jmp */
+static bool remove_unreachable_code(program_t *program) {
+    program_line_t *line;
+    bool unreachable = false, changed = false;
+    int i;
+
+    for (i = 0; i < program->count; i++) {
+        line = &program->lines[i];
+        if (!is_code_line(line)) {
+            continue;
+        }
+
+        /* A label makes the instruction a possible jump target */
+        if (line->parsed.label[0]) {
+            unreachable = false;
+        }
+
+        if (unreachable) {
+            remove_line(line);
+            changed = true;
+            continue;
+        }
+
+        if (strcmp(line->parsed.opcode, "stop") == 0 || strcmp(line->parsed.opcode, "rts") == 0 ||
+            strcmp(line->parsed.opcode, "jmp") == 0) {
+            unreachable = true;
+        }
+    }
+
+    return changed;
+}
+
+/* Helper function to drop an unlabeled jmp to the instruction that follows it */
+static bool remove_jump_to_next(program_t *program, int index, symbol_table_t *symbols) {
+    program_line_t *line = &program->lines[index];
+    const char *target;
+    int next;
+
+    if (line->parsed.label[0] || strcmp(line->parsed.opcode, "jmp") != 0) {
+        return false;
+    }
+
+    target = jump_target(&line->parsed, symbols);
+    next = next_code_line(program, index);
+    if (!target || next < 0 || strcmp(program->lines[next].parsed.label, target) != 0) {
+        return false;
+    }
+
+    remove_line(line);
+    return true;
+}
+
+/* Helper function to replace a line with a rewritten form, unless it would not fit on one line */
+static bool commit_line(program_line_t *line, const parsed_line_t *candidate) {
+    char text[MAX_LINE_LENGTH * 2];
+    size_t prefix = 0;
+
+    /* Keep the original label and indentation in front of the opcode */
+    while (isspace((unsigned char)line->text[prefix])) {
+        prefix++;
+    }
+    if (line->parsed.label[0]) {
+        prefix += strlen(line->parsed.label) + 1;
+        while (isspace((unsigned char)line->text[prefix])) {
+            prefix++;
+        }
+    }
+    memcpy(text, line->text, prefix);
+    text[prefix] = '\0';
+
+    format_instruction(candidate, text + prefix);
+
+    /* The passes read at most MAX_LINE_LENGTH - 1 characters including the newline */
+    if (strlen(text) > MAX_LINE_LENGTH - 3) {
+        return false;
+    }
+    strcat(text, "\n");
+
+    strcpy(line->text, text);
+    line->parsed = *candidate;
+    line->rewritten = true;
+    return true;
+}
+
+/* Helper function to mark a line as removed */
+static void remove_line(program_line_t *line) {
+    line->removed = true;
+    line->parsed.type = INST_TYPE_INVALID;
+}
+
+/* Helper function to get the label a jmp, bne or jsr transfers control to */
+static const char *jump_target(const parsed_line_t *parsed, symbol_table_t *symbols) {
+    const char *target;
+    symbol_t *symbol;
+
+    if (parsed->type != INST_TYPE_CODE || parsed->operand_count != 1 ||
+        (strcmp(parsed->opcode, "jmp") != 0 && strcmp(parsed->opcode, "bne") != 0 &&
+         strcmp(parsed->opcode, "jsr") != 0)) {
+        return NULL;
+    }
+
+    target = parsed->operands[0];
+    if (target[0] == '&') {
+        target++;
+    }
+
+    /* Registers, immediates and external labels cannot be followed */
+    symbol = find_symbol(symbols, target);
+    if (!symbol || !SYMBOL_IS_CODE(symbol) || SYMBOL_IS_EXTERNAL(symbol)) {
+        return NULL;
+    }
+
+    return target;
+}
+
+/* Helper function to find the instruction a label is defined on */
+static int find_label_line(const program_t *program, const char *label) {
+    int i;
+
+    for (i = 0; i < program->count; i++) {
+        if (is_code_line(&program->lines[i]) && strcmp(program->lines[i].parsed.label, label) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Helper function to find the next remaining instruction after a line */
+static int next_code_line(const program_t *program, int index) {
+    int i;
+
+    for (i = index + 1; i < program->count; i++) {
+        if (is_code_line(&program->lines[i])) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Helper function to check for a remaining instruction line */
+static bool is_code_line(const program_line_t *line) {
+    return !line->removed && line->parsed.type == INST_TYPE_CODE;
+}
+
+/* Helper function to check for an immediate operand with a given value */
+static bool is_immediate_value(const char *operand, int value) {
+    return operand[0] == '#' && is_integer(operand + 1) && string_to_int(operand + 1) == value;
+}
@@ -9,16 +9,39 @@
 #include "../include/output.h"
 #include "../include/utils.h"
 
+/* x86 builds convert four (SSE2) or eight (AVX2) words per step; -DOUTPUT_SCALAR_KERNEL forces the table loop */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(OUTPUT_SCALAR_KERNEL)
+#define OUTPUT_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define BASE64_HIGH_SHIFT 12   /* First character: bits 12-17 of the 24-bit word */
+#define BASE64_LOW_SHIFT 6     /* Second character: bits 6-11 */
+#define BASE64_INDEX_MASK 0x3F
+#define ADDRESS_MAX_DIGITS 11  /* Decimal digits of the largest int address */
+#define RECORD_MAX_LENGTH (ADDRESS_MAX_DIGITS + 4)  /* Address, space, two characters, newline */
+
 /* Base64-like character set for encoding machine words */
 static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-/* Helper function to convert a machine word to a base64-like representation */
-static void word_to_base64(machine_word_t word, char *base64);
+/* Forward declarations for internal functions */
+static char *format_object_text(machine_word_t *code_image, machine_word_t *data_image, int ICF, int DCF,
+                                size_t *length);
+static char *format_entries_text(symbol_table_t *symbols, size_t *length);
+static char *format_externals_text(const external_table_t *ext_refs, size_t *length);
+static bool write_text_file(const char *path, const char *text, size_t length, error_context_t *context);
+static void encode_word_chars(const machine_word_t *words, int count, char *chars);
+static size_t format_object_records(const char *chars, int count, int first_address, char *out);
+static int increment_address(char *digits, int length);
+#ifdef OUTPUT_X86_KERNELS
+static int encode_word_chars_sse2(const machine_word_t *words, int count, char *chars);
+static int encode_word_chars_avx2(const machine_word_t *words, int count, char *chars);
+#endif
 
 /* Generate the output files */
 bool generate_output_files(const char *filename, symbol_table_t *symbols,
                          machine_word_t *code_image, machine_word_t *data_image,
-                         external_reference_t *ext_refs, int ICF, int DCF,
+                         const external_table_t *ext_refs, int ICF, int DCF,
                          error_context_t *context) {
     bool success = true;
 
@@ -44,7 +67,7 @@ bool generate_output_files(const char *filename, symbol_table_t *symbols,
     }
 
     /* Write the externals file (only if there are external references) */
-    if (success && ext_refs) {
+    if (success && ext_refs && ext_refs->count > 0) {
         if (!write_externals_file(filename, ext_refs, context)) {
             report_context_error(context, "Failed to write externals file");
             success = false;
@@ -58,110 +81,189 @@ bool generate_output_files(const char *filename, symbol_table_t *symbols,
 bool write_object_file(const char *filename, machine_word_t *code_image,
                       machine_word_t *data_image, int ICF, int DCF,
                       error_context_t *context) {
-    FILE *ob_file;
     char base_filename[MAX_FILENAME_LENGTH];
     char ob_filename[MAX_FILENAME_LENGTH];
-    int i;
-    char base64[3]; /* Base64 requires 2 chars plus null terminator */
+    char *text;
+    size_t length;
+    bool success;
 
     /* Build the .ob filename */
     get_base_filename(filename, base_filename);
     create_filename(base_filename, EXT_OBJECT, ob_filename);
 
-    /* Open the file */
-    ob_file = fopen(ob_filename, "w");
-    if (!ob_file) {
-        report_context_error(context, "Could not open file: %s", ob_filename);
+    text = format_object_text(code_image, data_image, ICF, DCF, &length);
+    if (!text) {
+        report_context_error(context, "Memory allocation error for object file");
         return false;
     }
 
-    /* Write the header with IC and DC values */
-    fprintf(ob_file, "%d %d\n", ICF, DCF);
-
-    /* Write the code image */
-    for (i = 0; i < ICF; i++) {
-        /* Convert the machine word to base64 */
-        word_to_base64(code_image[MEMORY_START + i], base64);
-
-        /* Write the address and the encoded word */
-        fprintf(ob_file, "%04d %s\n", MEMORY_START + i, base64);
-    }
-
-    /* Write the data image */
-    for (i = 0; i < DCF; i++) {
-        /* Convert the machine word to base64 */
-        word_to_base64(data_image[i], base64);
-
-        /* Write the address and the encoded word */
-        fprintf(ob_file, "%04d %s\n", MEMORY_START + ICF + i, base64);
-    }
-
-    fclose(ob_file);
-    return true;
+    success = write_text_file(ob_filename, text, length, context);
+    free(text);
+    return success;
 }
 
 /* Write the entries file */
 bool write_entries_file(const char *filename, symbol_table_t *symbols,
                        error_context_t *context) {
-    FILE *ent_file;
     char base_filename[MAX_FILENAME_LENGTH];
     char ent_filename[MAX_FILENAME_LENGTH];
-    symbol_t *symbol;
+    char *text;
+    size_t length;
+    bool success;
 
     /* Build the .ent filename */
     get_base_filename(filename, base_filename);
     create_filename(base_filename, EXT_ENTRY, ent_filename);
 
-    /* Open the file */
-    ent_file = fopen(ent_filename, "w");
-    if (!ent_file) {
-        report_context_error(context, "Could not open file: %s", ent_filename);
+    text = format_entries_text(symbols, &length);
+    if (!text) {
+        report_context_error(context, "Memory allocation error for entries file");
         return false;
     }
 
-    /* Iterate through the symbol table and write entries */
-    symbol = symbols->head;
-    while (symbol) {
-        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
-            fprintf(ent_file, "%s %04d\n", symbol->name, symbol->value);
-        }
-        symbol = symbol->next;
-    }
-
-    fclose(ent_file);
-    return true;
+    success = write_text_file(ent_filename, text, length, context);
+    free(text);
+    return success;
 }
 
 /* Write the externals file */
-bool write_externals_file(const char *filename, external_reference_t *ext_refs,
+bool write_externals_file(const char *filename, const external_table_t *ext_refs,
                          error_context_t *context) {
-    FILE *ext_file;
     char base_filename[MAX_FILENAME_LENGTH];
     char ext_filename[MAX_FILENAME_LENGTH];
-    external_reference_t *ref;
+    char *text;
+    size_t length;
+    bool success;
 
     /* Build the .ext filename */
     get_base_filename(filename, base_filename);
     create_filename(base_filename, EXT_EXTERN, ext_filename);
 
-    /* Open the file */
-    ext_file = fopen(ext_filename, "w");
-    if (!ext_file) {
-        report_context_error(context, "Could not open file: %s", ext_filename);
+    text = format_externals_text(ext_refs, &length);
+    if (!text) {
+        report_context_error(context, "Memory allocation error for externals file");
         return false;
     }
 
-    /* Iterate through the external references and write them */
-    ref = ext_refs;
-    while (ref) {
-        fprintf(ext_file, "%s %04d\n", ref->name, ref->address);
-        ref = ref->next;
+    success = write_text_file(ext_filename, text, length, context);
+    free(text);
+    return success;
+}
+
+/* Add the object, entries and externals outputs of a module to an archive */
+bool archive_output_files(archive_writer_t *archive, const char *module, symbol_table_t *symbols,
+                          machine_word_t *code_image, machine_word_t *data_image,
+                          const external_table_t *ext_refs, int ICF, int DCF,
+                          error_context_t *context) {
+    char *text;
+    size_t length;
+    bool success;
+
+    /* The same members, under the same conditions, as the files generate_output_files writes */
+    text = format_object_text(code_image, data_image, ICF, DCF, &length);
+    success = text && add_archive_member(archive, module, ARCHIVE_MEMBER_OBJECT, text, length, context);
+    free(text);
+
+    if (success && has_entries(symbols)) {
+        text = format_entries_text(symbols, &length);
+        success = text && add_archive_member(archive, module, ARCHIVE_MEMBER_ENTRIES, text, length, context);
+        free(text);
+    }
+
+    if (success && ext_refs && ext_refs->count > 0) {
+        text = format_externals_text(ext_refs, &length);
+        success = text && add_archive_member(archive, module, ARCHIVE_MEMBER_EXTERNALS, text, length, context);
+        free(text);
+    }
+
+    if (!success) {
+        report_context_error(context, "Failed to add the outputs of %s to the archive", module);
+    }
+
+    return success;
+}
+
+/* Write the outputs of a module to a framed stream */
+bool stream_output_files(FILE *stream, const char *module, symbol_table_t *symbols,
+                         machine_word_t *code_image, machine_word_t *data_image,
+                         const external_table_t *ext_refs, int ICF, int DCF,
+                         error_context_t *context) {
+    char *text;
+    size_t length;
+    bool success;
+
+    /* The same sections, under the same conditions, as the files generate_output_files writes */
+    text = format_object_text(code_image, data_image, ICF, DCF, &length);
+    success = text && write_stream_frame(stream, module, "ob", text, length, context);
+    free(text);
+
+    if (success && has_entries(symbols)) {
+        text = format_entries_text(symbols, &length);
+        success = text && write_stream_frame(stream, module, "ent", text, length, context);
+        free(text);
+    }
+
+    if (success && ext_refs && ext_refs->count > 0) {
+        text = format_externals_text(ext_refs, &length);
+        success = text && write_stream_frame(stream, module, "ext", text, length, context);
+        free(text);
+    }
+
+    return success && write_stream_frame(stream, module, "end", "", 0, context);
+}
+
+/* Write one frame to a framed output stream */
+bool write_stream_frame(FILE *stream, const char *module, const char *section, const char *data,
+                        size_t size, error_context_t *context) {
+    if (fprintf(stream, "%s %s %lu %s\n", STREAM_FRAME_MAGIC, section, (unsigned long)size, module) < 0 ||
+        fwrite(data, 1, size, stream) != size) {
+        report_context_error(context, "Failed to write the %s section of %s to the output stream", section, module);
+        return false;
     }
 
-    fclose(ext_file);
     return true;
 }
 
+/* Start writing the output files in the background */
+bool queue_output_files(async_io_t *io, const char *filename, symbol_table_t *symbols,
+                        machine_word_t *code_image, machine_word_t *data_image,
+                        const external_table_t *ext_refs, int ICF, int DCF,
+                        error_context_t *context) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char path[MAX_FILENAME_LENGTH];
+    char *text;
+    size_t length;
+    bool success;
+
+    get_base_filename(filename, base_filename);
+    if (context) {
+        context->line_number = 0;
+    }
+
+    /* The engine owns each buffer once the write is started */
+    create_filename(base_filename, EXT_OBJECT, path);
+    text = format_object_text(code_image, data_image, ICF, DCF, &length);
+    success = text && async_write_file(io, path, text, length, context);
+
+    if (success && has_entries(symbols)) {
+        create_filename(base_filename, EXT_ENTRY, path);
+        text = format_entries_text(symbols, &length);
+        success = text && async_write_file(io, path, text, length, context);
+    }
+
+    if (success && ext_refs && ext_refs->count > 0) {
+        create_filename(base_filename, EXT_EXTERN, path);
+        text = format_externals_text(ext_refs, &length);
+        success = text && async_write_file(io, path, text, length, context);
+    }
+
+    if (!success) {
+        report_context_error(context, "Failed to write the output files");
+    }
+
+    return success;
+}
+
 /* Helper function to check if symbol table has entries */
 bool has_entries(symbol_table_t *symbols) {
     symbol_t *symbol;
@@ -181,21 +283,218 @@ bool has_entries(symbol_table_t *symbols) {
     return false;
 }
 
-/* Helper function to convert a machine word to a base64-like representation
- * The 24-bit word is converted to four base64 characters (6 bits each)
+/* Helper function to lay out the object file: the IC and DC header, then one record per word */
+static char *format_object_text(machine_word_t *code_image, machine_word_t *data_image, int ICF, int DCF,
+                                size_t *length) {
+    char *chars, *text;
+
+    /* Convert both images to characters, then lay out every record in one buffer */
+    chars = (char *)malloc(2 * (size_t)(ICF + DCF) + 1);
+    text = (char *)malloc((size_t)(ICF + DCF + 1) * RECORD_MAX_LENGTH + 2 * ADDRESS_MAX_DIGITS);
+    if (!chars || !text) {
+        free(chars);
+        free(text);
+        return NULL;
+    }
+
+    encode_word_chars(code_image + MEMORY_START, ICF, chars);
+    encode_word_chars(data_image, DCF, chars + 2 * ICF);
+
+    *length = (size_t)sprintf(text, "%d %d\n", ICF, DCF);
+    *length += format_object_records(chars, ICF + DCF, MEMORY_START, text + *length);
+
+    free(chars);
+    return text;
+}
+
+/* Helper function to lay out the entries file: name, space, address, newline per entry */
+static char *format_entries_text(symbol_table_t *symbols, size_t *length) {
+    symbol_t *symbol;
+    char *text;
+    size_t count = 0;
+
+    for (symbol = symbols->head; symbol; symbol = symbol->next) {
+        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
+            count++;
+        }
+    }
+
+    text = (char *)malloc(count * (MAX_LABEL_LENGTH + RECORD_MAX_LENGTH) + 1);
+    if (!text) {
+        return NULL;
+    }
+
+    *length = 0;
+    for (symbol = symbols->head; symbol; symbol = symbol->next) {
+        if (symbol_has_attribute(symbol, SYMBOL_ATTR_ENTRY)) {
+            *length += (size_t)sprintf(text + *length, "%s %04d\n", symbol->name, symbol->value);
+        }
+    }
+
+    return text;
+}
+
+/* Helper function to lay out the externals file: name, space, address, newline per reference */
+static char *format_externals_text(const external_table_t *ext_refs, size_t *length) {
+    const external_reference_t *ref;
+    const external_symbol_t *symbol;
+    char *text;
+    int i;
+
+    text = (char *)malloc((size_t)ext_refs->count * (MAX_LABEL_LENGTH + RECORD_MAX_LENGTH) + 1);
+    if (!text) {
+        return NULL;
+    }
+
+    *length = 0;
+    for (i = 0; i < ext_refs->count; i++) {
+        ref = &ext_refs->refs[i];
+        symbol = &ext_refs->symbols[ref->symbol];
+        memcpy(text + *length, symbol->name, (size_t)symbol->length);
+        *length += (size_t)symbol->length;
+        *length += (size_t)sprintf(text + *length, " %04d\n", ref->address);
+    }
+
+    return text;
+}
+
+/* Helper function to write a laid-out output file in one call */
+static bool write_text_file(const char *path, const char *text, size_t length, error_context_t *context) {
+    FILE *file;
+    bool success;
+
+    file = fopen(path, "w");
+    if (!file) {
+        report_context_error(context, "Could not open file: %s", path);
+        return false;
+    }
+
+    success = fwrite(text, 1, length, file) == length;
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    if (!success) {
+        report_context_error(context, "Could not write file: %s", path);
+    }
+
+    return success;
+}
+
+/* Helper function to convert words to their two base64-like characters each
+ * The characters come from bits 12-17 and 6-11 of the 24-bit word
+ */
+static void encode_word_chars(const machine_word_t *words, int count, char *chars) {
+    int i = 0;
+
+#ifdef OUTPUT_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        i = encode_word_chars_avx2(words, count, chars);
+    } else {
+        i = encode_word_chars_sse2(words, count, chars);
+    }
+#endif
+
+    /* Scalar loop for the remaining words (all of them without a vector kernel) */
+    for (; i < count; i++) {
+        chars[2 * i] = base64_chars[(words[i] >> BASE64_HIGH_SHIFT) & BASE64_INDEX_MASK];
+        chars[2 * i + 1] = base64_chars[(words[i] >> BASE64_LOW_SHIFT) & BASE64_INDEX_MASK];
+    }
+}
+
+/* Helper function to write "address XY" records, counting the ASCII address up instead of formatting it */
+static size_t format_object_records(const char *chars, int count, int first_address, char *out) {
+    char address[ADDRESS_MAX_DIGITS + 1];
+    char *start = out;
+    int i, digits;
+
+    digits = sprintf(address, "%04d", first_address);
+
+    for (i = 0; i < count; i++) {
+        memcpy(out, address, digits);
+        out += digits;
+        out[0] = ' ';
+        out[1] = chars[2 * i];
+        out[2] = chars[2 * i + 1];
+        out[3] = '\n';
+        out += 4;
+        digits = increment_address(address, digits);
+    }
+
+    return (size_t)(out - start);
+}
+
+/* Helper function to add one to a decimal ASCII number in place; returns its new length */
+static int increment_address(char *digits, int length) {
+    int i = length - 1;
+
+    while (i >= 0 && digits[i] == '9') {
+        digits[i--] = '0';
+    }
+    if (i >= 0) {
+        digits[i]++;
+        return length;
+    }
+
+    /* 9...9 + 1 gains a digit */
+    memmove(digits + 1, digits, length);
+    digits[0] = '1';
+    return length + 1;
+}
+
+#ifdef OUTPUT_X86_KERNELS
+/*
+ * The vector kernels map each 6-bit index to its character without a table:
+ * 'A' + index, moved up to 'a' past 25, to '0' past 51, to '+' at 62 and to
+ * '/' at 63, each step adding a constant under a compare mask.
  */
-static void word_to_base64(machine_word_t word, char *base64) {
-    unsigned int combined_value;
+#define BASE64_MAP(set1, add, and, cmpgt, index) \
+    add(add(add(add(add((index), set1('A')), \
+                        and(cmpgt((index), set1(25)), set1('a' - 'A' - 26))), \
+                    and(cmpgt((index), set1(51)), set1('0' - 'a' - 26))), \
+                and(cmpgt((index), set1(61)), set1('+' - '0' - 10))), \
+            and(cmpgt((index), set1(62)), set1('/' - '+' - 1)))
+
+/* Helper function to convert four words per step with SSE2; returns the words converted */
+static int encode_word_chars_sse2(const machine_word_t *words, int count, char *chars) {
+    const __m128i mask = _mm_set1_epi32(BASE64_INDEX_MASK);
+    __m128i word, high, low;
     int i;
 
-    /* Combine the value and ARE bits */
-    combined_value = (word.value << 3) | word.are;
+    for (i = 0; i + 4 <= count; i += 4) {
+        word = _mm_loadu_si128((const __m128i *)(words + i));
+        high = _mm_and_si128(_mm_srli_epi32(word, BASE64_HIGH_SHIFT), mask);
+        low = _mm_and_si128(_mm_srli_epi32(word, BASE64_LOW_SHIFT), mask);
+        high = BASE64_MAP(_mm_set1_epi32, _mm_add_epi32, _mm_and_si128, _mm_cmpgt_epi32, high);
+        low = BASE64_MAP(_mm_set1_epi32, _mm_add_epi32, _mm_and_si128, _mm_cmpgt_epi32, low);
 
-    /* Extract 6-bit segments and convert to base64 */
-    for (i = 0; i < 2; i++) {
-        /* Extract 6 bits, starting from most significant bits */
-        int index = (combined_value >> (12 - i * 6)) & 0x3F;
-        base64[i] = base64_chars[index];
+        /* Each lane holds its two characters in its low bytes; pack the lanes to 16 bits */
+        word = _mm_or_si128(high, _mm_slli_epi32(low, 8));
+        _mm_storel_epi64((__m128i *)(chars + 2 * i), _mm_packs_epi32(word, word));
     }
-    base64[2] = '\0';
-}
\ No newline at end of file
+
+    return i;
+}
+
+/* Helper function to convert eight words per step with AVX2; returns the words converted */
+__attribute__((target("avx2")))
+static int encode_word_chars_avx2(const machine_word_t *words, int count, char *chars) {
+    const __m256i mask = _mm256_set1_epi32(BASE64_INDEX_MASK);
+    __m256i word, high, low;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        word = _mm256_loadu_si256((const __m256i *)(words + i));
+        high = _mm256_and_si256(_mm256_srli_epi32(word, BASE64_HIGH_SHIFT), mask);
+        low = _mm256_and_si256(_mm256_srli_epi32(word, BASE64_LOW_SHIFT), mask);
+        high = BASE64_MAP(_mm256_set1_epi32, _mm256_add_epi32, _mm256_and_si256, _mm256_cmpgt_epi32, high);
+        low = BASE64_MAP(_mm256_set1_epi32, _mm256_add_epi32, _mm256_and_si256, _mm256_cmpgt_epi32, low);
+
+        /* Pack within each 128-bit half, then gather the two halves' low quadwords */
+        word = _mm256_or_si256(high, _mm256_slli_epi32(low, 8));
+        word = _mm256_permute4x64_epi64(_mm256_packs_epi32(word, word), 0x08);
+        _mm_storeu_si128((__m128i *)(chars + 2 * i), _mm256_castsi256_si128(word));
+    }
+
+    return i;
+}
+#endif /* OUTPUT_X86_KERNELS */
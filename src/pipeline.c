@@ -0,0 +1,452 @@
+/**
+ * @file pipeline.c
+ * @brief Implementation of the pipelined pre-assembler and first pass
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/pipeline.h"
+#include "../include/first_pass.h"
+
+/* The ring needs the GCC atomic builtins; elsewhere, or with -DPIPELINE_NO_THREADS, the stages run in turn */
+#if defined(__GNUC__) && !defined(PIPELINE_NO_THREADS)
+#define PIPELINE_HAVE_ATOMICS
+#endif
+
+#define PIPELINE_MASK (PIPELINE_CAPACITY - 1)
+#define CACHE_LINE 64                 /* Bytes kept between the fields of the two stages */
+
+/**
+ * @brief A line in the ring
+ */
+typedef struct {
+    const char *text;             /* Text of the line's template */
+    int template_index;           /* Index of the line's template */
+} piped_line_t;
+
+/**
+ * @brief Ring of lines from the pre-assembler to the first pass
+ *
+ * The counters only grow; a line lives in slot counter & PIPELINE_MASK.
+ * Each stage keeps private copies of the other stage's counter and only
+ * reads the shared one when its copy runs out.
+ */
+struct line_pipe {
+    piped_line_t slots[PIPELINE_CAPACITY];
+    unsigned long head;           /* Lines published by the pre-assembler (shared) */
+    unsigned long added;          /* Lines added by the pre-assembler */
+    unsigned long seen_tail;      /* The tail as last read by the pre-assembler */
+    char producer_pad[CACHE_LINE];
+    unsigned long tail;           /* Lines handed back by the first pass (shared) */
+    unsigned long taken;          /* Lines taken by the first pass */
+    unsigned long seen_head;      /* The head as last read by the first pass */
+    char consumer_pad[CACHE_LINE];
+    int closed;                   /* The pre-assembler is done (shared) */
+    int cancelled;                /* The first pass stopped taking lines (shared) */
+    int producer_waiting;         /* The pre-assembler sleeps on wake (shared) */
+    int consumer_waiting;         /* The first pass sleeps on wake (shared) */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+/**
+ * @brief The pre-assembler's work, run on its own thread
+ */
+typedef struct {
+    const char *filename;
+    const char *text;             /* Contents already read (NULL = read the file) */
+    size_t length;
+    const struct macro_library *library;
+    macro_table_t *macros;
+    expanded_source_t *expanded;
+    bool write_output;
+    error_context_t *context;
+    bool success;                 /* Set once the thread is joined */
+} expansion_job_t;
+
+/**
+ * @brief Parses made by the first pass, by template
+ */
+typedef struct {
+    parsed_line_t *lines;
+    bool *parsed;                 /* lines[i] holds the parse of template i */
+    int capacity;
+} parse_cache_t;
+
+/* Forward declarations for internal functions */
+static bool expand_source(expansion_job_t *job);
+static void init_pipelined_pass(pipelined_pass_t *pass, error_context_t *pass_context,
+                                const error_context_t *context);
+#ifdef PIPELINE_HAVE_ATOMICS
+static void *run_expansion(void *arg);
+static bool consume_lines(struct line_pipe *pipe, const char *filename, symbol_table_t *symbols,
+                          first_pass_state_t *state, parse_cache_t *cache, error_context_t *context);
+static bool parse_piped_line(parse_cache_t *cache, const piped_line_t *line, int line_number,
+                             parsed_line_t *parsed, bool *success, error_context_t *context);
+static void keep_parses(const parse_cache_t *cache, expanded_source_t *expanded);
+static struct line_pipe *create_pipe(void);
+static void destroy_pipe(struct line_pipe *pipe);
+static bool pop_line(struct line_pipe *pipe, piped_line_t *line);
+static void publish_lines(struct line_pipe *pipe);
+static void release_slots(struct line_pipe *pipe);
+static void close_pipe(struct line_pipe *pipe);
+static void cancel_pipe(struct line_pipe *pipe);
+static bool has_room(struct line_pipe *pipe);
+static bool has_lines(struct line_pipe *pipe);
+static void wait_for_stage(struct line_pipe *pipe, int *waiting, bool (*ready)(struct line_pipe *));
+static void wake_stage(struct line_pipe *pipe, int *waiting);
+#endif
+
+/* Expand the macros of a source file while its first pass runs on the lines expanded so far */
+bool pipeline_first_pass(const char *filename, const char *text, size_t length,
+                         const struct macro_library *library, macro_table_t *macros, expanded_source_t *expanded,
+                         bool write_output, symbol_table_t *symbols, pipelined_pass_t *pass,
+                         error_context_t *context) {
+    expansion_job_t job;
+    error_context_t pass_context;
+#ifdef PIPELINE_HAVE_ATOMICS
+    first_pass_state_t state;
+    parse_cache_t cache;
+    struct line_pipe *pipe;
+    pthread_t expander;
+    bool consumed;
+#endif
+
+    job.filename = filename;
+    job.text = text;
+    job.length = length;
+    job.library = library;
+    job.macros = macros;
+    job.expanded = expanded;
+    job.write_output = write_output;
+    job.context = context;
+    job.success = false;
+
+    init_pipelined_pass(pass, &pass_context, context);
+    reset_symbol_table(symbols);
+
+#ifdef PIPELINE_HAVE_ATOMICS
+    pipe = create_pipe();
+    if (pipe) {
+        expanded->pipe = pipe;
+        if (pthread_create(&expander, NULL, run_expansion, &job) != 0) {
+            expanded->pipe = NULL;
+            destroy_pipe(pipe);
+            pipe = NULL;
+        }
+    }
+
+    if (pipe) {
+        memset(&cache, 0, sizeof(cache));
+        begin_first_pass(&state, filename, &pass_context);
+        consumed = consume_lines(pipe, filename, symbols, &state, &cache, &pass_context);
+        if (!consumed) {
+            cancel_pipe(pipe);
+        }
+
+        pthread_join(expander, NULL);
+        expanded->pipe = NULL;
+        destroy_pipe(pipe);
+
+        /* The second pass reuses the parses like after a sequential first pass */
+        if (job.success && consumed) {
+            keep_parses(&cache, expanded);
+        }
+        free(cache.lines);
+        free(cache.parsed);
+
+        pass->success = end_first_pass(&state, symbols, expanded) && consumed;
+        if (!job.success) {
+            clear_diagnostics(&pass->diagnostics);
+        }
+        return job.success;
+    }
+#endif
+
+    /* Without a second thread the stages run one after the other */
+    if (!expand_source(&job)) {
+        return false;
+    }
+    pass->success = first_pass(filename, expanded, symbols, &pass_context);
+
+    return true;
+}
+
+/* Helper function to run the pre-assembler over the file or the contents already read */
+static bool expand_source(expansion_job_t *job) {
+    if (job->text) {
+        return process_loaded_file(job->filename, job->text, job->length, job->library, job->macros,
+                                   job->expanded, job->write_output, job->context);
+    }
+    return process_file(job->filename, job->library, job->macros, job->expanded, job->write_output,
+                        job->context);
+}
+
+/* Helper function to start the result of a first pass, with a context collecting its messages */
+static void init_pipelined_pass(pipelined_pass_t *pass, error_context_t *pass_context,
+                                const error_context_t *context) {
+    pass->success = false;
+    memset(&pass->diagnostics, 0, sizeof(pass->diagnostics));
+
+    *pass_context = *context;
+    pass_context->had_error = false;
+    pass_context->diagnostics = &pass->diagnostics;
+}
+
+#ifdef PIPELINE_HAVE_ATOMICS
+
+/* Hand a line just added to the expanded source to the first pass */
+void push_pipeline_line(struct line_pipe *pipe, const char *text, int template_index) {
+    piped_line_t *slot;
+
+    /* A full ring waits for the first pass to hand slots back */
+    if (pipe->added - pipe->seen_tail == PIPELINE_CAPACITY) {
+        pipe->seen_tail = __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE);
+        if (pipe->added - pipe->seen_tail == PIPELINE_CAPACITY) {
+            publish_lines(pipe);
+            wait_for_stage(pipe, &pipe->producer_waiting, has_room);
+            if (__atomic_load_n(&pipe->cancelled, __ATOMIC_SEQ_CST)) {
+                return;
+            }
+            pipe->seen_tail = __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    slot = &pipe->slots[pipe->added & PIPELINE_MASK];
+    slot->text = text;
+    slot->template_index = template_index;
+    pipe->added++;
+
+    if (pipe->added - __atomic_load_n(&pipe->head, __ATOMIC_RELAXED) >= PIPELINE_BATCH) {
+        publish_lines(pipe);
+    }
+}
+
+/* Helper function for the pre-assembler's thread */
+static void *run_expansion(void *arg) {
+    expansion_job_t *job = (expansion_job_t *)arg;
+
+    job->success = expand_source(job);
+    close_pipe(job->expanded->pipe);
+
+    return NULL;
+}
+
+/* Helper function to run the first pass over the lines of the ring until it is closed
+ * (false if the pass could not go on) */
+static bool consume_lines(struct line_pipe *pipe, const char *filename, symbol_table_t *symbols,
+                          first_pass_state_t *state, parse_cache_t *cache, error_context_t *context) {
+    piped_line_t line;
+    parsed_line_t parsed_line;
+    int line_number = 0;
+    bool parsed;
+
+    while (pop_line(pipe, &line)) {
+        line_number++;
+        if (!parse_piped_line(cache, &line, line_number, &parsed_line, &parsed, context)) {
+            return false;
+        }
+        if (!parsed) {
+            state->success = false;
+            continue;
+        }
+
+        first_pass_line(state, &parsed_line, filename, symbols, context);
+    }
+
+    return true;
+}
+
+/* Helper function to parse a line, reusing an earlier parse of its template like parse_source_line
+ * (false if the cache could not grow) */
+static bool parse_piped_line(parse_cache_t *cache, const piped_line_t *line, int line_number,
+                             parsed_line_t *parsed, bool *success, error_context_t *context) {
+    parsed_line_t *lines;
+    bool *flags;
+    int capacity, index = line->template_index;
+
+    context->line_number = line_number;
+    *success = false;
+
+    if (index >= cache->capacity) {
+        capacity = cache->capacity ? cache->capacity : 256;
+        while (capacity <= index) {
+            capacity *= 2;
+        }
+        lines = (parsed_line_t *)realloc(cache->lines, capacity * sizeof(parsed_line_t));
+        if (lines) {
+            cache->lines = lines;
+        }
+        flags = (bool *)realloc(cache->parsed, capacity * sizeof(bool));
+        if (flags) {
+            cache->parsed = flags;
+        }
+        if (!lines || !flags) {
+            report_context_error(context, "Memory allocation error for parsed lines");
+            return false;
+        }
+        memset(cache->parsed + cache->capacity, 0, (capacity - cache->capacity) * sizeof(bool));
+        cache->capacity = capacity;
+    }
+
+    if (!cache->parsed[index]) {
+        if (!parse_line(line->text, &cache->lines[index], line_number, context)) {
+            return true;
+        }
+        cache->parsed[index] = true;
+    }
+
+    *parsed = cache->lines[index];
+    parsed->line_number = line_number;
+    *success = true;
+
+    return true;
+}
+
+/* Helper function to store the parses of the first pass in the templates */
+static void keep_parses(const parse_cache_t *cache, expanded_source_t *expanded) {
+    int i;
+
+    for (i = 0; i < expanded->template_count && i < cache->capacity; i++) {
+        if (cache->parsed[i]) {
+            expanded->templates[i].parsed = cache->lines[i];
+            expanded->templates[i].is_parsed = true;
+        }
+    }
+}
+
+/* Helper function to allocate an empty ring */
+static struct line_pipe *create_pipe(void) {
+    struct line_pipe *pipe;
+
+    pipe = (struct line_pipe *)calloc(1, sizeof(struct line_pipe));
+    if (!pipe) {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&pipe->lock, NULL) != 0) {
+        free(pipe);
+        return NULL;
+    }
+    if (pthread_cond_init(&pipe->wake, NULL) != 0) {
+        pthread_mutex_destroy(&pipe->lock);
+        free(pipe);
+        return NULL;
+    }
+
+    return pipe;
+}
+
+/* Helper function to release a ring both stages are done with */
+static void destroy_pipe(struct line_pipe *pipe) {
+    pthread_cond_destroy(&pipe->wake);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe);
+}
+
+/* Helper function to take the next line of the ring (false once it is closed and empty) */
+static bool pop_line(struct line_pipe *pipe, piped_line_t *line) {
+    if (pipe->taken == pipe->seen_head) {
+        /* Slots taken so far go back before waiting for more */
+        release_slots(pipe);
+        pipe->seen_head = __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE);
+        if (pipe->taken == pipe->seen_head) {
+            wait_for_stage(pipe, &pipe->consumer_waiting, has_lines);
+            pipe->seen_head = __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE);
+            if (pipe->taken == pipe->seen_head) {
+                return false;
+            }
+        }
+    }
+
+    *line = pipe->slots[pipe->taken & PIPELINE_MASK];
+    pipe->taken++;
+
+    if (pipe->taken - __atomic_load_n(&pipe->tail, __ATOMIC_RELAXED) >= PIPELINE_BATCH) {
+        release_slots(pipe);
+    }
+
+    return true;
+}
+
+/* Helper function to let the first pass see the lines added so far */
+static void publish_lines(struct line_pipe *pipe) {
+    __atomic_store_n(&pipe->head, pipe->added, __ATOMIC_SEQ_CST);
+    wake_stage(pipe, &pipe->consumer_waiting);
+}
+
+/* Helper function to hand the slots taken so far back to the pre-assembler */
+static void release_slots(struct line_pipe *pipe) {
+    __atomic_store_n(&pipe->tail, pipe->taken, __ATOMIC_SEQ_CST);
+    wake_stage(pipe, &pipe->producer_waiting);
+}
+
+/* Helper function for the pre-assembler to publish its last lines and end the ring */
+static void close_pipe(struct line_pipe *pipe) {
+    __atomic_store_n(&pipe->head, pipe->added, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&pipe->closed, 1, __ATOMIC_SEQ_CST);
+    wake_stage(pipe, &pipe->consumer_waiting);
+}
+
+/* Helper function for the first pass to stop taking lines, so the pre-assembler never waits for it */
+static void cancel_pipe(struct line_pipe *pipe) {
+    __atomic_store_n(&pipe->cancelled, 1, __ATOMIC_SEQ_CST);
+    wake_stage(pipe, &pipe->producer_waiting);
+}
+
+/* Helper function telling the pre-assembler whether it can add a line */
+static bool has_room(struct line_pipe *pipe) {
+    return pipe->added - __atomic_load_n(&pipe->tail, __ATOMIC_SEQ_CST) < PIPELINE_CAPACITY ||
+           __atomic_load_n(&pipe->cancelled, __ATOMIC_SEQ_CST);
+}
+
+/* Helper function telling the first pass whether a line, or the end of the ring, is there */
+static bool has_lines(struct line_pipe *pipe) {
+    return __atomic_load_n(&pipe->head, __ATOMIC_SEQ_CST) != pipe->taken ||
+           __atomic_load_n(&pipe->closed, __ATOMIC_SEQ_CST);
+}
+
+/* Helper function to wait until the other stage makes ready true: spinning first, then sleeping.
+ * The waiting flag is raised before ready is checked under the lock, and the other stage reads it
+ * after its update, so one of the two always sees the other and no wake-up is lost. */
+static void wait_for_stage(struct line_pipe *pipe, int *waiting, bool (*ready)(struct line_pipe *)) {
+    int i;
+
+    for (i = 0; i < PIPELINE_SPINS; i++) {
+        if (ready(pipe)) {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    while (!ready(pipe)) {
+        pthread_cond_wait(&pipe->wake, &pipe->lock);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/* Helper function to wake the other stage if it sleeps */
+static void wake_stage(struct line_pipe *pipe, int *waiting) {
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pipe->lock);
+        pthread_cond_broadcast(&pipe->wake);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+}
+
+#else
+
+/* Hand a line just added to the expanded source to the first pass (no ring is ever created here) */
+void push_pipeline_line(struct line_pipe *pipe, const char *text, int template_index) {
+    (void)pipe;
+    (void)text;
+    (void)template_index;
+}
+
+#endif
@@ -2,18 +2,125 @@
  * @file pre_assembler.c
  * @brief Implementation of the macro processor
  */
+#define _POSIX_C_SOURCE 200809L
 #include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "../include/pre_assembler.h"
+#include "../include/macro_library.h"
+#include "../include/expanded_source.h"
 #include "../include/utils.h"
 
 #define MAX_MACRO_LINES 1000  /* Maximum number of lines in a macro */
 #define MAX_MACRO_NESTING 10  /* Maximum nesting level for macros */
 
+/**
+ * @brief Kind of an entry in a parsed header
+ */
+typedef enum {
+    INCLUDE_ITEM_LINE,            /* Source line, expanded where it is included */
+    INCLUDE_ITEM_MACRO,           /* Macro definition, visible from this point on */
+    INCLUDE_ITEM_INCLUDE          /* Nested .include */
+} include_item_kind_t;
+
+/**
+ * @brief One entry of a parsed header, in source order
+ */
+typedef struct {
+    include_item_kind_t kind;
+    int line_number;              /* Line in the header */
+    char *text;                   /* Source line, or resolved path of a nested header */
+    macro_t *macro;               /* Macro defined here (owned by the header's table) */
+} include_item_t;
+
+/**
+ * @brief A header parsed once and shared by every file that includes it
+ */
+typedef struct include_file {
+    char path[MAX_FILENAME_LENGTH];
+    dev_t device;                 /* File identity when parsed */
+    ino_t inode;
+    time_t mtime;                 /* Modification time when parsed */
+    long mtime_nsec;              /* Nanoseconds of the modification time */
+    long size;                    /* Size in bytes when parsed */
+    macro_table_t *macros;        /* Macros defined by the header */
+    include_item_t *items;
+    int item_count;
+    int users;                    /* Pre-assembler runs expanding it (under the cache lock) */
+    struct include_file *next;
+} include_file_t;
+
+/**
+ * @brief Identity of a header already included in the current file
+ */
+typedef struct {
+    dev_t device;
+    ino_t inode;
+    include_file_t *header;       /* Held until the end of the run, as its macros are borrowed */
+} include_id_t;
+
+/**
+ * @brief Templates of a library macro's body in the expanded source
+ */
+typedef struct {
+    int first;                    /* First template */
+    int count;                    /* Number of templates (0 = not expanded yet) */
+} library_expansion_t;
+
+/**
+ * @brief State of one pre-assembler run
+ */
+typedef struct {
+    expanded_source_t *source;    /* Output */
+    char pending[MAX_LINE_LENGTH * 2]; /* Labels of empty macros, continued by the next line */
+    macro_table_t *macros;
+    const macro_library_t *library; /* Consulted when a macro is not in macros */
+    library_expansion_t *library_expansions; /* Per library macro, allocated on first use */
+    int nesting_level;            /* Open mcro blocks */
+    include_id_t *included;       /* Headers already included (include-once) */
+    int included_count;
+    int included_capacity;
+    error_context_t *context;
+    bool success;
+} pre_assembler_state_t;
+
+/* Headers parsed by this process, newest first */
+static include_file_t *include_cache = NULL;
+/* Headers replaced by a newer parse while a run still used them */
+static include_file_t *retired_includes = NULL;
+static pthread_mutex_t include_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Forward declarations for internal functions */
+static char *safe_strtok_r(char *str, const char *delim, char **saveptr);
+static bool borrow_macro(macro_table_t *table, const macro_t *shared, error_context_t *context);
+static bool expand_macro(pre_assembler_state_t *state, const char *label, const char *name);
+static bool add_body_templates(pre_assembler_state_t *state, const char *body, size_t size, int *first, int *count);
+static void emit_line(pre_assembler_state_t *state, const char *text);
+static char *macro_definition_name(char **saveptr, error_context_t *context);
+static void process_source_line(pre_assembler_state_t *state, char *line, const char *path);
+static bool parse_include_name(char *operand, const char *including, char *resolved, error_context_t *context);
+static void include_header(pre_assembler_state_t *state, const char *path);
+static bool mark_included(pre_assembler_state_t *state, const struct stat *info, include_file_t *header);
+static include_file_t *get_include(const char *path, struct stat *info, error_context_t *context);
+static bool is_current_include(const include_file_t *header, const struct stat *info);
+static void retire_include(include_file_t *header);
+static void release_include(include_file_t *header);
+static include_file_t *parse_include(const char *path, const struct stat *info, error_context_t *context);
+static bool add_include_item(include_file_t *header, include_item_kind_t kind, int line_number,
+                             const char *text, error_context_t *context);
+static void free_include(include_file_t *header);
+static void init_state(pre_assembler_state_t *state, const macro_library_t *library, macro_table_t *macros,
+                       expanded_source_t *expanded, error_context_t *context);
+static void expand_line(pre_assembler_state_t *state, char *line, int line_number, const char *path);
+static void expand_text(pre_assembler_state_t *state, const char *text, size_t length, const char *path);
+static void finish_expansion(pre_assembler_state_t *state);
+
 /* Create a new macro table */
 macro_table_t* create_macro_table() {
     macro_table_t *table = (macro_table_t *)malloc(sizeof(macro_table_t));
     if (table) {
         table->head = NULL;
+        table->spare = NULL;
     }
     return table;
 }
@@ -40,25 +147,37 @@ bool add_macro(macro_table_t *table, const char *name, error_context_t *context)
         return false;
     }
 
-    /* Create a new macro */
-    macro = (macro_t *)malloc(sizeof(macro_t));
-    if (!macro) {
-        report_context_error(context, "Memory allocation error");
-        return false;
+    /* Reuse an entry left by reset_macro_table, or create a new macro */
+    if (table->spare) {
+        macro = table->spare;
+        table->spare = macro->next;
+    } else {
+        macro = (macro_t *)malloc(sizeof(macro_t));
+        if (!macro) {
+            report_context_error(context, "Memory allocation error");
+            return false;
+        }
+        macro->lines = NULL;
     }
 
     /* Initialize the macro */
     strncpy(macro->name, name, MAX_LABEL_LENGTH - 1);
     macro->name[MAX_LABEL_LENGTH - 1] = '\0';
 
-    macro->lines = (char **)malloc(MAX_MACRO_LINES * sizeof(char *));
     if (!macro->lines) {
-        free(macro);
-        report_context_error(context, "Memory allocation error");
-        return false;
+        macro->lines = (char **)malloc(MAX_MACRO_LINES * sizeof(char *));
+        if (!macro->lines) {
+            macro->next = table->spare;
+            table->spare = macro;
+            report_context_error(context, "Memory allocation error");
+            return false;
+        }
     }
     macro->line_count = 0;
     macro->usage_count = 0;  /* Initialize usage count */
+    macro->borrowed = false;
+    macro->first_template = 0;
+    macro->template_count = 0;
 
     /* Add the macro to the table */
     macro->next = table->head;
@@ -118,28 +237,49 @@ macro_t* find_macro(macro_table_t *table, const char *name) {
     return NULL;
 }
 
+/* Empty the table, keeping its entries and line arrays for reuse */
+void reset_macro_table(macro_table_t *table) {
+    macro_t *current, *next;
+    int i;
+
+    current = table->head;
+    while (current) {
+        next = current->next;
+
+        /* Free the lines; a borrowed entry's line array belongs to the include cache */
+        if (current->borrowed) {
+            current->lines = NULL;
+            current->borrowed = false;
+        } else {
+            for (i = 0; i < current->line_count; i++) {
+                free(current->lines[i]);
+            }
+        }
+        current->line_count = 0;
+
+        current->next = table->spare;
+        table->spare = current;
+        current = next;
+    }
+    table->head = NULL;
+}
+
 /* Free the macro table and all its entries */
 void free_macro_table(macro_table_t *table) {
     macro_t *current, *next;
-    int i;
 
     /* Check if the table is valid */
     if (!table) {
         return;
     }
 
-    /* Free all macros */
-    current = table->head;
+    /* Free all macros, spare ones included */
+    reset_macro_table(table);
+    current = table->spare;
     while (current) {
         next = current->next;
-
-        /* Free all lines */
-        for (i = 0; i < current->line_count; i++) {
-            free(current->lines[i]);
-        }
         free(current->lines);
         free(current);
-
         current = next;
     }
 
@@ -177,62 +317,531 @@ static char *safe_strtok_r(char *str, const char *delim, char **saveptr) {
     return token;
 }
 
-/* Process a source file to expand macros */
-bool process_file(const char *filename, error_context_t *context) {
-    FILE *source, *output;
-    char base_filename[MAX_FILENAME_LENGTH];
-    char source_filename[MAX_FILENAME_LENGTH];
-    char output_filename[MAX_FILENAME_LENGTH];
-    char line[MAX_LINE_LENGTH];
-    macro_table_t *macro_table;
-    bool success = true;
-    char macro_name_stack[MAX_MACRO_NESTING][MAX_LABEL_LENGTH];
-    int macro_nesting_level = 0;
-    int line_number = 0;
+/* Helper function to register a cached header's macro without copying its lines */
+static bool borrow_macro(macro_table_t *table, const macro_t *shared, error_context_t *context) {
+    macro_t *macro;
+
+    if (find_macro(table, shared->name)) {
+        report_context_error(context, "Macro '%s' already defined", shared->name);
+        return false;
+    }
+
+    macro = (macro_t *)malloc(sizeof(macro_t));
+    if (!macro) {
+        report_context_error(context, "Memory allocation error");
+        return false;
+    }
+
+    *macro = *shared;
+    macro->usage_count = 0;
+    macro->template_count = 0;
+    macro->borrowed = true;
+    macro->next = table->head;
+    table->head = macro;
+
+    return true;
+}
+
+/* Helper function to expand a macro in place of its invocation; false if name is no macro */
+static bool expand_macro(pre_assembler_state_t *state, const char *label, const char *name) {
+    macro_t *macro = find_macro(state->macros, name);
+    const macro_library_entry_t *entry = NULL;
+    library_expansion_t *expansion;
+    const char *first_line;
+    char text[MAX_LINE_LENGTH * 3];
+    int first, count, index, i, k;
+    bool created = true;
+
+    /* Local definitions shadow the library */
+    if (!macro) {
+        entry = find_library_macro(state->library, name);
+        if (!entry) {
+            return false;
+        }
+    }
+
+    /* The body becomes templates once; every expansion refers to the same ones */
+    if (macro) {
+        if (macro->template_count == 0) {
+            for (i = 0; created && i < macro->line_count; i++) {
+                index = add_source_templates(state->source, macro->lines[i], strlen(macro->lines[i]), &k);
+                created = index >= 0;
+                if (i == 0) {
+                    macro->first_template = index;
+                }
+                macro->template_count += k;
+            }
+        }
+        first = macro->first_template;
+        count = macro->template_count;
+        first_line = macro->line_count > 0 ? macro->lines[0] : NULL;
+
+        /* Increment usage count */
+        macro->usage_count++;
+    } else {
+        if (!state->library_expansions) {
+            state->library_expansions = (library_expansion_t *)calloc(state->library->header->macro_count,
+                                                                      sizeof(library_expansion_t));
+        }
+        if (!state->library_expansions) {
+            created = false;
+        } else {
+            expansion = &state->library_expansions[entry - state->library->macros];
+            if (expansion->count == 0) {
+                created = add_body_templates(state, state->library->text + entry->body_offset, entry->body_size,
+                                             &expansion->first, &expansion->count);
+            }
+            first = expansion->first;
+            count = expansion->count;
+        }
+        first_line = entry->line_count > 0 ? state->library->text + entry->body_offset : NULL;
+    }
+
+    if (!created) {
+        report_context_error(state->context, "Memory allocation error");
+        state->success = false;
+        return true;
+    }
+
+    if (label && strlen(state->pending) + strlen(label) + 1 < sizeof(state->pending)) {
+        strcat(state->pending, label);
+        strcat(state->pending, " ");
+    }
+
+    /* A label goes in front of the first line; the rest of the body is shared */
+    if (state->pending[0] && first_line) {
+        k = 0;
+        while (first_line[k] != '\0' && first_line[k] != '\n' && k < MAX_LINE_LENGTH * 2) {
+            text[k] = first_line[k];
+            k++;
+        }
+        text[k] = '\0';
+        emit_line(state, text);
+        index = k / (MAX_LINE_LENGTH - 1) + 1;
+        first += index;
+        count -= index;
+    }
+    if (!state->pending[0] && !add_source_span(state->source, first, count)) {
+        report_context_error(state->context, "Memory allocation error");
+        state->success = false;
+    }
+
+    return true;
+}
+
+/* Helper function to add the templates of a library body (lines ending in '\n') */
+static bool add_body_templates(pre_assembler_state_t *state, const char *body, size_t size, int *first, int *count) {
+    const char *end = body + size;
+    const char *newline;
+    int index, k;
+
+    *count = 0;
+    while (body < end) {
+        newline = (const char *)memchr(body, '\n', (size_t)(end - body));
+        if (!newline) {
+            newline = end;
+        }
+        index = add_source_templates(state->source, body, (size_t)(newline - body), &k);
+        if (index < 0) {
+            return false;
+        }
+        if (*count == 0) {
+            *first = index;
+        }
+        *count += k;
+        body = newline + 1;
+    }
+
+    return true;
+}
+
+/* Helper function to add a line of output, after the labels of empty macros before it */
+static void emit_line(pre_assembler_state_t *state, const char *text) {
+    char joined[MAX_LINE_LENGTH * 5];
+
+    if (state->pending[0]) {
+        sprintf(joined, "%s%.*s", state->pending, MAX_LINE_LENGTH * 2, text);
+        state->pending[0] = '\0';
+        text = joined;
+    }
+
+    if (!append_source_text(state->source, text)) {
+        report_context_error(state->context, "Memory allocation error");
+        state->success = false;
+    }
+}
+
+/* Helper function to check the name on a mcro line */
+static char *macro_definition_name(char **saveptr, error_context_t *context) {
+    char *name;
+
+    /* Get the macro name */
+    name = safe_strtok_r(NULL, " \t", saveptr);
+    if (!name) {
+        report_context_error(context, "Missing macro name");
+        return NULL;
+    }
+
+    /* Check for extra tokens */
+    if (safe_strtok_r(NULL, " \t", saveptr)) {
+        report_context_error(context, "Extra tokens after macro name");
+        return NULL;
+    }
+
+    return name;
+}
+
+/* Helper function to expand one source line; path is the file it came from */
+static void process_source_line(pre_assembler_state_t *state, char *line, const char *path) {
+    char processed_line[MAX_LINE_LENGTH];
+    char resolved[MAX_FILENAME_LENGTH];
     char *token, *saveptr;
+    error_context_t *context = state->context;
 
-    /* Initialize error context */
-    if (context) {
-        strncpy(context->filename, filename, MAX_FILENAME_LENGTH - 1);
-        context->filename[MAX_FILENAME_LENGTH - 1] = '\0';
+    /* Make a copy of the line for processing */
+    strncpy(processed_line, line, MAX_LINE_LENGTH - 1);
+    processed_line[MAX_LINE_LENGTH - 1] = '\0';
+
+    /* Skip comments */
+    if (processed_line[0] == ';') {
+        emit_line(state, processed_line);
+        return;
     }
 
-    /* Get the base filename */
-    get_base_filename(filename, base_filename);
+    /* Trim whitespace */
+    trim(processed_line);
 
-    /* Create source and output filenames */
-    create_filename(base_filename, EXT_SOURCE, source_filename);
-    create_filename(base_filename, EXT_MACRO, output_filename);
+    /* Skip empty lines */
+    if (processed_line[0] == '\0') {
+        emit_line(state, "");
+        return;
+    }
 
-    /* Open the source file */
-    source = fopen(source_filename, "r");
-    if (!source) {
-        report_context_error(context, "Could not open source file: %s", source_filename);
-        return false;
+    /* Tokenize the line */
+    token = safe_strtok_r(processed_line, " \t", &saveptr);
+
+    /* Check for macro definition start */
+    if (token && strcmp(token, "mcro") == 0) {
+        if (state->nesting_level >= MAX_MACRO_NESTING) {
+            report_context_error(context, "Macro nesting level exceeded");
+            state->success = false;
+            return;
+        }
+
+        token = macro_definition_name(&saveptr, context);
+        if (!token || !add_macro(state->macros, token, context)) {
+            state->success = false;
+            return;
+        }
+
+        state->nesting_level++;
+    }
+    /* Check for macro definition end */
+    else if (token && strcmp(token, "mcroend") == 0) {
+        if (state->nesting_level == 0) {
+            report_context_error(context, "mcroend without matching mcro");
+            state->success = false;
+            return;
+        }
+
+        /* Check for extra tokens */
+        if (safe_strtok_r(NULL, " \t", &saveptr)) {
+            report_context_error(context, "Extra tokens after mcroend");
+            state->success = false;
+            return;
+        }
+
+        state->nesting_level--;
     }
+    /* Inside a macro definition */
+    else if (state->nesting_level > 0) {
+        /* Add the line to the current macro */
+        if (!add_line_to_macro(state->macros, line, context)) {
+            state->success = false;
+        }
+    }
+    /* Check for a header to include */
+    else if (token && strcmp(token, ".include") == 0) {
+        if (!path) {
+            report_context_error(context, ".include is not available for a source assembled from memory");
+            state->success = false;
+            return;
+        }
+        if (!parse_include_name(saveptr, path, resolved, context)) {
+            state->success = false;
+            return;
+        }
+        include_header(state, resolved);
+    }
+    /* Check for macro usage */
+    else if (token) {
+        /* Regular case - token is directly a macro */
+        if (expand_macro(state, NULL, token)) {
+            return;
+        }
 
-    /* Open the output file */
-    output = fopen(output_filename, "w");
-    if (!output) {
-        fclose(source);
-        report_context_error(context, "Could not open output file: %s", output_filename);
+        /* Check if this is a label followed by a macro */
+        if (token[strlen(token) - 1] == ':') {
+            char *next_token = safe_strtok_r(NULL, " \t", &saveptr);
+            if (next_token && expand_macro(state, token, next_token)) {
+                return;
+            }
+        }
+
+        /* Write the line to the output file */
+        emit_line(state, line);
+    }
+}
+
+/* Helper function to resolve the quoted operand of .include against the including file */
+static bool parse_include_name(char *operand, const char *including, char *resolved, error_context_t *context) {
+    const char *slash;
+    size_t directory = 0, length;
+
+    operand = trim(operand);
+    length = strlen(operand);
+    if (length == 0) {
+        report_context_error(context, "Missing file name for .include directive");
+        return false;
+    }
+    if (length < 2 || operand[0] != '"' || operand[length - 1] != '"') {
+        report_context_error(context, "File name for .include directive must be quoted: %s", operand);
+        return false;
+    }
+    operand[length - 1] = '\0';
+    operand++;
+    length -= 2;
+    if (length == 0) {
+        report_context_error(context, "Empty file name for .include directive");
         return false;
     }
 
-    /* Create the macro table */
-    macro_table = create_macro_table();
-    if (!macro_table) {
-        fclose(source);
-        fclose(output);
-        report_context_error(context, "Could not create macro table");
+    /* Relative paths are taken from the directory of the including file */
+    slash = strrchr(including, '/');
+    if (operand[0] != '/' && slash) {
+        directory = (size_t)(slash - including) + 1;
+    }
+    if (directory + length >= MAX_FILENAME_LENGTH) {
+        report_context_error(context, "File name too long: %s", operand);
         return false;
     }
+    memcpy(resolved, including, directory);
+    strcpy(resolved + directory, operand);
 
-    /* Process the file line by line */
-    while (fgets(line, MAX_LINE_LENGTH, source)) {
-        char processed_line[MAX_LINE_LENGTH];
-        bool write_line = true;
+    return true;
+}
+
+/* Helper function to expand a header into the current file */
+static void include_header(pre_assembler_state_t *state, const char *path) {
+    include_file_t *header;
+    struct stat info;
+    char line[MAX_LINE_LENGTH];
+    char saved_filename[MAX_FILENAME_LENGTH];
+    int saved_line = 0;
+    int i;
+
+    /* Watch mode assembles the file again when a header it names changes, even one still missing */
+    if (!add_source_header(state->source, path)) {
+        report_context_error(state->context, "Memory allocation error");
+        state->success = false;
+        return;
+    }
+
+    header = get_include(path, &info, state->context);
+    if (!header) {
+        state->success = false;
+        return;
+    }
 
+    /* Each header is expanded at most once per file */
+    if (!mark_included(state, &info, header)) {
+        release_include(header);
+        return;
+    }
+
+    /* Diagnostics for header lines name the header */
+    if (state->context) {
+        strcpy(saved_filename, state->context->filename);
+        saved_line = state->context->line_number;
+        strcpy(state->context->filename, header->path);
+    }
+
+    for (i = 0; i < header->item_count; i++) {
+        const include_item_t *item = &header->items[i];
+
+        if (state->context) {
+            state->context->line_number = item->line_number;
+        }
+
+        switch (item->kind) {
+            case INCLUDE_ITEM_LINE:
+                strcpy(line, item->text);
+                process_source_line(state, line, header->path);
+                break;
+            case INCLUDE_ITEM_MACRO:
+                if (!borrow_macro(state->macros, item->macro, state->context)) {
+                    state->success = false;
+                }
+                break;
+            case INCLUDE_ITEM_INCLUDE:
+                include_header(state, item->text);
+                break;
+        }
+    }
+
+    if (state->context) {
+        strcpy(state->context->filename, saved_filename);
+        state->context->line_number = saved_line;
+    }
+}
+
+/* Helper function to record a header as included, keeping it until the end of the run; false if it already was */
+static bool mark_included(pre_assembler_state_t *state, const struct stat *info, include_file_t *header) {
+    include_id_t *grown;
+    int i;
+
+    for (i = 0; i < state->included_count; i++) {
+        if (state->included[i].device == info->st_dev && state->included[i].inode == info->st_ino) {
+            return false;
+        }
+    }
+
+    if (state->included_count == state->included_capacity) {
+        int capacity = state->included_capacity ? state->included_capacity * 2 : 8;
+        grown = (include_id_t *)realloc(state->included, capacity * sizeof(include_id_t));
+        if (!grown) {
+            report_context_error(state->context, "Memory allocation error");
+            state->success = false;
+            return false;
+        }
+        state->included = grown;
+        state->included_capacity = capacity;
+    }
+
+    state->included[state->included_count].device = info->st_dev;
+    state->included[state->included_count].inode = info->st_ino;
+    state->included[state->included_count].header = header;
+    state->included_count++;
+
+    return true;
+}
+
+/* Helper function to find a header in the cache, parsing it on a miss; the caller releases it */
+static include_file_t *get_include(const char *path, struct stat *info, error_context_t *context) {
+    include_file_t *header, **link;
+
+    if (stat(path, info) != 0 || !S_ISREG(info->st_mode)) {
+        report_context_error(context, "Could not open include file: %s", path);
+        return NULL;
+    }
+
+    /* Entries are immutable once listed; a stale one is unlinked and freed once no run uses it */
+    pthread_mutex_lock(&include_cache_lock);
+    link = &include_cache;
+    while ((header = *link) != NULL) {
+        if (strcmp(header->path, path) == 0) {
+            if (is_current_include(header, info)) {
+                break;
+            }
+            *link = header->next;
+            retire_include(header);
+            continue;
+        }
+        link = &header->next;
+    }
+    if (!header) {
+        header = parse_include(path, info, context);
+        if (header) {
+            header->next = include_cache;
+            include_cache = header;
+        }
+    }
+    if (header) {
+        header->users++;
+    }
+    pthread_mutex_unlock(&include_cache_lock);
+
+    return header;
+}
+
+/* Helper function to check that a cached header was parsed from the file as it is now */
+static bool is_current_include(const include_file_t *header, const struct stat *info) {
+    return header->device == info->st_dev && header->inode == info->st_ino &&
+           header->mtime == info->st_mtim.tv_sec && header->mtime_nsec == info->st_mtim.tv_nsec &&
+           header->size == (long)info->st_size;
+}
+
+/* Helper function to drop a header unlinked from the cache, or keep it until its last user is done
+ * (called with the cache lock held) */
+static void retire_include(include_file_t *header) {
+    if (header->users == 0) {
+        free_include(header);
+        return;
+    }
+    header->next = retired_includes;
+    retired_includes = header;
+}
+
+/* Helper function to give back a header from get_include, freeing it if it was replaced meanwhile */
+static void release_include(include_file_t *header) {
+    include_file_t **link;
+
+    pthread_mutex_lock(&include_cache_lock);
+    header->users--;
+    if (header->users == 0) {
+        for (link = &retired_includes; *link; link = &(*link)->next) {
+            if (*link == header) {
+                *link = header->next;
+                free_include(header);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&include_cache_lock);
+}
+
+/* Helper function to split a header into macro definitions, nested includes and lines */
+static include_file_t *parse_include(const char *path, const struct stat *info, error_context_t *context) {
+    FILE *file;
+    include_file_t *header;
+    char line[MAX_LINE_LENGTH];
+    char processed_line[MAX_LINE_LENGTH];
+    char resolved[MAX_FILENAME_LENGTH];
+    char saved_filename[MAX_FILENAME_LENGTH];
+    char *token, *saveptr;
+    int saved_line = 0, line_number = 0, nesting_level = 0;
+    bool success = true;
+
+    file = fopen(path, "r");
+    if (!file) {
+        report_context_error(context, "Could not open include file: %s", path);
+        return NULL;
+    }
+
+    header = (include_file_t *)calloc(1, sizeof(include_file_t));
+    if (header) {
+        header->macros = create_macro_table();
+    }
+    if (!header || !header->macros) {
+        free(header);
+        fclose(file);
+        report_context_error(context, "Memory allocation error");
+        return NULL;
+    }
+    strcpy(header->path, path);
+    header->device = info->st_dev;
+    header->inode = info->st_ino;
+    header->mtime = info->st_mtim.tv_sec;
+    header->mtime_nsec = info->st_mtim.tv_nsec;
+    header->size = (long)info->st_size;
+
+    if (context) {
+        strcpy(saved_filename, context->filename);
+        saved_line = context->line_number;
+        strcpy(context->filename, path);
+    }
+
+    while (fgets(line, MAX_LINE_LENGTH, file)) {
         line_number++;
         if (context) {
             context->line_number = line_number;
@@ -243,163 +852,372 @@ bool process_file(const char *filename, error_context_t *context) {
             line[strlen(line) - 1] = '\0';
         }
 
-        /* Make a copy of the line for processing */
-        strncpy(processed_line, line, MAX_LINE_LENGTH - 1);
-        processed_line[MAX_LINE_LENGTH - 1] = '\0';
-
-        /* Skip comments */
-        if (processed_line[0] == ';') {
-            fprintf(output, "%s\n", processed_line);
-            continue;
-        }
-
-        /* Trim whitespace */
-        trim(processed_line);
-
-        /* Skip empty lines */
-        if (processed_line[0] == '\0') {
-            fprintf(output, "\n");
+        /* Comments and empty lines are not kept */
+        strcpy(processed_line, line);
+        if (processed_line[0] == ';' || *trim(processed_line) == '\0') {
             continue;
         }
 
-        /* Tokenize the line */
         token = safe_strtok_r(processed_line, " \t", &saveptr);
 
-        /* Check for macro definition start */
-        if (token && strcmp(token, "mcro") == 0) {
-            if (macro_nesting_level >= MAX_MACRO_NESTING) {
+        if (strcmp(token, "mcro") == 0) {
+            if (nesting_level >= MAX_MACRO_NESTING) {
                 report_context_error(context, "Macro nesting level exceeded");
                 success = false;
                 continue;
             }
-
-            /* Get the macro name */
-            token = safe_strtok_r(NULL, " \t", &saveptr);
-            if (!token) {
-                report_context_error(context, "Missing macro name");
+            token = macro_definition_name(&saveptr, context);
+            if (!token || !add_macro(header->macros, token, context) ||
+                !add_include_item(header, INCLUDE_ITEM_MACRO, line_number, NULL, context)) {
                 success = false;
                 continue;
             }
-
-            /* Check for extra tokens */
-            if (safe_strtok_r(NULL, " \t", &saveptr)) {
-                report_context_error(context, "Extra tokens after macro name");
+            nesting_level++;
+        } else if (strcmp(token, "mcroend") == 0) {
+            if (nesting_level == 0) {
+                report_context_error(context, "mcroend without matching mcro");
                 success = false;
-                continue;
-            }
-
-            /* Add the macro to the table */
-            if (!add_macro(macro_table, token, context)) {
+            } else if (safe_strtok_r(NULL, " \t", &saveptr)) {
+                report_context_error(context, "Extra tokens after mcroend");
                 success = false;
-                continue;
+            } else {
+                nesting_level--;
             }
-
-            /* Remember the macro name and increase nesting level */
-            strncpy(macro_name_stack[macro_nesting_level], token, MAX_LABEL_LENGTH - 1);
-            macro_name_stack[macro_nesting_level][MAX_LABEL_LENGTH - 1] = '\0';
-            macro_nesting_level++;
-            write_line = false;
-        }
-        /* Check for macro definition end */
-        else if (token && strcmp(token, "mcroend") == 0) {
-            if (macro_nesting_level == 0) {
-                report_context_error(context, "mcroend without matching mcro");
+        } else if (nesting_level > 0) {
+            if (!add_line_to_macro(header->macros, line, context)) {
                 success = false;
-                continue;
             }
-
-            /* Check for extra tokens */
-            if (safe_strtok_r(NULL, " \t", &saveptr)) {
-                report_context_error(context, "Extra tokens after mcroend");
+        } else if (strcmp(token, ".include") == 0) {
+            if (!parse_include_name(saveptr, path, resolved, context) ||
+                !add_include_item(header, INCLUDE_ITEM_INCLUDE, line_number, resolved, context)) {
                 success = false;
-                continue;
             }
+        } else if (!add_include_item(header, INCLUDE_ITEM_LINE, line_number, line, context)) {
+            success = false;
+        }
+    }
+
+    if (nesting_level > 0) {
+        report_context_error(context, "Macro definition not closed");
+        success = false;
+    }
+
+    if (context) {
+        strcpy(context->filename, saved_filename);
+        context->line_number = saved_line;
+    }
+    fclose(file);
+
+    if (!success) {
+        free_include(header);
+        return NULL;
+    }
+
+    return header;
+}
 
-            /* Decrease nesting level */
-            macro_nesting_level--;
-            write_line = false;
+/* Helper function to append an entry to a parsed header */
+static bool add_include_item(include_file_t *header, include_item_kind_t kind, int line_number,
+                             const char *text, error_context_t *context) {
+    include_item_t *grown, *item;
+
+    grown = (include_item_t *)realloc(header->items, (header->item_count + 1) * sizeof(include_item_t));
+    if (!grown) {
+        report_context_error(context, "Memory allocation error");
+        return false;
+    }
+    header->items = grown;
+
+    item = &header->items[header->item_count];
+    item->kind = kind;
+    item->line_number = line_number;
+    item->text = NULL;
+    item->macro = header->macros->head;
+    if (text) {
+        item->text = str_duplicate(text);
+        if (!item->text) {
+            report_context_error(context, "Memory allocation error");
+            return false;
         }
-        /* Check for macro usage */
-        else if (token && macro_nesting_level == 0) {
-            macro_t *macro = find_macro(macro_table, token);
+    }
+    header->item_count++;
 
-            /* Check if this is a label followed by a macro */
-            if (!macro && token[strlen(token) - 1] == ':') {
-                /* This might be a label, check if next token is a macro */
-                char *next_token = safe_strtok_r(NULL, " \t", &saveptr);
-                if (next_token) {
-                    macro = find_macro(macro_table, next_token);
-                    if (macro) {
-                        int i;
+    return true;
+}
 
-                        /* Write the label part */
-                        fprintf(output, "%s ", token);
+/* Helper function to release a parsed header */
+static void free_include(include_file_t *header) {
+    int i;
 
-                        /* Replace the macro with its lines */
-                        for (i = 0; i < macro->line_count; i++) {
-                            fprintf(output, "%s\n", macro->lines[i]);
-                        }
+    for (i = 0; i < header->item_count; i++) {
+        free(header->items[i].text);
+    }
+    free(header->items);
+    free_macro_table(header->macros);
+    free(header);
+}
 
-                        /* Increment usage count */
-                        macro->usage_count++;
+/* Release the headers cached by .include directives */
+void clear_include_cache(void) {
+    include_file_t *next;
 
-                        write_line = false;
-                    }
-                }
-            }
-            /* Regular case - token is directly a macro */
-            else if (macro) {
-                int i;
+    pthread_mutex_lock(&include_cache_lock);
+    while (include_cache) {
+        next = include_cache->next;
+        free_include(include_cache);
+        include_cache = next;
+    }
+    while (retired_includes) {
+        next = retired_includes->next;
+        free_include(retired_includes);
+        retired_includes = next;
+    }
+    pthread_mutex_unlock(&include_cache_lock);
+}
 
-                /* Replace the macro with its lines */
-                for (i = 0; i < macro->line_count; i++) {
-                    fprintf(output, "%s\n", macro->lines[i]);
-                }
+/* Collect the macros defined by a definitions file */
+bool collect_macro_definitions(const char *path, macro_table_t *table, error_context_t *context) {
+    include_file_t *header;
+    struct stat info;
+    char saved_filename[MAX_FILENAME_LENGTH];
+    int saved_line = 0;
+    bool success = true;
+    int i;
+
+    /* The table borrows the macros, so the header is held until clear_include_cache */
+    header = get_include(path, &info, context);
+    if (!header) {
+        return false;
+    }
+
+    if (context) {
+        strcpy(saved_filename, context->filename);
+        saved_line = context->line_number;
+        strcpy(context->filename, header->path);
+    }
 
-                /* Increment usage count */
-                macro->usage_count++;
+    for (i = 0; i < header->item_count; i++) {
+        const include_item_t *item = &header->items[i];
 
-                write_line = false;
-            }
+        if (context) {
+            context->line_number = item->line_number;
         }
-        /* Inside a macro definition */
-        else if (macro_nesting_level > 0) {
-            /* Add the line to the current macro */
-            if (!add_line_to_macro(macro_table, line, context)) {
+
+        switch (item->kind) {
+            case INCLUDE_ITEM_LINE:
+                report_context_error(context, "Only macro definitions may appear in a macro library source");
                 success = false;
-                continue;
-            }
+                break;
+            case INCLUDE_ITEM_MACRO:
+                if (!borrow_macro(table, item->macro, context)) {
+                    success = false;
+                }
+                break;
+            case INCLUDE_ITEM_INCLUDE:
+                if (!collect_macro_definitions(item->text, table, context)) {
+                    success = false;
+                }
+                break;
+        }
+    }
+
+    if (context) {
+        strcpy(context->filename, saved_filename);
+        context->line_number = saved_line;
+    }
+
+    return success;
+}
+
+/* Process a source file to expand macros */
+bool process_file(const char *filename, const macro_library_t *library, macro_table_t *macros,
+                  expanded_source_t *expanded, bool write_output, error_context_t *context) {
+    FILE *source;
+    char base_filename[MAX_FILENAME_LENGTH];
+    char source_filename[MAX_FILENAME_LENGTH];
+    char output_filename[MAX_FILENAME_LENGTH];
+    char line[MAX_LINE_LENGTH];
+    pre_assembler_state_t state;
+    int line_number = 0;
+
+    reset_expanded_source(expanded);
+    reset_macro_table(macros);
+
+    /* Initialize error context */
+    if (context) {
+        strncpy(context->filename, filename, MAX_FILENAME_LENGTH - 1);
+        context->filename[MAX_FILENAME_LENGTH - 1] = '\0';
+    }
+
+    /* Get the base filename */
+    get_base_filename(filename, base_filename);
+
+    /* Create source and output filenames */
+    create_filename(base_filename, EXT_SOURCE, source_filename);
+    create_filename(base_filename, EXT_MACRO, output_filename);
+
+    /* Open the source file */
+    source = fopen(source_filename, "r");
+    if (!source) {
+        report_context_error(context, "Could not open source file: %s", source_filename);
+        return false;
+    }
+
+    init_state(&state, library, macros, expanded, context);
+
+    /* Process the file line by line */
+    while (fgets(line, MAX_LINE_LENGTH, source)) {
+        expand_line(&state, line, ++line_number, source_filename);
+    }
+
+    finish_expansion(&state);
+
+    /* The .am file is written even when expansion failed, to show how far it got */
+    if (write_output && !write_expanded_source(expanded, output_filename, context)) {
+        state.success = false;
+    }
 
-            write_line = false;
+    fclose(source);
+
+    return state.success;
+}
+
+/* Expand the macros of a source file whose contents were already read */
+bool process_loaded_file(const char *filename, const char *text, size_t length, const macro_library_t *library,
+                         macro_table_t *macros, expanded_source_t *expanded, bool write_output,
+                         error_context_t *context) {
+    char base_filename[MAX_FILENAME_LENGTH];
+    char source_filename[MAX_FILENAME_LENGTH];
+    char output_filename[MAX_FILENAME_LENGTH];
+    pre_assembler_state_t state;
+
+    reset_expanded_source(expanded);
+    reset_macro_table(macros);
+
+    if (context) {
+        strncpy(context->filename, filename, MAX_FILENAME_LENGTH - 1);
+        context->filename[MAX_FILENAME_LENGTH - 1] = '\0';
+    }
+
+    /* The same names process_file uses, for .include paths and the .am */
+    get_base_filename(filename, base_filename);
+    create_filename(base_filename, EXT_SOURCE, source_filename);
+    create_filename(base_filename, EXT_MACRO, output_filename);
+
+    init_state(&state, library, macros, expanded, context);
+    expand_text(&state, text, length, source_filename);
+    finish_expansion(&state);
+
+    if (write_output && !write_expanded_source(expanded, output_filename, context)) {
+        state.success = false;
+    }
+
+    return state.success;
+}
+
+/* Expand the macros of a source held in memory */
+bool process_source_text(const char *text, size_t length, const macro_library_t *library, macro_table_t *macros,
+                         expanded_source_t *expanded, error_context_t *context) {
+    pre_assembler_state_t state;
+
+    reset_expanded_source(expanded);
+    reset_macro_table(macros);
+    init_state(&state, library, macros, expanded, context);
+    expand_text(&state, text, length, NULL);
+    finish_expansion(&state);
+
+    return state.success;
+}
+
+/* Helper function to expand a buffer, split into lines the way fgets splits a file */
+static void expand_text(pre_assembler_state_t *state, const char *text, size_t length, const char *path) {
+    char line[MAX_LINE_LENGTH];
+    const char *end = text + length;
+    int line_number = 0;
+    size_t count;
+
+    while (text < end) {
+        count = 0;
+        while (text < end && count < MAX_LINE_LENGTH - 1) {
+            line[count] = *text++;
+            if (line[count++] == '\n') {
+                break;
+            }
         }
+        line[count] = '\0';
+        expand_line(state, line, ++line_number, path);
+    }
+}
 
-        /* Write the line to the output file if needed */
-        if (write_line) {
-            fprintf(output, "%s\n", line);
+/* Helper function to start a pre-assembler run */
+static void init_state(pre_assembler_state_t *state, const macro_library_t *library, macro_table_t *macros,
+                       expanded_source_t *expanded, error_context_t *context) {
+    memset(state, 0, sizeof(pre_assembler_state_t));
+    state->source = expanded;
+    state->macros = macros;
+    state->library = library;
+    state->context = context;
+    state->success = true;
+}
+
+/* Helper function to expand the next line of the source; path is NULL for a source in memory */
+static void expand_line(pre_assembler_state_t *state, char *line, int line_number, const char *path) {
+    size_t length = strlen(line);
+
+    if (state->context) {
+        state->context->line_number = line_number;
+    }
+
+    /* Remove newline character */
+    if (length > 0 && line[length - 1] == '\n') {
+        line[length - 1] = '\0';
+    }
+
+    process_source_line(state, line, path);
+}
+
+/* Helper function to finish a pre-assembler run once every line was expanded */
+static void finish_expansion(pre_assembler_state_t *state) {
+    expanded_source_t *expanded = state->source;
+    error_context_t *context = state->context;
+    macro_t *current;
+    int first, count, i;
+
+    /* A label of an empty macro on the last line ends the file without a newline */
+    if (state->pending[0]) {
+        first = add_source_templates(expanded, state->pending, strlen(state->pending), &count);
+        if (first < 0 || !add_source_span(expanded, first, count)) {
+            report_context_error(context, "Memory allocation error");
+            state->success = false;
+        } else {
+            expanded->templates[first + count - 1].joined = true;
         }
     }
 
     /* Check if we ended with an open macro definition */
-    if (macro_nesting_level > 0) {
+    if (state->nesting_level > 0) {
         report_context_error(context, "Macro definition not closed");
-        success = false;
+        state->success = false;
     }
 
-    /* Print warning for unused macros */
-    if (success) {
-        macro_t *current = macro_table->head;
-        while (current) {
-            if (current->usage_count == 0) {
-                fprintf(stderr, "Warning: Macro '%s' defined but never used\n", current->name);
+    /* Print warning for unused macros (headers may define more than a file uses) */
+    if (state->success) {
+        if (context) {
+            context->line_number = 0;
+        }
+        for (current = state->macros->head; current; current = current->next) {
+            if (current->usage_count == 0 && !current->borrowed) {
+                report_context_warning(context, "Macro '%s' defined but never used", current->name);
             }
-            current = current->next;
         }
     }
 
-    /* Clean up */
-    free_macro_table(macro_table);
-    fclose(source);
-    fclose(output);
-
-    return success;
-}
\ No newline at end of file
+    /* The macros stay in the table until its next reset */
+    for (i = 0; i < state->included_count; i++) {
+        release_include(state->included[i].header);
+    }
+    free(state->included);
+    free(state->library_expansions);
+    state->included = NULL;
+    state->library_expansions = NULL;
+}
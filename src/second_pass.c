@@ -3,20 +3,32 @@
  * @brief Implementation of the second pass of the assembler
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../include/second_pass.h"
 #include "../include/utils.h"
 #include "../include/machine_word.h"
+#include "../include/expanded_source.h"
+
+#define CODE_IMAGE_WORDS (MEMORY_START + 1000)  /* Words first allocated for the code image */
 
 /* Forward declarations for internal functions */
-static bool encode_data_image(machine_word_t **data_image, int *DCF, const char *filename, error_context_t *context);
+static bool encode_data_image(machine_word_t **data_image, int *DCF, const char *filename,
+                              expanded_source_t *source, error_context_t *context);
 static opcode_t get_opcode(const char *opcode_str);
 static funct_t get_funct(const char *opcode_str);
 static bool is_two_operand_instruction(opcode_t opcode);
-static char *safe_strtok_r(char *str, const char *delim, char **saveptr);
-static int parse_numbers_list(const char *str, int numbers[], int max_count, error_context_t *context);
+static int parse_numbers_list(const char *str, machine_word_t words[], int max_count, error_context_t *context);
+static bool encode_incbin(const incbin_range_t *range, machine_word_t *words, error_context_t *context);
+static bool reserve_code_words(machine_word_t **code_image, int *capacity, int words, error_context_t *context);
+static void fill_words(machine_word_t *words, int count, machine_word_t word);
 
 /* Determine the addressing method for an operand */
 addressing_method_t get_addressing_method(const char *operand) {
@@ -47,11 +59,12 @@ addressing_method_t get_addressing_method(const char *operand) {
 bool encode_operand_word(machine_word_t *word, const char *operand,
                         addressing_method_t addr_method,
                         symbol_table_t *symbols, int current_address,
-                        int word_offset, external_reference_t **ext_refs,
+                        int word_offset, external_table_t *ext_refs,
                         error_context_t *context) {
     symbol_t *symbol;
     int value, address, target_dist;
     char symbol_name[MAX_LABEL_LENGTH];
+    const char *end;
 
     /* Validate parameters */
     if (!word || !operand) {
@@ -62,11 +75,20 @@ bool encode_operand_word(machine_word_t *word, const char *operand,
     switch (addr_method) {
         case ADDR_IMMEDIATE:
             /* Skip the '#' character and convert to integer */
-            if (!is_integer(operand + 1)) {
-                report_context_error(context, "Invalid immediate value: %s", operand);
-                return false;
+            switch (parse_word_number(operand + 1, operand + strlen(operand), &end, &value)) {
+                case NUMBER_OK:
+                    if (*end == '\0') {
+                        break;
+                    }
+                    /* A comma inside the operand */
+                    /* fall through */
+                case NUMBER_INVALID:
+                    report_context_error(context, "Invalid immediate value: %s", operand);
+                    return false;
+                case NUMBER_OUT_OF_RANGE:
+                    report_context_error(context, "Immediate value out of 21-bit range: %s", operand);
+                    return false;
             }
-            value = string_to_int(operand + 1);
             *word = encode_immediate(value);
             break;
 
@@ -126,7 +148,7 @@ bool encode_operand_word(machine_word_t *word, const char *operand,
 /* Encode a machine instruction */
 bool encode_instruction(parsed_line_t *line, symbol_table_t *symbols,
                        instruction_code_t *code, int current_address,
-                       external_reference_t **ext_refs, error_context_t *context) {
+                       external_table_t *ext_refs, error_context_t *context) {
     const char *opcode = line->opcode;
     const char *operand1 = line->operand_count > 0 ? line->operands[0] : NULL;
     const char *operand2 = line->operand_count > 1 ? line->operands[1] : NULL;
@@ -255,108 +277,41 @@ bool process_entry_second_pass(parsed_line_t *line, symbol_table_t *symbols, err
     return true;
 }
 
-/* Add an external reference */
-bool add_external_reference(external_reference_t **ext_refs, const char *name, int address, error_context_t *context) {
-    external_reference_t *new_ref, *current;
-
-    /* Validate parameters */
-    if (!ext_refs || !name) {
-        report_context_error(context, "Invalid parameters for add_external_reference");
-        return false;
-    }
-
-    /* Allocate memory for the new reference */
-    new_ref = (external_reference_t *)malloc(sizeof(external_reference_t));
-    if (!new_ref) {
-        report_context_error(context, "Memory allocation error for external reference");
-        return false;
-    }
-
-    /* Initialize the reference */
-    strncpy(new_ref->name, name, MAX_LABEL_LENGTH - 1);
-    new_ref->name[MAX_LABEL_LENGTH - 1] = '\0';
-    new_ref->address = address;
-    new_ref->next = NULL;
-
-    /* Add to the linked list */
-    if (!*ext_refs) {
-        *ext_refs = new_ref;
-    } else {
-        current = *ext_refs;
-        while (current->next) {
-            current = current->next;
-        }
-        current->next = new_ref;
-    }
-
-    return true;
-}
-
-/* Free the list of external references */
-void free_external_references(external_reference_t *ext_refs) {
-    external_reference_t *current, *next;
-
-    current = ext_refs;
-    while (current) {
-        next = current->next;
-        free(current);
-        current = next;
-    }
-}
-
 /* Main function for the second pass */
-bool second_pass(const char *filename, symbol_table_t *symbols,
+bool second_pass(const char *filename, expanded_source_t *source, symbol_table_t *symbols,
                 machine_word_t **code_image, machine_word_t **data_image,
-                external_reference_t **ext_refs, int *ICF, int *DCF,
+                external_table_t *ext_refs, int *ICF, int *DCF,
                 error_context_t *context) {
-    FILE *file;
-    char base_filename[MAX_FILENAME_LENGTH];
-    char am_filename[MAX_FILENAME_LENGTH];
-    char line_buf[MAX_LINE_LENGTH];
+    source_cursor_t cursor;
+    source_template_t *line;
     parsed_line_t parsed_line;
-    int IC = 0, DC = 0;
-    int line_number = 0;
+    int IC = 0, DC = 0, incbin = 0;
+    int code_capacity = 0;
     bool success = true;
     instruction_code_t code;
+    int fill_count, fill_value;
+    machine_word_t *data;
 
     /* Initialize/update error context */
-    if (context) {
+    if (context && filename) {
         strncpy(context->filename, filename, MAX_FILENAME_LENGTH - 1);
         context->filename[MAX_FILENAME_LENGTH - 1] = '\0';
         context->line_number = 0;
     }
 
-    /* Build the .am filename */
-    get_base_filename(filename, base_filename);
-    create_filename(base_filename, EXT_MACRO, am_filename);
+    /* Empty the external reference table */
+    reset_external_table(ext_refs);
 
-    /* Open the file */
-    file = fopen(am_filename, "r");
-    if (!file) {
-        report_context_error(context, "Could not open file: %s", am_filename);
+    /* Allocate memory for code image, or clear the one left by an earlier file (a check builds none) */
+    if (code_image && !reserve_code_words(code_image, &code_capacity, CODE_IMAGE_WORDS, context)) {
         return false;
     }
 
-    /* Allocate memory for code image */
-    *code_image = (machine_word_t *)calloc(MEMORY_START + 1000, sizeof(machine_word_t));
-    if (!*code_image) {
-        report_context_error(context, "Memory allocation error for code image");
-        fclose(file);
-        return false;
-    }
-
-    /* Initialize external references list */
-    *ext_refs = NULL;
-
-    /* Second pass through the file */
-    while (fgets(line_buf, MAX_LINE_LENGTH, file)) {
-        line_number++;
-        if (context) {
-            context->line_number = line_number;
-        }
-
-        /* Parse the line */
-        if (!parse_line(line_buf, &parsed_line, line_number, context)) {
+    /* Second pass through the expanded source */
+    init_source_cursor(&cursor);
+    while ((line = next_source_line(source, &cursor)) != NULL) {
+        /* Parse the line (reuses the first pass's parse) */
+        if (!parse_source_line(line, cursor.line_number, &parsed_line, context)) {
             success = false;
             continue;
         }
@@ -370,9 +325,25 @@ bool second_pass(const char *filename, symbol_table_t *symbols,
         switch (parsed_line.type) {
                     case INST_TYPE_DATA:
                     case INST_TYPE_STRING:
+                    case INST_TYPE_INCBIN:
+                    case INST_TYPE_FILL:
                         /* Data and string directives don't need processing in second pass */
                         if (parsed_line.type == INST_TYPE_DATA) {
                             DC += parse_numbers_list(parsed_line.operands[0], NULL, 0, context);
+                        } else if (parsed_line.type == INST_TYPE_FILL) {
+                            if (parse_fill_directive(&parsed_line, &fill_count, &fill_value, context)) {
+                                DC += fill_count;
+                            } else {
+                                success = false;
+                            }
+                        } else if (parsed_line.type == INST_TYPE_INCBIN) {
+                            /* The size the first pass placed the data labels with */
+                            if (incbin < source->incbin_count) {
+                                DC += (int)source->incbin_sizes[incbin++];
+                            } else {
+                                report_context_error(context, "No first pass size for .incbin directive");
+                                success = false;
+                            }
                         } else {
                             /* String: -2 for quotes, +1 for null terminator */
                             DC += strlen(parsed_line.operands[0]) - 2 + 1;
@@ -395,9 +366,16 @@ bool second_pass(const char *filename, symbol_table_t *symbols,
                     continue;
                 }
 
-                /* Copy the encoded instruction to the code image */
-                memcpy(*code_image + MEMORY_START + IC, code.words,
-                       code.word_count * sizeof(machine_word_t));
+                /* Copy the encoded instruction to the code image, growing it like the data image */
+                if (code_image) {
+                    if (!reserve_code_words(code_image, &code_capacity, MEMORY_START + IC + code.word_count,
+                                            context)) {
+                        free_external_table(ext_refs);
+                        return false;
+                    }
+                    memcpy(*code_image + MEMORY_START + IC, code.words,
+                           code.word_count * sizeof(machine_word_t));
+                }
 
                 /* Update instruction counter */
                 IC += code.word_count;
@@ -411,27 +389,25 @@ bool second_pass(const char *filename, symbol_table_t *symbols,
     }
 
     /* Encode the data image */
-    if (success) {
-        /* Allocate memory for data image */
-        *data_image = (machine_word_t *)calloc(DC + 1, sizeof(machine_word_t));
-        if (!*data_image) {
+    if (success && code_image) {
+        /* Allocate memory for data image, resizing the one left by an earlier file */
+        data = (machine_word_t *)realloc(*data_image, (DC + 1) * sizeof(machine_word_t));
+        if (!data) {
             report_context_error(context, "Memory allocation error for data image");
-            fclose(file);
             free(*code_image);
             *code_image = NULL;
-            free_external_references(*ext_refs);
-            *ext_refs = NULL;
+            free_external_table(ext_refs);
             return false;
         }
+        memset(data, 0, (DC + 1) * sizeof(machine_word_t));
+        *data_image = data;
 
         /* Encode the data */
-        if (!encode_data_image(data_image, &DC, am_filename, context)) {
+        if (!encode_data_image(data_image, &DC, filename, source, context)) {
             success = false;
         }
     }
 
-    fclose(file);
-
     /* Set final counters */
     *ICF = IC;
     *DCF = DC;
@@ -440,33 +416,22 @@ bool second_pass(const char *filename, symbol_table_t *symbols,
 }
 
 /* Helper function to encode data image */
-static bool encode_data_image(machine_word_t **data_image, int *DCF, const char *filename, error_context_t *context) {
-    FILE *file;
-    char line_buf[MAX_LINE_LENGTH];
+static bool encode_data_image(machine_word_t **data_image, int *DCF, const char *filename,
+                              expanded_source_t *source, error_context_t *context) {
+    source_cursor_t cursor;
+    source_template_t *line;
     parsed_line_t parsed_line;
-    int line_number = 0;
-    int DC = 0;
+    int DC = 0, incbin = 0;
     int i, count;
-    int numbers[MAX_LINE_LENGTH];
     const char *str;
     int len;
+    incbin_range_t range;
 
-    /* Open the file */
-    file = fopen(filename, "r");
-    if (!file) {
-        report_context_error(context, "Could not open file: %s", filename);
-        return false;
-    }
-
-    /* Process the file */
-    while (fgets(line_buf, MAX_LINE_LENGTH, file)) {
-        line_number++;
-        if (context) {
-            context->line_number = line_number;
-        }
-
+    /* Process the expanded source */
+    init_source_cursor(&cursor);
+    while ((line = next_source_line(source, &cursor)) != NULL) {
         /* Parse the line */
-        if (!parse_line(line_buf, &parsed_line, line_number, context)) {
+        if (!parse_source_line(line, cursor.line_number, &parsed_line, context)) {
             continue;
         }
 
@@ -478,15 +443,30 @@ static bool encode_data_image(machine_word_t **data_image, int *DCF, const char
         /* Process data and string directives */
         if (parsed_line.type == INST_TYPE_DATA) {
             /* Parse the data values */
-            count = parse_numbers_list(parsed_line.operands[0], numbers, MAX_LINE_LENGTH, context);
+            count = parse_numbers_list(parsed_line.operands[0], *data_image + DC, 0, context);
             if (count > 0) {
-                /* Encode the data values */
-                for (i = 0; i < count; i++) {
-                    (*data_image)[DC].value = numbers[i];
-                    (*data_image)[DC].are = ARE_ABSOLUTE;
-                    DC++;
-                }
+                DC += count;
+            }
+        }
+        else if (parsed_line.type == INST_TYPE_FILL) {
+            /* Repeat one word without a word per line of text */
+            if (!parse_fill_directive(&parsed_line, &count, &i, context)) {
+                return false;
             }
+            fill_words(*data_image + DC, count, WORD_MAKE(i, ARE_ABSOLUTE));
+            DC += count;
+        }
+        else if (parsed_line.type == INST_TYPE_INCBIN) {
+            /* One word per byte of the file, read through a mapping; the image was sized with the
+             * length of the first pass, which a file grown since then does not change */
+            if (!resolve_incbin(&parsed_line, filename, &range, context)) {
+                return false;
+            }
+            range.length = source->incbin_sizes[incbin++];
+            if (!encode_incbin(&range, *data_image + DC, context)) {
+                return false;
+            }
+            DC += (int)range.length;
         }
         else if (parsed_line.type == INST_TYPE_STRING) {
             /* Get the string operand */
@@ -501,27 +481,109 @@ static bool encode_data_image(machine_word_t **data_image, int *DCF, const char
 
                 /* Encode each character */
                 for (i = 0; i < len; i++) {
-                    (*data_image)[DC].value = str[i];
-                    (*data_image)[DC].are = ARE_ABSOLUTE;
+                    (*data_image)[DC] = WORD_MAKE(str[i], ARE_ABSOLUTE);
                     DC++;
                 }
 
                 /* Add null terminator */
-                (*data_image)[DC].value = 0;
-                (*data_image)[DC].are = ARE_ABSOLUTE;
+                (*data_image)[DC] = WORD_MAKE(0, ARE_ABSOLUTE);
                 DC++;
             }
         }
     }
 
-    fclose(file);
-
     /* Set final data counter */
     *DCF = DC;
 
     return true;
 }
 
+/* Helper function to convert the bytes of a .incbin range into data words */
+static bool encode_incbin(const incbin_range_t *range, machine_word_t *words, error_context_t *context) {
+    struct stat info;
+    const unsigned char *bytes;
+    void *map;
+    long page, skip, i;
+    int fd;
+
+    if (range->length == 0) {
+        return true;
+    }
+
+    fd = open(range->path, O_RDONLY);
+    if (fd < 0) {
+        report_context_error(context, "Could not open file: %s", range->path);
+        return false;
+    }
+
+    /* The file may have shrunk since the first pass sized the data image */
+    if (fstat(fd, &info) != 0 || (long)info.st_size < range->offset + range->length) {
+        report_context_error(context, "File is shorter than when the first pass read it: %s", range->path);
+        close(fd);
+        return false;
+    }
+
+    /* Map from the page holding the first byte */
+    page = sysconf(_SC_PAGESIZE);
+    skip = page > 0 ? range->offset % page : 0;
+    map = mmap(NULL, (size_t)(range->length + skip), PROT_READ, MAP_PRIVATE, fd, (off_t)(range->offset - skip));
+    close(fd);
+    if (map == MAP_FAILED) {
+        report_context_error(context, "Could not map file: %s", range->path);
+        return false;
+    }
+
+    bytes = (const unsigned char *)map + skip;
+    for (i = 0; i < range->length; i++) {
+        words[i] = WORD_MAKE(bytes[i], ARE_ABSOLUTE);
+    }
+
+    munmap(map, (size_t)(range->length + skip));
+    return true;
+}
+
+/* Helper function to make room for a number of words in the code image, doubling its capacity; new words are
+ * zeroed, and so is the whole image on the first call of a pass (capacity 0) */
+static bool reserve_code_words(machine_word_t **code_image, int *capacity, int words, error_context_t *context) {
+    machine_word_t *image;
+    int grown = *capacity;
+
+    if (words <= *capacity) {
+        return true;
+    }
+
+    while (grown < words) {
+        grown = grown ? grown * 2 : words;
+    }
+    image = (machine_word_t *)realloc(*code_image, grown * sizeof(machine_word_t));
+    if (!image) {
+        report_context_error(context, "Memory allocation error for code image");
+        free(*code_image);
+        *code_image = NULL;
+        return false;
+    }
+    memset(image + *capacity, 0, (grown - *capacity) * sizeof(machine_word_t));
+    *code_image = image;
+    *capacity = grown;
+
+    return true;
+}
+
+/* Helper function to set count words to one value, doubling the filled part with each copy */
+static void fill_words(machine_word_t *words, int count, machine_word_t word) {
+    int filled;
+
+    if (count <= 0) {
+        return;
+    }
+
+    words[0] = word;
+    for (filled = 1; filled < count; filled *= 2) {
+        memcpy(words + filled, words, (size_t)(filled < count - filled ? filled : count - filled) *
+               sizeof(machine_word_t));
+    }
+}
+
 /* Helper function to get the opcode value */
 static opcode_t get_opcode(const char *opcode_str) {
     if (!opcode_str) {
@@ -607,42 +669,11 @@ static bool is_two_operand_instruction(opcode_t opcode) {
            opcode == OP_ADD || opcode == OP_LEA;
 }
 
-/* Safe implementation of strtok_r for C90 compatibility */
-static char *safe_strtok_r(char *str, const char *delim, char **saveptr) {
-    char *token;
-
-    if (str == NULL) {
-        str = *saveptr;
-    }
-
-    /* Skip leading delimiters */
-    str += strspn(str, delim);
-    if (*str == '\0') {
-        *saveptr = str;
-        return NULL;
-    }
-
-    /* Find the end of the token */
-    token = str;
-    str = strpbrk(str, delim);
-    if (str == NULL) {
-        /* This token finishes the string */
-        *saveptr = strchr(token, '\0');
-    } else {
-        /* Terminate the token and make saveptr point to the rest of the string */
-        *str = '\0';
-        *saveptr = str + 1;
-    }
-
-    return token;
-}
-
-/* Helper function to parse a list of comma-separated numbers */
-static int parse_numbers_list(const char *str, int numbers[], int max_count, error_context_t *context) {
-    char str_copy[MAX_LINE_LENGTH];
-    char *token;
-    char *saveptr = NULL;
+/* Helper function to parse a list of comma-separated numbers in one scan */
+static int parse_numbers_list(const char *str, machine_word_t words[], int max_count, error_context_t *context) {
+    const char *end, *item, *next;
     int count = 0;
+    int value = 0;
 
     /* Check for NULL pointer */
     if (!str) {
@@ -650,39 +681,28 @@ static int parse_numbers_list(const char *str, int numbers[], int max_count, err
         return 0;
     }
 
-    /* Copy the string for tokenization */
-    strncpy(str_copy, str, MAX_LINE_LENGTH - 1);
-    str_copy[MAX_LINE_LENGTH - 1] = '\0';
-
-    /* Get the first token */
-    token = safe_strtok_r(str_copy, ",", &saveptr);
-
-    /* Parse each token */
-    while (token && (max_count == 0 || count < max_count)) {
-        /* Trim whitespace */
-        token = trim(token);
+    end = str + strlen(str);
+    for (item = str; ; item = next + 1) {
+        if (!parse_data_item(item, end, &next, &value, context)) {
+            return -1;
+        }
 
-        /* Check if the token is a valid integer */
-        if (!is_integer(token)) {
-            report_context_error(context, "Invalid number format: %s", token);
+        /* Check if we have more numbers than room */
+        if (max_count > 0 && count >= max_count) {
+            report_context_error(context, "Too many numbers in list");
             return -1;
         }
 
-        /* Convert to integer and store */
-        if (numbers) {
-            numbers[count] = string_to_int(token);
+        /* Hand the value straight to the data image */
+        if (words) {
+            words[count] = WORD_MAKE(value, ARE_ABSOLUTE);
         }
         count++;
 
-        /* Get next token */
-        token = safe_strtok_r(NULL, ",", &saveptr);
-    }
-
-    /* Check if we have more tokens (too many numbers) */
-    if (token && max_count > 0 && count >= max_count) {
-        report_context_error(context, "Too many numbers in list");
-        return -1;
+        if (next == end) {
+            break;
+        }
     }
 
     return count;
-}
\ No newline at end of file
+}
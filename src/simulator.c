@@ -0,0 +1,520 @@
+/**
+ * @file simulator.c
+ * @brief Implementation of the instruction-set simulator
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "../include/simulator.h"
+#include "../include/binary_object.h"
+#include "../include/machine_word.h"
+#include "../include/error.h"
+
+/* GCC and Clang dispatch through a table of label addresses; other compilers use a switch */
+#if defined(__GNUC__) && !defined(SIM_SWITCH_DISPATCH)
+#define SIM_THREADED_DISPATCH
+#endif
+
+#define SIM_VALUE_MASK 0x1FFFFFUL  /* 21-bit word value */
+#define SIM_SIGN_BIT 0x100000L     /* Sign bit of a 21-bit value */
+
+/* Wrap an arithmetic result to a signed 21-bit value */
+#define SIM_WRAP(v) ((int32_t)(((uint32_t)(v) & SIM_VALUE_MASK) ^ SIM_SIGN_BIT) - (int32_t)SIM_SIGN_BIT)
+
+/**
+ * @brief Micro-op kinds; lea runs as SIM_MOV with the address as its source constant
+ *
+ * The order must match the dispatch table in run_program.
+ */
+typedef enum {
+    SIM_MOV, SIM_CMP, SIM_ADD, SIM_SUB,
+    SIM_CLR, SIM_NOT, SIM_INC, SIM_DEC,
+    SIM_JMP, SIM_BNE, SIM_JSR,
+    SIM_RED, SIM_PRN, SIM_RTS, SIM_STOP,
+    SIM_INVALID,
+    SIM_KIND_COUNT
+} sim_kind_t;
+
+/**
+ * @brief How an instruction uses an operand
+ */
+typedef enum {
+    SIM_ACCESS_READ,              /* Value is read */
+    SIM_ACCESS_WRITE,             /* Value is written (and possibly read) */
+    SIM_ACCESS_ADDRESS            /* Address itself is the value (lea source, jump targets) */
+} sim_access_t;
+
+/**
+ * @brief Predecoded instruction, one per memory address
+ */
+typedef struct {
+    int32_t *src;                 /* Source operand cell */
+    int32_t *dst;                 /* Destination operand cell (target address for jumps) */
+    int32_t src_value;            /* Constant source operand */
+    int32_t dst_value;            /* Constant destination operand */
+    unsigned char kind;           /* sim_kind_t */
+    unsigned char instruction;    /* instruction_id_t, for the profile */
+    unsigned char length;         /* Words up to the next instruction */
+    unsigned char cycles;         /* Estimated cycles */
+} sim_op_t;
+
+/**
+ * @brief Machine state
+ */
+typedef struct {
+    int32_t regs[SIM_REGISTER_COUNT];
+    int32_t *memory;              /* memory_size cells */
+    sim_op_t *ops;                /* memory_size + 1 micro-ops; the extra one catches running off the end */
+    uint32_t memory_size;
+    uint32_t stack[SIM_STACK_DEPTH];
+    int32_t scratch;              /* Sink for writes to immediate operands */
+    unsigned long *hits;          /* Per-address execution counts (profile only) */
+    error_context_t context;
+} sim_machine_t;
+
+/**
+ * @brief Counters collected by a run
+ */
+typedef struct {
+    unsigned long steps;          /* Instructions executed */
+    unsigned long cycles;         /* Estimated cycles (profile only) */
+} sim_stats_t;
+
+/* Forward declarations for internal functions */
+static bool load_machine(sim_machine_t *machine, const binary_object_t *object, bool profile);
+static void predecode(sim_machine_t *machine, const binary_object_t *object, uint32_t address);
+static int32_t *resolve_operand(sim_machine_t *machine, addressing_method_t mode, int reg,
+                                uint32_t word_address, uint32_t bits, sim_access_t access, int32_t *slot);
+static int is_memory_operand(addressing_method_t mode, sim_access_t access);
+static bool run_program(sim_machine_t *machine, uint32_t start, const sim_options_t *options,
+                        sim_stats_t *stats);
+static void print_profile(const sim_machine_t *machine, const sim_stats_t *stats, double seconds);
+
+/* Load a binary object and run it */
+bool simulate_object(const char *path, const sim_options_t *options) {
+    binary_object_t object;
+    sim_machine_t *machine;
+    sim_stats_t stats;
+    clock_t started;
+    bool success;
+
+    machine = (sim_machine_t *)calloc(1, sizeof(sim_machine_t));
+    if (!machine) {
+        fprintf(stderr, "Memory allocation error for simulator\n");
+        return false;
+    }
+    init_error_context(&machine->context, path);
+
+    if (!open_binary_object(path, &object, &machine->context)) {
+        free(machine);
+        return false;
+    }
+
+    success = load_machine(machine, &object, options->profile);
+    if (success) {
+        memset(&stats, 0, sizeof(stats));
+        started = clock();
+        success = run_program(machine, object.header->code_start, options, &stats);
+        fflush(stdout);
+
+        if (options->profile) {
+            print_profile(machine, &stats, (double)(clock() - started) / CLOCKS_PER_SEC);
+        }
+    }
+
+    close_binary_object(&object);
+    free(machine->memory);
+    free(machine->ops);
+    free(machine->hits);
+    free(machine);
+
+    return success;
+}
+
+/* Helper function to fill memory and predecode every address */
+static bool load_machine(sim_machine_t *machine, const binary_object_t *object, bool profile) {
+    const binary_object_header_t *header = object->header;
+    uint32_t i;
+
+    if (header->extern_count > 0) {
+        report_context_error(&machine->context, "Object has %lu unresolved external references; link it first",
+                             (unsigned long)header->extern_count);
+        return false;
+    }
+
+    machine->memory_size = header->code_start + header->icf + header->dcf;
+    if (machine->memory_size > SIM_VALUE_MASK) {
+        report_context_error(&machine->context, "Object does not fit in the address space");
+        return false;
+    }
+
+    machine->memory = (int32_t *)calloc(machine->memory_size + 1, sizeof(int32_t));
+    machine->ops = (sim_op_t *)calloc(machine->memory_size + 1, sizeof(sim_op_t));
+    if (profile) {
+        machine->hits = (unsigned long *)calloc(machine->memory_size + 1, sizeof(unsigned long));
+    }
+    if (!machine->memory || !machine->ops || (profile && !machine->hits)) {
+        report_context_error(&machine->context, "Memory allocation error for simulator memory");
+        return false;
+    }
+
+    /* Code first, then data, as laid out by the assembler and the linker */
+    for (i = 0; i < header->icf; i++) {
+        machine->memory[header->code_start + i] =
+            SIM_WRAP(WORD_VALUE(binary_object_code_word(object, (int)i)));
+    }
+    for (i = 0; i < header->dcf; i++) {
+        machine->memory[header->code_start + header->icf + i] =
+            SIM_WRAP(WORD_VALUE(binary_object_data_word(object, (int)i)));
+    }
+
+    for (i = 0; i <= machine->memory_size; i++) {
+        predecode(machine, object, i);
+    }
+
+    return true;
+}
+
+/* Helper function to turn the instruction starting at an address into a micro-op */
+static void predecode(sim_machine_t *machine, const binary_object_t *object, uint32_t address) {
+    static const unsigned char kinds[INSN_COUNT] = {
+        SIM_MOV, SIM_CMP, SIM_ADD, SIM_SUB, SIM_MOV,
+        SIM_CLR, SIM_NOT, SIM_INC, SIM_DEC,
+        SIM_JMP, SIM_BNE, SIM_JSR,
+        SIM_RED, SIM_PRN, SIM_RTS, SIM_STOP
+    };
+    const binary_object_header_t *header = object->header;
+    sim_op_t *op = &machine->ops[address];
+    decoded_instruction_t decoded;
+    sim_access_t src_access = SIM_ACCESS_READ, dst_access = SIM_ACCESS_WRITE;
+    uint32_t index = address - header->code_start;
+    int next = 1;
+
+    op->kind = SIM_INVALID;
+    op->length = 1;
+    op->cycles = 1;
+
+    if (address < header->code_start || index >= header->icf ||
+        !decode_instruction_word(word_from_bits(binary_object_code_word(object, (int)index)), &decoded) ||
+        index + (uint32_t)decoded.length > header->icf) {
+        return;
+    }
+
+    switch (decoded.instruction) {
+        case INSN_LEA:
+            src_access = SIM_ACCESS_ADDRESS;
+            break;
+        case INSN_CMP:
+        case INSN_PRN:
+            dst_access = SIM_ACCESS_READ;
+            break;
+        case INSN_JMP:
+        case INSN_BNE:
+        case INSN_JSR:
+            dst_access = SIM_ACCESS_ADDRESS;
+            break;
+        default:
+            break;
+    }
+
+    /* Operand words follow in source, destination order; two registers share one word */
+    if (decoded.operand_count == 2) {
+        if (decoded.src_addr == ADDR_REGISTER && decoded.dst_addr == ADDR_REGISTER) {
+            next++;
+        }
+        op->src = resolve_operand(machine, decoded.src_addr, decoded.src_reg, address + next,
+                                  decoded.src_addr == ADDR_REGISTER ? 0 :
+                                  binary_object_code_word(object, (int)(index + next)),
+                                  src_access, &op->src_value);
+        if (!op->src) {
+            return;
+        }
+        if (decoded.src_addr != ADDR_REGISTER) {
+            next++;
+        }
+        op->cycles += is_memory_operand(decoded.src_addr, src_access);
+    }
+    if (decoded.operand_count >= 1) {
+        op->dst = resolve_operand(machine, decoded.dst_addr, decoded.dst_reg, address + next,
+                                  decoded.dst_addr == ADDR_REGISTER ? 0 :
+                                  binary_object_code_word(object, (int)(index + next)),
+                                  dst_access, &op->dst_value);
+        if (!op->dst) {
+            return;
+        }
+        op->cycles += is_memory_operand(decoded.dst_addr, dst_access);
+    }
+
+    if (decoded.instruction == INSN_JSR || decoded.instruction == INSN_RTS) {
+        op->cycles++;  /* Stack access */
+    }
+
+    op->kind = kinds[decoded.instruction];
+    op->instruction = (unsigned char)decoded.instruction;
+    op->length = (unsigned char)decoded.length;
+    op->cycles += (unsigned char)(decoded.length - 1);
+}
+
+/* Helper function to resolve an operand to the cell it names, or NULL if it is invalid */
+static int32_t *resolve_operand(sim_machine_t *machine, addressing_method_t mode, int reg,
+                                uint32_t word_address, uint32_t bits, sim_access_t access, int32_t *slot) {
+    uint32_t address;
+
+    switch (mode) {
+        case ADDR_REGISTER:
+            return &machine->regs[reg];
+
+        case ADDR_IMMEDIATE:
+            *slot = SIM_WRAP(WORD_VALUE(bits));
+            return access == SIM_ACCESS_WRITE ? &machine->scratch : slot;
+
+        case ADDR_DIRECT:
+            if (WORD_ARE(bits) == WORD_ARE_EXTERNAL) {
+                return NULL;
+            }
+            address = (uint32_t)WORD_VALUE(bits);
+            break;
+
+        case ADDR_RELATIVE:
+            /* Distances are measured from the operand word */
+            address = word_address + (uint32_t)SIM_WRAP(WORD_VALUE(bits));
+            break;
+
+        default:
+            return NULL;
+    }
+
+    if (access == SIM_ACCESS_ADDRESS) {
+        *slot = (int32_t)address;
+        return slot;
+    }
+
+    return address < machine->memory_size ? &machine->memory[address] : NULL;
+}
+
+/* Helper function to tell whether an operand touches a memory cell */
+static int is_memory_operand(addressing_method_t mode, sim_access_t access) {
+    return (mode == ADDR_DIRECT || mode == ADDR_RELATIVE) && access != SIM_ACCESS_ADDRESS;
+}
+
+#ifdef SIM_THREADED_DISPATCH
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+#define SIM_HANDLER(kind) handle_##kind
+#define SIM_NEXT() do { SIM_ACCOUNT(); goto *dispatch[op->kind]; } while (0)
+#else
+#define SIM_HANDLER(kind) case kind
+#define SIM_NEXT() continue
+#endif
+
+/* Count the instruction about to run; profiling adds hit and cycle counters */
+#define SIM_ACCOUNT() \
+    do { \
+        if (++steps > limit) { \
+            goto step_limit; \
+        } \
+        if (hits) { \
+            hits[op - ops]++; \
+            cycles += op->cycles; \
+        } \
+    } while (0)
+
+/* Transfer control to an address, faulting outside memory */
+#define SIM_JUMP(target) \
+    do { \
+        if ((uint32_t)(target) >= memory_size) { \
+            address = (uint32_t)(target); \
+            goto bad_target; \
+        } \
+        op = ops + (target); \
+    } while (0)
+
+/* Run the predecoded program until stop, a fault or the step limit */
+static bool run_program(sim_machine_t *machine, uint32_t start, const sim_options_t *options,
+                        sim_stats_t *stats) {
+#ifdef SIM_THREADED_DISPATCH
+    static const void *const dispatch[SIM_KIND_COUNT] = {
+        &&handle_SIM_MOV, &&handle_SIM_CMP, &&handle_SIM_ADD, &&handle_SIM_SUB,
+        &&handle_SIM_CLR, &&handle_SIM_NOT, &&handle_SIM_INC, &&handle_SIM_DEC,
+        &&handle_SIM_JMP, &&handle_SIM_BNE, &&handle_SIM_JSR,
+        &&handle_SIM_RED, &&handle_SIM_PRN, &&handle_SIM_RTS, &&handle_SIM_STOP,
+        &&handle_SIM_INVALID
+    };
+#endif
+    sim_op_t *const ops = machine->ops;
+    const sim_op_t *op = ops + start;
+    const uint32_t memory_size = machine->memory_size;
+    unsigned long *const hits = machine->hits;
+    const unsigned long limit = options->max_steps > 0 ? options->max_steps : ULONG_MAX;
+    unsigned long steps = 0, cycles = 0;
+    uint32_t *const stack = machine->stack;
+    int sp = 0;
+    bool zero = false;
+    uint32_t address;
+    int32_t target;
+    long input;
+    bool success = false;
+
+    if (start >= memory_size) {
+        address = start;
+        goto bad_target;
+    }
+
+#ifdef SIM_THREADED_DISPATCH
+    SIM_NEXT();
+#else
+    for (;;) {
+        SIM_ACCOUNT();
+        switch (op->kind) {
+#endif
+
+    SIM_HANDLER(SIM_MOV):
+        *op->dst = *op->src;
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_CMP):
+        zero = SIM_WRAP(*op->src - *op->dst) == 0;
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_ADD):
+        *op->dst = SIM_WRAP(*op->dst + *op->src);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_SUB):
+        *op->dst = SIM_WRAP(*op->dst - *op->src);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_CLR):
+        *op->dst = 0;
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_NOT):
+        *op->dst = SIM_WRAP(~*op->dst);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_INC):
+        *op->dst = SIM_WRAP(*op->dst + 1);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_DEC):
+        *op->dst = SIM_WRAP(*op->dst - 1);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_JMP):
+        target = *op->dst;
+        SIM_JUMP(target);
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_BNE):
+        if (!zero) {
+            target = *op->dst;
+            SIM_JUMP(target);
+        } else {
+            op += op->length;
+        }
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_JSR):
+        if (sp == SIM_STACK_DEPTH) {
+            report_context_error(&machine->context, "Call stack overflow at address %04lu",
+                                 (unsigned long)(op - ops));
+            goto done;
+        }
+        stack[sp++] = (uint32_t)(op - ops) + op->length;
+        target = *op->dst;
+        SIM_JUMP(target);
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_RED):
+        if (scanf("%ld", &input) != 1) {
+            input = 0;
+        }
+        *op->dst = SIM_WRAP(input);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_PRN):
+        printf("%ld\n", (long)*op->dst);
+        op += op->length;
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_RTS):
+        if (sp == 0) {
+            report_context_error(&machine->context, "rts with an empty call stack at address %04lu",
+                                 (unsigned long)(op - ops));
+            goto done;
+        }
+        op = ops + stack[--sp];
+        SIM_NEXT();
+
+    SIM_HANDLER(SIM_STOP):
+        success = true;
+        goto done;
+
+    SIM_HANDLER(SIM_INVALID):
+        report_context_error(&machine->context, "Invalid instruction at address %04lu",
+                             (unsigned long)(op - ops));
+        goto done;
+
+#ifndef SIM_THREADED_DISPATCH
+            default:
+                goto done;
+        }
+    }
+#endif
+
+bad_target:
+    report_context_error(&machine->context, "Jump to address %lu outside memory", (unsigned long)address);
+    goto done;
+
+step_limit:
+    steps--;
+    report_context_error(&machine->context, "Step limit of %lu instructions reached at address %04lu",
+                         limit, (unsigned long)(op - ops));
+
+done:
+    stats->steps = steps;
+    stats->cycles = cycles;
+    return success;
+}
+
+#ifdef SIM_THREADED_DISPATCH
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+/* Helper function to print the execution profile */
+static void print_profile(const sim_machine_t *machine, const sim_stats_t *stats, double seconds) {
+    uint32_t address;
+
+    fprintf(stderr, "Executed %lu instructions (%lu estimated cycles) in %.3f s",
+            stats->steps, stats->cycles, seconds);
+    if (seconds > 0) {
+        fprintf(stderr, ", %.1f M instructions/s", stats->steps / seconds / 1e6);
+    }
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "Address  Instr        Hits       Cycles\n");
+    for (address = 0; address < machine->memory_size; address++) {
+        if (machine->hits[address] > 0) {
+            fprintf(stderr, "%04lu     %-4s %12lu %12lu\n", (unsigned long)address,
+                    machine->ops[address].kind == SIM_INVALID ? "?" :
+                    instruction_name((instruction_id_t)machine->ops[address].instruction),
+                    machine->hits[address], machine->hits[address] * machine->ops[address].cycles);
+        }
+    }
+}
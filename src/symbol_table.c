@@ -11,6 +11,7 @@ symbol_table_t* create_symbol_table() {
     symbol_table_t *table = (symbol_table_t *)malloc(sizeof(symbol_table_t));
     if (table) {
         table->head = NULL;
+        table->spare = NULL;
     }
     return table;
 }
@@ -29,10 +30,15 @@ bool add_symbol(symbol_table_t *table, const char *name, int value, symbol_attr_
         return false;
     }
 
-    /* Create a new symbol */
-    symbol = (symbol_t *)malloc(sizeof(symbol_t));
-    if (!symbol) {
-        return false;
+    /* Reuse an entry left by reset_symbol_table, or create a new symbol */
+    if (table->spare) {
+        symbol = table->spare;
+        table->spare = symbol->next;
+    } else {
+        symbol = (symbol_t *)malloc(sizeof(symbol_t));
+        if (!symbol) {
+            return false;
+        }
     }
 
     /* Initialize the symbol */
@@ -193,6 +199,21 @@ void print_symbol_table(symbol_table_t *table) {
     }
 }
 
+/* Empty the table, keeping its entries for reuse */
+void reset_symbol_table(symbol_table_t *table) {
+    symbol_t *current, *next;
+
+    /* Move every symbol onto the spare list */
+    current = table->head;
+    while (current) {
+        next = current->next;
+        current->next = table->spare;
+        table->spare = current;
+        current = next;
+    }
+    table->head = NULL;
+}
+
 /* Free the symbol table and all its entries */
 void free_symbol_table(symbol_table_t *table) {
     symbol_t *current, *next;
@@ -202,8 +223,9 @@ void free_symbol_table(symbol_table_t *table) {
         return;
     }
 
-    /* Free all symbols */
-    current = table->head;
+    /* Free all symbols, spare ones included */
+    reset_symbol_table(table);
+    current = table->spare;
     while (current) {
         next = current->next;
         free(current);
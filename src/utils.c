@@ -3,13 +3,35 @@
  * @brief Implementation of utility functions for the assembler
  */
 
+#include <stdint.h>
 #include "../include/utils.h"
 
+/* Eight-digit chunks are read as little-endian 64-bit words */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR_NUMBER_PARSING
+#endif
+
+/* A byte value repeated in every byte, and 16/32-bit values repeated in every lane, of a 64-bit word */
+#define SWAR_BYTES(b) ((((uint64_t)0x01010101UL << 32) | 0x01010101UL) * (b))
+#define SWAR_LANES16(v) ((((uint64_t)0x00010001UL << 32) | 0x00010001UL) * (v))
+#define SWAR_LANES32(v) ((((uint64_t)1 << 32) | 1) * (v))
+
+/* Forward declarations for internal functions */
+#ifdef SWAR_NUMBER_PARSING
+static int leading_digit_count(uint64_t chunk);
+static unsigned long swar_digits_value(uint64_t chunk, int run);
+#endif
+
+/* Powers of ten for appending a run of up to eight digits */
+static const unsigned long power_of_ten[9] = {
+    1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL
+};
+
 /* Reserved words - opcodes and directives */
 static const char *reserved_words[] = {
     "mov", "cmp", "add", "sub", "lea", "clr", "not", "inc", "dec",
     "jmp", "bne", "jsr", "red", "prn", "rts", "stop",
-    ".data", ".string", ".entry", ".extern", "mcro", "endmcro", NULL
+    ".data", ".string", ".incbin", ".space", ".fill", ".entry", ".extern", ".include", "mcro", "endmcro", NULL
 };
 
 /* Trim whitespace from beginning and end of string */
@@ -129,6 +151,144 @@ bool is_integer(const char *str) {
     return *endptr == '\0';
 }
 
+/* Parse one signed decimal integer for a 21-bit word, eight digits at a time where possible */
+number_status_t parse_word_number(const char *str, const char *end, const char **next, int *value) {
+    const char *p = str;
+    uint64_t magnitude = 0;
+    bool negative = false, overflow = false;
+    int digits = 0;
+#ifdef SWAR_NUMBER_PARSING
+    uint64_t chunk;
+    int run;
+#endif
+
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+
+#ifdef SWAR_NUMBER_PARSING
+    /* Whole eight-byte chunks: find the digit run, then convert it without a per-digit loop */
+    while (end - p >= 8) {
+        memcpy(&chunk, p, 8);
+        run = leading_digit_count(chunk);
+        if (run > 0) {
+            magnitude = magnitude * power_of_ten[run] + swar_digits_value(chunk, run);
+            digits += run;
+            p += run;
+            if (magnitude > WORD_NUMBER_MAX + 1) {
+                overflow = true;
+                magnitude = 0;
+            }
+        }
+        if (run < 8) {
+            break;
+        }
+    }
+#endif
+
+    /* The bytes left over (all of them without SWAR) */
+    while (p < end && *p >= '0' && *p <= '9') {
+        magnitude = magnitude * 10 + (unsigned long)(*p - '0');
+        digits++;
+        p++;
+        if (magnitude > WORD_NUMBER_MAX + 1) {
+            overflow = true;
+            magnitude = 0;
+        }
+    }
+
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+
+    if (digits == 0 || (p < end && *p != ',')) {
+        while (p < end && *p != ',') {
+            p++;
+        }
+        *next = p;
+        return NUMBER_INVALID;
+    }
+    *next = p;
+
+    if (overflow || magnitude > (uint64_t)(negative ? -WORD_NUMBER_MIN : WORD_NUMBER_MAX)) {
+        return NUMBER_OUT_OF_RANGE;
+    }
+    *value = negative ? -(int)magnitude : (int)magnitude;
+    return NUMBER_OK;
+}
+
+/* Parse one item of a .data list, where an empty item is an error like a malformed one */
+bool parse_data_item(const char *item, const char *end, const char **next, int *value, error_context_t *context) {
+    char token[MAX_LINE_LENGTH];
+    size_t length;
+    number_status_t status = parse_word_number(item, end, next, value);
+
+    if (status == NUMBER_OK) {
+        return true;
+    }
+
+    /* Copy the item only to name it in the error */
+    length = (size_t)(*next - item) < sizeof(token) ? (size_t)(*next - item) : sizeof(token) - 1;
+    memcpy(token, item, length);
+    token[length] = '\0';
+    if (*trim(token) == '\0') {
+        report_context_error(context, "Empty item in data list");
+    } else if (status == NUMBER_OUT_OF_RANGE) {
+        report_context_error(context, "Number out of 21-bit range: %s", trim(token));
+    } else {
+        report_context_error(context, "Invalid number format: %s", trim(token));
+    }
+    return false;
+}
+
+#ifdef SWAR_NUMBER_PARSING
+/* Helper function to count the ASCII digits at the start of an eight-byte little-endian chunk */
+static int leading_digit_count(uint64_t chunk) {
+    uint64_t high, nondigit;
+
+    /* A byte is a digit when its high nibble is 3 both before and after adding 6 */
+    high = chunk & SWAR_BYTES(0xF0);
+    nondigit = (high ^ SWAR_BYTES(0x30)) | (((chunk + SWAR_BYTES(0x06)) & SWAR_BYTES(0xF0)) ^ SWAR_BYTES(0x30));
+
+    /* Set the top bit of every non-zero byte, then find the lowest one */
+    nondigit = (((nondigit & SWAR_BYTES(0x7F)) + SWAR_BYTES(0x7F)) | nondigit) & SWAR_BYTES(0x80);
+    if (nondigit == 0) {
+        return 8;
+    }
+#ifdef __GNUC__
+    return __builtin_ctzll(nondigit) / 8;
+#else
+    {
+        int count = 0;
+        while (!(nondigit & 0x80)) {
+            nondigit >>= 8;
+            count++;
+        }
+        return count;
+    }
+#endif
+}
+
+/* Helper function to convert the first run (1-8) ASCII digits of a chunk with three multiply steps */
+static unsigned long swar_digits_value(uint64_t chunk, int run) {
+    /* Drop the bytes after the run and move the digits up so zeros lead */
+    chunk -= SWAR_BYTES(0x30);
+    if (run < 8) {
+        chunk <<= 8 * (8 - run);
+    }
+
+    /* Pairs of digits, then groups of four, then all eight */
+    chunk = (chunk * 10 + (chunk >> 8)) & SWAR_LANES16(0x00FF);
+    chunk = (chunk * 100 + (chunk >> 16)) & SWAR_LANES32(0x0000FFFF);
+    chunk = (chunk * 10000 + (chunk >> 32)) & 0xFFFFFFFFUL;
+    return (unsigned long)chunk;
+}
+#endif /* SWAR_NUMBER_PARSING */
+
 /* Convert string to integer */
 int string_to_int(const char *str) {
     return (int)strtol(str, NULL, 10);
@@ -149,6 +309,17 @@ char* str_duplicate(const char *str) {
     return result;
 }
 
+/* Hash a string (djb2) */
+unsigned long hash_string(const char *str) {
+    unsigned long hash = 5381;
+
+    while (*str) {
+        hash = hash * 33 + (unsigned char)*str++;
+    }
+
+    return hash;
+}
+
 /* Check if string is a reserved word */
 bool is_reserved_word(const char *str) {
     int i;
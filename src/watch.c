@@ -0,0 +1,496 @@
+/**
+ * @file watch.c
+ * @brief Implementation of watch mode
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/watch.h"
+#include "../include/first_pass.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+/* inotify is Linux only; elsewhere --watch reports that it is unavailable */
+#if defined(__linux__)
+#define WATCH_HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#define WATCH_EVENT_BUFFER 8192       /* Bytes of inotify events read at a time */
+#define WATCH_HASH_SEED 2166136261UL  /* FNV-1a offset basis */
+
+/**
+ * @brief A file read by the last assembly of a module (.include or .incbin)
+ */
+typedef struct {
+    char path[MAX_FILENAME_LENGTH];
+    int wd;                       /* Watch of the file's directory (-1 if it could not be watched) */
+    size_t name;                  /* Offset of the name within that directory in path */
+} watched_dependency_t;
+
+/**
+ * @brief A source file of the watched directory
+ */
+typedef struct {
+    char path[MAX_FILENAME_LENGTH];
+    unsigned long hash;           /* Hash of the contents last assembled, and of those of its dependencies */
+    size_t length;                /* Length of the contents last assembled */
+    bool assembled;               /* The last contents assembled without errors */
+    bool dirty;                   /* Changed since it was last assembled */
+    watched_dependency_t *dependencies; /* Files its last assembly read */
+    int dependency_count;
+} watched_module_t;
+
+/**
+ * @brief The source files of the watched directory, sorted by path
+ */
+typedef struct {
+    watched_module_t *modules;
+    int count;
+    int capacity;
+    int fd;                       /* inotify instance, also watching the directories of dependencies */
+    int wd;                       /* Watch of the directory itself */
+} module_list_t;
+
+#ifdef WATCH_HAVE_INOTIFY
+/* Forward declarations for internal functions */
+static bool scan_directory(const char *directory, module_list_t *list, error_context_t *context);
+static bool handle_events(const char *directory, const char *events, size_t length, module_list_t *list,
+                          error_context_t *context);
+static void assemble_changed(module_list_t *list, assembler_context_t *ctx, const assembler_options_t *options);
+static void mark_dependents(module_list_t *list, int wd, const char *name);
+static unsigned long hash_dependencies(const watched_module_t *module, unsigned long hash);
+static unsigned long hash_dependency_paths(const watched_module_t *module);
+static void record_dependencies(module_list_t *list, watched_module_t *module, const expanded_source_t *source);
+static void add_dependency(module_list_t *list, watched_module_t *module, const char *path);
+static void free_modules(module_list_t *list);
+static watched_module_t *find_module(module_list_t *list, const char *path, bool add);
+static void forget_module(module_list_t *list, const char *path);
+static bool source_path(const char *directory, const char *name, char *path);
+static char *read_module(const char *path, size_t *length, error_context_t *context);
+static unsigned long hash_contents(unsigned long hash, const char *text, size_t length);
+static int compare_modules(const void *a, const void *b);
+
+/* Assemble the sources of a directory and again whenever they change */
+bool watch_directory(const char *directory, assembler_context_t *ctx, const assembler_options_t *options) {
+    union {
+        struct inotify_event event;   /* Aligns the buffer for the events */
+        char bytes[WATCH_EVENT_BUFFER];
+    } buffer;
+    module_list_t list;
+    error_context_t context;
+    struct pollfd poller;
+    bool watching = true;
+    ssize_t count;
+    int fd;
+
+    init_error_context(&context, directory);
+    memset(&list, 0, sizeof(list));
+
+    /* The watch starts before the scan, so no change falls between them */
+    fd = inotify_init();
+    list.fd = fd;
+    if (fd < 0 || (list.wd = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                                              IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)) < 0) {
+        report_context_error(&context, "Could not watch directory: %s", directory);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    if (!scan_directory(directory, &list, &context)) {
+        close(fd);
+        free_modules(&list);
+        return false;
+    }
+
+    printf("Watching %s\n", directory);
+    assemble_changed(&list, ctx, options);
+
+    poller.fd = fd;
+    poller.events = POLLIN;
+    while (watching) {
+        count = read(fd, buffer.bytes, sizeof(buffer.bytes));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            report_context_error(&context, "Could not read events for directory: %s", directory);
+            break;
+        }
+        watching = handle_events(directory, buffer.bytes, (size_t)count, &list, &context);
+
+        /* A burst ends once no event arrives for WATCH_DEBOUNCE_MS */
+        while (watching && poll(&poller, 1, WATCH_DEBOUNCE_MS) > 0) {
+            count = read(fd, buffer.bytes, sizeof(buffer.bytes));
+            if (count <= 0) {
+                break;
+            }
+            watching = handle_events(directory, buffer.bytes, (size_t)count, &list, &context);
+        }
+
+        assemble_changed(&list, ctx, options);
+    }
+
+    printf("Stopped watching %s\n", directory);
+    close(fd);
+    free_modules(&list);
+    return true;
+}
+
+/* Helper function to add every source file of the directory, marked to be assembled */
+static bool scan_directory(const char *directory, module_list_t *list, error_context_t *context) {
+    char path[MAX_FILENAME_LENGTH];
+    struct dirent *entry;
+    struct stat info;
+    DIR *dir;
+
+    dir = opendir(directory);
+    if (!dir) {
+        report_context_error(context, "Could not open directory: %s", directory);
+        return false;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (source_path(directory, entry->d_name, path) && stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+            find_module(list, path, true);
+        }
+    }
+    closedir(dir);
+
+    return true;
+}
+
+/* Helper function to mark the files named by a batch of events (false once the directory is gone) */
+static bool handle_events(const char *directory, const char *events, size_t length, module_list_t *list,
+                          error_context_t *context) {
+    const struct inotify_event *event;
+    char path[MAX_FILENAME_LENGTH];
+    watched_module_t *module;
+    size_t offset;
+    bool watching = true;
+    int i;
+
+    for (offset = 0; offset + sizeof(struct inotify_event) <= length;
+         offset += sizeof(struct inotify_event) + event->len) {
+        event = (const struct inotify_event *)(events + offset);
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            /* Events were lost, so every file may have changed */
+            for (i = 0; i < list->count; i++) {
+                list->modules[i].dirty = true;
+            }
+            scan_directory(directory, list, context);
+        } else if (event->wd != list->wd) {
+            /* A directory holding dependencies only; its removal ends nothing */
+            if (event->len > 0) {
+                mark_dependents(list, event->wd, event->name);
+            }
+        } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+            watching = false;
+        } else if (event->len > 0) {
+            mark_dependents(list, event->wd, event->name);
+            if (!source_path(directory, event->name, path)) {
+                continue;
+            }
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                forget_module(list, path);
+            } else if ((module = find_module(list, path, true)) != NULL) {
+                module->dirty = true;
+            }
+        }
+    }
+
+    return watching;
+}
+
+/* Helper function to assemble the files marked since the last round, skipping unchanged contents */
+static void assemble_changed(module_list_t *list, assembler_context_t *ctx, const assembler_options_t *options) {
+    watched_module_t *module;
+    error_context_t context;
+    unsigned long hash, files;
+    size_t length;
+    char *text;
+    int i;
+
+    for (i = 0; i < list->count; i++) {
+        module = &list->modules[i];
+        if (!module->dirty) {
+            continue;
+        }
+        module->dirty = false;
+
+        init_error_context(&context, module->path);
+        text = read_module(module->path, &length, &context);
+        if (!text) {
+            continue;
+        }
+
+        /* Saving a file without changing it or the files it reads assembles nothing */
+        hash = hash_dependencies(module, hash_contents(WATCH_HASH_SEED, text, length));
+        if (module->assembled && module->hash == hash && module->length == length) {
+            printf("Skipping unchanged %s\n", module->path);
+        } else {
+            /* The hash is of the files as they were before the assembly read them; only a file read for the
+             * first time is hashed after it */
+            files = hash_dependency_paths(module);
+            module->assembled = assemble_loaded_file(ctx, module->path, text, length, options);
+            record_dependencies(list, module, &ctx->source);
+            if (hash_dependency_paths(module) != files) {
+                hash = hash_dependencies(module, hash_contents(WATCH_HASH_SEED, text, length));
+            }
+            module->hash = hash;
+            module->length = length;
+        }
+        free(text);
+    }
+
+    /* Outputs written behind are complete before the next round */
+    if (options->io) {
+        drain_async_io(options->io);
+    }
+    fflush(stdout);
+    fflush(stderr);
+}
+
+/* Helper function to mark the modules whose last assembly read a file named by an event */
+static void mark_dependents(module_list_t *list, int wd, const char *name) {
+    watched_dependency_t *dependency;
+    int i, k;
+
+    for (i = 0; i < list->count; i++) {
+        for (k = 0; k < list->modules[i].dependency_count; k++) {
+            dependency = &list->modules[i].dependencies[k];
+            if (dependency->wd == wd && strcmp(dependency->path + dependency->name, name) == 0) {
+                list->modules[i].dirty = true;
+                break;
+            }
+        }
+    }
+}
+
+/* Helper function to add the contents of a module's dependencies to its hash (a missing file counts too) */
+static unsigned long hash_dependencies(const watched_module_t *module, unsigned long hash) {
+    char *text;
+    size_t length;
+    int i;
+
+    for (i = 0; i < module->dependency_count; i++) {
+        hash = hash_contents(hash, module->dependencies[i].path, strlen(module->dependencies[i].path) + 1);
+        text = read_module(module->dependencies[i].path, &length, NULL);
+        if (text) {
+            hash = hash_contents(hash, text, length);
+            free(text);
+        }
+    }
+
+    return hash;
+}
+
+/* Helper function to hash the paths of a module's dependencies, which tells whether the set changed */
+static unsigned long hash_dependency_paths(const watched_module_t *module) {
+    unsigned long hash = WATCH_HASH_SEED;
+    int i;
+
+    for (i = 0; i < module->dependency_count; i++) {
+        hash = hash_contents(hash, module->dependencies[i].path, strlen(module->dependencies[i].path) + 1);
+    }
+
+    return hash;
+}
+
+/* Helper function to keep the headers and .incbin files the last assembly of a module read */
+static void record_dependencies(module_list_t *list, watched_module_t *module, const expanded_source_t *source) {
+    const source_template_t *line;
+    incbin_range_t range;
+    int i;
+
+    module->dependency_count = 0;
+    for (i = 0; i < source->header_count; i++) {
+        add_dependency(list, module, source->headers[i]);
+    }
+
+    /* A .incbin line names its file whether or not the passes got to it */
+    for (i = 0; i < source->template_count; i++) {
+        line = &source->templates[i];
+        if (line->is_parsed && line->parsed.type == INST_TYPE_INCBIN) {
+            range.path[0] = '\0';
+            resolve_incbin(&line->parsed, module->path, &range, NULL);
+            if (range.path[0]) {
+                add_dependency(list, module, range.path);
+            }
+        }
+    }
+}
+
+/* Helper function to add one dependency of a module, watching its directory */
+static void add_dependency(module_list_t *list, watched_module_t *module, const char *path) {
+    watched_dependency_t *dependencies, *dependency;
+    const char *slash;
+    int i;
+
+    for (i = 0; i < module->dependency_count; i++) {
+        if (strcmp(module->dependencies[i].path, path) == 0) {
+            return;
+        }
+    }
+
+    /* Grown one at a time; a module reads few files */
+    dependencies = (watched_dependency_t *)realloc(module->dependencies,
+                                                   (module->dependency_count + 1) * sizeof(watched_dependency_t));
+    if (!dependencies) {
+        return;
+    }
+    module->dependencies = dependencies;
+    dependency = &dependencies[module->dependency_count++];
+    strcpy(dependency->path, path);
+
+    /* The same directory under another name gets the same watch, so events are matched by watch and name */
+    slash = strrchr(path, '/');
+    if (slash) {
+        dependency->name = (size_t)(slash - path) + 1;
+        dependency->path[slash - path] = '\0';
+        dependency->wd = inotify_add_watch(list->fd, slash == path ? "/" : dependency->path,
+                                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_MASK_ADD);
+        dependency->path[slash - path] = '/';
+    } else {
+        dependency->name = 0;
+        dependency->wd = inotify_add_watch(list->fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                                          IN_DELETE | IN_MASK_ADD);
+    }
+}
+
+/* Helper function to release the list of files */
+static void free_modules(module_list_t *list) {
+    int i;
+
+    for (i = 0; i < list->count; i++) {
+        free(list->modules[i].dependencies);
+    }
+    free(list->modules);
+}
+
+/* Helper function to find a file in the list, adding it if asked (NULL if absent or out of memory) */
+static watched_module_t *find_module(module_list_t *list, const char *path, bool add) {
+    watched_module_t key, *module, *modules;
+    int capacity;
+
+    strcpy(key.path, path);
+    module = list->count > 0 ? (watched_module_t *)bsearch(&key, list->modules, list->count,
+                                                           sizeof(watched_module_t), compare_modules) : NULL;
+    if (module || !add) {
+        return module;
+    }
+
+    if (list->count == list->capacity) {
+        capacity = list->capacity ? list->capacity * 2 : 64;
+        modules = (watched_module_t *)realloc(list->modules, capacity * sizeof(watched_module_t));
+        if (!modules) {
+            return NULL;
+        }
+        list->modules = modules;
+        list->capacity = capacity;
+    }
+
+    module = &list->modules[list->count++];
+    memset(module, 0, sizeof(watched_module_t));
+    strcpy(module->path, path);
+    module->dirty = true;
+    qsort(list->modules, list->count, sizeof(watched_module_t), compare_modules);
+
+    return (watched_module_t *)bsearch(&key, list->modules, list->count, sizeof(watched_module_t),
+                                       compare_modules);
+}
+
+/* Helper function to drop a file that was deleted or moved away */
+static void forget_module(module_list_t *list, const char *path) {
+    watched_module_t *module = find_module(list, path, false);
+
+    if (module) {
+        free(module->dependencies);
+        memmove(module, module + 1, (list->modules + list->count - module - 1) * sizeof(watched_module_t));
+        list->count--;
+    }
+}
+
+/* Helper function to build the path of a directory entry if it names a source file */
+static bool source_path(const char *directory, const char *name, char *path) {
+    size_t name_length = strlen(name);
+    size_t ext_length = strlen(EXT_SOURCE);
+
+    if (name_length <= ext_length || strcmp(name + name_length - ext_length, EXT_SOURCE) != 0 ||
+        strlen(directory) + 1 + name_length >= MAX_FILENAME_LENGTH) {
+        return false;
+    }
+
+    sprintf(path, "%s/%s", directory, name);
+    return true;
+}
+
+/* Helper function to read a whole source file */
+static char *read_module(const char *path, size_t *length, error_context_t *context) {
+    FILE *file;
+    char *text = NULL;
+    long size;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        report_context_error(context, "Could not open source file: %s", path);
+        return NULL;
+    }
+
+    if (fseek(file, 0L, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0L, SEEK_SET) == 0) {
+        text = (char *)malloc((size_t)size + 1);
+        if (text && fread(text, 1, (size_t)size, file) != (size_t)size) {
+            free(text);
+            text = NULL;
+        }
+        *length = (size_t)size;
+    }
+    fclose(file);
+
+    if (!text) {
+        report_context_error(context, "Could not read source file: %s", path);
+    }
+    return text;
+}
+
+/* Helper function to continue a hash over file contents (FNV-1a) */
+static unsigned long hash_contents(unsigned long hash, const char *text, size_t length) {
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+/* Helper function to order files by path */
+static int compare_modules(const void *a, const void *b) {
+    return strcmp(((const watched_module_t *)a)->path, ((const watched_module_t *)b)->path);
+}
+
+#else
+
+/* Assemble the sources of a directory and again whenever they change */
+bool watch_directory(const char *directory, assembler_context_t *ctx, const assembler_options_t *options) {
+    error_context_t context;
+
+    (void)ctx;
+    (void)options;
+    init_error_context(&context, directory);
+    report_context_error(&context, "--watch needs inotify, which this system does not provide");
+    return false;
+}
+
+#endif
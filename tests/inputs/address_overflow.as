@@ -0,0 +1,6 @@
+; Data past the 21-bit address space
+MAIN:   prn LAST
+        stop
+HUGE:   .space 1048575
+MORE:   .space 1048575
+LAST:   .data 7
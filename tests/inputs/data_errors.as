@@ -0,0 +1,6 @@
+; Empty items in .data lists
+MAIN:   prn GAP
+        stop
+GAP:    .data 1,,2
+TRAIL:  .data 3,
+LEAD:   .data , 4
@@ -0,0 +1,12 @@
+; Reserved and repeated data words
+MAIN:   prn ZEROS
+        prn SEVENS
+        prn LAST
+        prn AFTER
+        stop
+ZEROS:  .space 3
+SEVENS: .fill 4, -7
+        .fill 2,5
+LAST:   .fill 1, 9
+        .space 0
+AFTER:  .data 42
@@ -0,0 +1,16 @@
+; Only some tables are used
+MAIN:   lea USED, r1
+        prn USED
+        prn &TAIL
+        jmp SKIP
+        prn UNREACH
+SKIP:   stop
+UNUSED: .data 1, 2, 3
+        .data 4
+USED:   .data 7, 8
+        .string "xy"
+ERRMSG: .string "never printed"
+UNREACH: .data 9
+TAIL:   .data -5
+EXPORT: .data 11
+.entry EXPORT
@@ -0,0 +1,8 @@
+; Binary files included as data, one word per byte
+MAIN:   prn BLOB
+        prn PART
+        prn TAIL
+        stop
+BLOB:   .incbin "incbin.bin"
+PART:   .incbin "incbin.bin", 1, 2
+TAIL:   .incbin "incbin.bin" , 4, 1
@@ -0,0 +1,6 @@
+; Ranges .incbin does not accept
+MAIN:   prn NONE
+        prn SIZE
+        stop
+NONE:   .incbin "incbin.bin", 2, 0
+SIZE:   .incbin "incbin.bin", 3
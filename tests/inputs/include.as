@@ -0,0 +1,9 @@
+; Headers expand once, even when included again directly or nested
+.include "include/io.inc"
+.include "include/regs.inc"
+.include "include/io.inc"
+
+MAIN:   load_pair
+        add r1, r2
+        print_pair
+        stop
@@ -0,0 +1,11 @@
+; A branch the optimizer retargets without removing any code
+MAIN:   clr r1
+        jsr SUB
+        cmp r1, #2
+        bne &HOP
+        prn #1
+HOP:    jmp END
+SUB:    inc r1
+        rts
+END:    prn r1
+        stop
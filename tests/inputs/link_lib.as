@@ -0,0 +1,6 @@
+PRINTIT: prn r1
+         inc COUNT
+         rts
+COUNT: .data 7
+.entry PRINTIT
+.entry COUNT
@@ -0,0 +1,11 @@
+.extern PRINTIT
+.extern COUNT
+MAIN: mov COUNT, r1
+      jsr PRINTIT
+      prn COUNT
+      lea MSG, r2
+      prn r2
+      jmp &END
+END:  stop
+MSG: .string "hi"
+.entry MAIN
@@ -0,0 +1,7 @@
+; CNT is exported, so --pool-data must not give FIVE its word
+SHOW:   prn FIVE
+        rts
+CNT:    .data 5
+FIVE:   .data 5
+.entry SHOW
+.entry CNT
@@ -0,0 +1,7 @@
+; Writes a data block of link_pool_lib through its .entry label
+.extern SHOW
+.extern CNT
+MAIN:   inc CNT
+        jsr SHOW
+        prn CNT
+        stop
@@ -0,0 +1,79 @@
+; More than 1000 code words: the code image grows past its first allocation
+mcro add40
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+        inc r1
+mcroend
+
+MAIN:   clr r1
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        add40
+        prn r1
+        prn LAST
+        stop
+LAST:   .data 77
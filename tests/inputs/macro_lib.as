@@ -0,0 +1,10 @@
+; Macros come from the library unless defined locally
+mcro show_sum
+    prn r2
+    prn #1
+mcroend
+
+MAIN:   load_pair
+        sum_pair
+        show_sum
+        stop
@@ -0,0 +1,22 @@
+; Repeated instruction sequences for the outliner
+MAIN:   mov #3, r1
+        add r1, r2
+        prn r2
+        mov TOTAL, r3
+        add r2, r3
+        mov r3, TOTAL
+        mov #4, r1
+        add r1, r2
+        prn r2
+        mov TOTAL, r3
+        add r2, r3
+        mov r3, TOTAL
+        mov #5, r1
+        add r1, r2
+        prn r2
+        mov TOTAL, r3
+        add r2, r3
+        mov r3, TOTAL
+        prn TOTAL
+        stop
+TOTAL:  .data 0
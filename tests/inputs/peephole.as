@@ -0,0 +1,21 @@
+; Peephole candidates
+MAIN:   mov #0, r1
+        mov #10, r2
+LOOP:   add #1, r1
+        sub #1, r2
+        cmp r2, #0
+        bne &TRAMP
+        jmp NEXT
+NEXT:   jmp DONE
+        prn r1
+        prn #99
+TRAMP:  jmp HOP
+HOP:    jmp &LOOP
+DONE:   mov #0, COUNT
+        add #1, COUNT
+        prn r1
+        prn COUNT
+        jmp FIN
+FIN:    stop
+        stop
+COUNT:  .data 5
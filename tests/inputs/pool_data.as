@@ -0,0 +1,19 @@
+; Repeated tables and strings
+MAIN:   prn MSG1
+        prn MSG2
+        prn TAIL
+        prn TAB2
+        lea TAB2, r1
+        prn r1
+        lea TAIL, r2
+        prn r2
+        prn EMPTY
+        stop
+MSG1:   .string "error"
+TAB1:   .data 1, 2, 3
+MSG2:   .string "error"
+TAIL:   .string "ror"
+TAB2:   .data 1, 2, 3
+EMPTY:  .string ""
+OTHER:  .data 3
+.entry OTHER
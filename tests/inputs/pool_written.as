@@ -0,0 +1,12 @@
+; Blocks the code writes to keep their own words under --pool-data
+MAIN:   inc A
+        prn A
+        prn B
+        dec D
+        prn C
+        prn D
+        stop
+A:      .data 5
+B:      .data 5
+C:      .data 9
+D:      .data 9
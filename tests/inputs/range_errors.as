@@ -0,0 +1,6 @@
+; Numbers outside the 21-bit word range
+MAIN:   mov #1048576, r1        ; Largest immediate is 1048575
+        prn #-1048577           ; Smallest immediate is -1048576
+        stop
+OK:     .data -1048576, 1048575
+BIG:    .data 1, 2097152, 3
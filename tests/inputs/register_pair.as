@@ -0,0 +1,12 @@
+; Two register operands take the instruction word and one shared register word
+MAIN:   mov #3, r1
+        mov r1, r2
+        add r2, r1
+        cmp r1, r2
+        bne &DONE
+        prn #0
+DONE:   prn r1
+        lea NEXT, r3
+        prn r3
+        stop
+NEXT:   .data 0
@@ -0,0 +1,19 @@
+; Sum 1..10 with a subroutine, a register pair and a relative branch
+MAIN:   clr r1
+        mov #10, r2
+LOOP:   jsr ADDIT
+        dec r2
+        cmp r2, #0
+        bne &LOOP
+        mov r1, RESULT
+        prn RESULT
+        lea VALS, r3
+        prn r3
+        mov VALS, r4
+        add #-3, r4
+        prn r4
+        stop
+ADDIT:  add r2, r1
+        rts
+RESULT: .data 0
+VALS:   .data 42, -1
@@ -0,0 +1,177 @@
+/**
+ * @file lib_test.c
+ * @brief Drives libassembler.a for the test suite
+ *
+ * Usage: lib_test file.as [threads]
+ *
+ * The file is read into memory and assembled by every thread with its own
+ * context, several times over. A successful result is printed in the format
+ * of the .ob, .ent and .ext files (in that order); a failed one prints its
+ * diagnostics as "line N: message". The exit status is non-zero when the
+ * source does not assemble or the threads disagree.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/libassembler.h"
+
+#define MAX_THREADS 16
+#define RUNS_PER_THREAD 20
+
+typedef struct {
+    const char *source;
+    size_t length;
+    unsigned long checksum;       /* Of the last result */
+    bool success;
+    bool consistent;              /* Every run gave the same checksum */
+} worker_t;
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Helper function to fold a result into a number that changes with any of its contents */
+static unsigned long checksum_result(const asm_result_t *result) {
+    unsigned long sum = (unsigned long)result->success;
+    const char *name;
+    int i;
+
+    for (i = 0; i < result->code_size; i++) {
+        sum = sum * 31 + result->code[i];
+    }
+    for (i = 0; i < result->data_size; i++) {
+        sum = sum * 31 + result->data[i];
+    }
+    for (i = 0; i < result->entry_count + result->extern_count; i++) {
+        const asm_symbol_t *symbol = i < result->entry_count ? &result->entries[i]
+                                                             : &result->externs[i - result->entry_count];
+        for (name = symbol->name; *name; name++) {
+            sum = sum * 31 + (unsigned char)*name;
+        }
+        sum = sum * 31 + (unsigned long)symbol->address;
+    }
+    for (i = 0; i < result->diagnostic_count; i++) {
+        sum = sum * 31 + (unsigned long)result->diagnostics[i].line_number;
+        for (name = result->diagnostics[i].message; *name; name++) {
+            sum = sum * 31 + (unsigned char)*name;
+        }
+    }
+    return sum;
+}
+
+/* Helper function to assemble the source repeatedly with one context */
+static void *run_worker(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    asm_context_t *ctx;
+    asm_result_t result;
+    unsigned long checksum;
+    int run;
+
+    worker->consistent = false;
+    ctx = asm_create_context(NULL);
+    if (!ctx) {
+        return NULL;
+    }
+
+    worker->consistent = true;
+    for (run = 0; run < RUNS_PER_THREAD; run++) {
+        worker->success = asm_assemble(ctx, worker->source, worker->length, &result);
+        checksum = checksum_result(&result);
+        if (run > 0 && checksum != worker->checksum) {
+            worker->consistent = false;
+        }
+        worker->checksum = checksum;
+    }
+
+    asm_destroy_context(ctx);
+    return NULL;
+}
+
+/* Helper function to print a result like the .ob, .ent and .ext files */
+static void print_result(const asm_result_t *result) {
+    int i;
+    machine_word_t word;
+
+    if (!result->success) {
+        for (i = 0; i < result->diagnostic_count; i++) {
+            printf("line %d: %s%s\n", result->diagnostics[i].line_number,
+                   result->diagnostics[i].severity == DIAGNOSTIC_WARNING ? "warning: " : "",
+                   result->diagnostics[i].message);
+        }
+        return;
+    }
+
+    printf("%d %d\n", result->code_size, result->data_size);
+    for (i = 0; i < result->code_size + result->data_size; i++) {
+        word = i < result->code_size ? result->code[i] : result->data[i - result->code_size];
+        printf("%04d %c%c\n", result->code_start + i, base64_chars[(word >> 12) & 0x3F],
+               base64_chars[(word >> 6) & 0x3F]);
+    }
+    for (i = 0; i < result->entry_count; i++) {
+        printf("%s %04d\n", result->entries[i].name, result->entries[i].address);
+    }
+    for (i = 0; i < result->extern_count; i++) {
+        printf("%s %04d\n", result->externs[i].name, result->externs[i].address);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    worker_t workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    asm_context_t *ctx;
+    asm_result_t result;
+    char *source;
+    long length;
+    FILE *file;
+    int count = 1, i;
+    bool success = true;
+
+    if (argc < 2 || argc > 3 || (argc == 3 && (count = atoi(argv[2])) < 1) || count > MAX_THREADS) {
+        fprintf(stderr, "Usage: lib_test file.as [threads]\n");
+        return 2;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (!file || fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0) {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 2;
+    }
+    rewind(file);
+    source = (char *)malloc((size_t)length + 1);
+    if (!source || fread(source, 1, (size_t)length, file) != (size_t)length) {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 2;
+    }
+    fclose(file);
+
+    /* Concurrent contexts must all agree */
+    for (i = 0; i < count; i++) {
+        workers[i].source = source;
+        workers[i].length = (size_t)length;
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+        if (!workers[i].consistent || workers[i].checksum != workers[0].checksum) {
+            fprintf(stderr, "Thread %d gave a different result\n", i);
+            success = false;
+        }
+    }
+
+    ctx = asm_create_context(NULL);
+    if (!ctx) {
+        fprintf(stderr, "Could not create a context\n");
+        return 2;
+    }
+    if (!asm_assemble(ctx, source, (size_t)length, &result)) {
+        success = false;
+    }
+    print_result(&result);
+
+    asm_destroy_context(ctx);
+    free(source);
+
+    return success ? 0 : 1;
+}
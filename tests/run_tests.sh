@@ -78,6 +78,579 @@ run_test() {
     echo "------------------------"
 }
 
+# Function to check that a binary object converts back to the text outputs
+run_format_test() {
+    local test_file=$1
+    local format=$2
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_base="$OUTPUT_DIR/${test_file}"
+    local ext
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as with --format=${format}${NC}"
+
+    if $ASSEMBLER --format=$format "$input_path" > /dev/null 2> "${output_base}_${format}.err" &&
+       $ASSEMBLER convert "${input_path%.as}.tpo" "${output_base}_${format}" > /dev/null 2>> "${output_base}_${format}.err"; then
+        rm -f "${input_path%.as}.tpo" "${input_path%.as}.am"
+        for ext in ob ent ext; do
+            if [ -f "${output_base}.${ext}" ] && ! cmp -s "${output_base}.${ext}" "${output_base}_${format}.${ext}"; then
+                echo -e "${RED}✗ Converted .${ext} differs from the text output${NC}"
+                echo -e "${RED}Result: FAIL${NC}"
+                ((FAIL_COUNT++))
+                echo "------------------------"
+                return
+            fi
+        done
+        echo -e "${GREEN}✓ Binary object converts back to identical text output${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Assembler failed${NC}"
+        cat "${output_base}_${format}.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+run_link_test() {
+    local output_base="$OUTPUT_DIR/linked"
+    local module
+
+    echo -e "\n${YELLOW}Testing: link of link_main.as and link_lib.as${NC}"
+
+    if $ASSEMBLER --format=bin "$INPUT_DIR/link_main.as" "$INPUT_DIR/link_lib.as" > /dev/null 2> "${output_base}.err" &&
+       $ASSEMBLER link -o "${output_base}.tpo" "$INPUT_DIR/link_main.tpo" "$INPUT_DIR/link_lib.tpo" > /dev/null 2>> "${output_base}.err" &&
+       $ASSEMBLER convert "${output_base}.tpo" "$output_base" > /dev/null 2>> "${output_base}.err"; then
+        for module in link_main link_lib; do
+            rm -f "$INPUT_DIR/${module}.tpo" "$INPUT_DIR/${module}.am"
+        done
+        # COUNT read through the patched reference, after PRINTIT incremented it, then the relocated MSG
+        $ASSEMBLER sim "${output_base}.tpo" > "${output_base}.out" 2>> "${output_base}.err"
+        if [ -f "${output_base}.ext" ]; then
+            echo -e "${RED}✗ Linked object still has unresolved references${NC}"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((FAIL_COUNT++))
+        elif [ "$(tr '\n' ' ' < "${output_base}.out")" != "7 8 116 " ] ||
+             ! grep -q "^PRINTIT 0112$" "${output_base}.ent" || ! grep -q "^COUNT 0119$" "${output_base}.ent"; then
+            echo -e "${RED}✗ Linked image runs with wrong addresses: '$(tr '\n' ' ' < "${output_base}.out")'${NC}"
+            cat "${output_base}.ent"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((FAIL_COUNT++))
+        else
+            echo -e "${GREEN}✓ All external references resolved and relocated${NC}"
+            echo -e "${GREEN}Result: PASS${NC}"
+            ((PASS_COUNT++))
+        fi
+    else
+        echo -e "${RED}✗ Link failed${NC}"
+        cat "${output_base}.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to check that modules linked after an optimization still run as written
+run_link_sim_test() {
+    local main=$1
+    local lib=$2
+    local expected=$3
+    local flags=$4
+    local output_base="$OUTPUT_DIR/${main}_linked"
+    local actual
+
+    echo -e "\n${YELLOW}Testing: link of ${main}.as and ${lib}.as in the simulator ${flags}${NC}"
+
+    if $ASSEMBLER --format=bin $flags "$INPUT_DIR/${main}.as" "$INPUT_DIR/${lib}.as" > /dev/null 2> "${output_base}.err" &&
+       $ASSEMBLER link -o "${output_base}.tpo" "$INPUT_DIR/${main}.tpo" "$INPUT_DIR/${lib}.tpo" > /dev/null 2>> "${output_base}.err" &&
+       $ASSEMBLER sim --max-steps=100000 "${output_base}.tpo" > "${output_base}.out" 2>> "${output_base}.err"; then
+        actual="$(tr '\n' ' ' < "${output_base}.out")"
+        if [ "$actual" = "$expected" ]; then
+            echo -e "${GREEN}✓ Program output matches${NC}"
+            echo -e "${GREEN}Result: PASS${NC}"
+            ((PASS_COUNT++))
+        else
+            echo -e "${RED}✗ Expected '$expected', got '$actual'${NC}"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((FAIL_COUNT++))
+        fi
+    else
+        echo -e "${RED}✗ Assembly, link or simulation failed${NC}"
+        cat "${output_base}.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    rm -f "$INPUT_DIR/${main}.tpo" "$INPUT_DIR/${main}.am" "$INPUT_DIR/${lib}.tpo" "$INPUT_DIR/${lib}.am"
+    echo "------------------------"
+}
+
+# Function to check that a file list assembles like separate runs
+run_batch_test() {
+    local list_option=$1
+    local io_option=$2
+    local list="$OUTPUT_DIR/batch.lst"
+    local test_file ext
+
+    echo -e "\n${YELLOW}Testing: batch assembly with ${list_option}${io_option:+ $io_option}${NC}"
+
+    for test_file in macro directives comprehensive nested_macros; do
+        echo "$INPUT_DIR/${test_file}.as"
+    done > "$list"
+
+    if [ "$list_option" = "--files-from=-" ]; then
+        $ASSEMBLER $io_option --files-from=- < "$list" > /dev/null 2> "$OUTPUT_DIR/batch.err"
+    else
+        $ASSEMBLER $io_option "@$list" > /dev/null 2> "$OUTPUT_DIR/batch.err"
+    fi
+
+    if [ $? -ne 0 ]; then
+        echo -e "${RED}✗ Batch assembly failed${NC}"
+        cat "$OUTPUT_DIR/batch.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+        echo "------------------------"
+        return
+    fi
+
+    for test_file in macro directives comprehensive nested_macros; do
+        for ext in ob ent ext am; do
+            if [ -f "$OUTPUT_DIR/${test_file}.${ext}" ] &&
+               ! cmp -s "$OUTPUT_DIR/${test_file}.${ext}" "$INPUT_DIR/${test_file}.${ext}"; then
+                echo -e "${RED}✗ ${test_file}.${ext} differs from the single-file output${NC}"
+                echo -e "${RED}Result: FAIL${NC}"
+                ((FAIL_COUNT++))
+                echo "------------------------"
+                return
+            fi
+            rm -f "$INPUT_DIR/${test_file}.${ext}"
+        done
+    done
+
+    echo -e "${GREEN}✓ Batch outputs match the single-file outputs${NC}"
+    echo -e "${GREEN}Result: PASS${NC}"
+    ((PASS_COUNT++))
+    echo "------------------------"
+}
+
+# Function to check that an output archive holds the single-file outputs
+run_archive_test() {
+    local archive="$OUTPUT_DIR/batch.tpa"
+    local extracted="$OUTPUT_DIR/archive"
+    local test_file ext
+
+    echo -e "\n${YELLOW}Testing: batch assembly with --archive${NC}"
+
+    rm -rf "$extracted"
+    if ! $ASSEMBLER --archive "$archive" "$INPUT_DIR/macro.as" "$INPUT_DIR/directives.as" \
+             "$INPUT_DIR/comprehensive.as" "$INPUT_DIR/nested_macros.as" > /dev/null 2> "$OUTPUT_DIR/archive.err" ||
+       ! $ASSEMBLER extract -C "$extracted" "$archive" 2>> "$OUTPUT_DIR/archive.err"; then
+        echo -e "${RED}✗ Archive assembly or extraction failed${NC}"
+        cat "$OUTPUT_DIR/archive.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+        echo "------------------------"
+        return
+    fi
+
+    for test_file in macro directives comprehensive nested_macros; do
+        for ext in ob ent ext am; do
+            # Nothing is written next to the sources, and the archive holds the same outputs
+            if [ -f "$INPUT_DIR/${test_file}.${ext}" ] ||
+               { [ -f "$OUTPUT_DIR/${test_file}.${ext}" ] || [ -f "$extracted/$INPUT_DIR/${test_file}.${ext}" ]; } &&
+               ! cmp -s "$OUTPUT_DIR/${test_file}.${ext}" "$extracted/$INPUT_DIR/${test_file}.${ext}"; then
+                echo -e "${RED}✗ ${test_file}.${ext} differs from the single-file output${NC}"
+                echo -e "${RED}Result: FAIL${NC}"
+                ((FAIL_COUNT++))
+                echo "------------------------"
+                return
+            fi
+        done
+    done
+
+    # A single module is found through the index
+    if ! $ASSEMBLER extract -l "$archive" "$INPUT_DIR/directives.as" | grep -q "^$INPUT_DIR/directives \.am:"; then
+        echo -e "${RED}✗ Module lookup in the archive failed${NC}"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+        echo "------------------------"
+        return
+    fi
+
+    # An absolute source path is stored relative, so extraction stays under -C
+    rm -rf "$OUTPUT_DIR/absolute"
+    if ! $ASSEMBLER --archive "$OUTPUT_DIR/absolute.tpa" "$PWD/$INPUT_DIR/basic.as" > /dev/null 2>> "$OUTPUT_DIR/archive.err" ||
+       ! $ASSEMBLER extract -C "$OUTPUT_DIR/absolute" "$OUTPUT_DIR/absolute.tpa" 2>> "$OUTPUT_DIR/archive.err" ||
+       [ ! -f "$OUTPUT_DIR/absolute$PWD/$INPUT_DIR/basic.am" ] || [ -f "$INPUT_DIR/basic.am" ]; then
+        echo -e "${RED}✗ Absolute module path escaped the extraction directory${NC}"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+        echo "------------------------"
+        return
+    fi
+
+    # Two sources whose paths resolve to one module name are refused rather than sharing its record
+    if $ASSEMBLER --archive "$OUTPUT_DIR/duplicate.tpa" "$INPUT_DIR/basic.as" "$OUTPUT_DIR/../$INPUT_DIR/basic.as" \
+           > /dev/null 2> "$OUTPUT_DIR/duplicate.err" ||
+       ! grep -q "Module $INPUT_DIR/basic is already in the archive" "$OUTPUT_DIR/duplicate.err"; then
+        echo -e "${RED}✗ Colliding module names were not reported${NC}"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+        echo "------------------------"
+        return
+    fi
+
+    echo -e "${GREEN}✓ Archived outputs match the single-file outputs${NC}"
+    echo -e "${GREEN}Result: PASS${NC}"
+    ((PASS_COUNT++))
+    echo "------------------------"
+}
+
+# Function to check that an error test reported each given message
+run_error_message_test() {
+    local test_file=$1
+    local err_file="$OUTPUT_DIR/${test_file}.err"
+    local message
+    shift
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as error messages${NC}"
+
+    for message in "$@"; do
+        if ! grep -qF "$message" "$err_file"; then
+            echo -e "${RED}✗ Missing error: ${message}${NC}"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((ERROR_FAIL_COUNT++))
+            echo "------------------------"
+            return
+        fi
+    done
+
+    echo -e "${GREEN}✓ Every expected error was reported${NC}"
+    echo -e "${GREEN}Result: PASS${NC}"
+    ((ERROR_PASS_COUNT++))
+    echo "------------------------"
+}
+
+# Function to check what the optimizer reports saving for a file
+run_optimizer_report_test() {
+    local test_file=$1
+    local expected=$2
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_base="$OUTPUT_DIR/${test_file}_report"
+    local report
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as optimizer report${NC}"
+
+    $ASSEMBLER -O --format=bin "$input_path" > "${output_base}.out" 2> "${output_base}.err"
+    EXIT_STATUS=$?
+    rm -f "${input_path%.as}.tpo" "${input_path%.as}.am"
+    report=$(grep "saved" "${output_base}.out")
+
+    if [ $EXIT_STATUS -eq 0 ] && [ "$report" = "$expected" ]; then
+        echo -e "${GREEN}✓ Optimizer report matches${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Expected '${expected}', got '${report}'${NC}"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to check that --check reports what a full run reports and writes nothing
+run_check_test() {
+    local test_file=$1
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_base="$OUTPUT_DIR/${test_file}"
+    local expected_status=0
+    local ext
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as with --check${NC}"
+
+    [ -s "${output_base}.err" ] && expected_status=1
+    rm -f "${input_path%.as}.am"
+    $ASSEMBLER --check "$input_path" > /dev/null 2> "${output_base}_check.err"
+    EXIT_STATUS=$?
+
+    for ext in am ob ent ext; do
+        if [ -f "${input_path%.as}.${ext}" ]; then
+            echo -e "${RED}✗ --check wrote ${test_file}.${ext}${NC}"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((FAIL_COUNT++))
+            echo "------------------------"
+            return
+        fi
+    done
+
+    if [ $EXIT_STATUS -eq $expected_status ] && cmp -s "${output_base}.err" "${output_base}_check.err"; then
+        echo -e "${GREEN}✓ Diagnostics match the full run${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Diagnostics differ from the full run${NC}"
+        diff "${output_base}.err" "${output_base}_check.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to check that --pipeline prints and writes exactly what the sequential run did
+run_pipeline_test() {
+    local test_file=$1
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_base="$OUTPUT_DIR/${test_file}"
+    local expected_status=0
+    local differs=""
+    local ext
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as with --pipeline${NC}"
+
+    [ -s "${output_base}.err" ] && expected_status=1
+    $ASSEMBLER --pipeline "$input_path" > "${output_base}_pipeline.out" 2> "${output_base}_pipeline.err"
+    EXIT_STATUS=$?
+
+    [ $EXIT_STATUS -eq $expected_status ] || differs="exit status"
+    cmp -s "${output_base}.out" "${output_base}_pipeline.out" || differs="$differs stdout"
+    cmp -s "${output_base}.err" "${output_base}_pipeline.err" || differs="$differs stderr"
+    for ext in am ob ent ext; do
+        if [ $expected_status -eq 0 ] && [ -f "${output_base}.${ext}" ]; then
+            cmp -s "${output_base}.${ext}" "${input_path%.as}.${ext}" || differs="$differs .${ext}"
+        fi
+        rm -f "${input_path%.as}.${ext}"
+    done
+
+    if [ -z "$differs" ]; then
+        echo -e "${GREEN}✓ Output matches the sequential run${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Differs from the sequential run:${differs}${NC}"
+        diff "${output_base}.err" "${output_base}_pipeline.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to check that an edit session's diagnostics match a full check after every edit
+run_serve_test() {
+    local test_file=$1
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_file="$OUTPUT_DIR/${test_file}_serve.out"
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as with serve${NC}"
+
+    $ASSEMBLER serve "$input_path" > "$output_file" << 'EOF'
+{"id":1,"op":"edit","start":1,"end":0,"text":"DUP: inc r1\n jmp DUP\n"}
+{"id":2,"op":"verify"}
+{"id":3,"op":"edit","start":1,"end":1,"text":"DUP: .data 3\n"}
+{"id":4,"op":"verify"}
+{"id":5,"op":"edit","start":3,"end":2,"text":"DUP: stop\n"}
+{"id":6,"op":"verify"}
+{"id":7,"op":"edit","start":1,"end":3,"text":""}
+{"id":8,"op":"verify"}
+{"id":9,"op":"exit"}
+EOF
+    EXIT_STATUS=$?
+
+    if [ $EXIT_STATUS -eq 0 ] && [ "$(grep -c '"consistent":true' "$output_file")" -eq 4 ] &&
+       grep -q '^{"id":1,"ok":true,[^}]*"relexed":2,' "$output_file" &&
+       grep -q "^{\"id\":5,.*\"Label 'DUP' already defined\"" "$output_file"; then
+        echo -e "${GREEN}✓ Edits match a full check${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Edits differ from a full check${NC}"
+        cat "$output_file"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to check that a source piped through -o - gives the outputs of a normal run as frames
+run_stream_test() {
+    local test_file=$1
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_base="$OUTPUT_DIR/${test_file}"
+    local stream_file="${output_base}.stream"
+    local magic section size module ext
+    local success=true
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as through standard input and output${NC}"
+
+    rm -f "${output_base}_stream."*
+    $ASSEMBLER -o - - < "$input_path" > "$stream_file"
+    EXIT_STATUS=$?
+
+    # Split the frames: a header line, then exactly size bytes
+    while read -r magic section size module; do
+        if [ "$magic" != "TPS1" ] || [ "$module" != "<stdin>" ]; then
+            success=false
+            break
+        fi
+        dd bs=1 count="$size" status=none > "${output_base}_stream.${section}"
+    done < "$stream_file"
+
+    for ext in ob ent ext; do
+        if [ -f "${output_base}.${ext}" ] && ! cmp -s "${output_base}.${ext}" "${output_base}_stream.${ext}"; then
+            success=false
+        fi
+        if [ ! -f "${output_base}.${ext}" ] && [ -f "${output_base}_stream.${ext}" ]; then
+            success=false
+        fi
+    done
+
+    if [ $EXIT_STATUS -eq 0 ] && [ "$success" = true ] && [ -f "${output_base}_stream.end" ]; then
+        echo -e "${GREEN}✓ Frames match the output files${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Frames differ from the output files${NC}"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to wait up to five seconds for a pattern to appear a number of times in a file
+wait_for_output() {
+    local i
+
+    for i in $(seq 50); do
+        [ "$(grep -c "$2" "$1")" -ge "$3" ] && return
+        sleep 0.1
+    done
+}
+
+# Function to check that watch mode assembles changed files once and skips unchanged ones
+run_watch_test() {
+    local watch_dir="$OUTPUT_DIR/watch"
+    local output_file="$OUTPUT_DIR/watch.out"
+    local watch_pid header_changed=false
+
+    echo -e "\n${YELLOW}Testing: --watch${NC}"
+
+    rm -rf "$watch_dir"
+    mkdir -p "$watch_dir/inc"
+    cp "$INPUT_DIR/basic.as" "$INPUT_DIR/directives.as" "$watch_dir/"
+    printf 'mcro show_value\n        prn #1\nmcroend\n' > "$watch_dir/inc/value.inc"
+    printf 'AB' > "$watch_dir/inc/blob.bin"
+    printf '.include "inc/value.inc"\nMAIN:   show_value\n        stop\nBLOB:   .incbin "inc/blob.bin"\n' \
+        > "$watch_dir/header.as"
+    $ASSEMBLER --watch "$watch_dir" > "$output_file" 2>&1 &
+    watch_pid=$!
+
+    # Each step waits for the previous round to be reported
+    wait_for_output "$output_file" "Successfully processed" 3
+    echo "; edited" >> "$watch_dir/basic.as"
+    wait_for_output "$output_file" "Successfully processed" 4
+    touch "$watch_dir/directives.as"
+    wait_for_output "$output_file" "Skipping unchanged" 1
+
+    # A header edited in place, keeping its size, and an included binary assemble their module again
+    printf 'mcro show_value\n        prn #2\nmcroend\n' > "$watch_dir/inc/value.inc"
+    wait_for_output "$output_file" "Successfully processed" 5
+    grep -q "prn #2" "$watch_dir/header.am" && header_changed=true
+    printf 'CD' > "$watch_dir/inc/blob.bin"
+    wait_for_output "$output_file" "Successfully processed" 6
+    touch "$watch_dir/header.as"
+    wait_for_output "$output_file" "Skipping unchanged" 2
+    rm -rf "$watch_dir"
+    wait "$watch_pid"
+    EXIT_STATUS=$?
+
+    if [ $EXIT_STATUS -eq 0 ] && [ "$(grep -c "Processing file: .*basic.as" "$output_file")" -eq 2 ] &&
+       [ "$(grep -c "Processing file: .*directives.as" "$output_file")" -eq 1 ] &&
+       [ "$(grep -c "Processing file: .*header.as" "$output_file")" -eq 3 ] && $header_changed &&
+       grep -q "Skipping unchanged .*directives.as" "$output_file" &&
+       grep -q "Skipping unchanged .*header.as" "$output_file" && grep -q "Stopped watching" "$output_file"; then
+        echo -e "${GREEN}✓ Only the changed file, or the file whose header changed, was assembled again${NC}"
+        echo -e "${GREEN}Result: PASS${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}✗ Watch mode did not assemble the expected files${NC}"
+        cat "$output_file"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
+# Function to check that libassembler.a gives the command line's results in memory
+run_lib_test() {
+    local test_file=$1
+    local expect_error=$2
+    local output_base="$OUTPUT_DIR/${test_file}_lib"
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as through libassembler.a${NC}"
+
+    "$OUTPUT_DIR/lib_test" "$INPUT_DIR/${test_file}.as" 4 > "${output_base}.out" 2> "${output_base}.err"
+    EXIT_STATUS=$?
+
+    if [ "$expect_error" = "true" ]; then
+        # The same messages at the same lines as the command line reported
+        sed -n 's/^Error in .*, line \([0-9]*\): /line \1: /p' "$OUTPUT_DIR/${test_file}.err" > "${output_base}.expected"
+        grep -v "^line [0-9]*: warning: " "${output_base}.out" > "${output_base}.actual"
+        if [ $EXIT_STATUS -eq 1 ] && [ ! -s "${output_base}.err" ] && cmp -s "${output_base}.expected" "${output_base}.actual"; then
+            echo -e "${GREEN}✓ Diagnostics match the command line${NC}"
+            echo -e "${GREEN}Result: PASS${NC}"
+            ((ERROR_PASS_COUNT++))
+        else
+            echo -e "${RED}✗ Diagnostics differ from the command line${NC}"
+            diff "${output_base}.expected" "${output_base}.actual"
+            cat "${output_base}.err"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((ERROR_FAIL_COUNT++))
+        fi
+    else
+        cat "$OUTPUT_DIR/${test_file}.ob" "$OUTPUT_DIR/${test_file}.ent" "$OUTPUT_DIR/${test_file}.ext" \
+            > "${output_base}.expected" 2> /dev/null
+        if [ $EXIT_STATUS -eq 0 ] && cmp -s "${output_base}.expected" "${output_base}.out"; then
+            echo -e "${GREEN}✓ In-memory result matches the output files${NC}"
+            echo -e "${GREEN}Result: PASS${NC}"
+            ((PASS_COUNT++))
+        else
+            echo -e "${RED}✗ In-memory result differs from the output files${NC}"
+            cat "${output_base}.err"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((FAIL_COUNT++))
+        fi
+    fi
+    echo "------------------------"
+}
+
+run_sim_test() {
+    local test_file=$1
+    local expected=$2
+    local flags=$3
+    local input_path="$INPUT_DIR/${test_file}.as"
+    local output_base="$OUTPUT_DIR/${test_file}_sim"
+
+    echo -e "\n${YELLOW}Testing: ${test_file}.as in the simulator ${flags}${NC}"
+
+    if $ASSEMBLER $flags --format=bin "$input_path" > /dev/null 2> "${output_base}.err" &&
+       $ASSEMBLER sim --max-steps=100000 "${input_path%.as}.tpo" > "${output_base}.out" 2>> "${output_base}.err"; then
+        rm -f "${input_path%.as}.tpo" "${input_path%.as}.am"
+        if [ "$(tr '\n' ' ' < "${output_base}.out")" = "$expected" ]; then
+            echo -e "${GREEN}✓ Program output matches${NC}"
+            echo -e "${GREEN}Result: PASS${NC}"
+            ((PASS_COUNT++))
+        else
+            echo -e "${RED}✗ Expected '${expected}', got '$(tr '\n' ' ' < "${output_base}.out")'${NC}"
+            echo -e "${RED}Result: FAIL${NC}"
+            ((FAIL_COUNT++))
+        fi
+    else
+        echo -e "${RED}✗ Simulation failed${NC}"
+        cat "${output_base}.err"
+        echo -e "${RED}Result: FAIL${NC}"
+        ((FAIL_COUNT++))
+    fi
+    echo "------------------------"
+}
+
 # Run regular tests
 for test_file in basic macro addressing directives edge_cases comprehensive \
                  macro_edge_cases macro_with_labels boundary_cases nested_macros \
@@ -86,10 +659,81 @@ for test_file in basic macro addressing directives edge_cases comprehensive \
     run_test "$test_file" "false"
 done
 
+# Run binary object format tests
+run_format_test "directives" "bin"
+run_format_test "comprehensive" "bin24"
+
+# Run linker tests
+run_link_test
+
+# Run batch tests
+run_batch_test "@list"
+run_batch_test "--files-from=-"
+run_batch_test "@list" "--io=uring --prefetch=2"
+run_batch_test "@list" "--io=threads --prefetch=2"
+run_archive_test
+run_watch_test
+run_stream_test "directives"
+run_stream_test "basic"
+
+# Run simulator tests
+run_sim_test "simulate" "55 127 39 "
+run_sim_test "register_pair" "6 117 "
+run_sim_test "peephole" "10 1 "
+run_sim_test "peephole" "10 1 " "-O"
+run_sim_test "jump_thread" "1 " "-O"
+run_optimizer_report_test "peephole" "Optimizer saved 13 code words in $INPUT_DIR/peephole.as"
+run_optimizer_report_test "jump_thread" ""
+run_sim_test "gc_data" "7 -5 " "-O --gc-data"
+run_sim_test "pool_data" "101 101 114 1 123 119 0 " "--pool-data"
+run_sim_test "pool_written" "6 5 9 8 " "--pool-data"
+run_link_sim_test "link_pool_main" "link_pool_lib" "5 6 " "--pool-data"
+run_sim_test "outline" "3 7 12 22 "
+run_sim_test "outline" "3 7 12 22 " "--outline"
+run_sim_test "incbin" "7 255 128 "
+run_sim_test "fill" "0 -7 9 42 "
+run_sim_test "fill" "0 -7 9 42 " "--gc-data --pool-data"
+run_sim_test "include" "5 13 "
+run_sim_test "long_code" "1200 77 "
+run_sim_test "long_code" "1200 77 " "--pipeline"
+
+# Run a module against a precompiled macro library
+$ASSEMBLER mlib -o "$OUTPUT_DIR/vendor.mlib" "$INPUT_DIR/include/vendor.inc" > /dev/null
+run_sim_test "macro_lib" "13 1 " "--macro-lib $OUTPUT_DIR/vendor.mlib"
+
 # Run error tests
-for test_file in errors macro_errors; do
+for test_file in errors macro_errors range_errors address_overflow incbin_errors data_errors; do
     run_test "$test_file" "true"
 done
+run_error_message_test "data_errors" "line 4: Empty item in data list" "line 5: Empty item in data list" \
+    "line 6: Empty item in data list"
+run_error_message_test "incbin_errors" "line 5: Empty range for .incbin directive: 2, 0" \
+    "line 6: Invalid range for .incbin directive (expected offset, length): 3"
+
+# Run the check tests against the diagnostics of the runs above
+for test_file in directives comprehensive errors macro_errors range_errors address_overflow incbin_errors \
+                 data_errors; do
+    run_check_test "$test_file"
+done
+
+# Run the pipelined stages against the outputs of the runs above
+for test_file in comprehensive macro_chains nested_macros errors macro_errors range_errors; do
+    run_pipeline_test "$test_file"
+done
+
+# Run the edit session tests
+for test_file in directives comprehensive range_errors; do
+    run_serve_test "$test_file"
+done
+
+# Run the library tests, four threads with a context each
+gcc -std=c90 -Wall -Wextra -pedantic -I../include lib_test.c ../bin/libassembler.a -o "$OUTPUT_DIR/lib_test" -pthread
+for test_file in directives comprehensive macro_chains; do
+    run_lib_test "$test_file" "false"
+done
+for test_file in errors macro_errors range_errors; do
+    run_lib_test "$test_file" "true"
+done
 
 echo -e "${BLUE}==========================${NC}"
 echo -e "Testing complete. Results saved in ${YELLOW}${OUTPUT_DIR}${NC}"